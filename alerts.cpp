@@ -0,0 +1,365 @@
+#include "alerts.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+std::vector<AlertRule>					 g_alertRules;
+std::vector<int>						 g_alertRulesByField[ALERT_FIELD_COUNT];
+std::unordered_map<AlertKey, AlertState> g_alertStates;
+std::vector<AlertEvent>					 g_alertEvents;
+int										 g_alertsActive = 0;
+
+bool ParseAlertAmount(const char*& p, double& value, bool& percent)
+{
+	char* end;
+	value = strtod(p, &end);
+	if(end == p)
+		return false;
+	p		= end;
+	percent = false;
+	if(*p == '%')
+	{
+		percent = true;
+		p++;
+		return true;
+	}
+	const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+	for(int i = 4; i >= 0; --i)
+	{
+		size_t len = strlen(units[i]);
+		if(_strnicmp(p, units[i], len) == 0)
+		{
+			for(int j = 0; j < i; ++j)
+				value *= 1024.0;
+			p += len;
+			break;
+		}
+	}
+	return true;
+}
+
+static const char* SkipSpaces(const char* p)
+{
+	while(*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+// <scope>.<metric>[.<prio>] > <amount> [for <duration>] [clear <amount>]
+//  scope:	any, tracked, adapter
+//  metric: usage, commit, nonlocal_usage, nonlocal_commit, demoted
+//  amount: bytes with an optional B/KB/MB/GB/TB suffix, or a percent of the adapter's local memory
+bool ParseAlertRule(const char* text, AlertRule& rule)
+{
+	const char* p = SkipSpaces(text);
+	rule.text	  = p;
+	while(rule.text.size() && (rule.text.back() == ' ' || rule.text.back() == '\r' || rule.text.back() == '\n'))
+		rule.text.pop_back();
+
+	struct Name
+	{
+		const char* name;
+		int			value;
+	};
+	auto Match = [&p](const Name* names, int count, int& value)
+	{
+		for(int i = 0; i < count; ++i)
+		{
+			size_t len = strlen(names[i].name);
+			if(_strnicmp(p, names[i].name, len) == 0 && !isalnum((unsigned char)p[len]) && p[len] != '_')
+			{
+				value = names[i].value;
+				p += len;
+				return true;
+			}
+		}
+		return false;
+	};
+	static const Name scopes[]	= { { "any", ALERT_SCOPE_ANY }, { "tracked", ALERT_SCOPE_TRACKED }, { "adapter", ALERT_SCOPE_ADAPTER } };
+	static const Name metrics[] = { { "usage", ALERT_FIELD_USAGE_LOCAL },
+									{ "commit", ALERT_FIELD_COMMITMENT_LOCAL },
+									{ "nonlocal_usage", ALERT_FIELD_USAGE_NONLOCAL },
+									{ "nonlocal_commit", ALERT_FIELD_COMMITMENT_NONLOCAL },
+									{ "demoted", ALERT_FIELD_DEMOTED } };
+	static const Name prios[]	= { { "min", PRIO_MIN }, { "low", PRIO_LOW }, { "normal", PRIO_NORMAL }, { "high", PRIO_HIGH }, { "max", PRIO_MAX } };
+
+	int scope, field, prio = -1;
+	if(!Match(scopes, _countof(scopes), scope) || *p++ != '.' || !Match(metrics, _countof(metrics), field))
+		return false;
+	if(*p == '.')
+	{
+		p++;
+		if(field != ALERT_FIELD_DEMOTED || !Match(prios, _countof(prios), prio))
+			return false;
+	}
+	rule.scope = (AlertScope)scope;
+	rule.field = (AlertField)field;
+	rule.prio  = prio;
+	if(rule.scope == ALERT_SCOPE_ADAPTER && (rule.prio >= 0 || rule.field == ALERT_FIELD_USAGE_NONLOCAL || rule.field == ALERT_FIELD_COMMITMENT_NONLOCAL))
+		return false; // no adapter totals for these
+
+	p = SkipSpaces(p);
+	if(*p++ != '>')
+		return false;
+	p = SkipSpaces(p);
+	if(!ParseAlertAmount(p, rule.threshold, rule.percent))
+		return false;
+	rule.clear	   = rule.threshold * 0.9;
+	rule.holdTicks = 0;
+
+	while(*(p = SkipSpaces(p)))
+	{
+		if(_strnicmp(p, "for", 3) == 0)
+		{
+			char*  end;
+			double seconds = strtod(p + 3, &end);
+			if(end == p + 3)
+				return false;
+			p = end;
+			if(_strnicmp(p, "ms", 2) == 0)
+			{
+				seconds /= 1000.0;
+				p += 2;
+			}
+			else if(*p == 'm' || *p == 'M')
+			{
+				seconds *= 60.0;
+				p++;
+			}
+			else if(*p == 's' || *p == 'S')
+			{
+				p++;
+			}
+			rule.holdTicks = (INT64)(seconds * g_qpcFrequency);
+		}
+		else if(_strnicmp(p, "clear", 5) == 0)
+		{
+			bool percent;
+			p = SkipSpaces(p + 5);
+			if(!ParseAlertAmount(p, rule.clear, percent) || percent != rule.percent)
+				return false;
+		}
+		else if(*p == '\r' || *p == '\n')
+		{
+			break;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return rule.clear <= rule.threshold;
+}
+
+bool AddAlertRule(const char* text)
+{
+	AlertRule rule;
+	if(g_alertRules.size() >= MAX_ALERT_RULES || !ParseAlertRule(text, rule))
+	{
+		fprintf(g_LogFile, "Invalid alert rule '%s'\n", text);
+		fflush(g_LogFile);
+		return false;
+	}
+	int index = (int)g_alertRules.size();
+	g_alertRulesByField[rule.field].push_back(index);
+	g_alertRules.push_back(rule);
+	return true;
+}
+
+void LoadAlertRules(const wchar_t* path)
+{
+	FILE* f = nullptr;
+	if(_wfopen_s(&f, path, L"r") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open alert rules '%ls'\n", path);
+		fflush(g_LogFile);
+		return;
+	}
+	char line[512];
+	while(fgets(line, sizeof(line), f))
+	{
+		const char* p = SkipSpaces(line);
+		if(*p && *p != '#' && *p != '\r' && *p != '\n')
+			AddAlertRule(p);
+	}
+	fclose(f);
+}
+
+static void AlertRaise(int ruleIndex, const AlertKey& key, AlertState& state, INT64 time, bool raised)
+{
+	AlertEvent e;
+	e.time		  = time;
+	e.rule		  = ruleIndex;
+	e.pid		  = key.pid;
+	e.pDxgAdapter = key.pDxgAdapter;
+	e.value		  = state.value;
+	e.raised	  = raised;
+	e.processName = key.pid == (DWORD)-1 ? FindAdapter(key.pDxgAdapter)->name : FindProcName(key.pid);
+	g_alertEvents.push_back(e);
+	if(raised)
+	{
+		state.active = true;
+		g_alertsActive++;
+	}
+	else
+	{
+		g_alertsActive--;
+	}
+}
+
+static void AlertEvaluate(int ruleIndex, UINT64& mask, DWORD pid, PVOID pDxgAdapter, UINT64 bytes, UINT64 capacity)
+{
+	const AlertRule& rule  = g_alertRules[ruleIndex];
+	double			 value = (double)bytes;
+	if(rule.percent)
+	{
+		if(!capacity)
+			return;
+		value = value * 100.0 / (double)capacity;
+	}
+
+	UINT64	 bit = 1ull << ruleIndex;
+	AlertKey key = { ruleIndex, pid, pDxgAdapter };
+	if(0 == (mask & bit))
+	{
+		if(value <= rule.threshold)
+			return;
+		AlertState& state = g_alertStates[key];
+		state			  = { g_eventTime, value, false };
+		mask |= bit;
+		if(!rule.holdTicks)
+			AlertRaise(ruleIndex, key, state, g_eventTime, true);
+		return;
+	}
+
+	auto		itr	  = g_alertStates.find(key);
+	AlertState& state = itr->second;
+	state.value		  = value;
+	if(state.active)
+	{
+		if(value < rule.clear)
+		{
+			AlertRaise(ruleIndex, key, state, g_eventTime, false);
+			g_alertStates.erase(itr);
+			mask &= ~bit;
+		}
+	}
+	else if(value <= rule.threshold)
+	{
+		g_alertStates.erase(itr);
+		mask &= ~bit;
+	}
+	else if(g_eventTime - state.since >= rule.holdTicks)
+	{
+		AlertRaise(ruleIndex, key, state, g_eventTime, true);
+	}
+}
+
+static UINT64 AlertProcessValue(const AlertRule& rule, UINT32 index)
+{
+	switch(rule.field)
+	{
+	case ALERT_FIELD_USAGE_LOCAL:
+		return g_processMemory.usageLocal[index];
+	case ALERT_FIELD_USAGE_NONLOCAL:
+		return g_processMemory.cold[index].UsageNonLocal;
+	case ALERT_FIELD_COMMITMENT_LOCAL:
+		return g_processMemory.commitmentLocal[index];
+	case ALERT_FIELD_COMMITMENT_NONLOCAL:
+		return g_processMemory.cold[index].CommitmentNonLocal;
+	case ALERT_FIELD_DEMOTED:
+		if(rule.prio >= 0)
+			return g_processMemory.demoted[index][rule.prio];
+		else
+		{
+			UINT64 sum = 0;
+			for(UINT64 dem : g_processMemory.demoted[index])
+				sum += dem;
+			return sum;
+		}
+	default:
+		return 0;
+	}
+}
+
+static UINT64 AlertAdapterValue(const AlertRule& rule, const Adapter* adapter)
+{
+	switch(rule.field)
+	{
+	case ALERT_FIELD_USAGE_LOCAL:
+		return adapter->UsageLocal;
+	case ALERT_FIELD_COMMITMENT_LOCAL:
+		return adapter->CommitmentLocal;
+	case ALERT_FIELD_DEMOTED:
+		return adapter->CommitmentDemoted;
+	default:
+		return 0;
+	}
+}
+
+void AlertOnAdapterChange(Adapter* adapter, AlertField field)
+{
+	for(int ruleIndex : g_alertRulesByField[field])
+	{
+		const AlertRule& rule = g_alertRules[ruleIndex];
+		if(rule.scope == ALERT_SCOPE_ADAPTER)
+			AlertEvaluate(ruleIndex, adapter->alertMask, (DWORD)-1, adapter->pDxgAdapter, AlertAdapterValue(rule, adapter), adapter->LocalMemory);
+	}
+}
+
+void AlertOnProcessChange(UINT32 index, AlertField field)
+{
+	const std::vector<int>& rules = g_alertRulesByField[field];
+	if(rules.empty())
+		return;
+	const ProcessKey& key	  = g_processMemory.keys[index];
+	Adapter*		  adapter = FindAdapter(key.pDxgAdapter);
+	for(int ruleIndex : rules)
+	{
+		const AlertRule& rule = g_alertRules[ruleIndex];
+		if(rule.scope == ALERT_SCOPE_ADAPTER || (rule.scope == ALERT_SCOPE_TRACKED && !g_processMemory.tracked[index]))
+			continue;
+		AlertEvaluate(ruleIndex, g_processMemory.cold[index].alertMask, key.pid, key.pDxgAdapter, AlertProcessValue(rule, index), adapter->LocalMemory);
+	}
+	AlertOnAdapterChange(adapter, field);
+}
+
+void AlertClearProcess(UINT32 index)
+{
+	UINT64&			  mask = g_processMemory.cold[index].alertMask;
+	const ProcessKey& key  = g_processMemory.keys[index];
+	for(int ruleIndex = 0; mask; ++ruleIndex)
+	{
+		UINT64 bit = 1ull << ruleIndex;
+		if(mask & bit)
+		{
+			AlertKey alertKey = { ruleIndex, key.pid, key.pDxgAdapter };
+			auto	 itr	  = g_alertStates.find(alertKey);
+			if(itr->second.active)
+				AlertRaise(ruleIndex, alertKey, itr->second, g_eventTime, false);
+			g_alertStates.erase(itr);
+			mask &= ~bit;
+		}
+	}
+}
+
+// Raises alerts whose hold time has run out without a new event arriving. Needs g_critSec.
+void AlertTick()
+{
+	if(g_alertStates.empty())
+		return;
+	INT64 now = EventClockNow();
+	for(auto& pair : g_alertStates)
+	{
+		AlertState& state = pair.second;
+		if(!state.active && now - state.since >= g_alertRules[pair.first.rule].holdTicks)
+			AlertRaise(pair.first.rule, pair.first, state, now, true);
+	}
+}
+
+void ResetAlerts()
+{
+	g_alertStates.clear();
+	g_alertEvents.clear();
+	g_alertsActive = 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "tracker.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Alerting
+//  rules are indexed by the field they read, so an event only evaluates the rules
+//  that can change because of it. Per (rule, entry) state is only stored while a
+//  rule is pending or active, tracked by a bit in the entry's alertMask.
+#define MAX_ALERT_RULES 64
+enum AlertScope
+{
+	ALERT_SCOPE_ANY,
+	ALERT_SCOPE_TRACKED,
+	ALERT_SCOPE_ADAPTER,
+};
+
+enum AlertField
+{
+	ALERT_FIELD_USAGE_LOCAL,
+	ALERT_FIELD_USAGE_NONLOCAL,
+	ALERT_FIELD_COMMITMENT_LOCAL,
+	ALERT_FIELD_COMMITMENT_NONLOCAL,
+	ALERT_FIELD_DEMOTED,
+	ALERT_FIELD_COUNT,
+};
+
+struct AlertRule
+{
+	std::string text;
+	AlertScope	scope;
+	AlertField	field;
+	int			prio	  = -1; // ALERT_FIELD_DEMOTED only, -1 is the sum of all priorities
+	bool		percent	  = false; // thresholds are percent of the adapter's local memory
+	double		threshold = 0;
+	double		clear	  = 0;
+	INT64		holdTicks = 0;
+};
+
+struct AlertKey
+{
+	int	  rule;
+	DWORD pid; // (DWORD)-1 for adapter scope
+	PVOID pDxgAdapter;
+	bool  operator==(const AlertKey& other) const
+	{
+		return rule == other.rule && pid == other.pid && pDxgAdapter == other.pDxgAdapter;
+	};
+};
+
+namespace std
+{
+template <>
+struct hash<AlertKey>
+{
+	std::size_t operator()(const AlertKey& f) const noexcept
+	{
+		std::size_t h1 = std::hash<DWORD>{}(f.pid) ^ ((size_t)f.rule << 24);
+		std::size_t h2 = std::hash<PVOID>{}(f.pDxgAdapter);
+		return h1 ^ (h2 + 0x9e3779b97f4a7c15ULL + (h1 << 6) + (h1 >> 2));
+	}
+};
+} // namespace std
+
+struct AlertState
+{
+	INT64  since;
+	double value;
+	bool   active;
+};
+
+struct AlertEvent
+{
+	INT64	time;
+	int		rule;
+	DWORD	pid;
+	PVOID	pDxgAdapter;
+	double	value;
+	bool	raised;
+	wstring processName;
+};
+
+extern std::vector<AlertRule>					g_alertRules;
+extern std::vector<int>							g_alertRulesByField[ALERT_FIELD_COUNT];
+extern std::unordered_map<AlertKey, AlertState> g_alertStates;
+extern std::vector<AlertEvent>					g_alertEvents; // raised on the trace thread, written out by the main loop
+extern int										g_alertsActive;
+
+bool ParseAlertRule(const char* text, AlertRule& rule);
+bool ParseAlertAmount(const char*& p, double& value, bool& percent); // "6GB", "512MB" or "90%"
+bool AddAlertRule(const char* text);
+void LoadAlertRules(const wchar_t* path);
+void AlertOnAdapterChange(Adapter* adapter, AlertField field);
+void AlertOnProcessChange(UINT32 index, AlertField field);
+void AlertClearProcess(UINT32 index);
+void AlertTick();
+void ResetAlerts(); // forgets the alert states, not the rules
@@ -0,0 +1,1057 @@
+#include "bench.h"
+#include "render.h"
+#include "synth.h"
+#include "publish.h"
+#include "recorder.h"
+#include "etl.h"
+#include "drm.h"
+#include "simulate.h"
+#include "fleet.h"
+#include "history.h"
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <type_traits>
+#include <filesystem>
+
+static UINT32 BenchRandom(UINT32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+static double BenchSeconds(const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	return (double)(end.QuadPart - start.QuadPart) / g_qpcFrequency;
+}
+
+// During a demotion storm VidMm emits bursts of commitment/usage/demotion changes for the few
+// processes fighting over the budget, on top of a trickle from everything else using the gpu
+static void MakeVidMmStorm(std::vector<MemoryUpdate>& updates, int numEvents, int numProcesses, int numAdapters)
+{
+	const int HOT_PROCESSES = 4;
+	UINT32	  rnd			= 1;
+	INT64	  time			= 1;
+	updates.resize(numEvents);
+	for(int i = 0; i < numEvents;)
+	{
+		bool  hot		  = BenchRandom(rnd) % 8 != 0;
+		DWORD pid		  = 1000 + 4 * (BenchRandom(rnd) % (hot ? HOT_PROCESSES : numProcesses));
+		PVOID pDxgAdapter = (PVOID)(UINT64)(0x10000 * (1 + (hot ? 0 : BenchRandom(rnd) % numAdapters)));
+		int	  burst		  = 1 + BenchRandom(rnd) % 16;
+		for(int j = 0; j < burst && i < numEvents; ++j, ++i)
+		{
+			MemoryUpdate& u = updates[i];
+			u.time			= time++;
+			u.pid			= pid;
+			u.pDxgAdapter	= pDxgAdapter;
+			u.field			= (UINT8)(BenchRandom(rnd) % (MEMORY_DEMOTED + 1));
+			u.prio			= (UINT8)(u.field == MEMORY_DEMOTED ? BenchRandom(rnd) % PRIO_COUNT : 0);
+			u.value			= (UINT64)(BenchRandom(rnd) % 4096) << 20;
+		}
+	}
+}
+
+void BenchEventBatching(FILE* out)
+{
+	const int				  NUM_EVENTS = 4 << 20;
+	std::vector<MemoryUpdate> storm;
+	MakeVidMmStorm(storm, NUM_EVENTS, 256, 2);
+
+	ResetTrackerState();
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for(const MemoryUpdate& u : storm)
+	{
+		EnterCriticalSection(&g_critSec);
+		ApplyMemoryUpdate(u, FindProcessMemory(u.pid, u.pDxgAdapter));
+		LeaveCriticalSection(&g_critSec);
+	}
+	double unbatched = BenchSeconds(start);
+
+	ResetTrackerState();
+	QueryPerformanceCounter(&start);
+	for(const MemoryUpdate& u : storm)
+	{
+		t_eventTime = u.time;
+		QueueMemoryUpdate(u.pid, u.pDxgAdapter, (MemoryField)u.field, u.prio, u.value);
+	}
+	FlushMemoryUpdates(t_batch);
+	double batched = BenchSeconds(start);
+
+	fprintf(out, "VidMm storm, %d events, 256 processes (4 hot), 2 adapters\n", NUM_EVENTS);
+	fprintf(out, "  per event lock: %8.2f Mevents/s %6.1f ns/event\n", NUM_EVENTS / unbatched / 1e6, unbatched * 1e9 / NUM_EVENTS);
+	fprintf(out, "  batched:        %8.2f Mevents/s %6.1f ns/event\n", NUM_EVENTS / batched / 1e6, batched * 1e9 / NUM_EVENTS);
+	ResetTrackerState();
+}
+
+// Insert, lookup, a frame's worth of iteration and sorting, and process teardown, compared to a node based map
+void BenchProcessMemory(FILE* out)
+{
+	struct MapEntry
+	{
+		ProcessMemory	  cold;
+		UINT64			  usageLocal;
+		UINT64			  commitmentLocal;
+		DemotedCommitment demoted;
+		bool			  tracked;
+	};
+	const PVOID adapters[2] = { (PVOID)0x10000, (PVOID)0x20000 };
+
+	// The first allocations after the previous benchmark's teardown pay for the allocator consolidating what it
+	// freed, milliseconds that would otherwise land on the first inserts
+	ResetTrackerState();
+	for(int p = 0; p < 4096; ++p)
+		g_processMemory.Add(1000 + 4 * p, adapters[0], false);
+	ResetTrackerState();
+
+	fprintf(out, "ProcessMemory storage, ns/entry     insert   lookup    frame teardown\n");
+	for(int numEntries : { 1000, 10000, 100000 })
+	{
+		const int	  numProcesses = numEntries / 2;
+		const int	  numLookups   = numEntries * 4;
+		const int	  numFrames	   = 8;
+		UINT32		  rnd		   = 1;
+		UINT64		  sum		   = 0;
+		LARGE_INTEGER start;
+		double		  t[2][4];
+
+		ResetTrackerState();
+		QueryPerformanceCounter(&start);
+		for(int p = 0; p < numProcesses; ++p)
+			for(PVOID adapter : adapters)
+				g_processMemory.Add(1000 + 4 * p, adapter, false);
+		t[0][0] = BenchSeconds(start);
+		for(UINT64& usage : g_processMemory.usageLocal)
+			usage = BenchRandom(rnd);
+
+		QueryPerformanceCounter(&start);
+		for(int i = 0; i < numLookups; ++i)
+			sum += g_processMemory.Find(1000 + 4 * (BenchRandom(rnd) % numProcesses), adapters[i & 1]);
+		t[0][1] = BenchSeconds(start) * numEntries / numLookups;
+
+		std::vector<UINT32> order;
+		QueryPerformanceCounter(&start);
+		for(int i = 0; i < numFrames; ++i)
+			sum += SortProcessMemory(order);
+		t[0][2] = BenchSeconds(start) / numFrames;
+
+		QueryPerformanceCounter(&start);
+		for(int p = 0; p < numProcesses; ++p)
+			for(PVOID adapter : adapters)
+				g_processMemory.Remove(g_processMemory.Find(1000 + 4 * p, adapter));
+		t[0][3] = BenchSeconds(start);
+
+		std::unordered_map<ProcessKey, MapEntry> map;
+		QueryPerformanceCounter(&start);
+		for(int p = 0; p < numProcesses; ++p)
+			for(PVOID adapter : adapters)
+				map[{ (DWORD)(1000 + 4 * p), adapter }] = {};
+		t[1][0] = BenchSeconds(start);
+		for(auto& pair : map)
+			pair.second.usageLocal = BenchRandom(rnd);
+
+		QueryPerformanceCounter(&start);
+		for(int i = 0; i < numLookups; ++i)
+			sum += map.find({ (DWORD)(1000 + 4 * (BenchRandom(rnd) % numProcesses)), adapters[i & 1] }) != map.end();
+		t[1][1] = BenchSeconds(start) * numEntries / numLookups;
+
+		std::vector<MapEntry*> entries;
+		QueryPerformanceCounter(&start);
+		for(int i = 0; i < numFrames; ++i)
+		{
+			entries.clear();
+			for(auto& pair : map)
+				entries.push_back(&pair.second);
+			std::sort(entries.begin(),
+					  entries.end(),
+					  [](const MapEntry* a, const MapEntry* b)
+					  {
+						  if(a->tracked == b->tracked)
+							  return a->usageLocal > b->usageLocal;
+						  return a->tracked > b->tracked;
+					  });
+			sum += entries.size();
+		}
+		t[1][2] = BenchSeconds(start) / numFrames;
+
+		QueryPerformanceCounter(&start);
+		for(int p = 0; p < numProcesses; ++p)
+			for(PVOID adapter : adapters)
+				map.erase({ (DWORD)(1000 + 4 * p), adapter });
+		t[1][3] = BenchSeconds(start);
+
+		const char* names[2] = { "flat", "unordered_map" };
+		for(int i = 0; i < 2; ++i)
+		{
+			fprintf(out, "  %6d entries, %-13s", numEntries, names[i]);
+			for(double seconds : t[i])
+				fprintf(out, " %8.1f", seconds * 1e9 / numEntries);
+			fprintf(out, "\n");
+		}
+		volatile UINT64 sink = sum; // the lookups and frames are only used through it
+		(void)sink;
+	}
+	ResetTrackerState();
+}
+
+// The double divide loop and sprintf the renderer used before FormatMemoryText
+void FormatMemoryPrintf(UINT64 bytes, char* buffer, size_t bufSize)
+{
+	const char ext[] = { ' ', 'K', 'M', 'G', 'T' };
+	double	   b	 = (double)bytes;
+	int		   x	 = 0;
+	for(int i = 0; i < g_minSize; ++i)
+	{
+		b /= 1024.f;
+		x++;
+	}
+	while(b > 1024 && x + 1 < (int)_countof(ext))
+	{
+		b /= 1024.f;
+		x++;
+	}
+	sprintf_s(buffer, bufSize, "%6.1f %cB", b, ext[x]);
+}
+
+void BenchFormatting(FILE* out)
+{
+	const int			NUM_VALUES = 1 << 16;
+	const int			NUM_PASSES = 32;
+	std::vector<UINT64> values(NUM_VALUES);
+	UINT32				rnd = 1;
+	for(UINT64& value : values)
+		value = ((UINT64)BenchRandom(rnd) << 24 | BenchRandom(rnd)) >> (BenchRandom(rnd) % 48);
+
+	char		  text[MEMORY_TEXT_MAX + 16];
+	UINT64		  sum = 0;
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for(int pass = 0; pass < NUM_PASSES; ++pass)
+		for(UINT64 value : values)
+		{
+			FormatMemoryPrintf(value, text, sizeof(text));
+			sum += text[4];
+		}
+	double printfSeconds = BenchSeconds(start);
+
+	QueryPerformanceCounter(&start);
+	for(int pass = 0; pass < NUM_PASSES; ++pass)
+		for(UINT64 value : values)
+			sum += FormatMemoryText(value, text) + text[4];
+	double fixedSeconds = BenchSeconds(start);
+
+	volatile UINT64 sink  = sum; // keeps the loops from being optimized out
+	(void)sink;
+	double			count = (double)NUM_VALUES * NUM_PASSES;
+	fprintf(out, "Memory value formatting\n");
+	fprintf(out, "  double + sprintf:   %6.1f ns/value\n", printfSeconds * 1e9 / count);
+	fprintf(out, "  fixed point:        %6.1f ns/value\n", fixedSeconds * 1e9 / count);
+}
+
+// Replays a synthetic stream through the same handlers as the trace callback. Leaves the tracker state for BenchRenderFrame.
+static double BenchSyntheticEvents(FILE* out, const char* name, const SynthConfig& config)
+{
+	const int	NUM_EVENTS = 2 << 20;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+
+	ResetTrackerState();
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	ReplaySynthEvents(stream);
+	double seconds	  = BenchSeconds(start);
+	double nsPerEvent = seconds * 1e9 / stream.events.size();
+	fprintf(out,
+			"  %-28s %8.2f Mevents/s %6.1f ns/event %4d storms %6u entries\n",
+			name,
+			stream.events.size() / seconds / 1e6,
+			nsPerEvent,
+			stream.numStorms,
+			g_processMemory.Size());
+	return nsPerEvent;
+}
+
+static double BenchRenderFrame(FILE* out, int width, int height, bool detailed, const wchar_t* filter = L"")
+{
+	const int NUM_FRAMES = 100;
+	g_consoleWidth		 = width;
+	g_consoleHeight		 = height;
+	g_detailedMode		 = detailed;
+	g_filterText		 = filter;
+
+	EnterCriticalSection(&g_critSec);
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for(int i = 0; i < NUM_FRAMES; ++i)
+		RenderFrame();
+	double microseconds = BenchSeconds(start) * 1e6 / NUM_FRAMES;
+	int	   rows			= std::min(g_listRows, (int)g_processMemory.Size());
+	LeaveCriticalSection(&g_critSec);
+	g_filterText.clear();
+
+	char label[32];
+	if(*filter)
+		sprintf_s(label, sizeof(label), " filter '%ls'", filter);
+	else
+		sprintf_s(label, sizeof(label), "%s", detailed ? " detailed" : "");
+	fprintf(out, "  %3dx%-4d%-20s %8.1f us/frame %8.0f rows/s\n", width, height, label, microseconds, rows * 1e6 / microseconds);
+	return microseconds;
+}
+
+// Publishes the current tracker state through a real segment and reads it back with the reader library, alone
+// and with a reader polling while the state is republished. Reports wrong reads, which would be torn blocks.
+static void BenchSharedState(FILE* out)
+{
+	const int NUM_PUBLISHES = 200;
+	char	  name[64];
+	LARGE_INTEGER nameTime;
+	QueryPerformanceCounter(&nameTime);
+	sprintf_s(name, sizeof(name), "%s_bench_%llx", DEMOTE_SHARED_NAME, (UINT64)nameTime.QuadPart);
+	if(!StartSharedState(name))
+	{
+		fprintf(out, "Shared state: could not create the segment\n");
+		return;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	UINT64 usageSum = 0;
+	for(UINT32 i = 0; i < g_processMemory.Size(); ++i)
+		usageSum += g_processMemory.usageLocal[i];
+	UINT32 numEntries = std::min(g_processMemory.Size(), (UINT32)DEMOTE_SHARED_MAX_ENTRIES);
+	bool   truncated  = g_processMemory.Size() > DEMOTE_SHARED_MAX_ENTRIES;
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for(int i = 0; i < NUM_PUBLISHES; ++i)
+		PublishSharedState();
+	double publishMicroseconds = BenchSeconds(start) * 1e6 / NUM_PUBLISHES;
+	LeaveCriticalSection(&g_critSec);
+
+	DemoteSharedReader reader;
+	DemoteSharedCopy   copy;
+	int				   wrong = 0;
+	auto			   Check = [&]()
+	{
+		UINT64 sum = 0;
+		for(const DemoteSharedEntry& e : copy.entries)
+			sum += e.usageLocal;
+		bool sorted = std::is_sorted(copy.entries.begin(),
+									 copy.entries.end(),
+									 [](const DemoteSharedEntry& a, const DemoteSharedEntry& b)
+									 {
+										 return a.pid != b.pid ? a.pid < b.pid : a.adapterId < b.adapterId;
+									 });
+		if(copy.entries.size() != numEntries || (!truncated && sum != usageSum) || !sorted)
+			wrong++;
+	};
+	if(!OpenSharedState(reader, name))
+	{
+		fprintf(out, "Shared state: could not open the segment\n");
+		StopSharedState();
+		return;
+	}
+	const int NUM_READS = 1000;
+	QueryPerformanceCounter(&start);
+	for(int i = 0; i < NUM_READS; ++i)
+	{
+		if(ReadSharedState(reader, copy))
+			Check();
+		else
+			wrong++;
+	}
+	double readMicroseconds = BenchSeconds(start) * 1e6 / NUM_READS;
+
+	std::atomic<bool> done	 = false;
+	int				  reads	 = 0;
+	int				  missed = 0;
+	std::thread		  readerThread(
+		  [&]()
+		  {
+			  while(!done)
+			  {
+				  if(ReadSharedState(reader, copy, 1))
+				  {
+					  Check();
+					  reads++;
+				  }
+				  else
+					  missed++;
+			  }
+		  });
+	EnterCriticalSection(&g_critSec);
+	for(int i = 0; i < NUM_PUBLISHES; ++i)
+		PublishSharedState();
+	LeaveCriticalSection(&g_critSec);
+	done = true;
+	readerThread.join();
+
+	CloseSharedState(reader);
+	StopSharedState();
+	fprintf(out, "Shared state, %u of %u entries\n", numEntries, g_processMemory.Size());
+	fprintf(out, "  publish %8.1f us   read copy %8.1f us\n", publishMicroseconds, readMicroseconds);
+	fprintf(out, "  while publishing: %d reads, %d retried out, %d wrong\n", reads, missed, wrong);
+}
+
+// Records a synthetic stream and dumps the ring, what a dump costs. demote_tests checks the replay of the dump.
+static void BenchFlightRecorder(FILE* out)
+{
+	const int	NUM_EVENTS = 1 << 20;
+	const char* PATH	   = "demote_bench.dtrec";
+	SynthConfig config;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+	if(!StartFlightRecorder(64, 60))
+	{
+		fprintf(out, "Flight recorder: could not allocate the ring\n");
+		return;
+	}
+
+	ResetTrackerState();
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	ReplaySynthEvents(stream);
+	double nsPerEvent = BenchSeconds(start) * 1e9 / stream.events.size();
+
+	QueryPerformanceCounter(&start);
+	DumpFlightRecorder(PATH);
+	double dumpSeconds = BenchSeconds(start);
+	StopFlightRecorder();
+	SynthStream loaded;
+	QueryPerformanceCounter(&start);
+	LoadFlightRecording(PATH, loaded);
+	double loadSeconds = BenchSeconds(start);
+	remove(PATH);
+	ResetTrackerState();
+
+	double megabytes = loaded.events.size() * sizeof(FlightRecord) / (1024.0 * 1024.0);
+	fprintf(out, "Flight recorder, %zu events\n", loaded.events.size());
+	fprintf(out, "  recording           %6.1f ns/event\n", nsPerEvent);
+	fprintf(out, "  dump %6.1f MB      %6.1f ms   load %6.1f ms\n", megabytes, dumpSeconds * 1e3, loadSeconds * 1e3);
+}
+
+// Each event goes to the buffer of one of the processors, and buffers go to the file when they are full, so the
+// file is only in time order per processor
+bool WriteSynthEtl(const char* path, const SynthStream& stream, UINT32 processors, UINT32 bufferSize)
+{
+	FILE* f;
+	if(fopen_s(&f, path, "wb") != 0)
+		return false;
+	std::vector<std::vector<BYTE>> buffers(processors);
+	auto						   Append = [](std::vector<BYTE>& to, const void* data, size_t size)
+	{
+		size_t at = to.size();
+		to.resize(at + size);
+		memcpy(to.data() + at, data, size);
+	};
+	auto Flush = [&](UINT32 processor)
+	{
+		std::vector<BYTE>& events = buffers[processor];
+		EtlBufferHeader	   header = {};
+		header.bufferSize		  = bufferSize;
+		header.savedOffset		  = (UINT32)(sizeof(header) + events.size());
+		header.offset			  = header.savedOffset;
+		header.processorIndex	  = (UINT16)processor;
+		events.resize(bufferSize - sizeof(header), 0xff);
+		fwrite(&header, sizeof(header), 1, f);
+		fwrite(events.data(), 1, events.size(), f);
+		events.clear();
+	};
+	auto Add = [&](UINT32 processor, const std::vector<BYTE>& event)
+	{
+		if(sizeof(EtlBufferHeader) + buffers[processor].size() + event.size() > bufferSize)
+			Flush(processor);
+		Append(buffers[processor], event.data(), event.size());
+		buffers[processor].resize((buffers[processor].size() + 7) & ~7, 0);
+	};
+
+	// TRACE_LOGFILE_HEADER of a 64 bit logger with a QPC clock
+	std::vector<BYTE> logfile(sizeof(EtlSystemHeader) + ETL_LOGFILE_SIZE(8));
+	EtlSystemHeader	  system = {};
+	system.headerType		 = ETL_HEADER_SYSTEM64;
+	system.headerFlags		 = ETL_HEADER_FLAG_TRACE | 0x40;
+	system.size				 = (UINT16)logfile.size();
+	UINT32 pointerSize		 = 8;
+	UINT32 clockType		 = ETL_CLOCK_QPC;
+	memcpy(logfile.data(), &system, sizeof(system));
+	memcpy(logfile.data() + sizeof(system) + ETL_LOGFILE_NUMBER_OF_PROCESSORS, &processors, 4);
+	memcpy(logfile.data() + sizeof(system) + ETL_LOGFILE_POINTER_SIZE, &pointerSize, 4);
+	memcpy(logfile.data() + sizeof(system) + ETL_LOGFILE_PERF_FREQ(8), &g_qpcFrequency, 8);
+	memcpy(logfile.data() + sizeof(system) + ETL_LOGFILE_CLOCK_TYPE(8), &clockType, 4);
+	Add(0, logfile);
+	Flush(0);
+
+	// Kernel-Process events use the version 3 templates, which have a SID before ImageName
+	const BYTE		  mandatoryLabel[] = { 1, 1, 0, 0, 0, 0, 0, 16, 0, 0x20, 0, 0 };
+	std::vector<BYTE> payload, event;
+	UINT32			  state = 1;
+	for(size_t i = 0; i < stream.events.size(); ++i)
+	{
+		const SynthEvent& e = stream.events[i];
+		EtlEventHeader	  header = {};
+		header.headerType		 = ETL_HEADER_EVENT_HEADER64;
+		header.headerFlags		 = ETL_HEADER_FLAG_TRACE | 0x40;
+		header.timeStamp		 = e.time;
+		header.providerId		 = DxgKrnlGuid;
+		payload.clear();
+		auto AddFields = [&](const auto& fields)
+		{
+			typedef std::remove_cvref_t<decltype(fields)> T;
+			header.id = T::Id;
+			for(int f = 0; f < T::FieldCount; ++f)
+				Append(payload, (const BYTE*)&fields + T::Fields()[f].offset, T::Fields()[f].size);
+		};
+		switch(e.type)
+		{
+		case SYNTH_PROCESS_START:
+		case SYNTH_PROCESS_RUNDOWN:
+		{
+			UINT32 values[12] = { e.processStart.ProcessID }; // up to ProcessTokenIsElevated
+			Append(payload, values, sizeof(values));
+			Append(payload, mandatoryLabel, sizeof(mandatoryLabel));
+			for(const wchar_t* c = e.processStart.ImageName; *c; ++c)
+			{
+				UINT16 unit = (UINT16)*c;
+				Append(payload, &unit, 2);
+			}
+			payload.push_back(0);
+			payload.push_back(0);
+			header.providerId = KernelProcessGuid;
+			header.id		  = e.type == SYNTH_PROCESS_START ? ProcessStart : ProcessRundown;
+			header.version	  = e.type == SYNTH_PROCESS_START ? 3 : 1;
+			header.flags	  = ETL_EVENT_FLAG_EXTENDED_INFO;
+			break;
+		}
+		case SYNTH_PROCESS_STOP:
+			Append(payload, &e.processStop.ProcessID, 4);
+			payload.resize(payload.size() + 24, 0);
+			header.providerId = KernelProcessGuid;
+			header.id		  = ProcessStop;
+			header.version	  = 2;
+			break;
+		case SYNTH_REPORT_SEGMENT:
+			AddFields(e.reportSegment);
+			break;
+		case SYNTH_USAGE_CHANGE:
+			AddFields(e.usageChange);
+			break;
+		case SYNTH_COMMITMENT_CHANGE:
+			AddFields(e.commitmentChange);
+			break;
+		case SYNTH_DEMOTED_COMMITMENT_CHANGE:
+			AddFields(e.demotedCommitmentChange);
+			break;
+		case SYNTH_DEVICE_ALLOCATION_START:
+			AddFields(e.deviceAllocationStart);
+			break;
+		case SYNTH_DEVICE_ALLOCATION_STOP:
+			AddFields(e.deviceAllocationStop);
+			break;
+		case SYNTH_DEVICE_ALLOCATION_RUNDOWN:
+			AddFields(e.deviceAllocationRundown);
+			break;
+		case SYNTH_ALLOCATION_DETAILS_START:
+			AddFields(e.allocationDetailsStart);
+			break;
+		case SYNTH_ALLOCATION_DETAILS_STOP:
+			AddFields(e.allocationDetailsStop);
+			break;
+		}
+
+		// A related activity id in the extended data, then the payload
+		EtlExtendedItem item = { 0, 1, 0, 16 };
+		size_t			size = sizeof(header) + payload.size() + ((header.flags & ETL_EVENT_FLAG_EXTENDED_INFO) ? sizeof(item) + 16 : 0);
+		header.size			 = (UINT16)size;
+		event.clear();
+		Append(event, &header, sizeof(header));
+		if(header.flags & ETL_EVENT_FLAG_EXTENDED_INFO)
+		{
+			Append(event, &item, sizeof(item));
+			event.resize(event.size() + 16, 0);
+		}
+		Append(event, payload.data(), payload.size());
+		UINT32 processor = BenchRandom(state) % processors;
+		Add(processor, event);
+
+		// and some kernel events nobody handles
+		if(i % 4 == 0)
+		{
+			BYTE perfInfo[24] = { 2, 0, ETL_HEADER_PERFINFO64, ETL_HEADER_FLAG_TRACE | 0x40, 24, 0, 0x10, 0x05 };
+			Add(processor, std::vector<BYTE>(perfInfo, perfInfo + sizeof(perfInfo)));
+		}
+	}
+	for(UINT32 p = 0; p < processors; ++p)
+		if(buffers[p].size())
+			Flush(p);
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// Writes a synthetic stream as an .etl file and times reading it back. demote_tests checks what the reader dispatched.
+static void BenchEtlReader(FILE* out)
+{
+	const int	NUM_EVENTS = 1 << 20;
+	const char* PATH	   = "demote_bench.etl";
+	SynthConfig config;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+
+	const UINT32 PROCESSORS = 8;
+	if(!WriteSynthEtl(PATH, stream, PROCESSORS, 64 * 1024))
+	{
+		fprintf(out, "ETL reader: could not write the file\n");
+		return;
+	}
+	ResetTrackerState();
+	EtlStats	  stats;
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	ReadEtlFile(PATH, stats);
+	double seconds = BenchSeconds(start);
+	remove(PATH);
+	ResetTrackerState();
+
+	double megabytes = stats.bytes / (1024.0 * 1024.0);
+	fprintf(out, "ETL reader, %u processors\n", PROCESSORS);
+	fprintf(out, "  %6.1f MB, %llu buffers %8.1f ms %8.0f MB/s %6.1f ns/event\n", megabytes, stats.buffers, seconds * 1e3, megabytes / seconds, seconds * 1e9 / stats.events);
+}
+
+static bool WriteFixtureFile(const std::filesystem::path& path, const char* text)
+{
+	FILE* f;
+	if(fopen_s(&f, path.string().c_str(), "w") != 0)
+		return false;
+	fputs(text, f);
+	fclose(f);
+	return true;
+}
+
+static void WriteDrmFixtureProcess(const std::filesystem::path& proc, const DrmFixtureProcess& p, bool gpu)
+{
+	namespace fs = std::filesystem;
+	fs::path		dir = proc / std::to_string(p.pid);
+	std::error_code error;
+	fs::create_directories(dir / "fd", error);
+	fs::create_directories(dir / "fdinfo", error);
+	fs::create_symlink(gpu ? "/usr/bin/game" : "/usr/bin/daemon", dir / "exe", error);
+	for(int fd = 0; fd < 3; ++fd)
+		fs::create_symlink("/dev/null", dir / "fd" / std::to_string(fd), error);
+	if(!gpu)
+		return;
+
+	char text[DRM_MAX_FDINFO];
+	if(p.newKeys)
+		sprintf_s(text,
+				  sizeof(text),
+				  "pos:\t0\nflags:\t02100002\ndrm-driver:\tamdgpu\ndrm-pdev:\t0000:03:00.0\ndrm-client-id:\t%llu\n"
+				  "drm-total-vram:\t%llu KiB\ndrm-resident-vram:\t%llu KiB\ndrm-purgeable-vram:\t1024 KiB\n"
+				  "drm-total-gtt:\t%llu KiB\ndrm-resident-gtt:\t%llu KiB\ndrm-engine-gfx:\t123456 ns\n",
+				  p.client,
+				  p.total >> 10,
+				  p.resident >> 10,
+				  p.gtt >> 10,
+				  p.gtt >> 10);
+	else
+		sprintf_s(text,
+				  sizeof(text),
+				  "pos:\t0\nflags:\t02100002\ndrm-driver:\tamdgpu\ndrm-pdev:\t0000:03:00.0\ndrm-client-id:\t%llu\n"
+				  "drm-memory-vram:\t%llu KiB\ndrm-memory-gtt:\t%llu KiB\ndrm-memory-cpu:\t0 KiB\n",
+				  p.client,
+				  p.total >> 10,
+				  p.gtt >> 10);
+	fs::create_symlink("/dev/dri/renderD128", dir / "fd" / "3", error);
+	WriteFixtureFile(dir / "fdinfo" / "3", text);
+	if(p.local)
+	{
+		sprintf_s(text,
+				  sizeof(text),
+				  "drm-driver:\ti915\ndrm-pdev:\t0000:00:02.0\ndrm-client-id:\t%llu\ndrm-total-local0:\t%llu\ndrm-resident-local0:\t%llu\n",
+				  p.client,
+				  p.local,
+				  p.local);
+		fs::create_symlink("/dev/dri/renderD129", dir / "fd" / "4", error);
+		WriteFixtureFile(dir / "fdinfo" / "4", text);
+	}
+}
+
+static DrmFixtureProcess MakeDrmFixtureProcess(DrmFixture& fixture)
+{
+	UINT32&			  rnd = fixture.rnd;
+	DrmFixtureProcess p;
+	p.pid	   = fixture.nextPid++;
+	p.client   = p.pid;
+	p.total	   = (UINT64)(1 + BenchRandom(rnd) % 4096) << 20;
+	p.newKeys  = BenchRandom(rnd) % 2 == 0;
+	p.resident = p.newKeys ? p.total - ((UINT64)(BenchRandom(rnd) % 2) << 20) : p.total;
+	p.gtt	   = (UINT64)(BenchRandom(rnd) % 256) << 20;
+	p.local	   = BenchRandom(rnd) % 5 == 0 ? (UINT64)(1 + BenchRandom(rnd) % 64) << 20 : 0;
+	p.shared   = false;
+	return p;
+}
+
+// Every 8th process uses the gpu, every 64th of those forked a child sharing its client
+void CreateDrmFixture(DrmFixture& fixture, const char* root, int numProcesses)
+{
+	namespace fs = std::filesystem;
+	const fs::path	ROOT = root;
+	std::error_code error;
+	fs::remove_all(ROOT, error);
+	fs::create_directories(ROOT / "sys/bus/pci/devices/0000:03:00.0", error);
+	WriteFixtureFile(ROOT / "sys/bus/pci/devices/0000:03:00.0/mem_info_vram_total", "8589934592\n");
+	WriteFixtureFile(ROOT / "sys/bus/pci/devices/0000:03:00.0/mem_info_gtt_total", "17179869184\n");
+
+	fixture.root = root;
+	fixture.gpu.clear();
+	std::vector<DrmFixtureProcess>& gpu = fixture.gpu;
+	for(int i = 0; i < numProcesses; ++i)
+	{
+		DrmFixtureProcess p = MakeDrmFixtureProcess(fixture);
+		if(i % 8 == 0)
+		{
+			gpu.push_back(p);
+			if(gpu.size() % 64 == 0)
+			{
+				DrmFixtureProcess child = gpu[gpu.size() - 2];
+				child.pid				= p.pid;
+				child.local				= 0;
+				child.shared			= true;
+				gpu.back()				= child;
+			}
+		}
+		WriteDrmFixtureProcess(ROOT / "proc", i % 8 == 0 ? gpu.back() : p, i % 8 == 0);
+	}
+}
+
+void ChangeDrmFixture(DrmFixture& fixture)
+{
+	namespace fs = std::filesystem;
+	const fs::path					PROC = fs::path(fixture.root) / "proc";
+	std::vector<DrmFixtureProcess>& gpu	 = fixture.gpu;
+	std::error_code					error;
+	for(size_t i = 0; i < gpu.size(); i += 4)
+	{
+		if(gpu[i].shared)
+			continue;
+		gpu[i].total += 64 << 20;
+		gpu[i].resident += gpu[i].newKeys ? 32 << 20 : 64 << 20;
+		WriteDrmFixtureProcess(PROC, gpu[i], true);
+	}
+	for(size_t i = 1; i < gpu.size() && i < 40; i += 3)
+	{
+		if(gpu[i].shared || (i + 1 < gpu.size() && gpu[i + 1].shared))
+			continue;
+		fs::remove_all(PROC / std::to_string(gpu[i].pid), error);
+		gpu.erase(gpu.begin() + i);
+	}
+	for(int i = 0; i < 16; ++i)
+	{
+		gpu.push_back(MakeDrmFixtureProcess(fixture));
+		WriteDrmFixtureProcess(PROC, gpu.back(), true);
+	}
+}
+
+void RemoveDrmFixture(DrmFixture& fixture)
+{
+	std::error_code error;
+	std::filesystem::remove_all(fixture.root, error);
+	fixture.gpu.clear();
+}
+
+bool DrmFixtureMatches(const DrmFixture& fixture)
+{
+	UINT64 expected[5] = {}; // usage, commitment, non-local commitment, demoted, entries
+	for(const DrmFixtureProcess& p : fixture.gpu)
+	{
+		if(p.shared)
+			continue;
+		expected[0] += (p.newKeys ? p.resident : p.total) + p.local;
+		expected[1] += p.total + p.local;
+		expected[2] += p.gtt;
+		expected[3] += p.newKeys ? p.total - p.resident : 0;
+		expected[4] += p.local ? 2 : 1;
+	}
+	UINT64 tracked[5] = {};
+	EnterCriticalSection(&g_critSec);
+	for(const auto& pair : g_adapters)
+	{
+		tracked[0] += pair.second.UsageLocal;
+		tracked[1] += pair.second.CommitmentLocal;
+		tracked[2] += pair.second.CommitmentNonLocal;
+		tracked[3] += pair.second.CommitmentDemoted;
+	}
+	tracked[4] = g_processMemory.Size();
+	LeaveCriticalSection(&g_critSec);
+	return memcmp(expected, tracked, sizeof(expected)) == 0;
+}
+
+// Scans of a fixture /proc and /sys with thousands of processes, some of them with DRM clients: the first one,
+// one after processes changed, exited and started, then steady scans of the unchanged tree. demote_tests checks
+// the tracker against the fixture.
+static void BenchDrmSource(FILE* out)
+{
+#ifdef _WIN32
+	fprintf(out, "DRM fdinfo source: Linux only\n");
+#else
+	DrmFixture fixture;
+	CreateDrmFixture(fixture, "demote_bench_drm", 4000);
+	ResetTrackerState();
+	SetDrmRoots((fixture.root + "/proc").c_str(), (fixture.root + "/sys").c_str());
+	DrmScanStats  first, changed;
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	ScanDrmClients(first);
+	double firstSeconds = BenchSeconds(start);
+
+	ChangeDrmFixture(fixture);
+	QueryPerformanceCounter(&start);
+	ScanDrmClients(changed);
+	double changedSeconds = BenchSeconds(start);
+
+	const int	 NUM_SCANS = 32;
+	DrmScanStats steady;
+	QueryPerformanceCounter(&start);
+	for(int i = 0; i < NUM_SCANS; ++i)
+		ScanDrmClients(steady);
+	double steadySeconds = BenchSeconds(start) / NUM_SCANS;
+
+	SetDrmRoots("/proc", "/sys");
+	ResetTrackerState();
+	RemoveDrmFixture(fixture);
+
+	fprintf(out, "DRM fdinfo source, fixture with %u processes, %u with DRM clients, %u clients\n", steady.processes, steady.gpuProcesses, steady.clients);
+	fprintf(out, "  first scan   %8.2f ms  %5u fd listings %5u fdinfo reads\n", firstSeconds * 1e3, first.fdListings, first.fdinfoReads);
+	fprintf(out, "  after change %8.2f ms  %5u fd listings %5u fdinfo reads\n", changedSeconds * 1e3, changed.fdListings, changed.fdinfoReads);
+	fprintf(out, "  steady scan  %8.2f ms  %5u fd listings %5u fdinfo reads %6.0f ns/process\n", steadySeconds * 1e3, steady.fdListings, steady.fdinfoReads, steadySeconds * 1e9 / steady.processes);
+#endif
+}
+
+// Sweeps of a synthetic stream over four capacities. demote_tests checks the model.
+static void BenchSimulator(FILE* out)
+{
+	const UINT64 GB			= 1ull << 30;
+	const int	 NUM_EVENTS = 2 << 20;
+	SynthConfig	 synth;
+	SynthStream	 stream;
+	GenerateSynthEvents(synth, NUM_EVENTS, stream);
+	std::vector<UINT64>	   capacities = { 2 * GB, 4 * GB, 8 * GB, 16 * GB };
+	std::vector<SimResult> results;
+	LARGE_INTEGER		   start;
+	QueryPerformanceCounter(&start);
+	SweepBudgets(stream, capacities, 0.9, results);
+	double seconds = BenchSeconds(start);
+
+	fprintf(out, "Budget simulator, %zu events over %.1f s, %zu capacities in parallel: %.1f ms\n", stream.events.size(), results[0].streamSeconds, capacities.size(), seconds * 1e3);
+	for(const SimResult& r : results)
+	{
+		double byteSeconds = 0;
+		for(const SimEntry& e : r.entries)
+			byteSeconds += e.demotedByteSeconds;
+		fprintf(out,
+				"  %5.1f GB %8.1f ns/event %6.0fx real time, peak %8.1f MB, %10.1f GB*s demoted\n",
+				r.config.capacity / (double)GB,
+				r.seconds * 1e9 / r.events,
+				r.streamSeconds / r.seconds,
+				r.peakDemoted / (1024.0 * 1024.0),
+				byteSeconds / GB);
+	}
+}
+
+// Localhost agents with 64 entries each send their full state, then rounds where a few entries change, one exits
+// and one starts, and a query is answered while the loop runs on another thread. demote_tests checks the model.
+static void BenchFleet(FILE* out)
+{
+#ifdef _WIN32
+	fprintf(out, "Fleet collector: Linux only\n");
+#else
+	const int	   NUM_AGENTS = 256;
+	const int	   NUM_ENTRIES = 64;
+	const int	   NUM_ROUNDS = 10;
+	FleetCollector collector;
+	if(!StartFleetCollector(collector, 0))
+	{
+		fprintf(out, "Fleet collector: could not listen\n");
+		return;
+	}
+	char address[64];
+	sprintf_s(address, sizeof(address), "127.0.0.1:%d", collector.port);
+
+	std::vector<FleetAgent> agents(NUM_AGENTS);
+	std::vector<Snapshot>	states(NUM_AGENTS);
+	UINT32					rnd	 = 7;
+	auto					Make = [&](DWORD pid)
+	{
+		SnapshotEntry e = {};
+		e.pid			= pid;
+		e.pDxgAdapter	= (PVOID)(UINT64)(0x10000 * (1 + pid % 2));
+		e.name			= L"app" + std::to_wstring(pid % 97) + L".exe";
+		e.tracked		= pid % 13 == 0;
+		e.usageLocal	= (UINT64)(BenchRandom(rnd) % 4096) << 20;
+		e.commitmentLocal = e.usageLocal + ((UINT64)(BenchRandom(rnd) % 256) << 20);
+		e.demoted[BenchRandom(rnd) % PRIO_COUNT] = (UINT64)(BenchRandom(rnd) % 64) << 20;
+		return e;
+	};
+	for(int a = 0; a < NUM_AGENTS; ++a)
+	{
+		for(int i = 0; i < NUM_ENTRIES; ++i)
+			states[a].entries.push_back(Make(1000 + i * 4));
+		char host[32];
+		sprintf_s(host, sizeof(host), "node%03d", a);
+		FleetAgentConnect(agents[a], address, host);
+	}
+
+	// Every agent sends, then the collector runs until it has all the records
+	auto Round = [&]()
+	{
+		UINT64 expected = 0;
+		for(int a = 0; a < NUM_AGENTS; ++a)
+		{
+			FleetAgentSend(agents[a], states[a]);
+			expected += agents[a].recordsSent;
+		}
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		while(collector.stats.records < expected && BenchSeconds(start) < 10)
+			PollFleetCollector(collector, 10);
+	};
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	Round();
+	double fullSeconds = BenchSeconds(start);
+	UINT64 fullBytes   = collector.stats.bytes;
+	UINT64 fullRecords = collector.stats.records;
+
+	QueryPerformanceCounter(&start);
+	for(int round = 0; round < NUM_ROUNDS; ++round)
+	{
+		for(Snapshot& state : states)
+		{
+			for(int i = 0; i < 4; ++i)
+			{
+				SnapshotEntry& e = state.entries[BenchRandom(rnd) % state.entries.size()];
+				e.usageLocal	 = (UINT64)(BenchRandom(rnd) % 4096) << 20;
+				e.demoted[PRIO_LOW] += 1 << 20;
+			}
+			state.entries.erase(state.entries.begin() + BenchRandom(rnd) % state.entries.size());
+			state.entries.push_back(Make(state.entries.back().pid + 4)); // pids stay sorted
+		}
+		Round();
+	}
+	double deltaSeconds = BenchSeconds(start);
+	UINT64 deltaBytes	= collector.stats.bytes - fullBytes;
+	UINT64 deltaRecords = collector.stats.records - fullRecords;
+
+	std::atomic<bool> stop = false;
+	std::thread		  loop([&]()
+					   {
+						   while(!stop)
+							   PollFleetCollector(collector, 10);
+					   });
+	std::string		  view;
+	QueryPerformanceCounter(&start);
+	QueryFleet(address, FLEET_DEMOTED, 10, view);
+	double querySeconds = BenchSeconds(start);
+	stop				= true;
+	loop.join();
+	for(FleetAgent& agent : agents)
+		FleetAgentClose(agent);
+	StopFleetCollector(collector);
+
+	fprintf(out, "Fleet collector, %d localhost agents of %d entries\n", NUM_AGENTS, NUM_ENTRIES);
+	fprintf(out, "  full state   %8.2f ms  %7.1f KB  %4.0f bytes/record\n", fullSeconds * 1e3, fullBytes / 1024.0, (double)fullBytes / fullRecords);
+	fprintf(out,
+			"  delta rounds %8.2f ms  %7.1f KB  %4.0f bytes/record  %5.0f bytes/agent/round  %6.0f ns/record\n",
+			deltaSeconds * 1e3 / NUM_ROUNDS,
+			deltaBytes / 1024.0 / NUM_ROUNDS,
+			(double)deltaBytes / deltaRecords,
+			(double)deltaBytes / NUM_AGENTS / NUM_ROUNDS,
+			deltaSeconds * 1e9 / deltaRecords);
+	fprintf(out, "  top 10 query %8.2f ms\n", querySeconds * 1e3);
+#endif
+}
+
+// The heatmap over the history of a synthetic stream, 17 minutes of updates at 8 s per cell. demote_tests checks the
+// store.
+static void BenchHistory(FILE* out)
+{
+	const int	NUM_EVENTS = 1 << 20;
+	const int	NUM_FRAMES = 100;
+	SynthConfig config;
+	config.eventsPerSecond = 1000;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+	ResetTrackerState();
+	ReplaySynthEvents(stream);
+
+	EnterCriticalSection(&g_critSec);
+	g_consoleWidth	= 120;
+	g_consoleHeight = 40;
+	g_heatmapView	= HEATMAP_USAGE;
+	g_heatmapZoom	= 5;
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for(int i = 0; i < NUM_FRAMES; ++i)
+		RenderFrame();
+	double microseconds = BenchSeconds(start) * 1e6 / NUM_FRAMES;
+	g_heatmapView		= HEATMAP_OFF;
+	g_heatmapZoom		= 2;
+	UINT32 numSeries	= (UINT32)g_historySeries.size();
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	fprintf(out, "History heatmap, %u series, %dx%d %8.1f us/frame\n", numSeries, 120, 40, microseconds);
+}
+
+static bool CheckLimit(FILE* out, const char* what, double value, double limit)
+{
+	if(limit <= 0 || value <= limit)
+		return true;
+	fprintf(out, "REGRESSION: %s %.1f is over the limit of %.1f\n", what, value, limit);
+	return false;
+}
+
+bool RunBenchmarks(FILE* out, const BenchLimits& limits)
+{
+	BenchEventBatching(out);
+	BenchProcessMemory(out);
+	BenchFormatting(out);
+
+	SynthConfig steady;
+	steady.churn	   = 0;
+	steady.stormChance = 0;
+	SynthConfig storms;
+	SynthConfig many;
+	many.numProcesses = 4096;
+
+	fprintf(out, "Synthetic event streams, full handler path\n");
+	double nsPerEvent = BenchSyntheticEvents(out, "steady, 256 processes", steady);
+	nsPerEvent		  = std::max(nsPerEvent, BenchSyntheticEvents(out, "storms+churn, 256 processes", storms));
+	nsPerEvent		  = std::max(nsPerEvent, BenchSyntheticEvents(out, "storms+churn, 4096 processes", many));
+
+	fprintf(out, "Render, %u entries\n", g_processMemory.Size());
+	double frameMicroseconds = BenchRenderFrame(out, 120, 40, false);
+	frameMicroseconds		 = std::max(frameMicroseconds, BenchRenderFrame(out, 240, 70, true));
+	BenchRenderFrame(out, 240, 1000, true);
+	BenchSharedState(out);
+	BenchFlightRecorder(out);
+	BenchEtlReader(out);
+	BenchDrmSource(out);
+	BenchSimulator(out);
+	BenchFleet(out);
+	BenchHistory(out);
+
+	// The list filters and sorts every entry but formats only the visible rows, so it has to stay interactive at this size
+	SynthConfig huge;
+	huge.numProcesses = 25000;
+	huge.hotShare	  = 0;
+	fprintf(out, "Large process list\n");
+	BenchSyntheticEvents(out, "storms+churn, 25000 cold", huge);
+	frameMicroseconds = std::max(frameMicroseconds, BenchRenderFrame(out, 120, 40, false));
+	frameMicroseconds = std::max(frameMicroseconds, BenchRenderFrame(out, 120, 40, false, L"app1"));
+	ResetTrackerState();
+
+	bool ok = CheckLimit(out, "ns/event", nsPerEvent, limits.maxNsPerEvent);
+	ok		= CheckLimit(out, "us/frame", frameMicroseconds, limits.maxFrameMicroseconds) && ok;
+	return ok;
+}
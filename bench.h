@@ -0,0 +1,51 @@
+#pragma once
+#include "tracker.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Results over a limit are reported as regressions, 0 disables the check
+struct BenchLimits
+{
+	double maxNsPerEvent		= 0;
+	double maxFrameMicroseconds = 0;
+};
+
+// Runs the benchmark suite, returns false if a limit was exceeded
+bool RunBenchmarks(FILE* out, const BenchLimits& limits);
+
+// Writes a stream the way an ETW file session would, with the DxgKrnl and Kernel-Process events of a QPC clocked
+// 64 bit logger and some kernel events nobody handles. Shared with demote_tests.
+struct SynthStream;
+bool WriteSynthEtl(const char* path, const SynthStream& stream, UINT32 processors, UINT32 bufferSize);
+
+// The sprintf formatting FormatMemoryText replaced, which it has to match. Shared with demote_tests.
+void FormatMemoryPrintf(UINT64 bytes, char* buffer, size_t bufSize);
+
+// A process of the DRM fixture tree. Shared ones only have a dup of their parent's client, new style ones report
+// drm-total/drm-resident instead of drm-memory, and some also have a second client on an integrated gpu.
+struct DrmFixtureProcess
+{
+	DWORD  pid;
+	UINT64 client;
+	UINT64 total;
+	UINT64 resident;
+	UINT64 gtt;
+	UINT64 local; // on the integrated gpu, 0 if none
+	bool   newKeys;
+	bool   shared;
+};
+
+// A fixture /proc and /sys for the DRM source, with an 8 GB amdgpu card. Shared with demote_tests.
+struct DrmFixture
+{
+	std::string					   root;
+	std::vector<DrmFixtureProcess> gpu; // the processes with DRM clients, alive ones only
+	UINT32						   rnd	   = 1;
+	DWORD						   nextPid = 100;
+};
+
+void CreateDrmFixture(DrmFixture& fixture, const char* root, int numProcesses);
+void ChangeDrmFixture(DrmFixture& fixture); // a quarter of the gpu processes grow, some exit and 16 start
+void RemoveDrmFixture(DrmFixture& fixture);
+bool DrmFixtureMatches(const DrmFixture& fixture); // the tracker's totals are those of the alive processes
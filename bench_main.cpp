@@ -0,0 +1,451 @@
+#include "bench.h"
+#include "recorder.h"
+#include "etl.h"
+#include "drm.h"
+#include "simulate.h"
+#include "fleet.h"
+#include "measure.h"
+#include "render.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// Event clock of the DRM source, which stamps its scans with QueryPerformanceCounter
+static INT64 QpcNow()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+// What the tracker ended up with after a replay
+static void PrintTrackerState(const char* csvPath)
+{
+	for(const auto& pair : g_adapters)
+	{
+		const Adapter& a = pair.second;
+		printf("adapter %p: usage %.1f MB, commit %.1f MB, demoted %.1f MB\n",
+			   pair.first,
+			   a.UsageLocal / (1024.0 * 1024.0),
+			   a.CommitmentLocal / (1024.0 * 1024.0),
+			   a.CommitmentDemoted / (1024.0 * 1024.0));
+	}
+	printf("%u process/adapter entries\n", g_processMemory.Size());
+	if(csvPath)
+		ExportCsv(csvPath);
+}
+
+// Replays a flight recorder dump through the handlers
+static int Replay(const char* path, const char* csvPath)
+{
+	SynthStream stream;
+	if(!LoadFlightRecording(path, stream))
+	{
+		fprintf(stderr, "Failed to load '%s'\n", path);
+		return 2;
+	}
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	ReplaySynthEvents(stream);
+	QueryPerformanceCounter(&end);
+
+	INT64 duration = stream.events.size() ? stream.events.back().time - stream.events.front().time : 0;
+	printf("%zu events over %.1f s, replayed in %.1f ms\n",
+		   stream.events.size(),
+		   (double)duration / g_qpcFrequency,
+		   (end.QuadPart - start.QuadPart) * 1000.0 / g_qpcFrequency);
+	PrintTrackerState(csvPath);
+	return 0;
+}
+
+// Reads an .etl capture straight into the handlers
+static int ReadEtl(const char* path, const char* csvPath)
+{
+	EtlStats	  stats;
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	if(!ReadEtlFile(path, stats))
+	{
+		fprintf(stderr, "Failed to read '%s' as an ETL file\n", path);
+		return 2;
+	}
+	QueryPerformanceCounter(&end);
+
+	double seconds = (double)(end.QuadPart - start.QuadPart) / g_qpcFrequency;
+	printf("%llu buffers, %llu events over %.1f s, read in %.1f ms (%.0f MB/s)\n",
+		   stats.buffers,
+		   stats.events,
+		   (double)(stats.lastTime - stats.firstTime) / stats.frequency,
+		   seconds * 1000.0,
+		   stats.bytes / (1024.0 * 1024.0) / seconds);
+	printf("%llu events handled, %llu undecoded, %llu out of order, %llu buffers skipped\n",
+		   stats.dispatched,
+		   stats.undecoded,
+		   stats.lateEvents,
+		   stats.skippedBuffers);
+	PrintTrackerState(csvPath);
+	return 0;
+}
+
+// Replays the commitment and priority timelines of a recording against cards of other sizes
+static int Simulate(const char* path, const std::vector<UINT64>& capacities, double budgetShare, const char* csvPath)
+{
+	SynthStream stream;
+	if(!LoadFlightRecording(path, stream))
+	{
+		fprintf(stderr, "Failed to load '%s'\n", path);
+		return 2;
+	}
+	std::vector<SimResult> results;
+	SweepBudgets(stream, capacities, budgetShare, results);
+	PrintSimulation(stdout, results, 10);
+	if(csvPath && !ExportSimulationCsv(csvPath, results))
+		return 2;
+	return 0;
+}
+
+// Polls the DRM fdinfo files for a while and reports what the scans cost
+static int ScanDrm(double interval, double duration, const char* csvPath)
+{
+	DrmScanStats  stats;
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	INT64  stop		= start.QuadPart + (INT64)(duration * g_qpcFrequency);
+	int	   scans	= 0;
+	double scanTime = 0, maxScanTime = 0;
+	do
+	{
+		LARGE_INTEGER scanStart;
+		QueryPerformanceCounter(&scanStart);
+		if(!ScanDrmClients(stats))
+		{
+			fprintf(stderr, "Failed to read the DRM clients\n");
+			return 2;
+		}
+		QueryPerformanceCounter(&end);
+		double seconds = (double)(end.QuadPart - scanStart.QuadPart) / g_qpcFrequency;
+		scanTime += seconds;
+		maxScanTime = std::max(maxScanTime, seconds);
+		scans++;
+		if(end.QuadPart < stop)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+		}
+	} while(end.QuadPart < stop);
+
+	printf("%d scans, %.2f ms average, %.2f ms max\n", scans, scanTime * 1000.0 / scans, maxScanTime * 1000.0);
+	printf("last scan: %u processes, %u with DRM clients, %u clients, %u fd listings, %u fdinfo reads, %.1f MB purgeable\n",
+		   stats.processes,
+		   stats.gpuProcesses,
+		   stats.clients,
+		   stats.fdListings,
+		   stats.fdinfoReads,
+		   stats.purgeable / (1024.0 * 1024.0));
+	PrintTrackerState(csvPath);
+	return 0;
+}
+
+// Runs the collector, printing the top-N view every interval, or forever with a duration of 0
+static int Collect(int port, FleetMetric metric, int top, double interval, double duration)
+{
+	FleetCollector collector;
+	if(!StartFleetCollector(collector, port))
+	{
+		fprintf(stderr, "Failed to start the collector on port %d\n", port);
+		return 2;
+	}
+	printf("collecting on port %d\n", collector.port);
+	LARGE_INTEGER start, now;
+	QueryPerformanceCounter(&start);
+	INT64 nextView = start.QuadPart + (INT64)(interval * g_qpcFrequency);
+	do
+	{
+		PollFleetCollector(collector, 100);
+		QueryPerformanceCounter(&now);
+		if(now.QuadPart >= nextView)
+		{
+			std::string view;
+			FormatFleetView(collector, metric, top, view);
+			printf("\n%s%llu frames, %.1f MB received, %u connections, %u dropped\n",
+				   view.c_str(),
+				   collector.stats.frames,
+				   collector.stats.bytes / (1024.0 * 1024.0),
+				   collector.stats.connections,
+				   collector.stats.dropped);
+			fflush(stdout);
+			nextView = now.QuadPart + (INT64)(interval * g_qpcFrequency);
+		}
+	} while(duration <= 0 || now.QuadPart - start.QuadPart < (INT64)(duration * g_qpcFrequency));
+	StopFleetCollector(collector);
+	return 0;
+}
+
+// Runs a command with the DRM source polling every interval, tracking its process tree until the command exits
+static int Launch(const std::vector<std::string>& command, double interval, const char* summaryPath, const char* csvPath)
+{
+	DrmScanStats  stats;
+	LARGE_INTEGER start, end;
+	double		  cpuStart = TrackerCpuSeconds();
+	if(!ScanDrmClients(stats))
+	{
+		fprintf(stderr, "Failed to read the DRM clients\n");
+		return 2;
+	}
+	QueryPerformanceCounter(&start);
+	EnterCriticalSection(&g_critSec);
+	StartMeasurement(start.QuadPart);
+	LeaveCriticalSection(&g_critSec);
+	MeasuredProcess process;
+	if(!LaunchMeasured(command, process))
+	{
+		fprintf(stderr, "Failed to launch '%s'\n", command[0].c_str());
+		return 2;
+	}
+	while(!PollMeasured(process))
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+		ScanDrmClients(stats);
+	}
+	QueryPerformanceCounter(&end);
+	EnterCriticalSection(&g_critSec);
+	FinishMeasurement(end.QuadPart);
+	LeaveCriticalSection(&g_critSec);
+
+	MeasureReport report;
+	for(const std::string& arg : command)
+		report.command += (report.command.size() ? " " : "") + arg;
+	report.exitCode			 = process.exitCode;
+	report.seconds			 = (double)(end.QuadPart - start.QuadPart) / g_qpcFrequency;
+	report.trackerCpuSeconds = TrackerCpuSeconds() - cpuStart;
+	report.commandCpuSeconds = process.cpuSeconds;
+	printf("exit code %d after %.1f s, %u processes tracked, tracker cpu %.2f s (%.2f%%), command cpu %.2f s\n",
+		   report.exitCode,
+		   report.seconds,
+		   g_measure.processes,
+		   report.trackerCpuSeconds,
+		   report.seconds > 0 ? report.trackerCpuSeconds * 100 / report.seconds : 0.0,
+		   report.commandCpuSeconds);
+	PrintMeasurement(stdout);
+	if(!WriteMeasureSummary(summaryPath, report))
+		return 2;
+	if(csvPath)
+		ExportCsv(csvPath);
+	return MeasureLimitsExceeded() ? 1 : process.exitCode;
+}
+
+// demote_bench [--max-ns-per-event N] [--max-frame-us N]
+//  exits with 1 when a result is over its limit, so it can gate CI
+// demote_bench --replay <file.dtrec> [--csv <file>]
+//  replays a flight recorder dump instead
+// demote_bench --etl <file.etl> [--csv <file>]
+//  reads a WPR/xperf capture with the DxgKrnl and Kernel-Process providers instead
+// demote_bench --simulate <file.dtrec> --capacity <size>[,<size>...] [--budget <share>] [--csv <file>]
+//  predicts the demotions of a recording on cards with that much local memory, one thread per size
+// demote_bench --drm [--proc <dir>] [--sys <dir>] [--interval <s>] [--duration <s>] [--csv <file>]
+//  polls the Linux DRM fdinfo files instead, of /proc and /sys or of a fixture tree
+//  --agent <host:port> also sends the entries to a fleet collector
+// demote_bench --collect [--port <n>] [--metric usage|commit|demoted] [--top <n>] [--interval <s>] [--duration <s>]
+//  runs a fleet collector, printing the largest hosts and processes every interval; a duration of 0 runs forever
+// demote_bench --query <host:port> [--metric usage|commit|demoted] [--top <n>]
+//  prints the view of a running collector
+// demote_bench [--interval <s>] [--summary <file.json>] [--limit <rule>]... --launch <command> [<args>...]
+//  runs the command, measuring the memory of its process tree through the DRM source; exits with 1 when a
+//  limit is exceeded, with the command's exit code otherwise
+int main(int argc, char** argv)
+{
+	BenchLimits			limits;
+	const char*			replayPath	 = nullptr;
+	const char*			etlPath		 = nullptr;
+	const char*			csvPath		 = nullptr;
+	bool				drm			 = false;
+	const char*			procRoot	 = "/proc";
+	const char*			sysRoot		 = "/sys";
+	double				interval	 = 0.5;
+	double				duration	 = 5;
+	const char*			simulatePath = nullptr;
+	std::vector<UINT64> capacities;
+	double				budgetShare = 0.9;
+	const char*			agentAddress = nullptr;
+	const char*			queryAddress = nullptr;
+	bool				collect		 = false;
+	int					port		 = FLEET_DEFAULT_PORT;
+	int					top			 = 10;
+	FleetMetric			metric		 = FLEET_DEMOTED;
+
+	std::vector<std::string> launch; // --launch takes the rest of the arguments
+	const char*				 summaryPath = "demote_tracker_summary.json";
+	MeasureLimit			 limit;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "--max-ns-per-event") == 0 && i + 1 < argc)
+		{
+			limits.maxNsPerEvent = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--max-frame-us") == 0 && i + 1 < argc)
+		{
+			limits.maxFrameMicroseconds = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+		{
+			replayPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--etl") == 0 && i + 1 < argc)
+		{
+			etlPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+		{
+			csvPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--simulate") == 0 && i + 1 < argc)
+		{
+			simulatePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--capacity") == 0 && i + 1 < argc && ParseCapacities(argv[i + 1], capacities))
+		{
+			i++;
+		}
+		else if(strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+		{
+			budgetShare = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--drm") == 0)
+		{
+			drm = true;
+		}
+		else if(strcmp(argv[i], "--proc") == 0 && i + 1 < argc)
+		{
+			procRoot = argv[++i];
+		}
+		else if(strcmp(argv[i], "--sys") == 0 && i + 1 < argc)
+		{
+			sysRoot = argv[++i];
+		}
+		else if(strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+		{
+			interval = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--duration") == 0 && i + 1 < argc)
+		{
+			duration = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--agent") == 0 && i + 1 < argc)
+		{
+			agentAddress = argv[++i];
+		}
+		else if(strcmp(argv[i], "--collect") == 0)
+		{
+			collect = true;
+		}
+		else if(strcmp(argv[i], "--query") == 0 && i + 1 < argc)
+		{
+			queryAddress = argv[++i];
+		}
+		else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+		{
+			port = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+		{
+			top = std::clamp(atoi(argv[++i]), 1, 255);
+		}
+		else if(strcmp(argv[i], "--metric") == 0 && i + 1 < argc && ParseFleetMetric(argv[i + 1], metric))
+		{
+			i++;
+		}
+		else if(strcmp(argv[i], "--summary") == 0 && i + 1 < argc)
+		{
+			summaryPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--limit") == 0 && i + 1 < argc && ParseMeasureLimit(argv[i + 1], limit))
+		{
+			g_measure.limits.push_back(limit);
+			i++;
+		}
+		else if(strcmp(argv[i], "--launch") == 0 && i + 1 < argc)
+		{
+			launch.assign(argv + i + 1, argv + argc);
+			break;
+		}
+		else
+		{
+			fprintf(stderr, "usage: demote_bench [--max-ns-per-event N] [--max-frame-us N] | --replay <file.dtrec> | --etl <file.etl> | --simulate <file.dtrec> --capacity <size,...> [--budget <share>] | --drm [--proc <dir>] [--sys <dir>] [--interval <s>] [--duration <s>] [--agent <host:port>] | --collect [--port <n>] | --query <host:port> [--metric usage|commit|demoted] [--top <n>] | [--summary <file>] [--limit <rule>] --launch <command> [<args>...] [--csv <file>]\n");
+			return 2;
+		}
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	g_qpcFrequency = frequency.QuadPart;
+	fopen_s(&g_LogFile, NULL_DEVICE, "w");
+	InitializeCriticalSection(&g_critSec);
+
+	if(simulatePath)
+	{
+		if(capacities.empty())
+		{
+			fprintf(stderr, "--simulate needs --capacity, e.g. --capacity 8GB,12GB\n");
+			fclose(g_LogFile);
+			return 2;
+		}
+		int result = Simulate(simulatePath, capacities, budgetShare, csvPath);
+		fclose(g_LogFile);
+		return result;
+	}
+	if(collect)
+	{
+		int result = Collect(port, metric, top, interval, duration);
+		fclose(g_LogFile);
+		return result;
+	}
+	if(queryAddress)
+	{
+		std::string view;
+		if(!QueryFleet(queryAddress, metric, top, view))
+		{
+			fprintf(stderr, "Failed to query the collector at '%s'\n", queryAddress);
+			fclose(g_LogFile);
+			return 2;
+		}
+		fputs(view.c_str(), stdout);
+		fclose(g_LogFile);
+		return 0;
+	}
+	if(launch.size())
+	{
+		SetDrmRoots(procRoot, sysRoot);
+		g_eventClock = QpcNow;
+		int result = Launch(launch, interval, summaryPath, csvPath);
+		fclose(g_LogFile);
+		return result;
+	}
+	if(drm)
+	{
+		SetDrmRoots(procRoot, sysRoot);
+		g_eventClock = QpcNow;
+		if(agentAddress)
+			StartFleetAgent(agentAddress);
+		int result = ScanDrm(interval, duration, csvPath);
+		StopFleetAgent();
+		fclose(g_LogFile);
+		return result;
+	}
+	if(replayPath || etlPath)
+	{
+		int result = replayPath ? Replay(replayPath, csvPath) : ReadEtl(etlPath, csvPath);
+		fclose(g_LogFile);
+		return result;
+	}
+
+	bool ok = RunBenchmarks(stdout, limits);
+	fclose(g_LogFile);
+	return ok ? 0 : 1;
+}
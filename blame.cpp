@@ -0,0 +1,215 @@
+#include "blame.h"
+#include <algorithm>
+
+std::unordered_map<BlameKey, BlameScore> g_blameScores;
+UINT64									 g_blameUnattributed = 0;
+
+struct BlameGrowth
+{
+	INT64  time;
+	UINT64 bytes;
+	DWORD  pid;
+};
+
+// The growth of the last BLAME_WINDOW_SECONDS on one adapter. The sums are packed so a demotion walks them in
+// one pass; sumIndex finds the sum of a pid when growth comes in or leaves the window.
+struct BlameWindow
+{
+	BlameGrowth							ring[BLAME_MAX_GROWTH];
+	UINT32								head  = 0;
+	UINT32								count = 0;
+	std::vector<std::pair<DWORD, UINT64>> sums;
+	std::unordered_map<DWORD, UINT32>	sumIndex;
+	UINT64								total = 0;
+
+	void Add(DWORD pid, UINT64 bytes)
+	{
+		auto itr = sumIndex.find(pid);
+		if(itr == sumIndex.end())
+		{
+			sumIndex[pid] = (UINT32)sums.size();
+			sums.push_back({ pid, bytes });
+		}
+		else
+			sums[itr->second].second += bytes;
+		total += bytes;
+	}
+
+	void Remove(DWORD pid, UINT64 bytes)
+	{
+		auto	itr = sumIndex.find(pid);
+		UINT32	i	= itr->second;
+		UINT64& sum = sums[i].second;
+		sum -= bytes;
+		total -= bytes;
+		if(sum)
+			return;
+		sumIndex.erase(itr);
+		if(i + 1 != sums.size())
+		{
+			sums[i]					  = sums.back();
+			sumIndex[sums[i].first] = i;
+		}
+		sums.pop_back();
+	}
+
+	void Expire(INT64 time)
+	{
+		INT64 windowTicks = (INT64)(BLAME_WINDOW_SECONDS * g_qpcFrequency);
+		while(count)
+		{
+			const BlameGrowth& oldest = ring[(head + BLAME_MAX_GROWTH - count) % BLAME_MAX_GROWTH];
+			if(oldest.time >= time - windowTicks)
+				break;
+			Remove(oldest.pid, oldest.bytes);
+			count--;
+		}
+	}
+};
+
+static std::unordered_map<PVOID, BlameWindow*> g_blameWindows;
+
+static BlameWindow* FindBlameWindow(PVOID pDxgAdapter)
+{
+	BlameWindow*& window = g_blameWindows[pDxgAdapter];
+	if(!window)
+		window = new BlameWindow();
+	return window;
+}
+
+void BlameOnCommitmentGrowth(PVOID pDxgAdapter, DWORD pid, UINT64 growth, INT64 time)
+{
+	BlameWindow* window = FindBlameWindow(pDxgAdapter);
+	window->Expire(time);
+	if(window->count == BLAME_MAX_GROWTH)
+	{
+		const BlameGrowth& oldest = window->ring[window->head];
+		window->Remove(oldest.pid, oldest.bytes);
+		window->count--;
+	}
+	window->ring[window->head] = { time, growth, pid };
+	window->head			   = (window->head + 1) % BLAME_MAX_GROWTH;
+	window->count++;
+	window->Add(pid, growth);
+}
+
+void BlameOnDemotion(UINT32 index, UINT64 increase, INT64 time)
+{
+	const ProcessKey& key	 = g_processMemory.keys[index];
+	ProcessMemory&	  memory = g_processMemory.cold[index];
+	BlameWindow*	  window = FindBlameWindow(key.pDxgAdapter);
+	window->Expire(time);
+
+	UINT64 own	 = 0;
+	auto   self	 = window->sumIndex.find(key.pid);
+	if(self != window->sumIndex.end())
+		own = window->sums[self->second].second;
+	UINT64 others = window->total - own;
+	if(!others)
+	{
+		g_blameUnattributed += increase;
+		return;
+	}
+
+	double scale = (double)increase / others;
+	for(const auto& sum : window->sums)
+	{
+		if(sum.first == key.pid)
+			continue;
+		BlameScore& score = g_blameScores[{ key.pid, sum.first, key.pDxgAdapter }];
+		if(!score.events)
+			score.culpritName = FindProcName(sum.first);
+		score.bytes += sum.second * scale;
+		score.events++;
+		score.lastTime = time;
+		if(sum.first == memory.blamePid || score.bytes > memory.blameBytes)
+		{
+			memory.blamePid	  = sum.first;
+			memory.blameBytes = score.bytes;
+		}
+	}
+}
+
+// The victim's pairs go with it; blame it put on others stays with them
+void BlameClearProcess(UINT32 index)
+{
+	ProcessMemory& memory = g_processMemory.cold[index];
+	if(memory.blameBytes == 0)
+		return;
+	DWORD pid	  = g_processMemory.keys[index].pid;
+	PVOID adapter = g_processMemory.keys[index].pDxgAdapter;
+	for(auto itr = g_blameScores.begin(); itr != g_blameScores.end();)
+	{
+		if(itr->first.victim == pid && itr->first.pDxgAdapter == adapter)
+			itr = g_blameScores.erase(itr);
+		else
+			++itr;
+	}
+	memory.blameBytes = 0;
+}
+
+const wstring* BlameCulpritName(UINT32 index)
+{
+	const ProcessMemory& memory = g_processMemory.cold[index];
+	if(memory.blameBytes == 0)
+		return nullptr;
+	const ProcessKey& key = g_processMemory.keys[index];
+	auto			  itr = g_blameScores.find({ key.pid, memory.blamePid, key.pDxgAdapter });
+	return itr != g_blameScores.end() ? &itr->second.culpritName : nullptr;
+}
+
+void ResetBlame()
+{
+	for(auto& pair : g_blameWindows)
+		delete pair.second;
+	g_blameWindows.clear();
+	g_blameScores.clear();
+	g_blameUnattributed = 0;
+}
+
+// One row per (victim, culprit) pair, the largest culprits of each victim first
+bool ExportBlameReport(const char* path)
+{
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open export file '%s'\n", path);
+		fflush(g_LogFile);
+		return false;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	INT64 now = EventClockNow();
+	std::vector<const std::pair<const BlameKey, BlameScore>*> rows;
+	for(const auto& pair : g_blameScores)
+		rows.push_back(&pair);
+	std::sort(rows.begin(),
+			  rows.end(),
+			  [](const auto* a, const auto* b)
+			  {
+				  if(a->first.victim != b->first.victim)
+					  return a->first.victim < b->first.victim;
+				  if(a->first.pDxgAdapter != b->first.pDxgAdapter)
+					  return a->first.pDxgAdapter < b->first.pDxgAdapter;
+				  return a->second.bytes > b->second.bytes;
+			  });
+
+	fprintf(f, "victim_pid,victim,adapter,culprit_pid,culprit,blamed_bytes,events,last_seconds_ago\n");
+	for(const auto* row : rows)
+	{
+		fprintf(f,
+				"%u,%ls,%ls,%u,%ls,%.0f,%u,%.1f\n",
+				(unsigned)row->first.victim,
+				FindProcName(row->first.victim).c_str(),
+				FindAdapter(row->first.pDxgAdapter)->name.c_str(),
+				(unsigned)row->first.culprit,
+				row->second.culpritName.c_str(),
+				row->second.bytes,
+				row->second.events,
+				(double)(now - row->second.lastTime) / g_qpcFrequency);
+	}
+	fprintf(f, "unattributed,,,,,%llu,,\n", g_blameUnattributed);
+	LeaveCriticalSection(&g_critSec);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+// Demotion blame
+//  the local commitment growth on each adapter is kept for BLAME_WINDOW_SECONDS of event time, in a ring with
+//  a running sum per process. When the demoted commitment of an entry rises, the increase is shared between the
+//  other processes that grew on the same adapter during the window, in proportion to their growth, and added to
+//  their running blame for that entry. Each entry keeps its largest culprit for the list, the pairs are kept
+//  until the victim exits for the report.
+#include "tracker.h"
+#include <unordered_map>
+
+#define BLAME_WINDOW_SECONDS 2.0
+#define BLAME_MAX_GROWTH 4096 // ring entries per adapter, the oldest growth is dropped first in a busy window
+
+struct BlameKey
+{
+	DWORD victim;
+	DWORD culprit;
+	PVOID pDxgAdapter;
+	bool  operator==(const BlameKey& other) const
+	{
+		return victim == other.victim && culprit == other.culprit && pDxgAdapter == other.pDxgAdapter;
+	};
+};
+
+namespace std
+{
+template <>
+struct hash<BlameKey>
+{
+	std::size_t operator()(const BlameKey& f) const noexcept
+	{
+		std::size_t h1 = std::hash<DWORD>{}(f.victim) ^ ((size_t)f.culprit << 32);
+		std::size_t h2 = std::hash<PVOID>{}(f.pDxgAdapter);
+		return h1 ^ (h2 + 0x9e3779b97f4a7c15ULL + (h1 << 6) + (h1 >> 2));
+	}
+};
+} // namespace std
+
+struct BlameScore
+{
+	double	bytes; // of the victim's demotion increases put on the culprit
+	UINT32	events;
+	INT64	lastTime;
+	wstring culpritName; // at the first blame, the culprit may have exited by the time of the report
+};
+
+extern std::unordered_map<BlameKey, BlameScore> g_blameScores;
+extern UINT64									g_blameUnattributed; // demotion increases with no other process growing
+
+// Need g_critSec
+void		   BlameOnCommitmentGrowth(PVOID pDxgAdapter, DWORD pid, UINT64 growth, INT64 time);
+void		   BlameOnDemotion(UINT32 index, UINT64 increase, INT64 time);
+void		   BlameClearProcess(UINT32 index);
+const wstring* BlameCulpritName(UINT32 index); // largest culprit of an entry, null if none
+void		   ResetBlame();
+bool		   ExportBlameReport(const char* path);
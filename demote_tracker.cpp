@@ -9,6 +9,9 @@
 #include <atomic>
 #include <algorithm>
 #include <unordered_map>
+#include <array>
+#include <climits>
+#include <cwctype>
 #include <mutex>
 #include <conio.h>
 
@@ -17,325 +20,61 @@
 #include <fcntl.h>
 #include <dxgi1_4.h>
 
-// Microsoft-Windows-DxgKrnl provider GUID
-// {802ec45a-1e99-4b83-9920-87c98277ba9d}
-DEFINE_GUID(DxgKrnlGuid, 0x802ec45a, 0x1e99, 0x4b83, 0x99, 0x20, 0x87, 0xc9, 0x82, 0x77, 0xba, 0x9d);
-
-// Microsoft-Windows-Kernel-Process provider GUID
-// {22FB2CD6-0E7B-422B-A0C7-2FAD1FD0E716}
-DEFINE_GUID(KernelProcessGuid, 0x22FB2CD6, 0x0E7B, 0x422B, 0xA0, 0xC7, 0x2F, 0xAD, 0x1F, 0xD0, 0xE7, 0x16);
-using std::wstring;
-
-// Kernel Process event IDs
-enum KernelProcessEventIds
-{
-	ProcessStart   = 1,
-	ProcessStop	   = 2,
-	ProcessRundown = 15, // DCStart - enumerates already-running processes
-};
+#include "tracker.h"
+#include "alerts.h"
+#include "render.h"
+#include "bench.h"
+#include "resolver.h"
+#include "snapshot.h"
+#include "publish.h"
+#include "recorder.h"
+#include "blame.h"
+#include "fleet.h"
+#include "measure.h"
+#include "device.h"
 
 // Session name for our trace
 static const wchar_t* SESSION_NAME = L"DemoteTrackerSession";
 
-enum DxgKrnlEventIds
-{
-	// AdapterAllocation events (keyword: Resource 0x40)
-	AdapterAllocation_Start	  = 33,
-	AdapterAllocation_Stop	  = 34,
-	AdapterAllocation_DCStart = 35,
-
-	// DeviceAllocation events (keyword: Resource 0x40)
-	DeviceAllocation_Start	 = 36,
-	DeviceAllocation_Stop	 = 37,
-	DeviceAllocation_DCStart = 38,
-
-	// Other allocation events
-	TerminateAllocation		   = 39,
-	ProcessTerminateAllocation = 40,
-
-	// ReferenceAllocations (keyword: References 0x4) - frequently seen
-	ReferenceAllocations = 43,
-
-	Adapter_Start	= 24,
-	Adapter_Stop	= 25,
-	Adapter_DCStart = 26,
-
-	RenameAllocation_Start = 64,
-	RenameAllocation_Stop  = 65,
-	ReportSegment_Info	   = 78,
-
-	DpiReportAdapter_Info = 110,
-
-	// Memory events (keyword: Memory)
-	ProcessAllocation_Start = 225,
-	ProcessAllocation_Stop	= 226,
-
-	// ProcessAllocationDetails (keyword: Resource 0x40)
-	ProcessAllocationDetails_Start = 288,
-	ProcessAllocationDetails_Stop  = 289,
-
-	// RecycleRangeTracking (keyword: 0x80) - memory range management
-	RecycleRangeTracking_Info1 = 301,
-	RecycleRangeTracking_Info2 = 302,
-	RecycleRangeTracking_Info3 = 303,
-
-	// VidMm events (keyword: References 0x4)
-	VidMmMakeResident = 320,
-	VidMmEvict		  = 321,
-
-	VidMmProcessBudgetChange			= 366,
-	VidMmProcessUsageChange				= 367,
-	VidMmProcessDemotedCommitmentChange = 370,
-	VidMmProcessCommitmentChange		= 371,
-
-	VidMmMakeResident_DCStart	= 374,
-	TransferAllocationOwnership = 373,
-
-};
-
-enum ConsoleColor
-{
-	BLACK		 = 0,
-	DARK_BLUE	 = 1,
-	DARK_GREEN	 = 2,
-	DARK_CYAN	 = 3,
-	DARK_RED	 = 4,
-	DARK_MAGENTA = 5,
-	DARK_YELLOW	 = 6,
-	GRAY		 = 7,
-	DARK_GRAY	 = 8,
-	BLUE		 = 9,
-	GREEN		 = 10,
-	CYAN		 = 11,
-	RED			 = 12,
-	MAGENTA		 = 13,
-	YELLOW		 = 14,
-	WHITE		 = 15
-};
-enum Prio
-{
-	PRIO_MIN,
-	PRIO_LOW,
-	PRIO_NORMAL,
-	PRIO_HIGH,
-	PRIO_MAX,
-	PRIO_COUNT,
-};
-
-struct Process
-{
-	DWORD	pid;
-	bool	isTracked = false;
-	wstring imageFilename;
-	wstring imagePath;
-	int		nextFree = -1;
-	void	Reset()
-	{
-		pid			  = (DWORD)-1;
-		isTracked	  = false;
-		imageFilename = L"";
-		imagePath	  = L"";
-	}
-};
-
-struct ProcessKey
-{
-	DWORD pid;
-	PVOID pDxgAdapter;
-	bool  operator==(const ProcessKey& other) const
-	{
-		return pid == other.pid && pDxgAdapter == other.pDxgAdapter;
-	};
-};
-
-namespace std
-{
-template <>
-struct hash<ProcessKey>
-{
-	std::size_t operator()(const ProcessKey& f) const noexcept
-	{
-		std::size_t h1 = std::hash<DWORD>{}(f.pid);
-		std::size_t h2 = std::hash<PVOID>{}(f.pDxgAdapter);
-		return h1 ^ (h2 + 0x9e3779b97f4a7c15ULL + (h1 << 6) + (h1 >> 2));
-	}
-};
-} // namespace std
-
-struct ProcessMemory
-{
-	DWORD pid;
-	PVOID pDxgAdapter;
-	bool  isTracked;
-
-	UINT64 CommitmentLocal;
-	UINT64 CommitmentNonLocal;
-	UINT64 UsageLocal;
-	UINT64 UsageNonLocal;
-	UINT64 CommitmentDemoted[PRIO_COUNT];
-
-	void Reset()
-	{
-		CommitmentLocal	   = 0;
-		CommitmentNonLocal = 0;
-		UsageLocal		   = 0;
-		UsageNonLocal	   = 0;
-		memset(&CommitmentDemoted[0], 0, sizeof(CommitmentDemoted));
-	}
-};
-
-#define MAX_SEGMENTS 32
-struct Adapter
-{
-	std::wstring name;
-	UINT64		 LocalMemory					  = 0;
-	PVOID		 pDxgAdapter					  = 0;
-	UINT64		 SegmentLocalMemory[MAX_SEGMENTS] = { 0 };
-};
+// Startup waits: for the trace thread to receive its first event, and for each capture state request.
+// A capture state that times out still completes, its rundown events just arrive after the first frame.
+static const DWORD TRACE_START_TIMEOUT_MS = 1000;
+static const ULONG RUNDOWN_TIMEOUT_MS	  = 250;
+
+static TRACEHANDLE		 g_sessionHandle   = 0;
+static TRACEHANDLE		 g_traceHandle	   = INVALID_PROCESSTRACE_HANDLE;
+static std::atomic<bool> g_traceStarted	   = false;
+static bool				 g_benchmark	   = false;
+static HANDLE			 g_hRedrawEvent;
+static HANDLE			 g_hTraceStartedEvent;
+static INT64			 g_startTime;
+static wstring			 g_alertCommand;
+static FILE*			 g_alertLogFile	   = nullptr;
+static int				 g_maxFps		   = 30;
+static bool				 g_sharedState	   = true;
+static bool				 g_record		   = false;
+static double			 g_recordMegabytes = 64;
+static double			 g_recordSeconds   = 60;
+static std::vector<int>	 g_recordTriggers; // alert rules that dump the flight recorder when raised
+static HANDLE			 g_hDumpEvent;
+static std::string		 g_fleetAddress; // collector the entries are sent to, host:port
+
+// Launch and measure (measure.h)
+static std::vector<std::string> g_launchCommand; // measured until it exits
+static std::string				g_summaryPath = "demote_tracker_summary.json";
+static MeasuredProcess			g_measured;
+static double					g_launchCpuSeconds; // of the tracker when the command started
+static int						g_exitCode = 0;
 
-static TRACEHANDLE									 g_sessionHandle = 0;
-static TRACEHANDLE									 g_traceHandle	 = INVALID_PROCESSTRACE_HANDLE;
-static std::atomic<bool>							 g_traceStarted	 = false;
-static CRITICAL_SECTION								 g_critSec;
-static std::vector<Process>							 g_processes;
-static int											 g_processFirstFree = -1;
-static std::unordered_map<DWORD, int>				 g_pidToProcess;
-static std::unordered_map<ProcessKey, ProcessMemory> g_processMemory;
-static std::unordered_map<PVOID, Adapter>			 g_adapters;
-static std::vector<wstring>							 g_trackedProcesses;
-static bool											 g_verbose			 = false;
-static bool											 g_detailedMode		 = false;
-static int											 g_minSize			 = 0;
-static bool											 g_detailedAvailable = false;
-static HANDLE										 g_hRedrawEvent;
 
 // Console Stuff
-static HANDLE				  g_hConsoleOutput	   = NULL;
-static HANDLE				  g_hConsoleInput	   = NULL;
-static int					  g_consoleWidth	   = 80;
-static int					  g_consoleHeight	   = 80;
-static WORD					  g_originalAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
-static int					  g_lastWidth		   = 0;
-static int					  g_lastHeight		   = 0;
-static int					  g_currentX		   = 0;
-static int					  g_currentY		   = 0;
-static int					  g_currentColor	   = 0;
-static std::vector<CHAR_INFO> g_chars;
-
-// Colors
-static int		   g_PrioTocolor[6]	  = { CYAN, YELLOW, DARK_YELLOW, RED, DARK_RED, MAGENTA };
-static const char* g_prioNames[6]	  = { "?", "MIN", "LOW", "NORMAL", "HIGH", "MAX" };
-static int		   g_adapterToColor[] = { YELLOW, WHITE, MAGENTA, RED, CYAN, WHITE, BLUE, GREEN };
-static int		   g_numAdapterColors = sizeof(g_adapterToColor) / sizeof(g_adapterToColor[0]);
-
-static FILE* g_LogFile = nullptr;
-
-Process* FindProcess(DWORD pid);
-
-wstring FindProcName(DWORD pid)
-{
-	auto itr = g_pidToProcess.find(pid);
-	if(itr != g_pidToProcess.end())
-	{
-		int index = (*itr).second;
-		return g_processes[index].imageFilename;
-	}
-	return L"?";
-}
-ProcessMemory* FindProcessMemory(DWORD processId, PVOID pDxgAdapter)
-{
-	ProcessKey Key = { processId, pDxgAdapter };
-	auto	   itr = g_processMemory.find(Key);
-	if(itr != g_processMemory.end())
-		return &(*itr).second;
-
-	ProcessMemory* mem = &g_processMemory[Key];
-	mem->isTracked	   = FindProcess(processId)->isTracked;
-	return mem;
-}
-
-void FreeProcessMemory(DWORD pid)
-{
-	erase_if(g_processMemory, [pid](auto& itr) { return itr.first.pid == pid; });
-}
-
-Adapter* FindAdapter(PVOID pDxgAdapter)
-{
-	Adapter& a	  = g_adapters[pDxgAdapter];
-	a.pDxgAdapter = pDxgAdapter;
-	return &a;
-}
-
-Process* FindProcess(DWORD pid)
-{
-	auto	 itr = g_pidToProcess.find(pid);
-	Process* res = nullptr;
-	if(itr != g_pidToProcess.end())
-	{
-		int index = (*itr).second;
-		res		  = &g_processes[index];
-	}
-	else
-	{
-		if(g_processFirstFree >= 0)
-		{
-			res				   = &g_processes[g_processFirstFree];
-			g_processFirstFree = res->nextFree;
-			res->nextFree	   = -1;
-		}
-		else
-		{
-			size_t s = g_processes.size();
-			g_processes.push_back({});
-			res = &g_processes[s];
-		}
-		res->Reset();
-		res->pid			= pid;
-		int index			= (int)(res - &g_processes[0]);
-		g_pidToProcess[pid] = index;
-	}
-	if(res->nextFree >= 0)
-		__debugbreak();
-	if(res->pid != pid)
-		__debugbreak();
-	return res;
-}
-void FreeProcess(Process* process)
-{
-	int	 index = (int)(process - &g_processes[0]);
-	auto itr   = g_pidToProcess.find(process->pid);
-	if(itr != g_pidToProcess.end())
-	{
-		g_pidToProcess.erase(itr);
-		process->pid = (DWORD)-1;
-	}
-
-	if(process->nextFree >= 0)
-		__debugbreak();
-	if(process->pid != (DWORD)-1)
-		__debugbreak();
-	process->nextFree  = g_processFirstFree;
-	g_processFirstFree = index;
-}
+static HANDLE g_hConsoleOutput	   = NULL;
+static HANDLE g_hConsoleInput	   = NULL;
+static WORD	  g_originalAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+static int	  g_lastWidth		   = 0;
+static int	  g_lastHeight		   = 0;
 
-std::wstring ToLower(const std::wstring& str)
-{
-	std::wstring result = str;
-	std::transform(result.begin(), result.end(), result.begin(), ::towlower);
-	return result;
-}
-
-std::wstring GetFileName(const std::wstring& path)
-{
-	size_t pos = path.find_last_of(L"\\/");
-	if(pos != std::wstring::npos)
-	{
-		return path.substr(pos + 1);
-	}
-	return path;
-}
-
-std::wstring GetProcessName(DWORD processId)
+std::wstring GetProcessPath(DWORD processId)
 {
 	std::wstring processName;
 	HANDLE		 hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
@@ -345,73 +84,147 @@ std::wstring GetProcessName(DWORD processId)
 		DWORD	size = MAX_PATH;
 		if(QueryFullProcessImageNameW(hProcess, 0, path, &size))
 		{
-			processName = GetFileName(path);
+			processName = path;
 		}
 		CloseHandle(hProcess);
 	}
 	return processName;
 }
 
-void FormatBytes(int64_t bytes, wchar_t* buffer, size_t bufferSize)
+// Fills the process table from a Toolhelp snapshot, so names are known before the rundown arrives and the UI
+// does not have to open processes. Runs on a worker thread while the session starts.
+void PrepopulateProcesses()
 {
-	const wchar_t* units[]	 = { L"B", L"KB", L"MB", L"GB", L"TB" };
-	int			   unitIndex = 0;
-	double		   value	 = (double)(bytes < 0 ? -bytes : bytes);
-
-	while(value >= 1024.0 && unitIndex < 4)
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	struct SnapshotEntry
 	{
-		value /= 1024.0;
-		unitIndex++;
-	}
+		DWORD	pid;
+		DWORD	parentPid;
+		wstring name;
+	};
+	std::vector<SnapshotEntry> entries;
+	HANDLE					   snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if(snapshot == INVALID_HANDLE_VALUE)
+		return;
+	PROCESSENTRY32W entry;
+	entry.dwSize = sizeof(entry);
+	for(BOOL ok = Process32FirstW(snapshot, &entry); ok; ok = Process32NextW(snapshot, &entry))
+		entries.push_back({ entry.th32ProcessID, entry.th32ParentProcessID, entry.szExeFile });
+	CloseHandle(snapshot);
 
-	if(bytes < 0)
-	{
-		swprintf_s(buffer, bufferSize, L"-%.2f%s", value, units[unitIndex]);
-	}
-	else
+	// Names the trace already delivered are newer than the snapshot
+	EnterCriticalSection(&g_critSec);
+	for(const SnapshotEntry& e : entries)
 	{
-		swprintf_s(buffer, bufferSize, L"%.2f%s", value, units[unitIndex]);
+		auto itr = g_pidToProcess.find(e.pid);
+		if(itr == g_pidToProcess.end() || g_processes[itr->second].imageFilename.empty())
+			OnProcessCreate(e.name, e.pid, e.parentPid, true);
 	}
+	LeaveCriticalSection(&g_critSec);
+
+	QueryPerformanceCounter(&end);
+	fprintf(g_LogFile, "Process snapshot: %d processes in %.1f ms\n", (int)entries.size(), (end.QuadPart - start.QuadPart) * 1000.0 / g_qpcFrequency);
+	fflush(g_LogFile);
 }
 
-// Get property value from event by name
-bool GetEventProperty(PEVENT_RECORD pEvent, PTRACE_EVENT_INFO pInfo, const wchar_t* propName, ULONGLONG* pValue)
+// Dumps the flight recorder to a timestamped .dtrec file. The trace thread keeps recording meanwhile.
+void DumpFlightRecording()
 {
-	for(DWORD i = 0; i < pInfo->TopLevelPropertyCount; i++)
-	{
-		wchar_t* name = (wchar_t*)((PBYTE)pInfo + pInfo->EventPropertyInfoArray[i].NameOffset);
-		if(_wcsicmp(name, propName) == 0)
+	if(!FlightRecorderEnabled())
+		return;
+	SYSTEMTIME t;
+	GetLocalTime(&t);
+	char path[64];
+	sprintf_s(path, sizeof(path), "demote_tracker_%04d%02d%02d_%02d%02d%02d.dtrec", t.wYear, t.wMonth, t.wDay, t.wHour, t.wMinute, t.wSecond);
+	DumpFlightRecorder(path);
+}
+
+// Writes out alerts raised since the last call and runs the alert command for each. Called from the main loop without g_critSec.
+void AlertFlush()
+{
+	static std::vector<AlertEvent> events;
+	events.clear();
+	EnterCriticalSection(&g_critSec);
+	events.swap(g_alertEvents);
+	LeaveCriticalSection(&g_critSec);
+
+	bool dump = false;
+	for(const AlertEvent& e : events)
+	{
+		const AlertRule& rule = g_alertRules[e.rule];
+		if(e.raised && std::find(g_recordTriggers.begin(), g_recordTriggers.end(), e.rule) != g_recordTriggers.end())
+			dump = true;
+		if(!g_alertLogFile)
+			fopen_s(&g_alertLogFile, "demote_tracker_alerts.txt", "a");
+		if(g_alertLogFile)
 		{
-			PROPERTY_DATA_DESCRIPTOR dataDesc = {};
-			dataDesc.PropertyName			  = (ULONGLONG)name;
-			dataDesc.ArrayIndex				  = ULONG_MAX;
+			SYSTEMTIME t;
+			GetLocalTime(&t);
+			fprintf(g_alertLogFile,
+					"%04d-%02d-%02d %02d:%02d:%02d.%03d,%s,\"%s\",%ls,%d,%p,%.1f%s\n",
+					t.wYear,
+					t.wMonth,
+					t.wDay,
+					t.wHour,
+					t.wMinute,
+					t.wSecond,
+					t.wMilliseconds,
+					e.raised ? "RAISED" : "CLEARED",
+					rule.text.c_str(),
+					e.processName.c_str(),
+					e.pid == (DWORD)-1 ? -1 : (int)e.pid,
+					e.pDxgAdapter,
+					rule.percent ? e.value : e.value / (1024.0 * 1024.0),
+					rule.percent ? "%" : "MB");
+			fflush(g_alertLogFile);
+		}
 
-			DWORD propSize = 0;
-			if(TdhGetPropertySize(pEvent, 0, nullptr, 1, &dataDesc, &propSize) == ERROR_SUCCESS)
+		if(g_alertCommand.size())
+		{
+			wchar_t value[64];
+			swprintf_s(value, _countof(value), L"%.0f", e.value);
+			std::wstring ruleText(rule.text.begin(), rule.text.end());
+			SetEnvironmentVariableW(L"DT_ALERT_STATE", e.raised ? L"RAISED" : L"CLEARED");
+			SetEnvironmentVariableW(L"DT_ALERT_RULE", ruleText.c_str());
+			SetEnvironmentVariableW(L"DT_ALERT_PROCESS", e.processName.c_str());
+			SetEnvironmentVariableW(L"DT_ALERT_PID", std::to_wstring(e.pid == (DWORD)-1 ? -1 : (int)e.pid).c_str());
+			SetEnvironmentVariableW(L"DT_ALERT_VALUE", value);
+
+			std::wstring		commandLine = g_alertCommand;
+			STARTUPINFOW		si			= { sizeof(si) };
+			PROCESS_INFORMATION pi			= {};
+			if(CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi))
 			{
-				if(propSize > 0 && propSize <= 8)
-				{
-					BYTE buffer[8] = { 0 };
-					if(TdhGetProperty(pEvent, 0, nullptr, 1, &dataDesc, 8, buffer) == ERROR_SUCCESS)
-					{
-						if(propSize == 8)
-							*pValue = *(ULONGLONG*)buffer;
-						else if(propSize == 4)
-							*pValue = *(ULONG*)buffer;
-						else if(propSize == 2)
-							*pValue = *(USHORT*)buffer;
-						else if(propSize == 1)
-							*pValue = *(UCHAR*)buffer;
-						return true;
-					}
-				}
+				CloseHandle(pi.hThread);
+				CloseHandle(pi.hProcess);
+			}
+			else
+			{
+				fprintf(g_LogFile, "Failed to run alert command '%ls'. Error: %lu\n", g_alertCommand.c_str(), GetLastError());
+				fflush(g_LogFile);
 			}
-			break;
 		}
 	}
-	return false;
+	if(dump)
+		DumpFlightRecording();
 }
 
+#define MAX_EVENT_FIELDS 16
+#define MAX_EVENT_VERSIONS 8
+struct EventLayout
+{
+	enum
+	{
+		UNRESOLVED,
+		VALID,
+		INVALID,
+	} state = UNRESOLVED;
+	USHORT minSize;
+	USHORT offsets[MAX_EVENT_FIELDS]; // in UserData
+	UCHAR  sizes[MAX_EVENT_FIELDS];	  // pointers can be 4 bytes in 32 bit events
+};
+
 PTRACE_EVENT_INFO ExtractEventInformation(PEVENT_RECORD pEvent)
 {
 	DWORD bufferSize = 0;
@@ -432,320 +245,178 @@ PTRACE_EVENT_INFO ExtractEventInformation(PEVENT_RECORD pEvent)
 	return pInfo;
 }
 
-template <typename T>
-T GetProperty(PEVENT_RECORD pEvent, const wchar_t* bleh)
+// Size of a top level property in UserData, 0 if it's variable length
+static USHORT GetPropertyFixedSize(const EVENT_PROPERTY_INFO& prop, USHORT pointerSize)
 {
-	T						 r;
-	PROPERTY_DATA_DESCRIPTOR dataDesc = {};
-	dataDesc.PropertyName			  = (ULONGLONG)bleh;
-	dataDesc.ArrayIndex				  = ULONG_MAX;
-
-	DWORD propSize = 0;
-	if(TdhGetPropertySize(pEvent, 0, nullptr, 1, &dataDesc, &propSize) == ERROR_SUCCESS)
-	{
-		if(propSize != sizeof(T))
-			__debugbreak();
-	}
-	else
-	{
-		__debugbreak();
+	if(prop.Flags & (PropertyStruct | PropertyParamLength | PropertyParamCount))
+		return 0;
+	USHORT count = prop.count ? prop.count : 1;
+	USHORT size	 = 0;
+	switch(prop.nonStructType.InType)
+	{
+	case TDH_INTYPE_INT8:
+	case TDH_INTYPE_UINT8:
+		size = 1;
+		break;
+	case TDH_INTYPE_INT16:
+	case TDH_INTYPE_UINT16:
+		size = 2;
+		break;
+	case TDH_INTYPE_INT32:
+	case TDH_INTYPE_UINT32:
+	case TDH_INTYPE_HEXINT32:
+	case TDH_INTYPE_FLOAT:
+	case TDH_INTYPE_BOOLEAN:
+		size = 4;
+		break;
+	case TDH_INTYPE_INT64:
+	case TDH_INTYPE_UINT64:
+	case TDH_INTYPE_HEXINT64:
+	case TDH_INTYPE_DOUBLE:
+	case TDH_INTYPE_FILETIME:
+		size = 8;
+		break;
+	case TDH_INTYPE_GUID:
+	case TDH_INTYPE_SYSTEMTIME:
+		size = 16;
+		break;
+	case TDH_INTYPE_POINTER:
+		size = pointerSize;
+		break;
+	case TDH_INTYPE_BINARY:
+		return prop.length;
+	default:
+		return 0;
 	}
-
-	if(TdhGetProperty(pEvent, 0, nullptr, 1, &dataDesc, sizeof(T), (PBYTE)&r) != ERROR_SUCCESS)
-		__debugbreak();
-	return r;
+	return size * count;
 }
 
-wstring GetPropertyString(PEVENT_RECORD pEvent, const wchar_t* nameOffset)
+// Resolves where each schema field lives in this version of the event, and checks its type matches
+static void ResolveEventLayout(PEVENT_RECORD pEvent, const EventField* fields, int fieldCount, EventLayout& layout)
 {
-	wstring					 r;
-	PROPERTY_DATA_DESCRIPTOR dataDesc = {};
-	dataDesc.PropertyName			  = (ULONGLONG)nameOffset;
-	dataDesc.ArrayIndex				  = ULONG_MAX;
-	DWORD propSize					  = 0;
-	if(TdhGetPropertySize(pEvent, 0, nullptr, 1, &dataDesc, &propSize) == ERROR_SUCCESS && propSize > 0)
+	layout.state   = EventLayout::INVALID;
+	layout.minSize = 0;
+	USHORT pointerSize = (pEvent->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) ? 4 : 8;
+	const EVENT_DESCRIPTOR& desc = pEvent->EventHeader.EventDescriptor;
+
+	PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
+	if(!pInfo)
 	{
-		wchar_t* buffer = (wchar_t*)malloc(propSize);
-		if(buffer && TdhGetProperty(pEvent, 0, nullptr, 1, &dataDesc, propSize, (PBYTE)buffer) == ERROR_SUCCESS)
-		{
-			wstring imageName = buffer;
-			free(buffer);
-			return imageName;
-		}
-		free(buffer);
-		__debugbreak();
+		fprintf(g_LogFile, "No schema for event %d version %d\n", desc.Id, desc.Version);
+		fflush(g_LogFile);
+		return;
 	}
-	__debugbreak();
-	return L"";
-}
 
-const wchar_t* GetPropertyOffset(PTRACE_EVENT_INFO pInfo, const wchar_t* searchPropName)
-{
-	for(DWORD i = 0; i < pInfo->TopLevelPropertyCount; i++)
+	int	   found	 = 0;
+	USHORT offset	 = 0;
+	bool   offsetKnown = true;
+	for(DWORD i = 0; i < pInfo->TopLevelPropertyCount && offsetKnown; i++)
 	{
-		wchar_t* propName = (wchar_t*)((PBYTE)pInfo + pInfo->EventPropertyInfoArray[i].NameOffset);
-		if(_wcsicmp(propName, searchPropName) == 0)
+		const EVENT_PROPERTY_INFO& prop		= pInfo->EventPropertyInfoArray[i];
+		const wchar_t*			   propName = (const wchar_t*)((PBYTE)pInfo + prop.NameOffset);
+		USHORT					   size		= GetPropertyFixedSize(prop, pointerSize);
+		for(int f = 0; f < fieldCount; ++f)
 		{
-			return propName;
+			if(_wcsicmp(propName, fields[f].name) != 0)
+				continue;
+			bool ok;
+			if(fields[f].type == FIELD_UNICODESTRING)
+				ok = prop.nonStructType.InType == TDH_INTYPE_UNICODESTRING && size == 0;
+			else if(fields[f].type == FIELD_POINTER)
+				ok = size == pointerSize;
+			else
+				ok = size == fields[f].size;
+			if(!ok)
+			{
+				fprintf(g_LogFile, "Event %d version %d: field %ls has an unexpected type\n", desc.Id, desc.Version, propName);
+				fflush(g_LogFile);
+				free(pInfo);
+				return;
+			}
+			layout.offsets[f] = offset;
+			layout.sizes[f]	  = (UCHAR)(size ? size : sizeof(wchar_t));
+			if(offset + layout.sizes[f] > layout.minSize)
+				layout.minSize = offset + layout.sizes[f];
+			found++;
 		}
+		offsetKnown = size != 0;
+		offset += size;
 	}
-	return 0;
-}
+	free(pInfo);
 
-bool ProcessCheckTracked(const wstring& path)
-{
-	for(const wstring& tracked : g_trackedProcesses)
+	if(found != fieldCount)
 	{
-		if(std::wcsstr(path.c_str(), tracked.c_str()))
-			return true;
+		fprintf(g_LogFile, "Event %d version %d: %d of %d fields could not be resolved\n", desc.Id, desc.Version, fieldCount - found, fieldCount);
+		fflush(g_LogFile);
+		return;
 	}
-	return false;
-}
-
-void OnProcessCreate(wstring imageName, DWORD processId, bool isRundown)
-{
-	(void)isRundown;
-	std::wstring fileName  = GetFileName(imageName);
-	Process*	 process   = FindProcess(processId);
-	process->imageFilename = fileName;
-	process->imagePath	   = imageName;
-	process->isTracked	   = ProcessCheckTracked(imageName);
-}
-void OnProcessStop(DWORD pid)
-{
-	Process* process = FindProcess(pid);
-	FreeProcess(process);
-	FreeProcessMemory(pid);
+	layout.state = EventLayout::VALID;
 }
 
-void HandleProcessStart(PEVENT_RECORD pEvent)
-{
-	static PTRACE_EVENT_INFO pInfo		   = ExtractEventInformation(pEvent);
-	static const wchar_t*	 propProcessId = GetPropertyOffset(pInfo, L"ProcessID");
-	static const wchar_t*	 propImageName = GetPropertyOffset(pInfo, L"ImageName");
-	DWORD					 pid		   = GetProperty<DWORD>(pEvent, propProcessId);
-	wstring					 imageName	   = GetPropertyString(pEvent, propImageName);
-	OnProcessCreate(imageName, pid, false);
-}
-void HandleProcessRundown(PEVENT_RECORD pEvent)
-{
-	static PTRACE_EVENT_INFO pInfo		   = ExtractEventInformation(pEvent);
-	static const wchar_t*	 propProcessId = GetPropertyOffset(pInfo, L"ProcessID");
-	static const wchar_t*	 propImageName = GetPropertyOffset(pInfo, L"ImageName");
-	DWORD					 pid		   = GetProperty<DWORD>(pEvent, propProcessId);
-	wstring					 imageName	   = GetPropertyString(pEvent, propImageName);
-	OnProcessCreate(imageName, pid, true);
-}
-void HandleProcessStop(PEVENT_RECORD pEvent)
+template <typename T, int Field>
+inline void DecodeEventField(const BYTE* data, USHORT dataSize, const EventLayout& layout, T& out)
 {
-	static PTRACE_EVENT_INFO pInfo		   = ExtractEventInformation(pEvent);
-	static const wchar_t*	 propProcessId = GetPropertyOffset(pInfo, L"ProcessID");
-	DWORD					 pid		   = GetProperty<DWORD>(pEvent, propProcessId);
-	OnProcessStop(pid);
-}
-
-void HandleProcessEvent(PEVENT_RECORD pEvent)
-{
-	USHORT eventId = pEvent->EventHeader.EventDescriptor.Id;
-
-	switch(eventId)
+	const EventField& field = T::Fields()[Field];
+	BYTE*			  dest	= (BYTE*)&out + field.offset;
+	const BYTE*		  src	= data + layout.offsets[Field];
+	if(field.type == FIELD_UNICODESTRING)
+	{
+		// make sure the string is terminated inside the event
+		const wchar_t* str	  = (const wchar_t*)src;
+		size_t		   maxLen = (dataSize - layout.offsets[Field]) / sizeof(wchar_t);
+		const wchar_t* value  = wcsnlen(str, maxLen) < maxLen ? str : L"";
+		memcpy(dest, &value, sizeof(value));
+	}
+	else if(layout.sizes[Field] == field.size)
 	{
-	case ProcessStart:
-		HandleProcessStart(pEvent);
-		break;
-	case ProcessRundown:
-		HandleProcessRundown(pEvent);
-		break;
-	case ProcessStop:
-		HandleProcessStop(pEvent);
-		break;
+		memcpy(dest, src, field.size);
 	}
-}
-
-void HandleVidMmProcessBudgetChange(PEVENT_RECORD pEvent)
-{
-
-	static PTRACE_EVENT_INFO pInfo					  = ExtractEventInformation(pEvent);
-	static const wchar_t*	 propNewBudget			  = GetPropertyOffset(pInfo, L"NewBudget");
-	static const wchar_t*	 propOldBudget			  = GetPropertyOffset(pInfo, L"OldBudget");
-	static const wchar_t*	 proppDxgAdapter		  = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t*	 propProcessId			  = GetPropertyOffset(pInfo, L"ProcessId");
-	static const wchar_t*	 propPhysicalAdapterIndex = GetPropertyOffset(pInfo, L"PhysicalAdapterIndex");
-	static const wchar_t*	 propNewPriorityBand	  = GetPropertyOffset(pInfo, L"NewPriorityBand");
-	static const wchar_t*	 propOldPriorityBand	  = GetPropertyOffset(pInfo, L"OldPriorityBand");
-	static const wchar_t*	 propNewVisibilityState	  = GetPropertyOffset(pInfo, L"NewVisibilityState");
-	static const wchar_t*	 propOldVisibilityState	  = GetPropertyOffset(pInfo, L"OldVisibilityState");
-	static const wchar_t*	 propMemorySegmentGroup	  = GetPropertyOffset(pInfo, L"MemorySegmentGroup");
-
-	UINT64 NewBudget			= GetProperty<UINT64>(pEvent, propNewBudget);
-	UINT64 OldBudget			= GetProperty<UINT64>(pEvent, propOldBudget);
-	void*  pDxgAdapter			= GetProperty<void*>(pEvent, proppDxgAdapter);
-	UINT32 ProcessId			= GetProperty<UINT32>(pEvent, propProcessId);
-	UINT16 PhysicalAdapterIndex = GetProperty<UINT16>(pEvent, propPhysicalAdapterIndex);
-	UINT8  NewPriorityBand		= GetProperty<UINT8>(pEvent, propNewPriorityBand);
-	UINT8  OldPriorityBand		= GetProperty<UINT8>(pEvent, propOldPriorityBand);
-	UINT8  NewVisibilityState	= GetProperty<UINT8>(pEvent, propNewVisibilityState);
-	UINT8  OldVisibilityState	= GetProperty<UINT8>(pEvent, propOldVisibilityState);
-	UINT8  MemorySegmentGroup	= GetProperty<UINT8>(pEvent, propMemorySegmentGroup);
-}
-
-void HandleVidMmProcessUsageChange(PEVENT_RECORD pEvent)
-{
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* propNewUsage			   = GetPropertyOffset(pInfo, L"NewUsage");
-	static const wchar_t* propOldUsage			   = GetPropertyOffset(pInfo, L"OldUsage");
-	static const wchar_t* proppDxgAdapter		   = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propProcessId			   = GetPropertyOffset(pInfo, L"ProcessId");
-	static const wchar_t* propPhysicalAdapterIndex = GetPropertyOffset(pInfo, L"PhysicalAdapterIndex");
-	static const wchar_t* propMemorySegmentGroup   = GetPropertyOffset(pInfo, L"MemorySegmentGroup");
-
-	UINT64 NewUsage				= GetProperty<UINT64>(pEvent, propNewUsage);
-	UINT64 OldUsage				= GetProperty<UINT64>(pEvent, propOldUsage);
-	void*  pDxgAdapter			= GetProperty<void*>(pEvent, proppDxgAdapter);
-	UINT32 ProcessId			= GetProperty<UINT32>(pEvent, propProcessId);
-	UINT16 PhysicalAdapterIndex = GetProperty<UINT16>(pEvent, propPhysicalAdapterIndex);
-	UINT8  MemorySegmentGroup	= GetProperty<UINT8>(pEvent, propMemorySegmentGroup);
-
-	ProcessMemory* memory = FindProcessMemory(ProcessId, pDxgAdapter);
-	if(MemorySegmentGroup)
-		memory->UsageNonLocal = NewUsage;
 	else
-		memory->UsageLocal = NewUsage;
-}
-
-void HandleVidMmProcessDemotedCommitmentChange(PEVENT_RECORD pEvent)
-{
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* propCommitment		   = GetPropertyOffset(pInfo, L"Commitment");
-	static const wchar_t* propOldCommitment		   = GetPropertyOffset(pInfo, L"OldCommitment");
-	static const wchar_t* proppDxgAdapter		   = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propProcessId			   = GetPropertyOffset(pInfo, L"ProcessId");
-	static const wchar_t* propPhysicalAdapterIndex = GetPropertyOffset(pInfo, L"PhysicalAdapterIndex");
-	static const wchar_t* propPriorityClass		   = GetPropertyOffset(pInfo, L"PriorityClass");
-
-	UINT64 Commitment			= GetProperty<UINT64>(pEvent, propCommitment);
-	UINT64 OldCommitment		= GetProperty<UINT64>(pEvent, propOldCommitment);
-	void*  pDxgAdapter			= GetProperty<void*>(pEvent, proppDxgAdapter);
-	UINT32 ProcessId			= GetProperty<UINT32>(pEvent, propProcessId);
-	UINT16 PhysicalAdapterIndex = GetProperty<UINT16>(pEvent, propPhysicalAdapterIndex);
-	UINT8  PriorityClass		= GetProperty<UINT8>(pEvent, propPriorityClass);
-
-	int			   prio				= PRIO_MAX < PriorityClass ? PRIO_MAX : PriorityClass;
-	ProcessMemory* memory			= FindProcessMemory(ProcessId, pDxgAdapter);
-	memory->CommitmentDemoted[prio] = Commitment;
-
-	if(g_verbose)
 	{
-		fprintf(g_LogFile, "DEM %lld <- %lld %p, %d. %d %d\n", Commitment, OldCommitment, pDxgAdapter, ProcessId, PhysicalAdapterIndex, PriorityClass);
-		fflush(g_LogFile);
+		memset(dest, 0, field.size);
+		memcpy(dest, src, layout.sizes[Field] < field.size ? layout.sizes[Field] : field.size);
 	}
 }
 
-void HandleVidMmProcessCommitmentChange(PEVENT_RECORD pEvent)
+template <typename T, int... Fields>
+inline void DecodeEventFields(const BYTE* data, USHORT dataSize, const EventLayout& layout, T& out, std::integer_sequence<int, Fields...>)
 {
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* propCommitment		   = GetPropertyOffset(pInfo, L"Commitment");
-	static const wchar_t* propOldCommitment		   = GetPropertyOffset(pInfo, L"OldCommitment");
-	static const wchar_t* proppDxgAdapter		   = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propProcessId			   = GetPropertyOffset(pInfo, L"ProcessId");
-	static const wchar_t* propPhysicalAdapterIndex = GetPropertyOffset(pInfo, L"PhysicalAdapterIndex");
-	static const wchar_t* propMemorySegmentGroup   = GetPropertyOffset(pInfo, L"MemorySegmentGroup");
-
-	UINT64 Commitment			= GetProperty<UINT64>(pEvent, propCommitment);
-	UINT64 OldCommitment		= GetProperty<UINT64>(pEvent, propOldCommitment);
-	void*  pDxgAdapter			= GetProperty<void*>(pEvent, proppDxgAdapter);
-	UINT32 ProcessId			= GetProperty<UINT32>(pEvent, propProcessId);
-	UINT16 PhysicalAdapterIndex = GetProperty<UINT16>(pEvent, propPhysicalAdapterIndex);
-	UINT8  MemorySegmentGroup	= GetProperty<UINT8>(pEvent, propMemorySegmentGroup);
-
-	ProcessMemory* memory = FindProcessMemory(ProcessId, pDxgAdapter);
-	if(MemorySegmentGroup)
-		memory->CommitmentNonLocal = Commitment;
-	else
-		memory->CommitmentLocal = Commitment;
+	(DecodeEventField<T, Fields>(data, dataSize, layout, out), ...);
 }
 
-void HandleReportSegment(PEVENT_RECORD pEvent)
+template <typename T>
+bool DecodeEvent(PEVENT_RECORD pEvent, T& out)
 {
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* propulSegmentId			 = GetPropertyOffset(pInfo, L"ulSegmentId");
-	static const wchar_t* proppDxgAdapter			 = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propBaseAddress			 = GetPropertyOffset(pInfo, L"BaseAddress");
-	static const wchar_t* propCpuTranslatedAddress	 = GetPropertyOffset(pInfo, L"CpuTranslatedAddress");
-	static const wchar_t* propSize					 = GetPropertyOffset(pInfo, L"Size");
-	static const wchar_t* propNbOfBanks				 = GetPropertyOffset(pInfo, L"NbOfBanks");
-	static const wchar_t* propFlags					 = GetPropertyOffset(pInfo, L"Flags");
-	static const wchar_t* propCommitLimit			 = GetPropertyOffset(pInfo, L"CommitLimit");
-	static const wchar_t* propSystemMemoryEndAddress = GetPropertyOffset(pInfo, L"SystemMemoryEndAddress");
-	static const wchar_t* propMemorySegmentGroup	 = GetPropertyOffset(pInfo, L"MemorySegmentGroup");
-
-	UINT32 ulSegmentId			  = GetProperty<UINT32>(pEvent, propulSegmentId);
-	LPVOID pDxgAdapter			  = GetProperty<LPVOID>(pEvent, proppDxgAdapter);
-	UINT64 BaseAddress			  = GetProperty<UINT64>(pEvent, propBaseAddress);
-	UINT64 CpuTranslatedAddress	  = GetProperty<UINT64>(pEvent, propCpuTranslatedAddress);
-	UINT64 Size					  = GetProperty<UINT64>(pEvent, propSize);
-	UINT32 NbOfBanks			  = GetProperty<UINT32>(pEvent, propNbOfBanks);
-	UINT32 Flags				  = GetProperty<UINT32>(pEvent, propFlags);
-	UINT64 CommitLimit			  = GetProperty<UINT64>(pEvent, propCommitLimit);
-	LPVOID SystemMemoryEndAddress = GetProperty<LPVOID>(pEvent, propSystemMemoryEndAddress);
-	UINT8  MemorySegmentGroup	  = GetProperty<UINT8>(pEvent, propMemorySegmentGroup);
-
-	typedef enum _D3DKMT_MEMORY_SEGMENT_GROUP
+	static_assert(T::FieldCount <= MAX_EVENT_FIELDS);
+	static EventLayout layouts[MAX_EVENT_VERSIONS];
+	static bool		   versionLogged = false;
+	UCHAR			   version		 = pEvent->EventHeader.EventDescriptor.Version;
+	if(version >= MAX_EVENT_VERSIONS)
 	{
-		D3DKMT_MEMORY_SEGMENT_GROUP_LOCAL,
-		D3DKMT_MEMORY_SEGMENT_GROUP_NON_LOCAL
-	} D3DKMT_MEMORY_SEGMENT_GROUP;
-
-	Adapter* adapter = FindAdapter(pDxgAdapter);
-	if(MemorySegmentGroup == D3DKMT_MEMORY_SEGMENT_GROUP_LOCAL)
-		adapter->SegmentLocalMemory[ulSegmentId % MAX_SEGMENTS] = Size;
-	else
-		adapter->SegmentLocalMemory[ulSegmentId % MAX_SEGMENTS] = 0;
-	UINT64 Local = 0;
-	for(UINT64 Memory : adapter->SegmentLocalMemory)
-	{
-		Local += Memory;
+		if(!versionLogged)
+		{
+			versionLogged = true;
+			fprintf(g_LogFile, "Event %d version %d: versions from %d on are not decoded\n", pEvent->EventHeader.EventDescriptor.Id, version, MAX_EVENT_VERSIONS);
+			fflush(g_LogFile);
+		}
+		return false;
 	}
-	adapter->LocalMemory = Local;
-
-	fprintf(g_LogFile,
-			"Adapter Segment %ls/%d: %6.fMB / %s\n",
-			adapter->name.c_str(),
-			ulSegmentId,
-			Size / (1024.f * 1024.f),
-			MemorySegmentGroup == D3DKMT_MEMORY_SEGMENT_GROUP_LOCAL ? "Local" : "NonLocal");
-	fflush(g_LogFile);
+	EventLayout& layout = layouts[version];
+	if(layout.state == EventLayout::UNRESOLVED)
+		ResolveEventLayout(pEvent, T::Fields(), T::FieldCount, layout);
+	if(layout.state != EventLayout::VALID || pEvent->UserDataLength < layout.minSize)
+		return false;
+	DecodeEventFields(
+		(const BYTE*)pEvent->UserData, pEvent->UserDataLength, layout, out, std::make_integer_sequence<int, T::FieldCount>());
+	return true;
 }
 
-void HandleAdapterStart(PEVENT_RECORD pEvent)
+void HandleDpiReportAdapter(const DpiReportAdapterEvent& e)
 {
-
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* propulSegmentId				 = GetPropertyOffset(pInfo, L"ulSegmentId");
-	static const wchar_t* proppDxgAdapter				 = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propApertureSegmentCommitLimit = GetPropertyOffset(pInfo, L"ApertureSegmentCommitLimit");
-
-	LPVOID pDxgAdapter				  = GetProperty<LPVOID>(pEvent, proppDxgAdapter);
-	UINT64 ApertureSegmentCommitLimit = GetProperty<UINT64>(pEvent, propApertureSegmentCommitLimit);
-}
-void HandleDpiReportAdapter(PEVENT_RECORD pEvent)
-{
-	static PTRACE_EVENT_INFO pInfo = ExtractEventInformation(pEvent);
-
-	static const wchar_t* proppDxgAdapter = GetPropertyOffset(pInfo, L"pDxgAdapter");
-	static const wchar_t* propAdapterLuid = GetPropertyOffset(pInfo, L"AdapterLuid");
-
-	LPVOID		   pDxgAdapter = GetProperty<LPVOID>(pEvent, proppDxgAdapter);
-	UINT64		   Luid		   = GetProperty<UINT64>(pEvent, propAdapterLuid);
 	IDXGIFactory4* pFactory;
 	CreateDXGIFactory2(0, __uuidof(IDXGIFactory4), (void**)&pFactory);
 	LUID luid;
-	memcpy(&luid, &Luid, sizeof(luid));
+	memcpy(&luid, &e.AdapterLuid, sizeof(luid));
 	IDXGIAdapter1* pAdapter;
 
 	pFactory->EnumAdapterByLuid(luid, __uuidof(IDXGIAdapter1), (void**)&pAdapter);
@@ -753,71 +424,109 @@ void HandleDpiReportAdapter(PEVENT_RECORD pEvent)
 	DXGI_ADAPTER_DESC1 desc;
 	pAdapter->GetDesc1(&desc);
 
-	Adapter* adapter = FindAdapter(pDxgAdapter);
+	Adapter* adapter = FindAdapter(e.pDxgAdapter);
 	adapter->name	 = desc.Description;
 
 	pFactory->Release();
 	pAdapter->Release();
 }
 
-void HandleDxgKrnlEvent(PEVENT_RECORD pEvent)
+// Dispatch tables indexed by event id, filled in by RegisterEventHandlers
+#define MAX_EVENT_ID 512
+typedef void (*EventHandler)(PEVENT_RECORD pEvent);
+static EventHandler g_processHandlers[MAX_EVENT_ID];
+static EventHandler g_dxgKrnlHandlers[MAX_EVENT_ID];
+
+// Queued handlers run without the lock and queue their updates
+template <typename T, void (*Handler)(const T&)>
+void DispatchQueuedEvent(PEVENT_RECORD pEvent)
 {
-	USHORT eventId = pEvent->EventHeader.EventDescriptor.Id;
+	T e;
+	if(DecodeEvent(pEvent, e))
+	{
+		RecordEvent(e, pEvent->EventHeader.TimeStamp.QuadPart);
+		Handler(e);
+	}
+}
 
-	switch(eventId)
+template <typename T, void (*Handler)(const T&)>
+void DispatchEvent(PEVENT_RECORD pEvent)
+{
+	T e;
+	if(DecodeEvent(pEvent, e))
 	{
-	case VidMmProcessBudgetChange:
-		HandleVidMmProcessBudgetChange(pEvent);
-		break;
-	case VidMmProcessUsageChange:
-		HandleVidMmProcessUsageChange(pEvent);
-		break;
-	case VidMmProcessDemotedCommitmentChange:
-		HandleVidMmProcessDemotedCommitmentChange(pEvent);
-		break;
-	case VidMmProcessCommitmentChange:
-		HandleVidMmProcessCommitmentChange(pEvent);
-		break;
-	case ReportSegment_Info:
-		HandleReportSegment(pEvent);
-		break;
-	case Adapter_Start:
-	case Adapter_DCStart:
-		HandleAdapterStart(pEvent);
-		break;
-	case DpiReportAdapter_Info:
-		HandleDpiReportAdapter(pEvent);
-		break;
-	default:
-		break;
+		RecordEvent(e, pEvent->EventHeader.TimeStamp.QuadPart);
+		RunLockedHandler<T, Handler>(e, pEvent->EventHeader.TimeStamp.QuadPart);
 	}
 }
 
+template <typename T, void (*Handler)(const T&), bool Queued = false>
+void RegisterEventHandler()
+{
+	static_assert(T::Id < MAX_EVENT_ID);
+	EventHandler* table = IsEqualGUID(T::Provider(), DxgKrnlGuid) ? g_dxgKrnlHandlers : g_processHandlers;
+	table[T::Id]		= Queued ? DispatchQueuedEvent<T, Handler> : DispatchEvent<T, Handler>;
+}
+
+void RegisterEventHandlers()
+{
+	RegisterEventHandler<ProcessStartEvent, HandleProcessStart>();
+	RegisterEventHandler<ProcessRundownEvent, HandleProcessRundown>();
+	RegisterEventHandler<ProcessStopEvent, HandleProcessStop>();
+
+	RegisterEventHandler<VidMmProcessBudgetChangeEvent, HandleVidMmProcessBudgetChange>();
+	RegisterEventHandler<VidMmProcessUsageChangeEvent, HandleVidMmProcessUsageChange, true>();
+	RegisterEventHandler<VidMmProcessDemotedCommitmentChangeEvent, HandleVidMmProcessDemotedCommitmentChange, true>();
+	RegisterEventHandler<VidMmProcessCommitmentChangeEvent, HandleVidMmProcessCommitmentChange, true>();
+	RegisterEventHandler<ReportSegmentEvent, HandleReportSegment>();
+	RegisterEventHandler<DpiReportAdapterEvent, HandleDpiReportAdapter>();
+	if(!g_deviceEvents)
+		return;
+	RegisterEventHandler<DeviceAllocationStartEvent, HandleDeviceAllocationStart>();
+	RegisterEventHandler<DeviceAllocationStopEvent, HandleDeviceAllocationStop>();
+	RegisterEventHandler<DeviceAllocationDCStartEvent, HandleDeviceAllocationRundown>();
+	RegisterEventHandler<ProcessAllocationDetailsStartEvent, HandleProcessAllocationDetailsStart>();
+	RegisterEventHandler<ProcessAllocationDetailsStopEvent, HandleProcessAllocationDetailsStop>();
+}
+
+void HandleProcessEvent(PEVENT_RECORD pEvent)
+{
+	USHORT eventId = pEvent->EventHeader.EventDescriptor.Id;
+	if(eventId < MAX_EVENT_ID && g_processHandlers[eventId])
+		g_processHandlers[eventId](pEvent);
+}
+
+void HandleDxgKrnlEvent(PEVENT_RECORD pEvent)
+{
+	USHORT eventId = pEvent->EventHeader.EventDescriptor.Id;
+	if(eventId < MAX_EVENT_ID && g_dxgKrnlHandlers[eventId])
+		g_dxgKrnlHandlers[eventId](pEvent);
+}
+
 void WINAPI EventRecordCallback(PEVENT_RECORD pEvent)
 {
-	g_traceStarted.store(true, std::memory_order_release);
+	if(!g_traceStarted.load(std::memory_order_relaxed) && !g_traceStarted.exchange(true))
+		SetEvent(g_hTraceStartedEvent);
 	if(!pEvent)
 		return;
 
-	EnterCriticalSection(&g_critSec);
-	struct exitDummy
-	{
-		~exitDummy()
-		{
-			LeaveCriticalSection(&g_critSec);
-		}
-	} foo;
-
-	if(IsEqualGUID(pEvent->EventHeader.ProviderId, KernelProcessGuid))
+	t_eventTime = pEvent->EventHeader.TimeStamp.QuadPart;
+	if(IsEqualGUID(pEvent->EventHeader.ProviderId, DxgKrnlGuid))
 	{
-		HandleProcessEvent(pEvent);
+		HandleDxgKrnlEvent(pEvent);
 	}
-	else if(IsEqualGUID(pEvent->EventHeader.ProviderId, DxgKrnlGuid))
+	else if(IsEqualGUID(pEvent->EventHeader.ProviderId, KernelProcessGuid))
 	{
-		HandleDxgKrnlEvent(pEvent);
+		HandleProcessEvent(pEvent);
 	}
 }
 
+ULONG WINAPI BufferCallback(PEVENT_TRACE_LOGFILEW)
+{
+	FlushMemoryUpdates(t_batch);
+	return TRUE;
+}
+
 void StopTraceSession()
 {
 	if(g_traceHandle != INVALID_PROCESSTRACE_HANDLE)
@@ -905,128 +614,30 @@ void GetConsoleSize(int& width, int& height)
 	}
 }
 
-void FormatMemory(SIZE_T bytes, char* buffer, size_t bufSize)
+static void SignalRedraw()
 {
-	double	   b	 = (double)bytes;
-	int		   x	 = 0;
-	for(int i = 0; i < g_minSize; ++i)
-	{
-		b /= 1024.f;
-		x++;
-	}
-	const char ext[] = { ' ', 'K', 'M', 'G', 'T' };
-
-	while(b > 1024 && x + 1 < _countof(ext))
-	{
-		b /= 1024.f;
-		x++;
-	}
-	sprintf_s(buffer, bufSize, "%6.1f %cB", b, ext[x]);
-}
-
-static void NextLine()
-{
-	g_currentX = 0;
-	g_currentY++;
-}
-
-static void Put(char c)
-{
-	if(g_currentX < g_consoleWidth)
-	{
-		int idx = g_currentY * g_consoleWidth + g_currentX;
-		if(idx < g_chars.size())
-		{
-			g_chars.at(idx).Char.AsciiChar = c;
-			g_chars.at(idx).Attributes	   = (WORD)g_currentColor;
-		}
-		g_currentX += 1;
-	}
+	SetEvent(g_hRedrawEvent);
 }
 
-template <typename... Args>
-static void PutFormat(const char* fmt, Args&&... args) /// wtf is going on with c++
+static INT64 QpcNow()
 {
-	char buffer[512];
-	int	 r = std::snprintf(buffer, sizeof(buffer), fmt, std::forward<decltype(args)>(args)...);
-	if(r > 0)
-	{
-		int base = g_currentY * g_consoleWidth;
-		int i	 = 0;
-		while(i < r && g_currentX < g_consoleWidth)
-		{
-			int idx = base + g_currentX;
-			if(idx < g_chars.size())
-			{
-				g_chars.at(idx).Char.AsciiChar = buffer[i];
-				g_chars.at(idx).Attributes	   = (WORD)g_currentColor;
-			}
-			g_currentX += 1;
-			i++;
-		}
-	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
 }
 
-void DrawMemoryBar(const ProcessMemory* process, SIZE_T maxMemoryBytes, int barWidth)
+// Periodic work that no event triggers. Returns true if the screen needs a redraw.
+bool ConsoleTick()
 {
-	SIZE_T usage	   = process->UsageLocal;
-	double barBytes	   = (double)maxMemoryBytes / (double)barWidth;
-	double rcpBarBytes = (double)barWidth / (double)maxMemoryBytes;
-
-	int filledBars = (int)(usage / barBytes);
-	if(filledBars > barWidth)
-		filledBars = barWidth;
-	if(usage > 0 && filledBars == 0)
-		filledBars = 1;
-
-	double floatBarPos = 0;
-	int	   barPut	   = 0;
-	int	   idx		   = 0;
-	int	   bars[PRIO_COUNT];
-	for(int i = PRIO_COUNT - 1; i >= 0; --i)
-	{
-		UINT64 dem = process->CommitmentDemoted[i];
-		if(!dem)
-			bars[i] = 0;
-		else
-		{
-			double newFloatBarPos = floatBarPos + (dem * rcpBarBytes);
-			int	   c			  = (int)ceil(newFloatBarPos);
-			bars[i]				  = c - barPut;
-			if(bars[i])
-				barPut = c;
-			floatBarPos = newFloatBarPos;
-		}
-	}
-	int tail	   = barWidth - filledBars;
-	int baseBars   = filledBars - barPut;
-	g_currentColor = WHITE;
-	Put('[');
-	g_currentColor = (GREEN);
-	for(int i = 0; i < baseBars; i++)
-		Put('#');
-
-	for(int i = 0; i < PRIO_COUNT; ++i)
-	{
-		int count = bars[i];
-		if(count)
-		{
-			g_currentColor = (g_PrioTocolor[i + 1]);
-			for(int j = 0; j < count; ++j)
-			{
-				Put('#');
-			}
-		}
-	}
-
-	for(int i = 0; i < tail; i++)
-	{
-		g_currentColor = (DARK_GRAY);
-		Put('-');
-	}
-
-	g_currentColor = (WHITE);
-	Put(']');
+	EnterCriticalSection(&g_critSec);
+	int alertsActive = g_alertsActive;
+	AlertTick();
+	bool changed = alertsActive != g_alertsActive;
+	LeaveCriticalSection(&g_critSec);
+
+	int width, height;
+	GetConsoleSize(width, height);
+	return changed || width != g_lastWidth || height != g_lastHeight;
 }
 
 void ConsoleUpdate()
@@ -1040,34 +651,7 @@ void ConsoleUpdate()
 		}
 	} foo;
 
-	static std::vector<ProcessMemory*> processes;
-	static std::vector<PVOID>		   adapters;
-
-	processes.clear();
-	adapters.clear();
-
-	UINT64 maxUsage = 1;
-	for(auto& pair : g_processMemory)
-	{
-		ProcessMemory& mem	   = (pair).second;
-		PVOID		   adapter = pair.first.pDxgAdapter;
-		mem.pid				   = pair.first.pid;
-		mem.pDxgAdapter		   = adapter;
-		processes.push_back(&mem);
-		maxUsage = mem.UsageLocal > maxUsage ? mem.UsageLocal : maxUsage;
-	}
-	std::sort(processes.begin(),
-			  processes.end(),
-			  [](const ProcessMemory* a, const ProcessMemory* b)
-
-			  {
-				  bool aTracked = a->isTracked;
-				  bool bTracked = b->isTracked;
-				  if(aTracked == bTracked)
-					  return a->UsageLocal > b->UsageLocal;
-				  else
-					  return (aTracked > bTracked);
-			  });
+	INT64 dirtyTime = g_dirtyTime.exchange(0);
 
 	GetConsoleSize(g_consoleWidth, g_consoleHeight);
 
@@ -1078,220 +662,25 @@ void ConsoleUpdate()
 		g_lastHeight = g_consoleHeight;
 	}
 
-	const int HEADER_LINES = 4;
-	int		  maxProcesses = g_consoleHeight - HEADER_LINES;
-	if(maxProcesses < 1)
-		maxProcesses = 1;
-
-	int displayCount = std::min(maxProcesses, (int)processes.size());
-
-	for(int i = 0; i < displayCount; i++)
-	{
-		PVOID adapter = processes[i]->pDxgAdapter;
-		if(adapters.end() == std::find(adapters.begin(), adapters.end(), adapter))
-			adapters.push_back(adapter);
-	}
-
-	int nameWidth	= 25;
-	int memoryWidth = 10;
-
-	if(g_consoleWidth < 60)
-	{
-		nameWidth = 15;
-	}
-
-	bool showDetailed = false;
-
-	int fixedWidth		= nameWidth + 3 * (1 + memoryWidth) - 1;
-	int fixedWidthAll	= nameWidth + (3 + 4) * (1 + memoryWidth) - 1;
-	g_detailedAvailable = fixedWidthAll + 15 < g_consoleWidth;
-	if(g_detailedAvailable && g_detailedMode)
-	{
-		showDetailed = true;
-		fixedWidth	   = fixedWidthAll;
-	}
-
-	int barWidth = g_consoleWidth - fixedWidth;
-
-	if(barWidth < 10)
-		barWidth = 10;
-
-	int numProcesses = (int)processes.size();
-
-	g_currentX	   = 0;
-	g_currentY	   = 0;
-	g_currentColor = WHITE;
-
-	auto GetAdapterColor = [&](PVOID adapter)
-	{
-		for(int i = 0; i < adapters.size(); ++i)
-		{
-			if(adapters[i] == adapter)
-			{
-				return g_adapterToColor[i % g_numAdapterColors];
-			}
-		}
-		return (int)WHITE;
-	};
-
-	g_chars.resize(g_consoleWidth * g_consoleHeight);
-	for(CHAR_INFO& c : g_chars)
-	{
-		c.Char.AsciiChar = ' ';
-		c.Attributes	 = 0;
-	}
+	RenderFrame();
+	PublishSharedState();
+	SMALL_RECT r{ 0, 0, (SHORT)g_consoleWidth, (SHORT)g_consoleHeight };
+	WriteConsoleOutputA(g_hConsoleOutput, &g_chars[0], { (SHORT)g_consoleWidth, (SHORT)g_consoleHeight }, { 0, 0 }, &r);
 
-	int colorIndex = 0;
-	int pos		   = 0;
-	for(PVOID adapter : adapters)
-	{
-		g_currentColor = GetAdapterColor(adapter);
-		Adapter* a	   = FindAdapter(adapter);
-		PutFormat("[%ls (%.1fGB)] ", a->name.c_str(), a->LocalMemory / (1024.0 * 1024.0 * 1024.0));
-	}
-	NextLine();
-	auto WritePrios = []()
-	{
-		PutFormat("[");
-		for(int i = 0; i < 5; ++i)
-		{
-			g_currentColor = g_PrioTocolor[i + 1];
-			if(i != 4)
-				PutFormat("%s ", g_prioNames[i + 1]);
-			else
-			{
-				PutFormat("%s", g_prioNames[i + 1]);
-				g_currentColor = (CYAN);
-				Put(']');
-			}
-		}
-	};
+	// Event timestamps are raw QPC (ClientContext = 1 and PROCESS_TRACE_MODE_RAW_TIMESTAMP), so this covers ETW
+	// buffering, batching and drawing
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	if(dirtyTime)
+		g_frameLatency.Add((double)(now.QuadPart - dirtyTime) / g_qpcFrequency);
 
-	g_currentColor = CYAN;
-	PutFormat("%-*s  %*s  %*s  ", nameWidth, "Process Name", memoryWidth-1, "Usage", memoryWidth-1, "Commit");
-	PutFormat("%*s  ", memoryWidth-1, "Demoted");
-	if(showDetailed)
-	{
-		WritePrios();
-		int lim = g_consoleWidth - barWidth;
-		while(g_currentX++ < lim + 2)
-			;
-	}
-	g_currentColor = GREEN;
-	PutFormat("Present ");
-	g_currentColor = CYAN;
-	PutFormat("Demoted");
-	WritePrios();
-	NextLine();
-
-	g_currentColor = DARK_GRAY;
-	for(int i = 0; i < g_consoleWidth; i++)
-		Put('-');
-	NextLine();
-	for(int i = 0; i < maxProcesses; i++)
+	static bool firstFrame = true;
+	if(firstFrame)
 	{
-		if(i < displayCount)
-		{
-			const ProcessMemory* procMem = processes[i];
-			if(procMem->CommitmentLocal == 0 && procMem->UsageLocal == 0)
-				continue;
-			Process* proc = FindProcess(procMem->pid);
-			if(proc->imageFilename.length() == 0)
-			{
-				proc->imagePath		= GetProcessName(procMem->pid);
-				proc->imageFilename = GetFileName(proc->imagePath);
-				proc->isTracked		= ProcessCheckTracked(proc->imagePath);
-			}
-			char nameBuffer[64] = {};
-			if(proc->isTracked)
-			{
-				nameBuffer[0] = '*';
-				WideCharToMultiByte(CP_ACP, 0, proc->imageFilename.c_str(), -1, nameBuffer + 1, sizeof(nameBuffer) - 2, NULL, NULL);
-			}
-			else
-				WideCharToMultiByte(CP_ACP, 0, proc->imageFilename.c_str(), -1, nameBuffer, sizeof(nameBuffer) - 1, NULL, NULL);
-
-			// Truncate if needed
-			if((int)strlen(nameBuffer) > nameWidth - 1)
-			{
-				nameBuffer[nameWidth - 4] = '.';
-				nameBuffer[nameWidth - 3] = '.';
-				nameBuffer[nameWidth - 2] = '.';
-				nameBuffer[nameWidth - 1] = '\0';
-			}
-
-			g_currentColor = GetAdapterColor(procMem->pDxgAdapter);
-			PutFormat("%-*s", nameWidth, nameBuffer);
-
-			char memBuffer[32];
-			FormatMemory(procMem->UsageLocal, memBuffer, sizeof(memBuffer));
-			g_currentColor = CYAN;
-			PutFormat(" %*s", memoryWidth, memBuffer);
-
-			FormatMemory(procMem->CommitmentLocal, memBuffer, sizeof(memBuffer));
-			g_currentColor = CYAN;
-			PutFormat(" %*s", memoryWidth, memBuffer);
-
-			
-			if(showDetailed)
-			{
-				int idx = 0;
-				for(UINT64 dem : procMem->CommitmentDemoted)
-				{
-					FormatMemory(dem, memBuffer, sizeof(memBuffer));
-					if(dem)
-					{
-						g_currentColor = (g_PrioTocolor[idx + 1]);
-					}
-					else
-					{
-						g_currentColor = DARK_GRAY;
-					}
-					PutFormat(" %*s", memoryWidth, memBuffer);
-					idx++;
-				}
-			}
-			else
-			{
-				UINT64 DemotedSum	  = 0;
-				int	   prioColorIndex = 0;
-				int	   idx			  = 0;
-				for(UINT64 dem : procMem->CommitmentDemoted)
-				{
-					if(dem)
-						prioColorIndex = idx + 1;
-					DemotedSum += dem;
-					idx++;
-				}
-
-				FormatMemory(DemotedSum, memBuffer, sizeof(memBuffer));
-				g_currentColor = (g_PrioTocolor[prioColorIndex]);
-				PutFormat(" %*s", memoryWidth, memBuffer);
-			}
-			Put(' ');
-			DrawMemoryBar(procMem, maxUsage, barWidth - 5);
-			g_currentColor = (WHITE);
-		}
-
-		for(int j = g_currentX; j < g_consoleWidth; j++)
-			Put(' ');
-
-		NextLine();
+		firstFrame = false;
+		fprintf(g_LogFile, "First frame after %.1f ms\n", (now.QuadPart - g_startTime) * 1000.0 / g_qpcFrequency);
+		fflush(g_LogFile);
 	}
-	g_currentColor = (DARK_GRAY);
-	g_currentY	   = g_consoleHeight - 1;
-
-	PutFormat("Refreshing... [Esc:exit");
-	if(g_detailedAvailable)
-		PutFormat(" Space:detailed ");
-
-	PutFormat(" bmkg:bytes]");
-
-	for(int i = g_currentX; i < g_consoleWidth - 1; i++)
-		Put(' ');
-	SMALL_RECT r{ 0, 0, (SHORT)g_consoleWidth, (SHORT)g_consoleHeight };
-	WriteConsoleOutputA(g_hConsoleOutput, &g_chars[0], { (SHORT)g_consoleWidth, (SHORT)g_consoleHeight }, { 0, 0 }, &r);
-	g_currentColor = (WHITE);
 }
 
 void ParseCommandLine()
@@ -1306,24 +695,152 @@ void ParseCommandLine()
 			g_verbose = true;
 			break;
 		}
+		else if(lstrcmpiW(argv[i], L"--bench") == 0)
+		{
+			g_benchmark = true;
+		}
+		else if(lstrcmpiW(argv[i], L"--alert") == 0 && i + 1 < argc)
+		{
+			char rule[512];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, rule, sizeof(rule), NULL, NULL);
+			AddAlertRule(rule);
+		}
+		else if(lstrcmpiW(argv[i], L"--alerts") == 0 && i + 1 < argc)
+		{
+			LoadAlertRules(argv[++i]);
+		}
+		else if(lstrcmpiW(argv[i], L"--alert-cmd") == 0 && i + 1 < argc)
+		{
+			g_alertCommand = argv[++i];
+		}
+		else if(lstrcmpiW(argv[i], L"--max-fps") == 0 && i + 1 < argc)
+		{
+			g_maxFps = std::max(1, (int)wcstol(argv[++i], nullptr, 10));
+		}
+		else if(lstrcmpiW(argv[i], L"--record") == 0)
+		{
+			g_record = true;
+		}
+		else if(lstrcmpiW(argv[i], L"--record-seconds") == 0 && i + 1 < argc)
+		{
+			g_record		= true;
+			g_recordSeconds = std::max(1.0, wcstod(argv[++i], nullptr));
+		}
+		else if(lstrcmpiW(argv[i], L"--record-mb") == 0 && i + 1 < argc)
+		{
+			g_record		  = true;
+			g_recordMegabytes = std::max(1.0, wcstod(argv[++i], nullptr));
+		}
+		else if(lstrcmpiW(argv[i], L"--record-trigger") == 0 && i + 1 < argc)
+		{
+			char rule[512];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, rule, sizeof(rule), NULL, NULL);
+			g_record = true;
+			if(AddAlertRule(rule))
+				g_recordTriggers.push_back((int)g_alertRules.size() - 1);
+		}
+		else if(lstrcmpiW(argv[i], L"--fleet") == 0 && i + 1 < argc)
+		{
+			char address[256];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, address, sizeof(address), NULL, NULL);
+			g_fleetAddress = address;
+		}
+		else if(lstrcmpiW(argv[i], L"--summary") == 0 && i + 1 < argc)
+		{
+			char path[MAX_PATH];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, path, sizeof(path), NULL, NULL);
+			g_summaryPath = path;
+		}
+		else if(lstrcmpiW(argv[i], L"--limit") == 0 && i + 1 < argc)
+		{
+			char rule[512];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, rule, sizeof(rule), NULL, NULL);
+			AddMeasureLimit(rule);
+		}
+		else if(lstrcmpiW(argv[i], L"--launch") == 0 && i + 1 < argc)
+		{
+			// the rest of the command line is the command
+			while(++i < argc)
+			{
+				char arg[1024];
+				WideCharToMultiByte(CP_ACP, 0, argv[i], -1, arg, sizeof(arg), NULL, NULL);
+				g_launchCommand.push_back(arg);
+			}
+		}
+		else if(lstrcmpiW(argv[i], L"--no-shared-state") == 0)
+		{
+			g_sharedState = false;
+		}
+		else if(lstrcmpiW(argv[i], L"--devices") == 0)
+		{
+			g_deviceEvents = true;
+		}
 		else if(argv[i][0] != L'-')
 		{
 			g_trackedProcesses.push_back(argv[i]);
 		}
 	}
 }
+// Starts the measured command, tracked before it runs
+static bool StartLaunch()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	g_launchCpuSeconds = TrackerCpuSeconds();
+	EnterCriticalSection(&g_critSec);
+	StartMeasurement(now.QuadPart);
+	LeaveCriticalSection(&g_critSec);
+	return LaunchMeasured(g_launchCommand, g_measured);
+}
+
+// Writes the summary once the command exited, or when the tracker is stopped first, and sets the exit code:
+// 1 when a limit is exceeded, 2 if the command did not finish, the command's own otherwise
+static void FinishLaunch()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	EnterCriticalSection(&g_critSec);
+	INT64 start = g_measure.start;
+	FinishMeasurement(now.QuadPart);
+	LeaveCriticalSection(&g_critSec);
+
+	MeasureReport report;
+	for(const std::string& arg : g_launchCommand)
+		report.command += (report.command.size() ? " " : "") + arg;
+	report.exitCode			 = g_measured.exited ? g_measured.exitCode : -1;
+	report.seconds			 = (double)(now.QuadPart - start) / g_qpcFrequency;
+	report.trackerCpuSeconds = TrackerCpuSeconds() - g_launchCpuSeconds;
+	report.commandCpuSeconds = g_measured.cpuSeconds;
+	if(!WriteMeasureSummary(g_summaryPath.c_str(), report))
+		g_exitCode = 2;
+	else if(MeasureLimitsExceeded())
+		g_exitCode = 1;
+	else
+		g_exitCode = g_measured.exited ? g_measured.exitCode : 2;
+}
+
 int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 {
-	ParseCommandLine();
+	LARGE_INTEGER frequency, start;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+	g_qpcFrequency = frequency.QuadPart;
+	g_startTime	   = start.QuadPart;
+
 	fopen_s(&g_LogFile, "demote_tracker_log.txt", "w");
+	ParseCommandLine();
 
-	g_hRedrawEvent = CreateEvent(NULL, FALSE, FALSE, L"ConsoleRedrawEvent");
+	g_hRedrawEvent		 = CreateEvent(NULL, FALSE, FALSE, L"ConsoleRedrawEvent");
+	g_hTraceStartedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	g_hDumpEvent		 = CreateEvent(NULL, FALSE, FALSE, L"Local\\demote_tracker_dump");
 
 	struct exitDummy
 	{
 		~exitDummy()
 		{
 			fclose(g_LogFile);
+			if(g_alertLogFile)
+				fclose(g_alertLogFile);
 		}
 	} foo;
 
@@ -1335,6 +852,38 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 	SetConsoleCP(CP_UTF8);
 
 	InitializeCriticalSection(&g_critSec);
+	RegisterEventHandlers();
+	g_processNameResolver = GetProcessPath;
+	g_redrawSignal		  = SignalRedraw;
+	g_eventClock		  = QpcNow;
+
+	if(g_benchmark)
+	{
+		FILE* out = nullptr;
+		freopen_s(&out, "CONOUT$", "w", stdout);
+		RunBenchmarks(stdout, {});
+		printf("Press any key to exit.\n");
+		_getch();
+		return 0;
+	}
+
+	if(g_record && !StartFlightRecorder(g_recordMegabytes, g_recordSeconds))
+	{
+		fprintf(g_LogFile, "Failed to allocate the flight recorder\n");
+		fflush(g_LogFile);
+	}
+
+	// The snapshot runs concurrently with starting the session, the first frame waits for it
+	std::thread snapshotThread(PrepopulateProcesses);
+	struct joinSnapshot
+	{
+		std::thread& thread;
+		~joinSnapshot()
+		{
+			if(thread.joinable())
+				thread.join();
+		}
+	} snapshotJoin{ snapshotThread };
 
 	{
 		size_t					bufferSize	= sizeof(EVENT_TRACE_PROPERTIES) + (wcslen(SESSION_NAME) + 1) * sizeof(wchar_t);
@@ -1391,8 +940,10 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 	}
 	EVENT_TRACE_LOGFILEW logfile = { 0 };
 	logfile.LoggerName			 = (LPWSTR)SESSION_NAME;
-	logfile.ProcessTraceMode	 = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+	// ClientContext = 1 makes the session stamp events with QPC, but ProcessTrace converts them to FILETIME without RAW_TIMESTAMP
+	logfile.ProcessTraceMode	 = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
 	logfile.EventRecordCallback	 = EventRecordCallback;
+	logfile.BufferCallback		 = BufferCallback;
 
 	g_traceHandle = OpenTraceW(&logfile);
 	if(g_traceHandle == INVALID_PROCESSTRACE_HANDLE)
@@ -1413,13 +964,11 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 			}
 		});
 
-	for(int i = 0; i < 100 && !g_traceStarted.load(std::memory_order_acquire); i++)
-	{
-		Sleep(10);
-	}
+	// A real-time consumer gets the session header event first, so this normally returns right away
+	WaitForSingleObject(g_hTraceStartedEvent, TRACE_START_TIMEOUT_MS);
 
-	status = EnableTraceEx2(g_sessionHandle, &KernelProcessGuid, EVENT_CONTROL_CODE_CAPTURE_STATE, TRACE_LEVEL_VERBOSE, 0x10 | 0x20, 0, INFINITE, &kernelProcessParams);
-	if(status != ERROR_SUCCESS)
+	status = EnableTraceEx2(g_sessionHandle, &KernelProcessGuid, EVENT_CONTROL_CODE_CAPTURE_STATE, TRACE_LEVEL_VERBOSE, 0x10 | 0x20, 0, RUNDOWN_TIMEOUT_MS, &kernelProcessParams);
+	if(status != ERROR_SUCCESS && status != ERROR_TIMEOUT)
 	{
 		wprintf(L"Warning: Failed to request Kernel-Process capture state. Error: %lu\n", status);
 		wprintf(L"Existing processes will not be enumerated.\n");
@@ -1443,8 +992,8 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 		return 1;
 	}
 
-	status = EnableTraceEx2(g_sessionHandle, &DxgKrnlGuid, EVENT_CONTROL_CODE_CAPTURE_STATE, TRACE_LEVEL_VERBOSE, 0xFFFFFFFFFFFFFFFF, 0, INFINITE, nullptr);
-	if(status != ERROR_SUCCESS)
+	status = EnableTraceEx2(g_sessionHandle, &DxgKrnlGuid, EVENT_CONTROL_CODE_CAPTURE_STATE, TRACE_LEVEL_VERBOSE, 0xFFFFFFFFFFFFFFFF, 0, RUNDOWN_TIMEOUT_MS, nullptr);
+	if(status != ERROR_SUCCESS && status != ERROR_TIMEOUT)
 	{
 		wprintf(L"Warning: Failed to request Kernel-Process capture state. Error: %lu\n", status);
 		wprintf(L"Existing processes will not be enumerated.\n");
@@ -1467,7 +1016,24 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 
 	HideCursor();
 	ClearScreen();
+	snapshotThread.join();
+	StartNameResolver();
+	if(g_sharedState)
+		StartSharedState();
+	if(g_fleetAddress.size())
+		StartFleetAgent(g_fleetAddress.c_str());
+	if(g_launchCommand.size() && !StartLaunch())
+	{
+		wprintf(L"Failed to launch the command.\n");
+		fflush(stdout);
+		g_exitCode = 2;
+		StopTraceSession();
+	}
 
+	// Redraws happen when the trace or a key changed something, at most g_maxFps times a second
+	INT64 lastFrame = 0;
+	INT64 lastTick	= 0;
+	bool  redraw	= true;
 	while(1)
 	{
 		do
@@ -1479,10 +1045,76 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 			if(!r || Length == 0)
 				break;
 			ReadConsoleInput(g_hConsoleInput, &Record, 1, &Length);
-			WORD ch = Record.Event.KeyEvent.wVirtualKeyCode;
-			if(Record.Event.KeyEvent.bKeyDown && ch != 0)
-			{				
-				if(ch == 'G')
+			WORD	ch	 = Record.Event.KeyEvent.wVirtualKeyCode;
+			wchar_t text = Record.Event.KeyEvent.uChar.UnicodeChar;
+			if(Record.EventType == KEY_EVENT && Record.Event.KeyEvent.bKeyDown)
+				redraw = true;
+			if(Record.EventType == KEY_EVENT && Record.Event.KeyEvent.bKeyDown && g_searchActive)
+			{
+				// Typing a name filter: Enter keeps it, Esc clears it
+				if(ch == VK_RETURN)
+					g_searchActive = false;
+				else if(ch == VK_ESCAPE)
+				{
+					g_searchActive = false;
+					g_filterText.clear();
+				}
+				else if(ch == VK_BACK)
+				{
+					if(g_filterText.size())
+						g_filterText.pop_back();
+				}
+				else if(text >= L' ')
+					g_filterText.push_back((wchar_t)towlower(text));
+				g_scrollOffset = 0;
+			}
+			else if(Record.EventType == KEY_EVENT && Record.Event.KeyEvent.bKeyDown && ch != 0)
+			{
+				if(text == L'/')
+				{
+					g_searchActive = true;
+				}
+				else if(ch == VK_UP || ch == VK_DOWN)
+				{
+					g_scrollOffset += ch == VK_UP ? -1 : 1;
+				}
+				else if(ch == VK_PRIOR || ch == VK_NEXT)
+				{
+					g_scrollOffset += ch == VK_PRIOR ? -g_listRows : g_listRows;
+				}
+				else if((ch == VK_LEFT || ch == VK_RIGHT) && g_heatmapView != HEATMAP_OFF)
+				{
+					PanHeatmap(ch == VK_RIGHT ? 1 : -1);
+				}
+				else if((text == L'[' || text == L']') && g_heatmapView != HEATMAP_OFF)
+				{
+					ZoomHeatmap(text == L'[' ? 1 : -1);
+				}
+				else if(ch == VK_HOME)
+				{
+					g_scrollOffset = 0;
+				}
+				else if(ch == VK_END)
+				{
+					g_scrollOffset = INT_MAX / 2;
+				}
+				else if(ch == 'T')
+				{
+					g_filterTrackedOnly = !g_filterTrackedOnly;
+					g_scrollOffset		= 0;
+				}
+				else if(ch == 'F')
+				{
+					g_filterAdapter++;
+					g_scrollOffset = 0;
+				}
+				else if(text == L'+' || text == L'=' || text == L'-')
+				{
+					int next		= g_filterMinSize + (text == L'-' ? -1 : 1);
+					g_filterMinSize = std::max(0, std::min(next, FILTER_MIN_SIZE_COUNT - 1));
+					g_scrollOffset	= 0;
+				}
+				else if(ch == 'G')
 				{
 					g_minSize = g_minSize == 3 ? 0 : 3;
 				}
@@ -1502,6 +1134,59 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 				{
 					g_detailedMode = !g_detailedMode;
 				}
+				else if(ch == 'A')
+				{
+					g_showSegments = !g_showSegments;
+				}
+				else if(ch == 'H')
+				{
+					g_heatmapView  = (g_heatmapView + 1) % HEATMAP_VIEW_COUNT;
+					g_scrollOffset = 0;
+				}
+				else if(ch == 'V' && g_deviceEvents)
+				{
+					g_showDevices = !g_showDevices;
+				}
+				else if(ch == 'N')
+				{
+					g_nonLocalView = !g_nonLocalView;
+				}
+				else if(ch == 'S')
+				{
+					g_sortColumn = (g_sortColumn + 1) % SORT_COLUMN_COUNT;
+				}
+				else if(ch == 'R')
+				{
+					g_sortReverse = !g_sortReverse;
+				}
+				else if(ch == 'X' || (ch == 'D' && !g_diffMode && !g_baseline.time))
+				{
+					EnterCriticalSection(&g_critSec);
+					TakeSnapshot(g_baseline);
+					LeaveCriticalSection(&g_critSec);
+					if(ch == 'D')
+						g_diffMode = true;
+				}
+				else if(ch == 'D')
+				{
+					g_diffMode = !g_diffMode;
+				}
+				else if(ch == 'W')
+				{
+					DumpFlightRecording();
+				}
+				else if(ch == 'E')
+				{
+					if(g_diffMode && g_baseline.time)
+						ExportDiffCsv("demote_tracker_diff.csv");
+					else
+					{
+						ExportCsv("demote_tracker_export.csv");
+						ExportBlameReport("demote_tracker_blame.csv");
+						if(g_deviceEvents)
+							ExportDeviceReport("demote_tracker_devices.csv");
+					}
+				}
 				if(ch == 27)
 				{
 					StopTraceSession();
@@ -1517,12 +1202,45 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 			fflush(stdout);
 			break;
 		}
-		ConsoleUpdate();
-		HANDLE handles[] = { g_hRedrawEvent, g_hConsoleInput };
-		WaitForMultipleObjects(2, handles, FALSE, 1000);
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		if(now.QuadPart - lastTick >= g_qpcFrequency)
+		{
+			lastTick = now.QuadPart;
+			redraw	 = ConsoleTick() || redraw;
+		}
+		if(g_measured.handle && PollMeasured(g_measured))
+		{
+			FinishLaunch();
+			StopTraceSession();
+			continue;
+		}
+		DWORD timeout = 1000;
+		if(redraw || g_dirtyTime.load(std::memory_order_relaxed))
+		{
+			INT64 wait = lastFrame + g_qpcFrequency / g_maxFps - now.QuadPart;
+			if(wait <= 0)
+			{
+				ConsoleUpdate();
+				lastFrame = now.QuadPart;
+				redraw	  = false;
+			}
+			else
+				timeout = (DWORD)(wait * 1000 / g_qpcFrequency) + 1;
+		}
+		AlertFlush();
+		HANDLE handles[] = { g_hRedrawEvent, g_hConsoleInput, g_hDumpEvent, (HANDLE)g_measured.handle };
+		if(WaitForMultipleObjects(g_measured.handle ? 4 : 3, handles, FALSE, timeout) == WAIT_OBJECT_0 + 2)
+			DumpFlightRecording();
 	}
 
 	traceThread.join();
+	if(g_measure.active)
+		FinishLaunch();
+	StopFlightRecorder();
+	StopNameResolver();
+	StopSharedState();
+	StopFleetAgent();
 
 	StopTraceSession();
 
@@ -1530,5 +1248,6 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 
 	free(pSessionProperties);
 
-	return 0;
+	return g_exitCode;
 }
+
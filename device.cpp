@@ -0,0 +1,225 @@
+#include "device.h"
+#include <algorithm>
+
+const char* g_allocationTypeNames[ALLOCATION_TYPE_COUNT] = { "gpu", "cpu", "sysmem", "display", "protected" };
+bool		g_deviceEvents								= false;
+
+static std::vector<DeviceMemory>					g_deviceMemory;
+static std::vector<UINT32>							g_deviceFree;
+static std::unordered_map<PVOID, DeviceAllocation> g_deviceAllocations; // by pDxgAllocation
+
+AllocationType GetAllocationType(UINT32 flags)
+{
+	if(flags & ALLOCATION_FLAG_PROTECTED)
+		return ALLOCATION_PROTECTED;
+	if(flags & (ALLOCATION_FLAG_OVERLAY | ALLOCATION_FLAG_CAPTURE))
+		return ALLOCATION_DISPLAY;
+	if(flags & (ALLOCATION_FLAG_PERMANENT_SYSMEM | ALLOCATION_FLAG_EXISTING_SYSMEM))
+		return ALLOCATION_SYSTEM;
+	if(flags & ALLOCATION_FLAG_CPU_VISIBLE)
+		return ALLOCATION_CPU_VISIBLE;
+	return ALLOCATION_GPU;
+}
+
+// The record of a device in the entry's list, added at the front if new
+static UINT32 FindDeviceMemory(UINT32 index, PVOID hDevice)
+{
+	UINT32 first = g_processMemory.cold[index].firstDevice;
+	for(UINT32 slot = first; slot; slot = g_deviceMemory[slot - 1].next)
+	{
+		if(g_deviceMemory[slot - 1].hDevice == hDevice)
+			return slot - 1;
+	}
+	UINT32 slot;
+	if(g_deviceFree.size())
+	{
+		slot = g_deviceFree.back();
+		g_deviceFree.pop_back();
+	}
+	else
+	{
+		slot = (UINT32)g_deviceMemory.size();
+		g_deviceMemory.emplace_back();
+	}
+	g_deviceMemory[slot]				   = {};
+	g_deviceMemory[slot].hDevice		   = hDevice;
+	g_deviceMemory[slot].next			   = first;
+	g_processMemory.cold[index].firstDevice = slot + 1;
+	return slot;
+}
+
+static void AddAllocation(UINT32 index, const DeviceAllocation& allocation)
+{
+	DeviceMemory& device = g_deviceMemory[FindDeviceMemory(index, allocation.hDevice)];
+	device.bytes[allocation.type] += allocation.size;
+	device.allocations++;
+}
+
+// A record goes back to the pool with its last allocation
+static void RemoveAllocation(UINT32 index, const DeviceAllocation& allocation)
+{
+	UINT32		  slot	 = FindDeviceMemory(index, allocation.hDevice);
+	DeviceMemory& device = g_deviceMemory[slot];
+	device.bytes[allocation.type] -= allocation.size;
+	if(--device.allocations)
+		return;
+	UINT32* link = &g_processMemory.cold[index].firstDevice;
+	while(*link != slot + 1)
+		link = &g_deviceMemory[*link - 1].next;
+	*link = device.next;
+	g_deviceFree.push_back(slot);
+}
+
+static void OnDeviceAllocation(PVOID hDevice, PVOID pDxgAllocation)
+{
+	DeviceAllocation& allocation = g_deviceAllocations[pDxgAllocation];
+	UINT32			  index		 = g_processMemory.Resolve(allocation.entry);
+	if(index == INVALID_MEMORY_INDEX || allocation.hDevice == hDevice)
+	{
+		allocation.hDevice = hDevice;
+		return;
+	}
+	RemoveAllocation(index, allocation);
+	allocation.hDevice = hDevice;
+	AddAllocation(index, allocation);
+	MarkDirty(g_eventTime);
+}
+
+static void OnAllocationStop(PVOID pDxgAllocation)
+{
+	auto itr = g_deviceAllocations.find(pDxgAllocation);
+	if(itr == g_deviceAllocations.end())
+		return;
+	UINT32 index = g_processMemory.Resolve(itr->second.entry);
+	if(index != INVALID_MEMORY_INDEX)
+	{
+		RemoveAllocation(index, itr->second);
+		MarkDirty(g_eventTime);
+	}
+	g_deviceAllocations.erase(itr);
+}
+
+void HandleDeviceAllocationStart(const DeviceAllocationStartEvent& e)
+{
+	OnDeviceAllocation(e.hDevice, e.pDxgAllocation);
+}
+
+void HandleDeviceAllocationRundown(const DeviceAllocationDCStartEvent& e)
+{
+	OnDeviceAllocation(e.hDevice, e.pDxgAllocation);
+}
+
+void HandleDeviceAllocationStop(const DeviceAllocationStopEvent& e)
+{
+	OnAllocationStop(e.pDxgAllocation);
+}
+
+void HandleProcessAllocationDetailsStart(const ProcessAllocationDetailsStartEvent& e)
+{
+	DeviceAllocation& allocation = g_deviceAllocations[e.pDxgAllocation];
+	UINT32			  previous	 = g_processMemory.Resolve(allocation.entry);
+	if(previous != INVALID_MEMORY_INDEX)
+		RemoveAllocation(previous, allocation); // an address reused without a stop
+	UINT32 index	  = FindProcessMemory(e.ProcessId, e.pDxgAdapter);
+	allocation.entry  = g_processMemory.Handle(index);
+	allocation.size	  = e.Size;
+	allocation.type	  = GetAllocationType(e.Flags);
+	AddAllocation(index, allocation);
+	MarkDirty(g_eventTime);
+}
+
+void HandleProcessAllocationDetailsStop(const ProcessAllocationDetailsStopEvent& e)
+{
+	OnAllocationStop(e.pDxgAllocation);
+}
+
+const DeviceMemory* FirstDeviceMemory(UINT32 index)
+{
+	UINT32 slot = g_processMemory.cold[index].firstDevice;
+	return slot ? &g_deviceMemory[slot - 1] : nullptr;
+}
+
+const DeviceMemory* NextDeviceMemory(const DeviceMemory* device)
+{
+	return device->next ? &g_deviceMemory[device->next - 1] : nullptr;
+}
+
+UINT32 DeviceMemoryCount(UINT32 index)
+{
+	UINT32 count = 0;
+	for(const DeviceMemory* device = FirstDeviceMemory(index); device; device = NextDeviceMemory(device))
+		count++;
+	return count;
+}
+
+UINT32 SortDeviceMemory(UINT32 index, const DeviceMemory** devices, UINT32 maxDevices)
+{
+	static std::vector<const DeviceMemory*> all;
+	all.clear();
+	for(const DeviceMemory* device = FirstDeviceMemory(index); device; device = NextDeviceMemory(device))
+		all.push_back(device);
+	UINT32 count = std::min((UINT32)all.size(), maxDevices);
+	std::partial_sort(all.begin(), all.begin() + count, all.end(), [](const DeviceMemory* a, const DeviceMemory* b) { return a->Total() > b->Total(); });
+	std::copy(all.begin(), all.begin() + count, devices);
+	return (UINT32)all.size();
+}
+
+// The entry's allocations stay in the map until their stop events, their handle no longer resolves
+void DeviceClearProcess(UINT32 index)
+{
+	UINT32& first = g_processMemory.cold[index].firstDevice;
+	for(UINT32 slot = first; slot; slot = g_deviceMemory[slot - 1].next)
+		g_deviceFree.push_back(slot - 1);
+	first = 0;
+}
+
+void ResetDevices()
+{
+	g_deviceMemory.clear();
+	g_deviceFree.clear();
+	g_deviceAllocations.clear();
+}
+
+size_t DeviceAllocationCount()
+{
+	return g_deviceAllocations.size();
+}
+
+// Entries in table order, their devices most recent first
+bool ExportDeviceReport(const char* path)
+{
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open export file '%s'\n", path);
+		fflush(g_LogFile);
+		return false;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	fprintf(f, "pid,process,adapter,device,allocations,bytes");
+	for(const char* name : g_allocationTypeNames)
+		fprintf(f, ",%s", name);
+	fprintf(f, "\n");
+	for(UINT32 index = 0; index < g_processMemory.Size(); ++index)
+	{
+		const ProcessKey& key = g_processMemory.keys[index];
+		for(const DeviceMemory* device = FirstDeviceMemory(index); device; device = NextDeviceMemory(device))
+		{
+			fprintf(f,
+					"%u,%ls,%ls,0x%llx,%u,%llu",
+					(unsigned)key.pid,
+					FindProcName(key.pid).c_str(),
+					FindAdapter(key.pDxgAdapter)->name.c_str(),
+					(UINT64)device->hDevice,
+					device->allocations,
+					device->Total());
+			for(UINT64 bytes : device->bytes)
+				fprintf(f, ",%llu", bytes);
+			fprintf(f, "\n");
+		}
+	}
+	LeaveCriticalSection(&g_critSec);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+// Device breakdown
+//  the allocations of a (process, adapter) entry split by the D3D device they were made through and by their
+//  kind, from the DxgKrnl allocation events: ProcessAllocationDetails gives the owner, size and flags of an
+//  allocation, DeviceAllocation its device, in either order. Each entry has a short list of device records in
+//  a pool outside ProcessMemory, so entries without allocation events cost nothing and a list is only walked
+//  for the rows shown expanded and for the export.
+#include "tracker.h"
+
+#define DEVICE_MAX_ROWS 6 // sub-rows under an expanded entry, the smallest devices past it share the last one
+
+enum AllocationType : UINT8
+{
+	ALLOCATION_GPU, // none of the others
+	ALLOCATION_CPU_VISIBLE,
+	ALLOCATION_SYSTEM, // backed by system memory
+	ALLOCATION_DISPLAY, // overlays and captures
+	ALLOCATION_PROTECTED,
+	ALLOCATION_TYPE_COUNT,
+};
+
+// DXGK_ALLOCATIONINFOFLAGS bits of ProcessAllocationDetails Flags
+#define ALLOCATION_FLAG_CPU_VISIBLE 0x1
+#define ALLOCATION_FLAG_PERMANENT_SYSMEM 0x2
+#define ALLOCATION_FLAG_PROTECTED 0x8
+#define ALLOCATION_FLAG_EXISTING_SYSMEM 0x10
+#define ALLOCATION_FLAG_OVERLAY 0x100
+#define ALLOCATION_FLAG_CAPTURE 0x200
+
+struct DeviceMemory
+{
+	PVOID  hDevice; // 0 for the allocations whose device is not known yet
+	UINT32 next;	// + 1, 0 at the end of the entry's list
+	UINT32 allocations;
+	UINT64 bytes[ALLOCATION_TYPE_COUNT];
+
+	UINT64 Total() const
+	{
+		UINT64 total = 0;
+		for(UINT64 b : bytes)
+			total += b;
+		return total;
+	}
+};
+
+struct DeviceAllocation
+{
+	MemoryHandle entry; // invalid until the details are known, or once the entry is gone
+	PVOID		 hDevice;
+	UINT64		 size;
+	UINT8		 type;
+};
+
+extern const char* g_allocationTypeNames[ALLOCATION_TYPE_COUNT];
+
+// Event handlers, through RunLockedHandler
+void HandleDeviceAllocationStart(const DeviceAllocationStartEvent& e);
+void HandleDeviceAllocationStop(const DeviceAllocationStopEvent& e);
+void HandleDeviceAllocationRundown(const DeviceAllocationDCStartEvent& e);
+void HandleProcessAllocationDetailsStart(const ProcessAllocationDetailsStartEvent& e);
+void HandleProcessAllocationDetailsStop(const ProcessAllocationDetailsStopEvent& e);
+
+// The allocation events are only decoded with --devices, as their field lists in events.h have not been checked
+// against the DxgKrnl manifest yet
+extern bool g_deviceEvents;
+
+// Need g_critSec
+AllocationType		GetAllocationType(UINT32 flags);
+const DeviceMemory* FirstDeviceMemory(UINT32 index); // null if the entry has no allocations
+const DeviceMemory* NextDeviceMemory(const DeviceMemory* device);
+UINT32				DeviceMemoryCount(UINT32 index);
+UINT32				SortDeviceMemory(UINT32 index, const DeviceMemory** devices, UINT32 maxDevices); // largest first, returns the count
+void				DeviceClearProcess(UINT32 index);
+void				ResetDevices();
+size_t				DeviceAllocationCount();
+
+bool ExportDeviceReport(const char* path); // a row per (entry, device)
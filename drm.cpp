@@ -0,0 +1,581 @@
+#include "drm.h"
+#include "synth.h"
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define DRM_MAX_REGIONS 8
+#define DRM_NO_CLIENT 0xffffffffffffffffull
+
+static std::string g_drmProcRoot = "/proc";
+static std::string g_drmSysRoot	 = "/sys";
+
+void SetDrmRoots(const char* procRoot, const char* sysRoot)
+{
+	g_drmProcRoot = procRoot;
+	g_drmSysRoot  = sysRoot;
+	ResetDrmSource();
+}
+
+#ifdef _WIN32
+void ResetDrmSource()
+{
+}
+
+bool ScanDrmClients(DrmScanStats& stats)
+{
+	stats = DrmScanStats();
+	return false;
+}
+#else
+
+// The values of one (pid, adapter) as last sent to the handlers
+struct DrmMemory
+{
+	UINT64 usage[SEGMENT_GROUP_COUNT];
+	UINT64 commitment[SEGMENT_GROUP_COUNT];
+	UINT64 demoted;
+
+	bool operator==(const DrmMemory& other) const
+	{
+		return memcmp(this, &other, sizeof(*this)) == 0;
+	}
+};
+
+struct DrmFd
+{
+	UINT32 fd;
+	UINT64 client; // adapter << 48 | drm-client-id of the last read, DRM_NO_CLIENT if not known
+};
+
+struct DrmProcess
+{
+	UINT32				   lastScan	   = 0;
+	UINT32				   relistPhase = 0;
+	bool				   listed	   = false;
+	bool				   reported	   = false; // the process start went to the handlers
+	INT64				   fdDirSize   = 0;
+	INT64				   fdDirTime   = 0;
+	std::string			   exe;
+	std::vector<DrmFd>	   fds;					// of DRM devices only
+	std::vector<DrmMemory> memory;				// sent, by adapter, empty until the first one
+};
+
+// One drm-pdev (or driver, without it) is one adapter
+struct DrmAdapter
+{
+	std::string key;
+	PVOID		pDxgAdapter;
+};
+
+// Per memory region of one fdinfo, before the regions are folded into the local/non-local groups
+struct DrmRegion
+{
+	char   name[24];
+	UINT64 total;
+	UINT64 resident;
+	UINT64 evicted;
+	bool   hasTotal, hasResident, hasEvicted;
+};
+
+struct DrmClient
+{
+	char	  pdev[32];
+	char	  driver[32];
+	UINT64	  id;
+	bool	  hasId;
+	UINT64	  purgeable;
+	int		  numRegions;
+	DrmRegion regions[DRM_MAX_REGIONS];
+};
+
+static std::unordered_map<DWORD, DrmProcess> g_drmProcesses;
+static std::vector<DrmAdapter>				  g_drmAdapters;
+static std::unordered_set<UINT64>			  g_drmClientsSeen; // in the current scan
+static UINT32								  g_drmScan			 = 0;
+static UINT32								  g_drmProcessesSeen = 0;
+static INT64								  g_drmScanTime		 = 0; // the events of a scan are stamped with its start
+
+void ResetDrmSource()
+{
+	g_drmProcesses.clear();
+	g_drmAdapters.clear();
+	g_drmClientsSeen.clear();
+	g_drmScan		   = 0;
+	g_drmProcessesSeen = 0;
+}
+
+// Region names differ per driver (vram, gtt, cpu for amdgpu, local0, system0 for i915, vram0, gtt for xe);
+// the device memory ones are the local group
+static UINT8 DrmRegionGroup(const char* region)
+{
+	return strstr(region, "vram") || strstr(region, "local") ? SEGMENT_GROUP_LOCAL : SEGMENT_GROUP_NON_LOCAL;
+}
+
+static DrmRegion* FindDrmRegion(DrmClient& client, const char* name, size_t length)
+{
+	for(int i = 0; i < client.numRegions; ++i)
+		if(strlen(client.regions[i].name) == length && memcmp(client.regions[i].name, name, length) == 0)
+			return &client.regions[i];
+	if(client.numRegions == DRM_MAX_REGIONS || length >= sizeof(client.regions[0].name))
+		return nullptr;
+	DrmRegion& region = client.regions[client.numRegions++];
+	memset(&region, 0, sizeof(region));
+	memcpy(region.name, name, length);
+	return &region;
+}
+
+static UINT64 ParseDrmValue(const char* value)
+{
+	char*  end;
+	UINT64 v = strtoull(value, &end, 10);
+	while(*end == ' ' || *end == '\t')
+		end++;
+	if(end[0] && end[1] == 'i' && end[2] == 'B')
+	{
+		if(end[0] == 'K')
+			v <<= 10;
+		else if(end[0] == 'M')
+			v <<= 20;
+		else if(end[0] == 'G')
+			v <<= 30;
+	}
+	return v;
+}
+
+static void CopyDrmString(char* to, size_t size, const char* value)
+{
+	size_t i = 0;
+	for(; value[i] && value[i] != '\n' && i + 1 < size; ++i)
+		to[i] = value[i];
+	to[i] = '\0';
+}
+
+// The keys are drm-<key>: <value>, with the memory ones being drm-<stat>-<region>: <value> [KiB|MiB|GiB]. drm-memory-<region>
+// is the older name of drm-resident-<region> and counts as both resident and total when the newer keys are missing.
+// amdgpu reports the buffers that want VRAM but were evicted from it as amd-evicted-vram.
+static void ParseDrmFdinfo(char* text, DrmClient& client)
+{
+	memset(&client, 0, sizeof(client));
+	for(char* line = text; *line;)
+	{
+		char* next = strchr(line, '\n');
+		if(next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		char* colon = strchr(line, ':');
+		if(colon)
+		{
+			*colon			  = '\0';
+			const char* value = colon + 1;
+			while(*value == ' ' || *value == '\t')
+				value++;
+
+			static const char* prefixes[] = { "drm-total-", "drm-memory-", "drm-resident-", "drm-purgeable-", "amd-evicted-" };
+			int				   stat			= -1;
+			size_t			   prefixLength = 0;
+			for(int i = 0; i < (int)_countof(prefixes) && stat < 0; ++i)
+			{
+				prefixLength = strlen(prefixes[i]);
+				if(strncmp(line, prefixes[i], prefixLength) == 0)
+					stat = i;
+			}
+			if(strcmp(line, "drm-pdev") == 0)
+				CopyDrmString(client.pdev, sizeof(client.pdev), value);
+			else if(strcmp(line, "drm-driver") == 0)
+				CopyDrmString(client.driver, sizeof(client.driver), value);
+			else if(strcmp(line, "drm-client-id") == 0)
+			{
+				client.id	 = strtoull(value, nullptr, 10);
+				client.hasId = true;
+			}
+			else if(stat == 3)
+				client.purgeable += ParseDrmValue(value);
+			else if(stat >= 0)
+			{
+				const char* name   = line + prefixLength;
+				DrmRegion*	region = FindDrmRegion(client, name, strlen(name));
+				UINT64		v	   = ParseDrmValue(value);
+				if(region && stat == 0)
+				{
+					region->total	 = v;
+					region->hasTotal = true;
+				}
+				else if(region && stat == 1)
+				{
+					region->total	 = region->hasTotal ? region->total : v;
+					region->resident = region->hasResident ? region->resident : v;
+				}
+				else if(region && stat == 2)
+				{
+					region->resident	= v;
+					region->hasResident = true;
+				}
+				else if(region && strncmp(name, "visible-", 8) != 0) // amd-evicted-visible-vram is part of amd-evicted-vram
+				{
+					region->evicted	   = v;
+					region->hasEvicted = true;
+				}
+			}
+		}
+		line = next;
+	}
+}
+
+// Resident bytes are the usage, total bytes the commitment. The local bytes that are not resident are
+// reported as demoted, at PRIO_NORMAL since Linux has no priority classes.
+static void AddDrmClient(const DrmClient& client, DrmMemory& memory)
+{
+	for(int i = 0; i < client.numRegions; ++i)
+	{
+		const DrmRegion& region = client.regions[i];
+		UINT8			 group	= DrmRegionGroup(region.name);
+		memory.usage[group] += region.resident;
+		memory.commitment[group] += region.total;
+		if(group != SEGMENT_GROUP_LOCAL)
+			continue;
+		if(region.hasEvicted)
+			memory.demoted += region.evicted;
+		else if(region.total > region.resident)
+			memory.demoted += region.total - region.resident;
+	}
+}
+
+static bool ReadDrmFile(int dirFd, const char* path, char* buffer, size_t size)
+{
+	int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+	ssize_t length = read(fd, buffer, size - 1);
+	close(fd);
+	if(length < 0)
+		return false;
+	buffer[length] = '\0';
+	return true;
+}
+
+// The segments of a new adapter come from sysfs where the driver has them (amdgpu's mem_info_*_total)
+static void AddDrmAdapter(const DrmClient& client, const std::string& key)
+{
+	DrmAdapter adapter;
+	adapter.key			= key;
+	adapter.pDxgAdapter = (PVOID)(UINT64)(g_drmAdapters.size() + 1);
+	g_drmAdapters.push_back(adapter);
+
+	wchar_t name[80];
+	swprintf_s(name, _countof(name), L"%s %s", client.driver[0] ? client.driver : "drm", client.pdev);
+	EnterCriticalSection(&g_critSec);
+	FindAdapter(adapter.pDxgAdapter)->name = name;
+	LeaveCriticalSection(&g_critSec);
+	if(!client.pdev[0])
+		return;
+
+	const char* files[] = { "mem_info_vram_total", "mem_info_gtt_total" };
+	for(UINT32 i = 0; i < _countof(files); ++i)
+	{
+		char path[512], text[64];
+		sprintf_s(path, sizeof(path), "%s/bus/pci/devices/%s/%s", g_drmSysRoot.c_str(), client.pdev, files[i]);
+		if(!ReadDrmFile(AT_FDCWD, path, text, sizeof(text)))
+			continue;
+		SynthEvent e;
+		memset(&e, 0, sizeof(e));
+		e.time							   = g_drmScanTime;
+		e.type							   = SYNTH_REPORT_SEGMENT;
+		e.reportSegment.ulSegmentId		   = i;
+		e.reportSegment.pDxgAdapter		   = adapter.pDxgAdapter;
+		e.reportSegment.Size			   = strtoull(text, nullptr, 10);
+		e.reportSegment.CommitLimit		   = e.reportSegment.Size;
+		e.reportSegment.Flags			   = i ? SEGMENT_FLAG_APERTURE | SEGMENT_FLAG_CPU_VISIBLE : 0;
+		e.reportSegment.MemorySegmentGroup = i ? SEGMENT_GROUP_NON_LOCAL : SEGMENT_GROUP_LOCAL;
+		DispatchSynthEvent(e);
+	}
+}
+
+static UINT32 FindDrmAdapter(const DrmClient& client)
+{
+	std::string key = client.pdev[0] ? client.pdev : client.driver;
+	for(UINT32 i = 0; i < g_drmAdapters.size(); ++i)
+		if(g_drmAdapters[i].key == key)
+			return i;
+	if(g_drmAdapters.size() == DRM_MAX_ADAPTERS)
+		return DRM_MAX_ADAPTERS;
+	AddDrmAdapter(client, key);
+	return (UINT32)g_drmAdapters.size() - 1;
+}
+
+static std::string ReadDrmExe(int procFd, const char* pid)
+{
+	char path[64], exe[1024];
+	sprintf_s(path, sizeof(path), "%s/exe", pid);
+	ssize_t length = readlinkat(procFd, path, exe, sizeof(exe) - 1);
+	if(length > 0)
+		return std::string(exe, length);
+	sprintf_s(path, sizeof(path), "%s/comm", pid);
+	if(!ReadDrmFile(procFd, path, exe, sizeof(exe)))
+		return std::string();
+	exe[strcspn(exe, "\n")] = '\0';
+	return exe;
+}
+
+// Lists the fd directory, keeping the DRM fds and the client they had if they were already known
+static void ListDrmFds(int procFd, const char* pid, DrmProcess& process, DrmScanStats& stats)
+{
+	char path[64];
+	sprintf_s(path, sizeof(path), "%s/fd", pid);
+	int dirFd = openat(procFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dirFd < 0)
+		return;
+	DIR* dir = fdopendir(dirFd);
+	if(!dir)
+	{
+		close(dirFd);
+		return;
+	}
+	stats.fdListings++;
+	std::vector<DrmFd> fds;
+	while(dirent* entry = readdir(dir))
+	{
+		if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+			continue;
+		char	target[256];
+		ssize_t length = readlinkat(dirFd, entry->d_name, target, sizeof(target) - 1);
+		if(length < 9 || memcmp(target, "/dev/dri/", 9) != 0)
+			continue;
+		DrmFd fd = { (UINT32)strtoul(entry->d_name, nullptr, 10), DRM_NO_CLIENT };
+		for(const DrmFd& old : process.fds)
+			if(old.fd == fd.fd)
+				fd.client = old.client;
+		fds.push_back(fd);
+	}
+	closedir(dir);
+	process.fds.swap(fds);
+	process.listed = true;
+}
+
+// The parent a process is tracked through (TrackProcessTree). Processes without GPU memory are never reported,
+// so the nearest ancestor tracked by pid stands in for the ones in between.
+static DWORD FindDrmParent(int procFd, DWORD pid)
+{
+	DWORD parent = 0;
+	EnterCriticalSection(&g_critSec);
+	for(int depth = 0; depth < 16 && g_trackedPids.size(); ++depth)
+	{
+		char path[64], text[1024];
+		sprintf_s(path, sizeof(path), "%u/stat", (unsigned)pid);
+		const char* end = ReadDrmFile(procFd, path, text, sizeof(text)) ? strrchr(text, ')') : nullptr;
+		char		state;
+		unsigned	ppid;
+		if(!end || sscanf(end + 1, " %c %u", &state, &ppid) != 2 || ppid <= 1)
+			break;
+		if(!depth)
+			parent = ppid;
+		if(g_trackedPids.count(ppid))
+		{
+			parent = ppid;
+			break;
+		}
+		pid = ppid;
+	}
+	LeaveCriticalSection(&g_critSec);
+	return parent;
+}
+
+static void DispatchDrmProcess(DWORD pid, DWORD parentPid, const std::string& exe, SynthEventType type)
+{
+	wchar_t name[1024];
+	if(mbstowcs(name, exe.c_str(), _countof(name)) == (size_t)-1)
+		name[0] = L'\0';
+	name[_countof(name) - 1] = L'\0';
+	SynthEvent e;
+	memset(&e, 0, sizeof(e));
+	e.time = g_drmScanTime;
+	e.type = type;
+	if(type == SYNTH_PROCESS_STOP)
+		e.processStop.ProcessID = pid;
+	else
+	{
+		e.processStart.ProcessID	   = pid;
+		e.processStart.ParentProcessID = parentPid;
+		e.processStart.ImageName	   = name;
+	}
+	DispatchSynthEvent(e);
+}
+
+// Sends what changed since the last scan as VidMm events
+static void DispatchDrmMemory(DWORD pid, PVOID pDxgAdapter, const DrmMemory& sent, const DrmMemory& memory)
+{
+	SynthEvent e;
+	memset(&e, 0, sizeof(e));
+	e.time = g_drmScanTime;
+	for(UINT8 group = 0; group < SEGMENT_GROUP_COUNT; ++group)
+	{
+		if(memory.usage[group] != sent.usage[group])
+		{
+			e.type							 = SYNTH_USAGE_CHANGE;
+			e.usageChange.NewUsage			 = memory.usage[group];
+			e.usageChange.OldUsage			 = sent.usage[group];
+			e.usageChange.pDxgAdapter		 = pDxgAdapter;
+			e.usageChange.ProcessId			 = pid;
+			e.usageChange.MemorySegmentGroup = group;
+			DispatchSynthEvent(e);
+		}
+		if(memory.commitment[group] != sent.commitment[group])
+		{
+			e.type								  = SYNTH_COMMITMENT_CHANGE;
+			e.commitmentChange.Commitment		  = memory.commitment[group];
+			e.commitmentChange.OldCommitment	  = sent.commitment[group];
+			e.commitmentChange.pDxgAdapter		  = pDxgAdapter;
+			e.commitmentChange.ProcessId		  = pid;
+			e.commitmentChange.MemorySegmentGroup = group;
+			DispatchSynthEvent(e);
+		}
+	}
+	if(memory.demoted != sent.demoted)
+	{
+		e.type									= SYNTH_DEMOTED_COMMITMENT_CHANGE;
+		e.demotedCommitmentChange.Commitment	= memory.demoted;
+		e.demotedCommitmentChange.OldCommitment = sent.demoted;
+		e.demotedCommitmentChange.pDxgAdapter	= pDxgAdapter;
+		e.demotedCommitmentChange.ProcessId		= pid;
+		e.demotedCommitmentChange.PriorityClass = PRIO_NORMAL;
+		DispatchSynthEvent(e);
+	}
+}
+
+static void ScanDrmProcess(int procFd, const char* pidText, DWORD pid, DrmScanStats& stats)
+{
+	auto		itr		= g_drmProcesses.find(pid);
+	bool		isNew	= itr == g_drmProcesses.end();
+	DrmProcess& process = isNew ? g_drmProcesses[pid] : itr->second;
+	if(isNew)
+		process.relistPhase = g_drmProcessesSeen++ % DRM_RELIST_SCANS;
+	process.lastScan = g_drmScan;
+	stats.processes++;
+
+	// st_size of a /proc/<pid>/fd directory is its number of open files, a fixture directory changes mtime
+	char		path[64];
+	struct stat st;
+	sprintf_s(path, sizeof(path), "%s/fd", pidText);
+	if(fstatat(procFd, path, &st, 0) != 0)
+		return;
+	INT64 fdDirTime = (INT64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	bool  relist	= !process.listed || (INT64)st.st_size != process.fdDirSize || fdDirTime != process.fdDirTime ||
+				  g_drmScan % DRM_RELIST_SCANS == process.relistPhase;
+	process.fdDirSize = (INT64)st.st_size;
+	process.fdDirTime = fdDirTime;
+	if(relist)
+	{
+		ListDrmFds(procFd, pidText, process, stats);
+		// a pid reused by another program is a new process
+		if(process.fds.size() || process.reported)
+		{
+			std::string exe = ReadDrmExe(procFd, pidText);
+			if(process.reported && exe != process.exe)
+			{
+				DispatchDrmProcess(pid, 0, process.exe, SYNTH_PROCESS_STOP);
+				process.reported = false;
+				process.memory.clear();
+			}
+			process.exe = exe;
+		}
+	}
+	if(process.fds.empty() && process.memory.empty())
+		return;
+
+	DrmMemory memory[DRM_MAX_ADAPTERS] = {};
+	UINT32	  numAdapters			   = (UINT32)process.memory.size();
+	for(DrmFd& fd : process.fds)
+	{
+		// a client already read through another fd or process is only counted there
+		if(fd.client != DRM_NO_CLIENT && g_drmClientsSeen.count(fd.client))
+			continue;
+		char text[DRM_MAX_FDINFO];
+		sprintf_s(path, sizeof(path), "%s/fdinfo/%u", pidText, fd.fd);
+		if(!ReadDrmFile(procFd, path, text, sizeof(text)))
+			continue;
+		stats.fdinfoReads++;
+		DrmClient client;
+		ParseDrmFdinfo(text, client);
+		if(!client.hasId || !client.driver[0])
+			continue;
+		UINT32 adapter = FindDrmAdapter(client);
+		if(adapter == DRM_MAX_ADAPTERS)
+			continue;
+		fd.client = (UINT64)adapter << 48 | client.id;
+		if(!g_drmClientsSeen.insert(fd.client).second)
+			continue;
+		stats.clients++;
+		stats.purgeable += client.purgeable;
+		AddDrmClient(client, memory[adapter]);
+		numAdapters = std::max(numAdapters, adapter + 1);
+	}
+
+	if(!process.reported)
+	{
+		if(numAdapters == 0)
+			return;
+		DispatchDrmProcess(pid, FindDrmParent(procFd, pid), process.exe, g_drmScan == 1 ? SYNTH_PROCESS_RUNDOWN : SYNTH_PROCESS_START);
+		process.reported = true;
+	}
+	stats.gpuProcesses++;
+	process.memory.resize(numAdapters, DrmMemory());
+	for(UINT32 a = 0; a < numAdapters; ++a)
+	{
+		if(memory[a] == process.memory[a])
+			continue;
+		DispatchDrmMemory(pid, g_drmAdapters[a].pDxgAdapter, process.memory[a], memory[a]);
+		process.memory[a] = memory[a];
+	}
+}
+
+bool ScanDrmClients(DrmScanStats& stats)
+{
+	stats	   = DrmScanStats();
+	int procFd = open(g_drmProcRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(procFd < 0)
+		return false;
+	DIR* dir = fdopendir(dup(procFd));
+	if(!dir)
+	{
+		close(procFd);
+		return false;
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	g_drmScanTime = now.QuadPart;
+	g_drmScan++;
+	g_drmClientsSeen.clear();
+	while(dirent* entry = readdir(dir))
+	{
+		if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+			continue;
+		ScanDrmProcess(procFd, entry->d_name, (DWORD)strtoul(entry->d_name, nullptr, 10), stats);
+	}
+	closedir(dir);
+	close(procFd);
+
+	for(auto itr = g_drmProcesses.begin(); itr != g_drmProcesses.end();)
+	{
+		if(itr->second.lastScan == g_drmScan)
+		{
+			++itr;
+			continue;
+		}
+		if(itr->second.reported)
+			DispatchDrmProcess(itr->first, 0, itr->second.exe, SYNTH_PROCESS_STOP);
+		itr = g_drmProcesses.erase(itr);
+	}
+	FlushMemoryUpdates(t_batch);
+	return true;
+}
+#endif
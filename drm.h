@@ -0,0 +1,26 @@
+#pragma once
+// Linux event source: per client GPU memory from the DRM fdinfo files (Documentation/gpu/drm-usage-stats.rst)
+//  each scan walks /proc and turns what changed since the last one into the same process and VidMm events
+//  the ETW callback decodes, so the tracker model and everything on top of it work unchanged. Processes only
+//  get their fd directory listed again when their number of open files changes, or once every
+//  DRM_RELIST_SCANS scans, staggered; a steady scan costs one stat per process and one read per DRM client.
+//  The roots are parameters so a fixture tree can stand in for /proc and /sys.
+#include "tracker.h"
+
+#define DRM_RELIST_SCANS 16
+#define DRM_MAX_ADAPTERS 16
+#define DRM_MAX_FDINFO 4096 // bytes read of each fdinfo file
+
+struct DrmScanStats
+{
+	UINT32 processes   = 0;
+	UINT32 gpuProcesses = 0;
+	UINT32 clients	   = 0; // distinct drm-client-id, a client shared by several fds or processes counts once
+	UINT32 fdListings  = 0;
+	UINT32 fdinfoReads = 0;
+	UINT64 purgeable   = 0; // not in the tracker model, only reported here
+};
+
+void SetDrmRoots(const char* procRoot, const char* sysRoot); // "/proc" and "/sys" by default
+void ResetDrmSource();										 // forgets what was scanned, with ResetTrackerState
+bool ScanDrmClients(DrmScanStats& stats);					 // false if procRoot cannot be read
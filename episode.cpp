@@ -0,0 +1,136 @@
+#include "episode.h"
+#include <math.h>
+
+static std::vector<EpisodeStats> g_episodeStats;
+static std::vector<UINT32>		 g_episodeFree;
+
+static EpisodeStats* FindEpisodeStats(UINT32 index, bool create)
+{
+	UINT32& slot = g_processMemory.cold[index].episodeSlot; // + 1, 0 if none
+	if(!slot && create)
+	{
+		if(g_episodeFree.size())
+		{
+			slot = g_episodeFree.back() + 1;
+			g_episodeFree.pop_back();
+		}
+		else
+		{
+			g_episodeStats.emplace_back();
+			slot = (UINT32)g_episodeStats.size();
+		}
+		g_episodeStats[slot - 1] = {};
+	}
+	return slot ? &g_episodeStats[slot - 1] : nullptr;
+}
+
+static int DurationBucket(double seconds)
+{
+	double ms = seconds * 1000;
+	if(ms < 1)
+		return 0;
+	int bucket = 1 + (int)(log2(ms) * EPISODE_BUCKETS_PER_OCTAVE);
+	return bucket < EPISODE_BUCKETS ? bucket : EPISODE_BUCKETS - 1;
+}
+
+// The geometric middle of a bucket
+static double BucketSeconds(int bucket)
+{
+	if(bucket == 0)
+		return 0.0005;
+	return exp2((bucket - 0.5) / EPISODE_BUCKETS_PER_OCTAVE) / 1000;
+}
+
+void EpisodeOnDemoted(UINT32 index, UINT8 prio, UINT64 previous, UINT64 value, INT64 time)
+{
+	if(previous == value)
+		return;
+	EpisodeStats* stats = FindEpisodeStats(index, value != 0);
+	if(!stats)
+		return;
+	EpisodeState& state = stats->open[prio];
+	if(!state.bytes)
+	{
+		if(!value)
+			return;
+		state = { time, time, value, value, 0 };
+		stats->peak = std::max(stats->peak, value);
+		return;
+	}
+
+	state.byteSeconds += (double)state.bytes * (time - state.last) / g_qpcFrequency;
+	state.last	= time;
+	state.bytes = value;
+	if(value)
+	{
+		state.peak	= std::max(state.peak, value);
+		stats->peak = std::max(stats->peak, value);
+		return;
+	}
+
+	double seconds = (double)(time - state.start) / g_qpcFrequency;
+	stats->durations[DurationBucket(seconds)]++;
+	stats->ended++;
+	stats->longest = std::max(stats->longest, seconds);
+	stats->byteSeconds += state.byteSeconds;
+}
+
+// Percentiles come from the histogram, within a bucket's width (19%) of the exact value
+bool EpisodeSummarize(UINT32 index, INT64 now, EpisodeSummary& summary)
+{
+	summary				= {};
+	EpisodeStats* stats = FindEpisodeStats(index, false);
+	if(!stats)
+		return false;
+	summary.count		= stats->ended;
+	summary.longest		= stats->longest;
+	summary.byteSeconds = stats->byteSeconds;
+	summary.peak		= stats->peak;
+	for(const EpisodeState& state : stats->open)
+	{
+		if(!state.bytes)
+			continue;
+		summary.count++;
+		summary.open++;
+		summary.longest = std::max(summary.longest, (double)(now - state.start) / g_qpcFrequency);
+		summary.byteSeconds += state.byteSeconds + (double)state.bytes * std::max(now - state.last, (INT64)0) / g_qpcFrequency;
+	}
+
+	double* targets[2] = { &summary.p50, &summary.p99 };
+	UINT32	ranks[2]   = { (stats->ended + 1) / 2, stats->ended - stats->ended / 100 };
+	UINT32	seen	   = 0;
+	int		next	   = 0;
+	for(int bucket = 0; bucket < EPISODE_BUCKETS && next < 2 && stats->ended; ++bucket)
+	{
+		seen += stats->durations[bucket];
+		while(next < 2 && seen >= ranks[next])
+			*targets[next++] = std::min(BucketSeconds(bucket), stats->longest);
+	}
+	return true;
+}
+
+void EpisodeClearProcess(UINT32 index)
+{
+	UINT32& slot = g_processMemory.cold[index].episodeSlot;
+	if(!slot)
+		return;
+	g_episodeFree.push_back(slot - 1);
+	slot = 0;
+}
+
+void ResetEpisodes()
+{
+	g_episodeStats.clear();
+	g_episodeFree.clear();
+}
+
+int FormatSeconds(double seconds, char* out, int outSize)
+{
+	if(seconds < 1)
+		return snprintf(out, outSize, "%.0fms", seconds * 1000);
+	if(seconds < 60)
+		return snprintf(out, outSize, "%.1fs", seconds);
+	if(seconds < 3600)
+		return snprintf(out, outSize, "%.1fm", seconds / 60);
+	return snprintf(out, outSize, "%.1fh", seconds / 3600);
+}
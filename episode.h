@@ -0,0 +1,49 @@
+#pragma once
+// Demotion episodes
+//  an episode of an entry at one priority class starts when its demoted commitment rises from zero and ends when
+//  it is back to zero. Each demoted commitment event moves the state of its class along (start, grow/shrink, end),
+//  integrating the demoted bytes over time, so nothing is scanned. Ended episodes go into a log histogram of
+//  their durations, which bounds the statistics of an entry whatever the number of episodes. The statistics live
+//  in a pool outside ProcessMemory, only entries that have been demoted get one.
+#include "tracker.h"
+
+#define EPISODE_BUCKETS_PER_OCTAVE 4
+#define EPISODE_BUCKETS 96 // from 1 ms, the last one takes everything over ~4.6 hours
+
+struct EpisodeState
+{
+	INT64  start; // event time, if bytes
+	INT64  last;
+	UINT64 bytes; // demoted now, 0 when no episode is open
+	UINT64 peak;
+	double byteSeconds;
+};
+
+struct EpisodeStats
+{
+	EpisodeState open[PRIO_COUNT];
+	UINT32		 ended;
+	UINT32		 durations[EPISODE_BUCKETS];
+	double		 longest;	  // seconds, of the ended episodes
+	double		 byteSeconds; // of the ended episodes
+	UINT64		 peak;
+};
+
+// What the list and the exports show of an entry
+struct EpisodeSummary
+{
+	UINT32 count; // ended and open
+	UINT32 open;
+	double p50; // seconds, of the ended episodes, 0 without any
+	double p99;
+	double longest;		// including the open ones up to 'now'
+	double byteSeconds; // demoted, including the open ones up to 'now'
+	UINT64 peak;
+};
+
+// Need g_critSec
+void EpisodeOnDemoted(UINT32 index, UINT8 prio, UINT64 previous, UINT64 value, INT64 time);
+bool EpisodeSummarize(UINT32 index, INT64 now, EpisodeSummary& summary); // false if the entry was never demoted
+void EpisodeClearProcess(UINT32 index);
+void ResetEpisodes();
+int	 FormatSeconds(double seconds, char* out, int outSize); // "850ms", "12.5s", "4.2m", "1.5h"
@@ -0,0 +1,723 @@
+#include "etl.h"
+#include "synth.h"
+#include "device.h"
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define ETL_MAX_EVENT_ID 512
+#define ETL_MAX_EVENT_VERSIONS 8
+#define ETL_MAX_TEMPLATE_FIELDS 16
+#define ETL_NOT_READ 0xff
+#define ETL_RELEASE_BYTES (64ull << 20) // how often the pages behind the merge are dropped
+
+// Types of the manifest template fields, enough to step over the ones before those the tracker reads
+enum EtlInType : UINT8
+{
+	ETL_UINT8,
+	ETL_UINT16,
+	ETL_UINT32,
+	ETL_UINT64,
+	ETL_POINTER,
+	ETL_UNICODESTRING,
+	ETL_SID,
+};
+
+// Same order as EventFieldType
+static const EtlInType g_etlInTypes[] = { ETL_UINT8, ETL_UINT16, ETL_UINT32, ETL_UINT64, ETL_POINTER, ETL_UNICODESTRING };
+
+struct EtlTemplateField
+{
+	const wchar_t* name;
+	EtlInType	   type;
+};
+
+struct EtlTemplate
+{
+	const EtlTemplateField* fields;
+	int						count;
+	bool					whole; // every field of the version, so the payload ends with the last one
+};
+#define ETL_TEMPLATE(fields) { fields, (int)_countof(fields), false }
+#define ETL_WHOLE_TEMPLATE(fields) { fields, (int)_countof(fields), true }
+
+// Leading fields of the Microsoft-Windows-Kernel-Process templates, up to the last one the tracker reads
+static const EtlTemplateField g_processStartV0[] = {
+	{ L"ProcessID", ETL_UINT32 },
+	{ L"CreateTime", ETL_UINT64 },
+	{ L"ParentProcessID", ETL_UINT32 },
+	{ L"SessionID", ETL_UINT32 },
+	{ L"ImageName", ETL_UNICODESTRING },
+};
+static const EtlTemplateField g_processStartV1[] = {
+	{ L"ProcessID", ETL_UINT32 },
+	{ L"CreateTime", ETL_UINT64 },
+	{ L"ParentProcessID", ETL_UINT32 },
+	{ L"SessionID", ETL_UINT32 },
+	{ L"Flags", ETL_UINT32 },
+	{ L"ImageName", ETL_UNICODESTRING },
+};
+static const EtlTemplateField g_processStartV2[] = {
+	{ L"ProcessID", ETL_UINT32 },
+	{ L"ProcessSequenceNumber", ETL_UINT64 },
+	{ L"CreateTime", ETL_UINT64 },
+	{ L"ParentProcessID", ETL_UINT32 },
+	{ L"ParentProcessSequenceNumber", ETL_UINT64 },
+	{ L"SessionID", ETL_UINT32 },
+	{ L"Flags", ETL_UINT32 },
+	{ L"ImageName", ETL_UNICODESTRING },
+};
+static const EtlTemplateField g_processStartV3[] = {
+	{ L"ProcessID", ETL_UINT32 },
+	{ L"ProcessSequenceNumber", ETL_UINT64 },
+	{ L"CreateTime", ETL_UINT64 },
+	{ L"ParentProcessID", ETL_UINT32 },
+	{ L"ParentProcessSequenceNumber", ETL_UINT64 },
+	{ L"SessionID", ETL_UINT32 },
+	{ L"Flags", ETL_UINT32 },
+	{ L"ProcessTokenElevationType", ETL_UINT32 },
+	{ L"ProcessTokenIsElevated", ETL_UINT32 },
+	{ L"MandatoryLabel", ETL_SID },
+	{ L"ImageName", ETL_UNICODESTRING },
+};
+static const EtlTemplateField g_processStop[] = {
+	{ L"ProcessID", ETL_UINT32 },
+};
+
+// Microsoft-Windows-DxgKrnl templates, whole. Only version 0 is known; the live tracker resolves these fields by
+// name through TDH, the reader has to know their positions, and a payload that does not end with the last field
+// is not decoded rather than read at the wrong offsets.
+static const EtlTemplateField g_reportSegmentV0[] = {
+	{ L"ulSegmentId", ETL_UINT32 },
+	{ L"pDxgAdapter", ETL_POINTER },
+	{ L"BaseAddress", ETL_UINT64 },
+	{ L"CpuTranslatedAddress", ETL_UINT64 },
+	{ L"Size", ETL_UINT64 },
+	{ L"NbOfBanks", ETL_UINT32 },
+	{ L"Flags", ETL_UINT32 },
+	{ L"CommitLimit", ETL_UINT64 },
+	{ L"SystemMemoryEndAddress", ETL_POINTER },
+	{ L"MemorySegmentGroup", ETL_UINT8 },
+};
+static const EtlTemplateField g_usageChangeV0[] = {
+	{ L"NewUsage", ETL_UINT64 },
+	{ L"OldUsage", ETL_UINT64 },
+	{ L"pDxgAdapter", ETL_POINTER },
+	{ L"ProcessId", ETL_UINT32 },
+	{ L"PhysicalAdapterIndex", ETL_UINT16 },
+	{ L"MemorySegmentGroup", ETL_UINT8 },
+};
+static const EtlTemplateField g_commitmentChangeV0[] = {
+	{ L"Commitment", ETL_UINT64 },
+	{ L"OldCommitment", ETL_UINT64 },
+	{ L"pDxgAdapter", ETL_POINTER },
+	{ L"ProcessId", ETL_UINT32 },
+	{ L"PhysicalAdapterIndex", ETL_UINT16 },
+	{ L"MemorySegmentGroup", ETL_UINT8 },
+};
+static const EtlTemplateField g_demotedCommitmentChangeV0[] = {
+	{ L"Commitment", ETL_UINT64 },
+	{ L"OldCommitment", ETL_UINT64 },
+	{ L"pDxgAdapter", ETL_POINTER },
+	{ L"ProcessId", ETL_UINT32 },
+	{ L"PhysicalAdapterIndex", ETL_UINT16 },
+	{ L"PriorityClass", ETL_UINT8 },
+};
+static const EtlTemplateField g_deviceAllocationV0[] = {
+	{ L"hDevice", ETL_POINTER },
+	{ L"pDxgAllocation", ETL_POINTER },
+};
+static const EtlTemplateField g_allocationDetailsV0[] = {
+	{ L"ProcessId", ETL_UINT32 },
+	{ L"pDxgAdapter", ETL_POINTER },
+	{ L"pDxgAllocation", ETL_POINTER },
+	{ L"Size", ETL_UINT64 },
+	{ L"Flags", ETL_UINT32 },
+};
+
+// Indexed by version; the last one also applies to later versions, which only append fields
+static const EtlTemplate g_processStartTemplates[]			  = { ETL_TEMPLATE(g_processStartV0), ETL_TEMPLATE(g_processStartV1), ETL_TEMPLATE(g_processStartV2), ETL_TEMPLATE(g_processStartV3) };
+static const EtlTemplate g_processRundownTemplates[]		  = { ETL_TEMPLATE(g_processStartV1), ETL_TEMPLATE(g_processStartV3) };
+static const EtlTemplate g_processStopTemplates[]			  = { ETL_TEMPLATE(g_processStop) };
+static const EtlTemplate g_reportSegmentTemplates[]			  = { ETL_WHOLE_TEMPLATE(g_reportSegmentV0) };
+static const EtlTemplate g_usageChangeTemplates[]			  = { ETL_WHOLE_TEMPLATE(g_usageChangeV0) };
+static const EtlTemplate g_commitmentChangeTemplates[]		  = { ETL_WHOLE_TEMPLATE(g_commitmentChangeV0) };
+static const EtlTemplate g_demotedCommitmentChangeTemplates[] = { ETL_WHOLE_TEMPLATE(g_demotedCommitmentChangeV0) };
+static const EtlTemplate g_deviceAllocationTemplates[]		  = { ETL_WHOLE_TEMPLATE(g_deviceAllocationV0) };
+static const EtlTemplate g_allocationDetailsTemplates[]		  = { ETL_WHOLE_TEMPLATE(g_allocationDetailsV0) };
+
+static int GetEtlTemplates(const ProcessStartEvent*, const EtlTemplate*& templates)
+{
+	templates = g_processStartTemplates;
+	return (int)_countof(g_processStartTemplates);
+}
+static int GetEtlTemplates(const ProcessRundownEvent*, const EtlTemplate*& templates)
+{
+	templates = g_processRundownTemplates;
+	return (int)_countof(g_processRundownTemplates);
+}
+static int GetEtlTemplates(const ProcessStopEvent*, const EtlTemplate*& templates)
+{
+	templates = g_processStopTemplates;
+	return (int)_countof(g_processStopTemplates);
+}
+static int GetEtlTemplates(const ReportSegmentEvent*, const EtlTemplate*& templates)
+{
+	templates = g_reportSegmentTemplates;
+	return (int)_countof(g_reportSegmentTemplates);
+}
+static int GetEtlTemplates(const VidMmProcessUsageChangeEvent*, const EtlTemplate*& templates)
+{
+	templates = g_usageChangeTemplates;
+	return (int)_countof(g_usageChangeTemplates);
+}
+static int GetEtlTemplates(const VidMmProcessCommitmentChangeEvent*, const EtlTemplate*& templates)
+{
+	templates = g_commitmentChangeTemplates;
+	return (int)_countof(g_commitmentChangeTemplates);
+}
+static int GetEtlTemplates(const VidMmProcessDemotedCommitmentChangeEvent*, const EtlTemplate*& templates)
+{
+	templates = g_demotedCommitmentChangeTemplates;
+	return (int)_countof(g_demotedCommitmentChangeTemplates);
+}
+static int GetEtlTemplates(const DeviceAllocationStartEvent*, const EtlTemplate*& templates)
+{
+	templates = g_deviceAllocationTemplates;
+	return (int)_countof(g_deviceAllocationTemplates);
+}
+static int GetEtlTemplates(const DeviceAllocationStopEvent*, const EtlTemplate*& templates)
+{
+	templates = g_deviceAllocationTemplates;
+	return (int)_countof(g_deviceAllocationTemplates);
+}
+static int GetEtlTemplates(const DeviceAllocationDCStartEvent*, const EtlTemplate*& templates)
+{
+	templates = g_deviceAllocationTemplates;
+	return (int)_countof(g_deviceAllocationTemplates);
+}
+static int GetEtlTemplates(const ProcessAllocationDetailsStartEvent*, const EtlTemplate*& templates)
+{
+	templates = g_allocationDetailsTemplates;
+	return (int)_countof(g_allocationDetailsTemplates);
+}
+static int GetEtlTemplates(const ProcessAllocationDetailsStopEvent*, const EtlTemplate*& templates)
+{
+	templates = g_allocationDetailsTemplates;
+	return (int)_countof(g_allocationDetailsTemplates);
+}
+
+// Where the fields of an event struct are in one version of its template
+struct EtlLayout
+{
+	enum
+	{
+		UNRESOLVED,
+		VALID,
+		INVALID,
+	} state = UNRESOLVED;
+	int	  count;	  // template fields to walk, up to the last one read or all of a whole template
+	bool  exactSize;  // the payload ends with the last field, for a whole template of this very version
+	bool  sizeLogged; // a payload of another size was logged
+	UINT8 types[ETL_MAX_TEMPLATE_FIELDS];
+	UINT8 targets[ETL_MAX_TEMPLATE_FIELDS]; // field of the event struct, ETL_NOT_READ if none
+};
+
+template <typename T>
+static void ResolveEtlLayout(UCHAR version, EtlLayout& layout)
+{
+	layout.state	  = EtlLayout::INVALID;
+	layout.count	  = 0;
+	layout.sizeLogged = false;
+	const EtlTemplate* templates;
+	int				   versions = GetEtlTemplates((const T*)nullptr, templates);
+	const EtlTemplate& tmpl		= templates[std::min((int)version, versions - 1)];
+	if(tmpl.count > ETL_MAX_TEMPLATE_FIELDS)
+		return;
+	layout.exactSize = tmpl.whole && version < versions;
+
+	int found = 0;
+	for(int i = 0; i < tmpl.count; ++i)
+	{
+		layout.types[i]	  = tmpl.fields[i].type;
+		layout.targets[i] = ETL_NOT_READ;
+		for(int f = 0; f < T::FieldCount; ++f)
+		{
+			if(wcscmp(tmpl.fields[i].name, T::Fields()[f].name) != 0)
+				continue;
+			if(g_etlInTypes[T::Fields()[f].type] != tmpl.fields[i].type)
+			{
+				fprintf(g_LogFile, "ETL event %d version %d: field %ls has an unexpected type\n", T::Id, version, tmpl.fields[i].name);
+				return;
+			}
+			layout.targets[i] = (UINT8)f;
+			layout.count	  = i + 1;
+			found++;
+		}
+	}
+	if(found != T::FieldCount)
+	{
+		fprintf(g_LogFile, "ETL event %d version %d: %d of %d fields are not in the template\n", T::Id, version, T::FieldCount - found, T::FieldCount);
+		return;
+	}
+	if(tmpl.whole)
+		layout.count = tmpl.count;
+	layout.state = EtlLayout::VALID;
+}
+
+static wstring g_etlString; // ImageName of the event being dispatched
+
+static void StoreEtlField(const EventField& field, const BYTE* src, UINT32 size, BYTE* out)
+{
+	BYTE* dest = out + field.offset;
+	if(field.type == FIELD_UNICODESTRING)
+	{
+		// UTF-16 in the file, whatever the size of wchar_t
+		g_etlString.clear();
+		for(UINT32 i = 0; i + 2 < size; i += 2)
+			g_etlString += (wchar_t)(src[i] | src[i + 1] << 8);
+		const wchar_t* value = g_etlString.c_str();
+		memcpy(dest, &value, sizeof(value));
+	}
+	else
+	{
+		memset(dest, 0, field.size);
+		memcpy(dest, src, std::min<UINT32>(size, field.size));
+	}
+}
+
+// Walks the template over the user data, as the sizes of SIDs and strings are only known from the data
+template <typename T>
+static bool DecodeEtlEvent(const BYTE* data, UINT32 size, UCHAR version, UINT32 pointerSize, T& out)
+{
+	static_assert(T::FieldCount <= ETL_MAX_TEMPLATE_FIELDS);
+	static EtlLayout layouts[ETL_MAX_EVENT_VERSIONS];
+	version			  = (UCHAR)std::min((int)version, ETL_MAX_EVENT_VERSIONS - 1);
+	EtlLayout& layout = layouts[version];
+	if(layout.state == EtlLayout::UNRESOLVED)
+		ResolveEtlLayout<T>(version, layout);
+	if(layout.state != EtlLayout::VALID)
+		return false;
+
+	UINT32 offset = 0;
+	for(int i = 0; i < layout.count; ++i)
+	{
+		UINT32 fieldSize;
+		switch(layout.types[i])
+		{
+		case ETL_UINT8:
+			fieldSize = 1;
+			break;
+		case ETL_UINT16:
+			fieldSize = 2;
+			break;
+		case ETL_UINT32:
+			fieldSize = 4;
+			break;
+		case ETL_UINT64:
+			fieldSize = 8;
+			break;
+		case ETL_POINTER:
+			fieldSize = pointerSize;
+			break;
+		case ETL_SID:
+			// revision, sub authority count, 6 byte authority and 4 bytes per sub authority
+			if(offset + 2 > size)
+				return false;
+			fieldSize = 8 + 4 * data[offset + 1];
+			break;
+		default:
+		{
+			UINT32 end = offset;
+			while(end + 2 <= size && (data[end] | data[end + 1]))
+				end += 2;
+			fieldSize = end + 2 - offset;
+			break;
+		}
+		}
+		if(offset + fieldSize > size)
+			return false;
+		if(layout.targets[i] != ETL_NOT_READ)
+			StoreEtlField(T::Fields()[layout.targets[i]], data + offset, fieldSize, (BYTE*)&out);
+		offset += fieldSize;
+	}
+	if(layout.exactSize && offset != size)
+	{
+		if(!layout.sizeLogged)
+			fprintf(g_LogFile, "ETL event %d version %d: %u bytes of payload for a template of %u\n", T::Id, version, size, offset);
+		layout.sizeLogged = true;
+		return false;
+	}
+	return true;
+}
+
+// Decodes into a SynthEvent and dispatches it, false if it could not be decoded
+typedef bool (*EtlHandler)(UCHAR version, const BYTE* data, UINT32 size, UINT32 pointerSize, INT64 time);
+static EtlHandler g_etlProcessHandlers[ETL_MAX_EVENT_ID];
+static EtlHandler g_etlDxgKrnlHandlers[ETL_MAX_EVENT_ID];
+
+template <typename T, T SynthEvent::*Member, SynthEventType Type>
+static bool DispatchEtlEvent(UCHAR version, const BYTE* data, UINT32 size, UINT32 pointerSize, INT64 time)
+{
+	SynthEvent e;
+	memset(&e, 0, sizeof(e));
+	e.time = time;
+	e.type = Type;
+	if(!DecodeEtlEvent(data, size, version, pointerSize, e.*Member))
+		return false;
+	DispatchSynthEvent(e);
+	return true;
+}
+
+template <typename T, T SynthEvent::*Member, SynthEventType Type>
+static void RegisterEtlHandler()
+{
+	static_assert(T::Id < ETL_MAX_EVENT_ID);
+	EtlHandler* table = IsEqualGUID(T::Provider(), DxgKrnlGuid) ? g_etlDxgKrnlHandlers : g_etlProcessHandlers;
+	table[T::Id]	  = DispatchEtlEvent<T, Member, Type>;
+}
+
+static void RegisterEtlHandlers()
+{
+	RegisterEtlHandler<ProcessStartEvent, &SynthEvent::processStart, SYNTH_PROCESS_START>();
+	RegisterEtlHandler<ProcessRundownEvent, &SynthEvent::processRundown, SYNTH_PROCESS_RUNDOWN>();
+	RegisterEtlHandler<ProcessStopEvent, &SynthEvent::processStop, SYNTH_PROCESS_STOP>();
+	RegisterEtlHandler<ReportSegmentEvent, &SynthEvent::reportSegment, SYNTH_REPORT_SEGMENT>();
+	RegisterEtlHandler<VidMmProcessUsageChangeEvent, &SynthEvent::usageChange, SYNTH_USAGE_CHANGE>();
+	RegisterEtlHandler<VidMmProcessCommitmentChangeEvent, &SynthEvent::commitmentChange, SYNTH_COMMITMENT_CHANGE>();
+	RegisterEtlHandler<VidMmProcessDemotedCommitmentChangeEvent, &SynthEvent::demotedCommitmentChange, SYNTH_DEMOTED_COMMITMENT_CHANGE>();
+	if(!g_deviceEvents)
+		return;
+	RegisterEtlHandler<DeviceAllocationStartEvent, &SynthEvent::deviceAllocationStart, SYNTH_DEVICE_ALLOCATION_START>();
+	RegisterEtlHandler<DeviceAllocationStopEvent, &SynthEvent::deviceAllocationStop, SYNTH_DEVICE_ALLOCATION_STOP>();
+	RegisterEtlHandler<DeviceAllocationDCStartEvent, &SynthEvent::deviceAllocationRundown, SYNTH_DEVICE_ALLOCATION_RUNDOWN>();
+	RegisterEtlHandler<ProcessAllocationDetailsStartEvent, &SynthEvent::allocationDetailsStart, SYNTH_ALLOCATION_DETAILS_START>();
+	RegisterEtlHandler<ProcessAllocationDetailsStopEvent, &SynthEvent::allocationDetailsStop, SYNTH_ALLOCATION_DETAILS_STOP>();
+}
+
+static EtlHandler FindEtlHandler(const EtlEventHeader& header)
+{
+	if(header.id >= ETL_MAX_EVENT_ID)
+		return nullptr;
+	if(IsEqualGUID(header.providerId, DxgKrnlGuid))
+		return g_etlDxgKrnlHandlers[header.id];
+	if(IsEqualGUID(header.providerId, KernelProcessGuid))
+		return g_etlProcessHandlers[header.id];
+	return nullptr;
+}
+
+// The rest of one buffer; header, data and handler describe the next event with a handler
+struct EtlCursor
+{
+	const BYTE*	   pos;
+	const BYTE*	   end;
+	const BYTE*	   buffer;
+	UINT64		   order; // buffer number, events with the same timestamp keep the file order
+	EtlEventHeader header;
+	const BYTE*	   data;
+	UINT32		   dataSize;
+	UINT32		   pointerSize;
+	EtlHandler	   handler;
+};
+
+// Moves to the next event with a handler, false at the end of the buffer
+static bool NextEtlEvent(EtlCursor& c, EtlStats& stats)
+{
+	while(c.end - c.pos >= 8)
+	{
+		const BYTE* event = c.pos;
+		UINT32		marker;
+		memcpy(&marker, event, sizeof(marker));
+		if(marker == 0xffffffff || !(event[3] & ETL_HEADER_FLAG_TRACE))
+			return false; // padding after the last event
+
+		// The size is the first field, but the system headers start with a version
+		UINT8  type			= event[2];
+		bool   systemHeader = type <= ETL_HEADER_COMPACT64 || type == ETL_HEADER_PERFINFO32 || type == ETL_HEADER_PERFINFO64;
+		UINT16 size;
+		memcpy(&size, event + (systemHeader ? 4 : 0), sizeof(size));
+		if(size < 8 || size > c.end - event)
+			return false;
+		c.pos += (size + 7) & ~7;
+		stats.events++;
+		if((type != ETL_HEADER_EVENT_HEADER32 && type != ETL_HEADER_EVENT_HEADER64) || size < sizeof(EtlEventHeader))
+			continue;
+		memcpy(&c.header, event, sizeof(EtlEventHeader));
+		c.handler = FindEtlHandler(c.header);
+		if(!c.handler)
+			continue;
+
+		UINT32 offset = sizeof(EtlEventHeader);
+		bool   ok	  = true;
+		if(c.header.flags & ETL_EVENT_FLAG_EXTENDED_INFO)
+		{
+			EtlExtendedItem item;
+			do
+			{
+				ok = offset + sizeof(item) <= size;
+				if(!ok)
+					break;
+				memcpy(&item, event + offset, sizeof(item));
+				offset += (sizeof(item) + item.dataSize + 7) & ~7;
+			} while(item.linkage & 1);
+		}
+		if(!ok || offset > size)
+		{
+			stats.undecoded++;
+			continue;
+		}
+		c.data		  = event + offset;
+		c.dataSize	  = size - offset;
+		c.pointerSize = (c.header.flags & ETL_EVENT_FLAG_32_BIT_HEADER) ? 4 : 8;
+		return true;
+	}
+	return false;
+}
+
+struct EtlFile
+{
+	const BYTE* data	 = nullptr;
+	UINT64		size	 = 0;
+	UINT64		released = 0; // pages below were dropped
+	HANDLE		mapping	 = nullptr;
+};
+
+static bool MapEtlFile(const char* path, EtlFile& file)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(handle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	HANDLE		  mapping = nullptr;
+	if(GetFileSizeEx(handle, &size) && size.QuadPart >= (LONGLONG)sizeof(EtlBufferHeader))
+		mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	CloseHandle(handle);
+	if(!view)
+	{
+		if(mapping)
+			CloseHandle(mapping);
+		return false;
+	}
+	file.mapping = mapping;
+	file.size	 = (UINT64)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	void*		view = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(EtlBufferHeader))
+		view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(view == MAP_FAILED)
+		return false;
+	madvise(view, st.st_size, MADV_SEQUENTIAL);
+	file.size = (UINT64)st.st_size;
+#endif
+	file.data	  = (const BYTE*)view;
+	file.released = 0;
+	return true;
+}
+
+static void UnmapEtlFile(EtlFile& file)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+#else
+	munmap((void*)file.data, file.size);
+#endif
+	file.data = nullptr;
+}
+
+// Drops the mapped pages below 'end', which the merge is done with. They are clean, so this only takes them
+// out of the working set.
+static void ReleaseEtlPages(EtlFile& file, UINT64 end)
+{
+	end &= ~(UINT64)0xffff;
+	if(end <= file.released)
+		return;
+#ifdef _WIN32
+	VirtualUnlock((void*)(file.data + file.released), end - file.released);
+#else
+	madvise((void*)(file.data + file.released), end - file.released, MADV_DONTNEED);
+#endif
+	file.released = end;
+}
+
+// The file starts with a buffer whose first event is the TRACE_LOGFILE_HEADER, which has the clock
+static bool ReadEtlLogfileHeader(const EtlFile& file, EtlStats& stats)
+{
+	EtlBufferHeader buffer;
+	EtlSystemHeader header;
+	memcpy(&buffer, file.data, sizeof(buffer));
+	if(buffer.bufferSize < sizeof(buffer) + sizeof(header) || buffer.bufferSize > file.size)
+		return false;
+	memcpy(&header, file.data + sizeof(buffer), sizeof(header));
+	if(!(header.headerFlags & ETL_HEADER_FLAG_TRACE) || (header.headerType != ETL_HEADER_SYSTEM32 && header.headerType != ETL_HEADER_SYSTEM64) ||
+	   header.hookId != 0 || header.size < sizeof(header) || header.size > buffer.bufferSize - sizeof(buffer))
+		return false;
+
+	const BYTE* payload		= file.data + sizeof(buffer) + sizeof(header);
+	UINT32		payloadSize = header.size - sizeof(header);
+	UINT32		pointerSize = header.headerType == ETL_HEADER_SYSTEM64 ? 8 : 4;
+	if(payloadSize >= ETL_LOGFILE_POINTER_SIZE + 4)
+	{
+		UINT32 size;
+		memcpy(&size, payload + ETL_LOGFILE_POINTER_SIZE, sizeof(size));
+		if(size == 4 || size == 8)
+			pointerSize = size;
+	}
+	if(payloadSize < ETL_LOGFILE_SIZE(pointerSize))
+		return false;
+
+	UINT32 processors, cpuSpeed, clockType;
+	INT64  perfFrequency;
+	memcpy(&processors, payload + ETL_LOGFILE_NUMBER_OF_PROCESSORS, sizeof(processors));
+	memcpy(&cpuSpeed, payload + ETL_LOGFILE_CPU_SPEED, sizeof(cpuSpeed));
+	memcpy(&perfFrequency, payload + ETL_LOGFILE_PERF_FREQ(pointerSize), sizeof(perfFrequency));
+	memcpy(&clockType, payload + ETL_LOGFILE_CLOCK_TYPE(pointerSize), sizeof(clockType));
+	if(clockType == ETL_CLOCK_SYSTEM_TIME)
+		stats.frequency = 10000000;
+	else if(clockType == ETL_CLOCK_CPU_CYCLES)
+		stats.frequency = (INT64)cpuSpeed * 1000000;
+	else
+		stats.frequency = perfFrequency;
+	stats.processors  = processors;
+	stats.pointerSize = pointerSize;
+	return stats.frequency > 0;
+}
+
+static bool ParseEtlFile(EtlFile& file, EtlStats& stats)
+{
+	if(!ReadEtlLogfileHeader(file, stats))
+		return false;
+	// Again for each file, as g_deviceEvents may have changed
+	memset(g_etlDxgKrnlHandlers, 0, sizeof(g_etlDxgKrnlHandlers));
+	RegisterEtlHandlers();
+
+	// Cursors are kept in a heap on their next event's timestamp. Buffers are read ahead until there are
+	// ETL_MERGE_BUFFERS of them with events left, which is what bounds the reordering, and the memory.
+	std::vector<EtlCursor> cursors(ETL_MERGE_BUFFERS);
+	std::vector<UINT32>	   heap;
+	std::vector<UINT32>	   unused;
+	for(UINT32 i = ETL_MERGE_BUFFERS; i > 0; --i)
+		unused.push_back(i - 1);
+	auto Later = [&](UINT32 a, UINT32 b)
+	{
+		const EtlCursor& ca = cursors[a];
+		const EtlCursor& cb = cursors[b];
+		if(ca.header.timeStamp != cb.header.timeStamp)
+			return ca.header.timeStamp > cb.header.timeStamp;
+		return ca.order > cb.order;
+	};
+
+	double ratio	 = (double)g_qpcFrequency / stats.frequency;
+	UINT64 next		 = 0; // file offset of the next buffer
+	UINT64 releaseAt = ETL_RELEASE_BYTES;
+	bool   first	 = true;
+	while(1)
+	{
+		while(unused.size() && next + sizeof(EtlBufferHeader) <= file.size)
+		{
+			EtlBufferHeader header;
+			memcpy(&header, file.data + next, sizeof(header));
+			if(header.bufferSize < sizeof(header) || header.bufferSize > file.size - next)
+			{
+				// without a valid size the next buffer cannot be found
+				stats.skippedBuffers++;
+				next = file.size;
+				break;
+			}
+			const BYTE* buffer = file.data + next;
+			next += header.bufferSize;
+			stats.buffers++;
+			if(header.bufferFlag & ETL_BUFFER_FLAG_COMPRESSED)
+			{
+				stats.skippedBuffers++;
+				continue;
+			}
+			UINT32 end = std::max(header.offset, header.savedOffset);
+			if(end < sizeof(header) || end > header.bufferSize)
+				end = header.bufferSize;
+			UINT32 processor = (header.bufferFlag & ETL_BUFFER_FLAG_PROCESSOR_INDEX) ? header.processorIndex : header.processorIndex & 0xff;
+			stats.processors = std::max(stats.processors, processor + 1);
+
+			EtlCursor& c = cursors[unused.back()];
+			c.pos		 = buffer + sizeof(header);
+			c.end		 = buffer + end;
+			c.buffer	 = buffer;
+			c.order		 = stats.buffers;
+			if(!NextEtlEvent(c, stats))
+				continue;
+			heap.push_back(unused.back());
+			unused.pop_back();
+			std::push_heap(heap.begin(), heap.end(), Later);
+		}
+		if(heap.empty())
+			break;
+
+		std::pop_heap(heap.begin(), heap.end(), Later);
+		UINT32	   index = heap.back();
+		EtlCursor& c	 = cursors[index];
+		INT64	   time	 = c.header.timeStamp;
+		if(first)
+			stats.firstTime = stats.lastTime = time;
+		first = false;
+		if(time < stats.lastTime)
+			stats.lateEvents++;
+		else
+			stats.lastTime = time;
+		// Times are rebased to the first event and converted to g_qpcFrequency ticks
+		INT64 ticks = 1 + (INT64)((double)(std::max(time, stats.firstTime) - stats.firstTime) * ratio);
+		if(c.handler(c.header.version, c.data, c.dataSize, c.pointerSize, ticks))
+			stats.dispatched++;
+		else
+			stats.undecoded++;
+
+		if(NextEtlEvent(c, stats))
+			std::push_heap(heap.begin(), heap.end(), Later);
+		else
+		{
+			heap.pop_back();
+			unused.push_back(index);
+		}
+
+		if(next >= releaseAt)
+		{
+			const BYTE* oldest = file.data + next;
+			for(UINT32 i : heap)
+				oldest = std::min(oldest, cursors[i].buffer);
+			ReleaseEtlPages(file, oldest - file.data);
+			releaseAt = next + ETL_RELEASE_BYTES;
+		}
+	}
+	FlushMemoryUpdates(t_batch);
+	stats.bytes = next;
+	return true;
+}
+
+bool ReadEtlFile(const char* path, EtlStats& stats)
+{
+	stats = EtlStats();
+	EtlFile file;
+	if(!MapEtlFile(path, file))
+	{
+		fprintf(g_LogFile, "Failed to map '%s'\n", path);
+		return false;
+	}
+	bool ok = ParseEtlFile(file, stats);
+	if(!ok)
+		fprintf(g_LogFile, "'%s' does not start with an ETW logfile header\n", path);
+	UnmapEtlFile(file);
+	return ok;
+}
@@ -0,0 +1,136 @@
+#pragma once
+// Reader of the .etl files written by WPR, xperf or any other ETW file session, without TDH or OpenTrace
+//  the file is mapped and walked one WMI buffer at a time. A buffer holds the events of one processor in time
+//  order and buffers are written out as they fill, so the buffers read so far are merged by timestamp. Only
+//  the Kernel-Process and DxgKrnl events the tracker handles are decoded, with their manifest field layouts
+//  built in, and they go through DispatchSynthEvent like a replay.
+#include "tracker.h"
+
+#define ETL_MERGE_BUFFERS 1024 // buffers read ahead of the oldest unfinished one
+
+// Raw layouts, as they are in the file
+
+// WMI_BUFFER_HEADER, at the start of every buffer
+struct EtlBufferHeader
+{
+	UINT32 bufferSize;
+	UINT32 savedOffset;
+	UINT32 currentOffset;
+	UINT32 referenceCount;
+	INT64  timeStamp;
+	INT64  sequenceNumber;
+	UINT64 clock;
+	UINT16 processorIndex; // only the low byte is the processor without ETL_BUFFER_FLAG_PROCESSOR_INDEX
+	UINT16 loggerId;
+	UINT32 state;
+	UINT32 offset; // end of the events
+	UINT16 bufferFlag;
+	UINT16 bufferType;
+	UINT64 reserved[2];
+};
+static_assert(sizeof(EtlBufferHeader) == 72, "fixed layout");
+
+#define ETL_BUFFER_FLAG_PROCESSOR_INDEX 0x20
+#define ETL_BUFFER_FLAG_COMPRESSED 0x40
+
+// The third byte of every event is its header type, the fourth has ETL_HEADER_FLAG_TRACE set
+enum EtlHeaderType : UINT8
+{
+	ETL_HEADER_SYSTEM32		  = 1,
+	ETL_HEADER_SYSTEM64		  = 2,
+	ETL_HEADER_COMPACT32	  = 3,
+	ETL_HEADER_COMPACT64	  = 4,
+	ETL_HEADER_PERFINFO32	  = 16,
+	ETL_HEADER_PERFINFO64	  = 17,
+	ETL_HEADER_EVENT_HEADER32 = 18,
+	ETL_HEADER_EVENT_HEADER64 = 19,
+};
+
+#define ETL_HEADER_FLAG_TRACE 0x80
+
+// SYSTEM_TRACE_HEADER of the kernel logger events, like the TRACE_LOGFILE_HEADER event opening the file
+struct EtlSystemHeader
+{
+	UINT16 version;
+	UINT8  headerType;
+	UINT8  headerFlags;
+	UINT16 size;
+	UINT16 hookId;
+	UINT32 threadId;
+	UINT32 processId;
+	INT64  systemTime;
+	UINT32 kernelTime;
+	UINT32 userTime;
+};
+static_assert(sizeof(EtlSystemHeader) == 32, "fixed layout");
+
+// EVENT_HEADER of the manifest based events, followed by the extended data items and the user data
+struct EtlEventHeader
+{
+	UINT16 size; // of the whole event
+	UINT8  headerType;
+	UINT8  headerFlags;
+	UINT16 flags;
+	UINT16 eventProperty;
+	UINT32 threadId;
+	UINT32 processId;
+	INT64  timeStamp;
+	GUID   providerId;
+	UINT16 id;
+	UINT8  version;
+	UINT8  channel;
+	UINT8  level;
+	UINT8  opcode;
+	UINT16 task;
+	UINT64 keyword;
+	UINT64 processorTime;
+	GUID   activityId;
+};
+static_assert(sizeof(EtlEventHeader) == 80, "fixed layout");
+
+#define ETL_EVENT_FLAG_EXTENDED_INFO 0x0001
+#define ETL_EVENT_FLAG_32_BIT_HEADER 0x0020
+
+// Each item is padded to 8 bytes, the next one follows while linkage is 1
+struct EtlExtendedItem
+{
+	UINT16 reserved;
+	UINT16 extType;
+	UINT16 linkage;
+	UINT16 dataSize;
+};
+
+// Fields of the TRACE_LOGFILE_HEADER payload read by the parser; the ones after the two logger name
+// pointers move with the pointer size of the logger
+#define ETL_LOGFILE_NUMBER_OF_PROCESSORS 12
+#define ETL_LOGFILE_POINTER_SIZE 44
+#define ETL_LOGFILE_CPU_SPEED 52
+#define ETL_LOGFILE_PERF_FREQ(pointerSize) ((pointerSize) == 8 ? 256 : 248)
+#define ETL_LOGFILE_CLOCK_TYPE(pointerSize) ((pointerSize) == 8 ? 272 : 264)
+#define ETL_LOGFILE_SIZE(pointerSize) ((pointerSize) == 8 ? 280 : 272)
+
+enum EtlClockType
+{
+	ETL_CLOCK_QPC		  = 1,
+	ETL_CLOCK_SYSTEM_TIME = 2,
+	ETL_CLOCK_CPU_CYCLES  = 3,
+};
+
+struct EtlStats
+{
+	UINT64 bytes		  = 0;
+	UINT64 buffers		  = 0;
+	UINT64 skippedBuffers = 0; // compressed, or with an invalid header
+	UINT64 events		  = 0;
+	UINT64 dispatched	  = 0;
+	UINT64 undecoded	  = 0; // handled events with an unknown version or a payload too short for it
+	UINT64 lateEvents	  = 0; // older than an event already dispatched, their buffer came too late for the merge
+	UINT32 processors	  = 0;
+	UINT32 pointerSize	  = 0;
+	INT64  frequency	  = 0; // of the timestamps in the file
+	INT64  firstTime	  = 0;
+	INT64  lastTime		  = 0;
+};
+
+// Maps the file and feeds its events to the handlers, false if it is not an ETL file
+bool ReadEtlFile(const char* path, EtlStats& stats);
@@ -0,0 +1,240 @@
+#pragma once
+#include "platform.h"
+#include <stddef.h>
+
+// Microsoft-Windows-DxgKrnl provider GUID
+// {802ec45a-1e99-4b83-9920-87c98277ba9d}
+inline constexpr GUID DxgKrnlGuid = { 0x802ec45a, 0x1e99, 0x4b83, { 0x99, 0x20, 0x87, 0xc9, 0x82, 0x77, 0xba, 0x9d } };
+
+// Microsoft-Windows-Kernel-Process provider GUID
+// {22FB2CD6-0E7B-422B-A0C7-2FAD1FD0E716}
+inline constexpr GUID KernelProcessGuid = { 0x22FB2CD6, 0x0E7B, 0x422B, { 0xA0, 0xC7, 0x2F, 0xAD, 0x1F, 0xD0, 0xE7, 0x16 } };
+
+// Kernel Process event IDs
+enum KernelProcessEventIds
+{
+	ProcessStart   = 1,
+	ProcessStop	   = 2,
+	ProcessRundown = 15, // DCStart - enumerates already-running processes
+};
+
+enum DxgKrnlEventIds
+{
+	// AdapterAllocation events (keyword: Resource 0x40)
+	AdapterAllocation_Start	  = 33,
+	AdapterAllocation_Stop	  = 34,
+	AdapterAllocation_DCStart = 35,
+
+	// DeviceAllocation events (keyword: Resource 0x40)
+	DeviceAllocation_Start	 = 36,
+	DeviceAllocation_Stop	 = 37,
+	DeviceAllocation_DCStart = 38,
+
+	// Other allocation events
+	TerminateAllocation		   = 39,
+	ProcessTerminateAllocation = 40,
+
+	// ReferenceAllocations (keyword: References 0x4) - frequently seen
+	ReferenceAllocations = 43,
+
+	Adapter_Start	= 24,
+	Adapter_Stop	= 25,
+	Adapter_DCStart = 26,
+
+	RenameAllocation_Start = 64,
+	RenameAllocation_Stop  = 65,
+	ReportSegment_Info	   = 78,
+
+	DpiReportAdapter_Info = 110,
+
+	// Memory events (keyword: Memory)
+	ProcessAllocation_Start = 225,
+	ProcessAllocation_Stop	= 226,
+
+	// ProcessAllocationDetails (keyword: Resource 0x40)
+	ProcessAllocationDetails_Start = 288,
+	ProcessAllocationDetails_Stop  = 289,
+
+	// RecycleRangeTracking (keyword: 0x80) - memory range management
+	RecycleRangeTracking_Info1 = 301,
+	RecycleRangeTracking_Info2 = 302,
+	RecycleRangeTracking_Info3 = 303,
+
+	// VidMm events (keyword: References 0x4)
+	VidMmMakeResident = 320,
+	VidMmEvict		  = 321,
+
+	VidMmProcessBudgetChange			= 366,
+	VidMmProcessUsageChange				= 367,
+	VidMmProcessDemotedCommitmentChange = 370,
+	VidMmProcessCommitmentChange		= 371,
+
+	VidMmMakeResident_DCStart	= 374,
+	TransferAllocationOwnership = 373,
+
+};
+
+// Event schemas
+//  each handled event is described once, as a list of the fields we read. DECLARE_EVENT turns
+//  that into a typed struct with a constexpr field table. The first event seen for each
+//  version resolves the field offsets in UserData through TDH and validates their sizes,
+//  after which decoding is a handful of fixed-size loads.
+enum EventFieldType
+{
+	FIELD_UINT8,
+	FIELD_UINT16,
+	FIELD_UINT32,
+	FIELD_UINT64,
+	FIELD_POINTER,
+	FIELD_UNICODESTRING, // decoded as a pointer into UserData, only valid during the callback
+};
+
+template <typename T>
+struct EventFieldTypeOf;
+template <>
+struct EventFieldTypeOf<UINT8>
+{
+	static constexpr EventFieldType value = FIELD_UINT8;
+};
+template <>
+struct EventFieldTypeOf<UINT16>
+{
+	static constexpr EventFieldType value = FIELD_UINT16;
+};
+template <>
+struct EventFieldTypeOf<UINT32>
+{
+	static constexpr EventFieldType value = FIELD_UINT32;
+};
+template <>
+struct EventFieldTypeOf<UINT64>
+{
+	static constexpr EventFieldType value = FIELD_UINT64;
+};
+template <>
+struct EventFieldTypeOf<PVOID>
+{
+	static constexpr EventFieldType value = FIELD_POINTER;
+};
+template <>
+struct EventFieldTypeOf<const wchar_t*>
+{
+	static constexpr EventFieldType value = FIELD_UNICODESTRING;
+};
+
+struct EventField
+{
+	const wchar_t* name;
+	EventFieldType type;
+	USHORT		   offset; // in the decoded struct
+	USHORT		   size;
+};
+
+#define EVENT_STRUCT_MEMBER(type, name) type name;
+#define EVENT_FIELD_DESC(type, name) { L## #name, EventFieldTypeOf<type>::value, (USHORT)offsetof(EventStruct, name), (USHORT)sizeof(type) },
+#define DECLARE_EVENT(structName, provider, id, FIELDS)                       \
+	struct structName                                                         \
+	{                                                                         \
+		FIELDS(EVENT_STRUCT_MEMBER)                                           \
+		static constexpr USHORT Id = id;                                      \
+		static const GUID&		Provider()                                    \
+		{                                                                     \
+			return provider;                                                  \
+		}                                                                     \
+		static const EventField* Fields();                                    \
+		static constexpr int	 FieldCount = 0 FIELDS(EVENT_FIELD_COUNT_ONE); \
+	};                                                                        \
+	inline const EventField* structName::Fields()                             \
+	{                                                                         \
+		typedef structName		EventStruct;                                  \
+		static const EventField fields[] = { FIELDS(EVENT_FIELD_DESC) };      \
+		return fields;                                                        \
+	}
+#define EVENT_FIELD_COUNT_ONE(type, name) +1
+
+#define PROCESS_START_FIELDS(F)	  \
+	F(UINT32, ProcessID)		  \
+	F(UINT32, ParentProcessID)	  \
+	F(const wchar_t*, ImageName)
+DECLARE_EVENT(ProcessStartEvent, KernelProcessGuid, ProcessStart, PROCESS_START_FIELDS)
+DECLARE_EVENT(ProcessRundownEvent, KernelProcessGuid, ProcessRundown, PROCESS_START_FIELDS)
+
+#define PROCESS_STOP_FIELDS(F) F(UINT32, ProcessID)
+DECLARE_EVENT(ProcessStopEvent, KernelProcessGuid, ProcessStop, PROCESS_STOP_FIELDS)
+
+#define VIDMM_PROCESS_BUDGET_CHANGE_FIELDS(F) \
+	F(UINT64, NewBudget)					  \
+	F(UINT64, OldBudget)					  \
+	F(PVOID, pDxgAdapter)					  \
+	F(UINT32, ProcessId)					  \
+	F(UINT16, PhysicalAdapterIndex)			  \
+	F(UINT8, NewPriorityBand)				  \
+	F(UINT8, OldPriorityBand)				  \
+	F(UINT8, NewVisibilityState)			  \
+	F(UINT8, OldVisibilityState)			  \
+	F(UINT8, MemorySegmentGroup)
+DECLARE_EVENT(VidMmProcessBudgetChangeEvent, DxgKrnlGuid, VidMmProcessBudgetChange, VIDMM_PROCESS_BUDGET_CHANGE_FIELDS)
+
+#define VIDMM_PROCESS_USAGE_CHANGE_FIELDS(F) \
+	F(UINT64, NewUsage)						 \
+	F(UINT64, OldUsage)						 \
+	F(PVOID, pDxgAdapter)					 \
+	F(UINT32, ProcessId)					 \
+	F(UINT16, PhysicalAdapterIndex)			 \
+	F(UINT8, MemorySegmentGroup)
+DECLARE_EVENT(VidMmProcessUsageChangeEvent, DxgKrnlGuid, VidMmProcessUsageChange, VIDMM_PROCESS_USAGE_CHANGE_FIELDS)
+
+#define VIDMM_PROCESS_DEMOTED_COMMITMENT_CHANGE_FIELDS(F) \
+	F(UINT64, Commitment)								  \
+	F(UINT64, OldCommitment)							  \
+	F(PVOID, pDxgAdapter)								  \
+	F(UINT32, ProcessId)								  \
+	F(UINT16, PhysicalAdapterIndex)						  \
+	F(UINT8, PriorityClass)
+DECLARE_EVENT(VidMmProcessDemotedCommitmentChangeEvent, DxgKrnlGuid, VidMmProcessDemotedCommitmentChange, VIDMM_PROCESS_DEMOTED_COMMITMENT_CHANGE_FIELDS)
+
+#define VIDMM_PROCESS_COMMITMENT_CHANGE_FIELDS(F) \
+	F(UINT64, Commitment)						  \
+	F(UINT64, OldCommitment)					  \
+	F(PVOID, pDxgAdapter)						  \
+	F(UINT32, ProcessId)						  \
+	F(UINT16, PhysicalAdapterIndex)				  \
+	F(UINT8, MemorySegmentGroup)
+DECLARE_EVENT(VidMmProcessCommitmentChangeEvent, DxgKrnlGuid, VidMmProcessCommitmentChange, VIDMM_PROCESS_COMMITMENT_CHANGE_FIELDS)
+
+#define REPORT_SEGMENT_FIELDS(F)	 \
+	F(UINT32, ulSegmentId)			 \
+	F(PVOID, pDxgAdapter)			 \
+	F(UINT64, BaseAddress)			 \
+	F(UINT64, CpuTranslatedAddress) \
+	F(UINT64, Size)					 \
+	F(UINT32, NbOfBanks)			 \
+	F(UINT32, Flags)				 \
+	F(UINT64, CommitLimit)			 \
+	F(PVOID, SystemMemoryEndAddress) \
+	F(UINT8, MemorySegmentGroup)
+DECLARE_EVENT(ReportSegmentEvent, DxgKrnlGuid, ReportSegment_Info, REPORT_SEGMENT_FIELDS)
+
+#define DPI_REPORT_ADAPTER_FIELDS(F) \
+	F(PVOID, pDxgAdapter)			 \
+	F(UINT64, AdapterLuid)
+DECLARE_EVENT(DpiReportAdapterEvent, DxgKrnlGuid, DpiReportAdapter_Info, DPI_REPORT_ADAPTER_FIELDS)
+
+// The device an allocation was made through; hDevice is the kernel handle of the process's D3D device. This and
+// the details below are not checked against the manifest yet, they are only decoded with --devices (device.h).
+#define DEVICE_ALLOCATION_FIELDS(F) \
+	F(PVOID, hDevice)				\
+	F(PVOID, pDxgAllocation)
+DECLARE_EVENT(DeviceAllocationStartEvent, DxgKrnlGuid, DeviceAllocation_Start, DEVICE_ALLOCATION_FIELDS)
+DECLARE_EVENT(DeviceAllocationStopEvent, DxgKrnlGuid, DeviceAllocation_Stop, DEVICE_ALLOCATION_FIELDS)
+DECLARE_EVENT(DeviceAllocationDCStartEvent, DxgKrnlGuid, DeviceAllocation_DCStart, DEVICE_ALLOCATION_FIELDS)
+
+// The owner, size and DXGK_ALLOCATIONINFOFLAGS of an allocation
+#define PROCESS_ALLOCATION_DETAILS_FIELDS(F) \
+	F(UINT32, ProcessId)					 \
+	F(PVOID, pDxgAdapter)					 \
+	F(PVOID, pDxgAllocation)				 \
+	F(UINT64, Size)							 \
+	F(UINT32, Flags)
+DECLARE_EVENT(ProcessAllocationDetailsStartEvent, DxgKrnlGuid, ProcessAllocationDetails_Start, PROCESS_ALLOCATION_DETAILS_FIELDS)
+DECLARE_EVENT(ProcessAllocationDetailsStopEvent, DxgKrnlGuid, ProcessAllocationDetails_Stop, PROCESS_ALLOCATION_DETAILS_FIELDS)
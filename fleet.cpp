@@ -0,0 +1,759 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include "fleet.h"
+#include "render.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define CloseSocket closesocket
+#define SEND_FLAGS 0
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define CloseSocket close
+#define SEND_FLAGS MSG_NOSIGNAL // a collector gone away is a failed send, not a SIGPIPE
+typedef int SOCKET;
+#endif
+
+static void StartSockets()
+{
+#ifdef _WIN32
+	static bool started = false;
+	if(!started)
+	{
+		WSADATA data;
+		started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}
+#endif
+}
+
+static void AppendBytes(std::vector<UINT8>& out, const void* data, size_t size)
+{
+	size_t at = out.size();
+	out.resize(at + size);
+	memcpy(out.data() + at, data, size);
+}
+
+static size_t BeginFrame(std::vector<UINT8>& out, FleetFrameType type)
+{
+	size_t			 start	= out.size();
+	FleetFrameHeader header = { FLEET_MAGIC, (UINT16)type, 0, 0 };
+	AppendBytes(out, &header, sizeof(header));
+	return start;
+}
+
+static void EndFrame(std::vector<UINT8>& out, size_t start)
+{
+	UINT32 length = (UINT32)(out.size() - start - sizeof(FleetFrameHeader));
+	memcpy(&out[start] + offsetof(FleetFrameHeader, length), &length, sizeof(length));
+}
+
+static void EntryValues(const SnapshotEntry& e, UINT64* values)
+{
+	values[0] = e.usageLocal;
+	values[1] = e.commitmentLocal;
+	values[2] = e.usageNonLocal;
+	values[3] = e.commitmentNonLocal;
+	for(int i = 0; i < PRIO_COUNT; ++i)
+		values[4 + i] = e.demoted[i];
+}
+
+// One record, nothing if the entry did not change. 'sent' is null for an entry the collector does not have.
+static bool EncodeRecord(const SnapshotEntry* sent, const SnapshotEntry& current, bool removed, std::vector<UINT8>& out)
+{
+	FleetRecordHeader header = { current.pid, (UINT64)current.pDxgAdapter, 0, 0 };
+	UINT64			  values[FLEET_FIELD_COUNT];
+	UINT64			  sentValues[FLEET_FIELD_COUNT] = {};
+	EntryValues(current, values);
+	if(removed)
+		header.flags = FLEET_REMOVED;
+	else
+	{
+		if(sent)
+			EntryValues(*sent, sentValues);
+		for(int i = 0; i < FLEET_FIELD_COUNT; ++i)
+		{
+			if(values[i] != sentValues[i])
+				header.fieldMask |= 1 << i;
+		}
+		header.flags = current.tracked ? FLEET_TRACKED : 0;
+		if(current.name.size() && (!sent || sent->name != current.name))
+			header.flags |= FLEET_NAME;
+		if(sent && !header.fieldMask && !(header.flags & FLEET_NAME) && sent->tracked == current.tracked)
+			return false;
+	}
+
+	AppendBytes(out, &header, sizeof(header));
+	for(int i = 0; i < FLEET_FIELD_COUNT; ++i)
+	{
+		if(header.fieldMask & (1 << i))
+			AppendBytes(out, &values[i], sizeof(UINT64));
+	}
+	if(header.flags & FLEET_NAME)
+	{
+		// A length byte, then up to 255 characters. The terminator is forced in case the conversion failed on a
+		// longer name.
+		char name[1 + 256];
+		ToNarrow(current.name.c_str(), name + 1, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+		UINT8 length		   = (UINT8)strlen(name + 1);
+		name[0]				   = (char)length;
+		AppendBytes(out, name, 1 + length);
+	}
+	return true;
+}
+
+// Both snapshots are sorted by (pid, adapter), like for the diff view. Frames are cut to fit FLEET_BUFFER_BYTES.
+void EncodeFleetDelta(const Snapshot& sent, const Snapshot& current, std::vector<UINT8>& frames, UINT64& records)
+{
+	static thread_local std::vector<DiffEntry> diff;
+	static thread_local std::vector<UINT8>	   record;
+	size_t									   frame = 0;
+	UINT32									   count = 0;
+	auto									   Close = [&]()
+	{
+		memcpy(&frames[frame + sizeof(FleetFrameHeader)], &count, sizeof(count));
+		EndFrame(frames, frame);
+		count = 0;
+	};
+
+	DiffSnapshots(sent, current, diff);
+	for(const DiffEntry& d : diff)
+	{
+		record.clear();
+		bool removed = d.state == DIFF_EXITED;
+		if(!EncodeRecord(d.base, removed ? *d.base : *d.current, removed, record))
+			continue;
+		if(count && frames.size() - frame + record.size() > FLEET_BUFFER_BYTES)
+			Close();
+		if(!count)
+		{
+			frame = BeginFrame(frames, FLEET_DELTA);
+			AppendBytes(frames, &count, sizeof(count));
+		}
+		AppendBytes(frames, record.data(), record.size());
+		count++;
+		records++;
+	}
+	if(count)
+		Close();
+}
+
+static bool SendAll(intptr_t socket, const UINT8* data, size_t size)
+{
+	while(size)
+	{
+		int sent = (int)send((SOCKET)socket, (const char*)data, (int)std::min(size, (size_t)1 << 20), SEND_FLAGS);
+		if(sent <= 0)
+			return false;
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static intptr_t ConnectTo(const char* address)
+{
+	StartSockets();
+	std::string host = address;
+	std::string port = std::to_string(FLEET_DEFAULT_PORT);
+	size_t		colon = host.rfind(':');
+	if(colon != std::string::npos)
+	{
+		port = host.substr(colon + 1);
+		host.resize(colon);
+	}
+	addrinfo hints = {};
+	hints.ai_family	  = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* result  = nullptr;
+	if(getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+		return -1;
+	intptr_t s = -1;
+	for(addrinfo* ai = result; ai && s == -1; ai = ai->ai_next)
+	{
+		s = (intptr_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(s != -1 && connect((SOCKET)s, ai->ai_addr, (int)ai->ai_addrlen) != 0)
+		{
+			CloseSocket((SOCKET)s);
+			s = -1;
+		}
+	}
+	freeaddrinfo(result);
+	return s;
+}
+
+bool FleetAgentConnect(FleetAgent& agent, const char* address, const char* hostName)
+{
+	FleetAgentClose(agent);
+	agent.socket = ConnectTo(address);
+	if(agent.socket == -1)
+		return false;
+
+	char name[256];
+	if(hostName)
+		snprintf(name, sizeof(name), "%s", hostName);
+	else if(gethostname(name, sizeof(name)) != 0)
+		snprintf(name, sizeof(name), "unknown");
+	UINT8 length = (UINT8)std::min(strlen(name), (size_t)255);
+	agent.buffer.clear();
+	size_t frame = BeginFrame(agent.buffer, FLEET_HELLO);
+	AppendBytes(agent.buffer, &length, 1);
+	AppendBytes(agent.buffer, name, length);
+	EndFrame(agent.buffer, frame);
+
+	// The collector starts the host over on a hello, so everything is sent again
+	agent.sent = Snapshot();
+	if(!SendAll(agent.socket, agent.buffer.data(), agent.buffer.size()))
+	{
+		FleetAgentClose(agent);
+		return false;
+	}
+	agent.bytesSent += agent.buffer.size();
+	return true;
+}
+
+bool FleetAgentSend(FleetAgent& agent, const Snapshot& current)
+{
+	if(agent.socket == -1)
+		return false;
+	agent.buffer.clear();
+	EncodeFleetDelta(agent.sent, current, agent.buffer, agent.recordsSent);
+	if(agent.buffer.size() && !SendAll(agent.socket, agent.buffer.data(), agent.buffer.size()))
+	{
+		FleetAgentClose(agent);
+		return false;
+	}
+	agent.bytesSent += agent.buffer.size();
+	agent.sent = current;
+	return true;
+}
+
+void FleetAgentClose(FleetAgent& agent)
+{
+	if(agent.socket != -1)
+		CloseSocket((SOCKET)agent.socket);
+	agent.socket = -1;
+}
+
+bool ParseFleetMetric(const char* text, FleetMetric& metric)
+{
+	static const char* names[FLEET_METRIC_COUNT] = { "usage", "commit", "demoted" };
+	for(int i = 0; i < FLEET_METRIC_COUNT; ++i)
+	{
+		if(strcmp(text, names[i]) == 0)
+		{
+			metric = (FleetMetric)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool QueryFleet(const char* address, FleetMetric metric, UINT32 count, std::string& text)
+{
+	intptr_t s = ConnectTo(address);
+	if(s == -1)
+		return false;
+	std::vector<UINT8> request;
+	size_t			   frame = BeginFrame(request, FLEET_QUERY);
+	FleetQuery		   query = { metric, (UINT8)std::min(count, 255u) };
+	AppendBytes(request, &query, sizeof(query));
+	EndFrame(request, frame);
+
+	FleetFrameHeader header;
+	bool			 ok = SendAll(s, request.data(), request.size());
+	auto			 Receive = [s](void* data, size_t size)
+	{
+		for(char* p = (char*)data; size;)
+		{
+			int r = (int)recv((SOCKET)s, p, (int)size, 0);
+			if(r <= 0)
+				return false;
+			p += r;
+			size -= r;
+		}
+		return true;
+	};
+	ok = ok && Receive(&header, sizeof(header)) && header.magic == FLEET_MAGIC && header.type == FLEET_VIEW && header.length <= FLEET_MAX_OUTPUT;
+	if(ok)
+	{
+		text.resize(header.length);
+		ok = Receive(text.data(), header.length);
+	}
+	CloseSocket((SOCKET)s);
+	return ok;
+}
+
+static std::atomic<bool> g_fleetAgentStop;
+static std::thread		 g_fleetAgentThread;
+
+void StartFleetAgent(const char* address)
+{
+	StopFleetAgent();
+	g_fleetAgentStop   = false;
+	g_fleetAgentThread = std::thread(
+		[address = std::string(address)]()
+		{
+			FleetAgent agent;
+			Snapshot   current;
+			double	   wait = 0;
+			while(!g_fleetAgentStop)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				wait -= 0.1;
+				if(wait > 0)
+					continue;
+				wait = FLEET_SEND_SECONDS;
+				if(agent.socket == -1 && !FleetAgentConnect(agent, address.c_str(), nullptr))
+				{
+					fprintf(g_LogFile, "Failed to connect to the fleet collector '%s'\n", address.c_str());
+					fflush(g_LogFile);
+					wait = FLEET_RECONNECT_SECONDS;
+					continue;
+				}
+				EnterCriticalSection(&g_critSec);
+				TakeSnapshot(current);
+				LeaveCriticalSection(&g_critSec);
+				if(!FleetAgentSend(agent, current))
+					wait = FLEET_RECONNECT_SECONDS;
+			}
+			FleetAgentClose(agent);
+		});
+}
+
+void StopFleetAgent()
+{
+	if(!g_fleetAgentThread.joinable())
+		return;
+	g_fleetAgentStop = true;
+	g_fleetAgentThread.join();
+}
+
+void FleetTopProcesses(const FleetCollector& collector, FleetMetric metric, UINT32 count, std::vector<FleetRow>& rows)
+{
+	rows.clear();
+	for(UINT32 host = 0; host < (UINT32)collector.hosts.size(); ++host)
+	{
+		for(const auto& pair : collector.hosts[host].entries)
+		{
+			UINT64 value = pair.second.Metric(metric);
+			if(value)
+				rows.push_back({ host, pair.first.pid, &pair.second, value });
+		}
+	}
+	size_t top = std::min((size_t)count, rows.size());
+	std::partial_sort(rows.begin(),
+					  rows.begin() + top,
+					  rows.end(),
+					  [](const FleetRow& a, const FleetRow& b)
+					  {
+						  return a.value > b.value;
+					  });
+	rows.resize(top);
+}
+
+// The hosts, then the processes, with the largest 'metric' first
+void FormatFleetView(const FleetCollector& collector, FleetMetric metric, UINT32 count, std::string& text)
+{
+	static const char* titles[FLEET_METRIC_COUNT] = { "usage", "commitment", "demoted" };
+	char			   line[512];
+	UINT32			   connected = 0;
+	size_t			   entries	 = 0;
+	for(const FleetHost& host : collector.hosts)
+	{
+		connected += host.connected;
+		entries += host.entries.size();
+	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	snprintf(line,
+			 sizeof(line),
+			 "%zu hosts (%u connected), %zu entries, top %u by %s\n",
+			 collector.hosts.size(),
+			 connected,
+			 entries,
+			 count,
+			 titles[metric]);
+	text = line;
+
+	auto Memory = [](UINT64 bytes, char* out)
+	{
+		char memory[MEMORY_TEXT_MAX];
+		int	 length = FormatMemoryText(bytes, memory);
+		snprintf(out, MEMORY_TEXT_MAX + 2, "%*.*s", MEMORY_WIDTH + 1, length, memory);
+	};
+	char usage[MEMORY_TEXT_MAX + 2], commit[MEMORY_TEXT_MAX + 2], demoted[MEMORY_TEXT_MAX + 2];
+
+	std::vector<UINT32> hosts;
+	for(UINT32 i = 0; i < (UINT32)collector.hosts.size(); ++i)
+		hosts.push_back(i);
+	size_t topHosts = std::min((size_t)count, hosts.size());
+	std::partial_sort(hosts.begin(),
+					  hosts.begin() + topHosts,
+					  hosts.end(),
+					  [&](UINT32 a, UINT32 b)
+					  {
+						  return collector.hosts[a].Total(metric) > collector.hosts[b].Total(metric);
+					  });
+	snprintf(line, sizeof(line), "\n%-24s %11s%11s%11s %8s %8s\n", "Host", "Usage", "Commit", "Demoted", "Entries", "Age");
+	text += line;
+	for(size_t i = 0; i < topHosts; ++i)
+	{
+		const FleetHost& host = collector.hosts[hosts[i]];
+		Memory(host.totals[FLEET_USAGE], usage);
+		Memory(host.totals[FLEET_COMMITMENT], commit);
+		Memory(host.Total(FLEET_DEMOTED), demoted);
+		snprintf(line,
+				 sizeof(line),
+				 "%-24.24s %s%s%s %8zu %7.1fs%s\n",
+				 host.name.c_str(),
+				 usage,
+				 commit,
+				 demoted,
+				 host.entries.size(),
+				 (double)(now.QuadPart - host.lastUpdate) / g_qpcFrequency,
+				 host.connected ? "" : " disconnected");
+		text += line;
+	}
+
+	std::vector<FleetRow> rows;
+	FleetTopProcesses(collector, metric, count, rows);
+	snprintf(line, sizeof(line), "\n%-24s %8s %-24s %11s%11s%11s\n", "Host", "Pid", "Process", "Usage", "Commit", "Demoted");
+	text += line;
+	for(const FleetRow& row : rows)
+	{
+		Memory(row.entry->values[FLEET_USAGE], usage);
+		Memory(row.entry->values[FLEET_COMMITMENT], commit);
+		Memory(row.entry->Metric(FLEET_DEMOTED), demoted);
+		snprintf(line,
+				 sizeof(line),
+				 "%-24.24s %8u %c%-23.23s%s%s%s\n",
+				 collector.hosts[row.host].name.c_str(),
+				 (unsigned)row.pid,
+				 row.entry->tracked ? '*' : ' ',
+				 row.entry->name.c_str(),
+				 usage,
+				 commit,
+				 demoted);
+		text += line;
+	}
+}
+
+#ifdef _WIN32
+bool StartFleetCollector(FleetCollector&, int)
+{
+	fprintf(g_LogFile, "The fleet collector needs epoll, it runs on Linux\n");
+	return false;
+}
+
+int PollFleetCollector(FleetCollector&, int)
+{
+	return 0;
+}
+
+void StopFleetCollector(FleetCollector&)
+{
+}
+#else
+
+struct FleetConnection
+{
+	int			fd;
+	UINT32		index; // in collector.connections
+	int			host;  // -1 until the hello
+	UINT32		used;
+	std::string output; // reply bytes not sent yet
+	UINT8		input[FLEET_BUFFER_BYTES];
+};
+
+static void CloseConnection(FleetCollector& collector, FleetConnection* connection)
+{
+	epoll_ctl(collector.epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+	close(connection->fd);
+	if(connection->host >= 0)
+		collector.hosts[connection->host].connected = false;
+	FleetConnection* last						  = collector.connections.back();
+	collector.connections[connection->index]	  = last;
+	last->index									  = connection->index;
+	collector.connections.pop_back();
+	collector.stats.connections--;
+	delete connection;
+}
+
+// Sends what it can of the pending reply, and waits for the socket to be writable for the rest
+static bool FlushOutput(FleetCollector& collector, FleetConnection* connection)
+{
+	size_t sent = 0;
+	while(sent < connection->output.size())
+	{
+		ssize_t r = send(connection->fd, connection->output.data() + sent, connection->output.size() - sent, MSG_NOSIGNAL);
+		if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if(r <= 0)
+			return false;
+		sent += r;
+	}
+	connection->output.erase(0, sent);
+	epoll_event event = {};
+	event.events	  = EPOLLIN | (connection->output.size() ? (UINT32)EPOLLOUT : 0);
+	event.data.ptr	  = connection;
+	epoll_ctl(collector.epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+	return true;
+}
+
+static void ApplyRecord(FleetHost& host, const FleetRecordHeader& header, const UINT64* values, const char* name, int nameLength)
+{
+	FleetKey key = { header.pid, header.adapter };
+	if(header.flags & FLEET_REMOVED)
+	{
+		auto itr = host.entries.find(key);
+		if(itr == host.entries.end())
+			return;
+		for(int i = 0; i < FLEET_FIELD_COUNT; ++i)
+			host.totals[i] -= itr->second.values[i];
+		host.entries.erase(itr);
+		return;
+	}
+	FleetEntry& entry = host.entries[key];
+	for(int i = 0, next = 0; i < FLEET_FIELD_COUNT; ++i)
+	{
+		if(!(header.fieldMask & (1 << i)))
+			continue;
+		host.totals[i] += values[next] - entry.values[i];
+		entry.values[i] = values[next++];
+	}
+	entry.tracked = (header.flags & FLEET_TRACKED) != 0;
+	if(header.flags & FLEET_NAME)
+		entry.name.assign(name, nameLength);
+}
+
+// False for a frame that does not parse, which drops the connection
+static bool HandleFrame(FleetCollector& collector, FleetConnection* connection, UINT16 type, const UINT8* payload, UINT32 length)
+{
+	const UINT8* end = payload + length;
+	switch(type)
+	{
+	case FLEET_HELLO:
+	{
+		if(length < 1 || length < 1u + payload[0])
+			return false;
+		std::string name((const char*)payload + 1, payload[0]);
+		auto		itr = collector.hostIndex.find(name);
+		if(itr == collector.hostIndex.end())
+		{
+			itr = collector.hostIndex.emplace(name, (UINT32)collector.hosts.size()).first;
+			collector.hosts.emplace_back();
+			collector.hosts.back().name = name;
+		}
+		FleetHost& host = collector.hosts[itr->second];
+		host.entries.clear();
+		memset(host.totals, 0, sizeof(host.totals));
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		host.lastUpdate	 = now.QuadPart;
+		host.connected	 = true;
+		connection->host = (int)itr->second;
+		return true;
+	}
+	case FLEET_DELTA:
+	{
+		UINT32 count;
+		if(connection->host < 0 || length < sizeof(count))
+			return false;
+		memcpy(&count, payload, sizeof(count));
+		const UINT8* p	  = payload + sizeof(count);
+		FleetHost&	 host = collector.hosts[connection->host];
+		for(UINT32 i = 0; i < count; ++i)
+		{
+			FleetRecordHeader header;
+			UINT64			  values[FLEET_FIELD_COUNT];
+			if(end - p < (ptrdiff_t)sizeof(header))
+				return false;
+			memcpy(&header, p, sizeof(header));
+			p += sizeof(header);
+			int numValues = 0;
+			for(int bit = 0; bit < FLEET_FIELD_COUNT; ++bit)
+				numValues += (header.fieldMask >> bit) & 1;
+			if(header.fieldMask >> FLEET_FIELD_COUNT || end - p < (ptrdiff_t)(numValues * sizeof(UINT64)))
+				return false;
+			memcpy(values, p, numValues * sizeof(UINT64));
+			p += numValues * sizeof(UINT64);
+			const char* name	   = nullptr;
+			int			nameLength = 0;
+			if(header.flags & FLEET_NAME)
+			{
+				if(end - p < 1 || end - p < 1 + *p)
+					return false;
+				nameLength = *p;
+				name	   = (const char*)p + 1;
+				p += 1 + nameLength;
+			}
+			ApplyRecord(host, header, values, name, nameLength);
+		}
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		host.lastUpdate = now.QuadPart;
+		collector.stats.records += count;
+		return p == end;
+	}
+	case FLEET_QUERY:
+	{
+		FleetQuery query;
+		if(length != sizeof(query))
+			return false;
+		memcpy(&query, payload, sizeof(query));
+		if(query.metric >= FLEET_METRIC_COUNT)
+			return false;
+		std::string text;
+		FormatFleetView(collector, (FleetMetric)query.metric, query.count, text);
+		FleetFrameHeader header = { FLEET_MAGIC, FLEET_VIEW, 0, (UINT32)text.size() };
+		if(connection->output.size() + sizeof(header) + text.size() > FLEET_MAX_OUTPUT)
+			return false;
+		connection->output.append((const char*)&header, sizeof(header));
+		connection->output += text;
+		return FlushOutput(collector, connection);
+	}
+	default:
+		return false;
+	}
+}
+
+// Reads until the socket is drained, handling the complete frames as they come. Returns false to drop the connection.
+static bool ReadConnection(FleetCollector& collector, FleetConnection* connection, int& frames)
+{
+	while(true)
+	{
+		ssize_t r = recv(connection->fd, connection->input + connection->used, FLEET_BUFFER_BYTES - connection->used, 0);
+		if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if(r <= 0)
+			return false;
+		connection->used += (UINT32)r;
+		collector.stats.bytes += r;
+
+		UINT32 offset = 0;
+		while(connection->used - offset >= sizeof(FleetFrameHeader))
+		{
+			FleetFrameHeader header;
+			memcpy(&header, connection->input + offset, sizeof(header));
+			bool fits = header.magic == FLEET_MAGIC && header.length <= FLEET_BUFFER_BYTES - sizeof(header);
+			if(fits && connection->used - offset < sizeof(header) + header.length)
+				break;
+			if(!fits || !HandleFrame(collector, connection, header.type, connection->input + offset + sizeof(header), header.length))
+			{
+				collector.stats.dropped++;
+				return false;
+			}
+			offset += sizeof(header) + header.length;
+			frames++;
+			collector.stats.frames++;
+		}
+		memmove(connection->input, connection->input + offset, connection->used - offset);
+		connection->used -= offset;
+	}
+}
+
+static void AcceptConnections(FleetCollector& collector)
+{
+	while(true)
+	{
+		int fd = accept4(collector.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+			return;
+		if(collector.connections.size() >= FLEET_MAX_CONNECTIONS)
+		{
+			close(fd);
+			collector.stats.dropped++;
+			continue;
+		}
+		FleetConnection* connection = new FleetConnection;
+		connection->fd				= fd;
+		connection->index			= (UINT32)collector.connections.size();
+		connection->host			= -1;
+		connection->used			= 0;
+		epoll_event event			= {};
+		event.events				= EPOLLIN;
+		event.data.ptr				= connection;
+		epoll_ctl(collector.epollFd, EPOLL_CTL_ADD, fd, &event);
+		collector.connections.push_back(connection);
+		collector.stats.connections++;
+		collector.stats.accepted++;
+	}
+}
+
+bool StartFleetCollector(FleetCollector& collector, int port)
+{
+	StopFleetCollector(collector);
+	collector.listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int reuse		   = 1;
+	setsockopt(collector.listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	sockaddr_in address		= {};
+	address.sin_family		= AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port		= htons((uint16_t)port);
+	socklen_t length		= sizeof(address);
+	if(collector.listenFd < 0 || bind(collector.listenFd, (sockaddr*)&address, sizeof(address)) != 0 ||
+	   listen(collector.listenFd, FLEET_MAX_CONNECTIONS) != 0 || getsockname(collector.listenFd, (sockaddr*)&address, &length) != 0)
+	{
+		fprintf(g_LogFile, "Failed to listen on port %d: %s\n", port, strerror(errno));
+		fflush(g_LogFile);
+		StopFleetCollector(collector);
+		return false;
+	}
+	collector.port	  = ntohs(address.sin_port);
+	collector.epollFd = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event event = {};
+	event.events	  = EPOLLIN;
+	event.data.ptr	  = nullptr;
+	epoll_ctl(collector.epollFd, EPOLL_CTL_ADD, collector.listenFd, &event);
+	return true;
+}
+
+int PollFleetCollector(FleetCollector& collector, int timeoutMs)
+{
+	epoll_event events[64];
+	int			count  = epoll_wait(collector.epollFd, events, 64, timeoutMs);
+	int			frames = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		FleetConnection* connection = (FleetConnection*)events[i].data.ptr;
+		if(!connection)
+		{
+			AcceptConnections(collector);
+			continue;
+		}
+		bool ok = true;
+		if(events[i].events & EPOLLOUT)
+			ok = FlushOutput(collector, connection);
+		if(ok && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			ok = ReadConnection(collector, connection, frames);
+		if(!ok)
+			CloseConnection(collector, connection);
+	}
+	return frames;
+}
+
+void StopFleetCollector(FleetCollector& collector)
+{
+	while(collector.connections.size())
+		CloseConnection(collector, collector.connections.back());
+	if(collector.epollFd >= 0)
+		close(collector.epollFd);
+	if(collector.listenFd >= 0)
+		close(collector.listenFd);
+	collector.epollFd  = -1;
+	collector.listenFd = -1;
+}
+#endif
@@ -0,0 +1,183 @@
+#pragma once
+// Fleet collection
+//  agents send the (process, adapter) entries that changed since their last send to a collector over TCP, in
+//  length prefixed binary frames where each record only carries the fields that changed. The collector keeps a
+//  model per host, fed by an epoll loop over non-blocking sockets with a fixed receive buffer per connection; a
+//  frame that does not fit in it drops the connection. Top-N views over all the hosts are answered to QUERY frames.
+//  The wire format is little endian. Agents run everywhere, the collector on Linux.
+#include "tracker.h"
+#include "snapshot.h"
+#include <string>
+#include <unordered_map>
+
+#define FLEET_MAGIC 0x31465444 // "DTF1"
+#define FLEET_DEFAULT_PORT 47800
+#define FLEET_BUFFER_BYTES 16384	 // receive buffer of each connection, and so the largest frame an agent sends
+#define FLEET_MAX_OUTPUT (256 * 1024) // reply bytes pending on a connection before it is dropped
+#define FLEET_MAX_CONNECTIONS 1024
+#define FLEET_SEND_SECONDS 1.0
+#define FLEET_RECONNECT_SECONDS 5.0
+#define FLEET_FIELD_COUNT (4 + PRIO_COUNT)
+
+enum FleetFrameType : UINT16
+{
+	FLEET_HELLO = 1, // UINT8 length, host name
+	FLEET_DELTA,	 // UINT32 count, records
+	FLEET_QUERY,	 // FleetQuery
+	FLEET_VIEW,		 // text of the view asked for
+};
+
+enum FleetRecordFlags : UINT8
+{
+	FLEET_REMOVED = 1,
+	FLEET_TRACKED = 2,
+	FLEET_NAME	  = 4, // followed by a UINT8 length and the name
+};
+
+enum FleetMetric : UINT8
+{
+	FLEET_USAGE,
+	FLEET_COMMITMENT,
+	FLEET_DEMOTED,
+	FLEET_METRIC_COUNT
+};
+
+#pragma pack(push, 1)
+struct FleetFrameHeader
+{
+	UINT32 magic;
+	UINT16 type;
+	UINT16 reserved;
+	UINT32 length; // of the payload that follows
+};
+
+// Followed by a UINT64 for each bit of fieldMask, in FleetEntry::values order
+struct FleetRecordHeader
+{
+	UINT32 pid;
+	UINT64 adapter;
+	UINT16 fieldMask;
+	UINT8  flags;
+};
+
+struct FleetQuery
+{
+	UINT8 metric;
+	UINT8 count;
+};
+#pragma pack(pop)
+
+struct FleetEntry
+{
+	UINT64		values[FLEET_FIELD_COUNT]; // local usage and commitment, non-local usage and commitment, demoted per priority
+	std::string name;
+	bool		tracked;
+
+	UINT64 Metric(FleetMetric metric) const
+	{
+		if(metric != FLEET_DEMOTED)
+			return values[metric];
+		UINT64 sum = 0;
+		for(int i = 0; i < PRIO_COUNT; ++i)
+			sum += values[4 + i];
+		return sum;
+	}
+};
+
+struct FleetKey
+{
+	DWORD  pid;
+	UINT64 adapter;
+	bool   operator==(const FleetKey& other) const
+	{
+		return pid == other.pid && adapter == other.adapter;
+	};
+};
+
+namespace std
+{
+template <>
+struct hash<FleetKey>
+{
+	std::size_t operator()(const FleetKey& f) const noexcept
+	{
+		return (size_t)((f.adapter ^ ((UINT64)f.pid << 32)) * 0x9e3779b97f4a7c15ULL);
+	}
+};
+} // namespace std
+
+struct FleetHost
+{
+	std::string								 name;
+	std::unordered_map<FleetKey, FleetEntry> entries;
+	UINT64									 totals[FLEET_FIELD_COUNT]; // of the entries, kept as records apply
+	INT64									 lastUpdate; // QPC ticks of the collector
+	bool									 connected;
+
+	UINT64 Total(FleetMetric metric) const
+	{
+		if(metric != FLEET_DEMOTED)
+			return totals[metric];
+		UINT64 sum = 0;
+		for(int i = 0; i < PRIO_COUNT; ++i)
+			sum += totals[4 + i];
+		return sum;
+	}
+};
+
+struct FleetConnection;
+
+struct FleetStats
+{
+	UINT64 frames	   = 0;
+	UINT64 records	   = 0;
+	UINT64 bytes	   = 0;
+	UINT32 connections = 0; // open now
+	UINT32 accepted	   = 0;
+	UINT32 dropped	   = 0; // over FLEET_MAX_CONNECTIONS, or for a bad frame
+};
+
+struct FleetCollector
+{
+	int								  listenFd = -1;
+	int								  epollFd  = -1;
+	int								  port	   = 0;
+	std::vector<FleetHost>			  hosts;
+	std::unordered_map<std::string, UINT32> hostIndex;
+	std::vector<FleetConnection*>	  connections;
+	FleetStats						  stats;
+};
+
+struct FleetRow
+{
+	UINT32			  host;
+	DWORD			  pid;
+	const FleetEntry* entry;
+	UINT64			  value;
+};
+
+bool StartFleetCollector(FleetCollector& collector, int port); // 0 takes a free port, in collector.port
+int	 PollFleetCollector(FleetCollector& collector, int timeoutMs); // one round of the loop, returns the frames handled
+void StopFleetCollector(FleetCollector& collector);
+void FleetTopProcesses(const FleetCollector& collector, FleetMetric metric, UINT32 count, std::vector<FleetRow>& rows);
+void FormatFleetView(const FleetCollector& collector, FleetMetric metric, UINT32 count, std::string& text);
+
+struct FleetAgent
+{
+	intptr_t		   socket = -1;
+	Snapshot		   sent; // what the collector has
+	std::vector<UINT8> buffer;
+	UINT64			   bytesSent   = 0;
+	UINT64			   recordsSent = 0;
+};
+
+void EncodeFleetDelta(const Snapshot& sent, const Snapshot& current, std::vector<UINT8>& frames, UINT64& records);
+bool FleetAgentConnect(FleetAgent& agent, const char* address, const char* hostName); // "host:port", null for this machine's name
+bool FleetAgentSend(FleetAgent& agent, const Snapshot& current); // false if the connection is lost
+void FleetAgentClose(FleetAgent& agent);
+bool QueryFleet(const char* address, FleetMetric metric, UINT32 count, std::string& text);
+bool ParseFleetMetric(const char* text, FleetMetric& metric); // "usage", "commit" or "demoted"
+
+// A thread sending the tracker's entries every FLEET_SEND_SECONDS, connecting again after a failure
+void StartFleetAgent(const char* address);
+void StopFleetAgent();
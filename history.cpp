@@ -0,0 +1,188 @@
+#include "history.h"
+#include <string.h>
+
+std::vector<HistorySeries> g_historySeries;
+static std::vector<HistoryRings> g_historyRings;
+static std::vector<UINT32> g_historyWeights; // KB, the larger current value of each series
+static UINT32			   g_historyFloor	   = 0; // at most the smallest weight, what a new series has to beat once full
+static INT64			   g_historyScanBucket = -1; // of the last search for the smallest, at most one per bucket
+
+static UINT32 HistoryKb(UINT64 bytes)
+{
+	return (UINT32)std::min<UINT64>((bytes + 1023) >> 10, 0xffffffff);
+}
+
+static INT64 HistoryTicksPerBucket()
+{
+	return std::max<INT64>(1, g_qpcFrequency * HISTORY_BUCKET_MS / 1000);
+}
+
+INT64 HistoryBucketIndex(INT64 time)
+{
+	return time / HistoryTicksPerBucket();
+}
+
+// Closes the open buckets before 'time' into the rings, the buckets skipped since with the values they had, and
+// opens the ones of 'time'. A level only closes if the one below did.
+static void AdvanceSeries(UINT32 slot, INT64 time)
+{
+	HistorySeries& series = g_historySeries[slot];
+	INT64		   bucket = HistoryBucketIndex(time);
+	for(int level = 0; level < HISTORY_LEVELS; ++level)
+	{
+		INT64 open = series.bucket >> level;
+		INT64 to   = bucket >> level;
+		if(open >= to)
+			break;
+		for(int metric = 0; metric < HISTORY_METRIC_COUNT; ++metric)
+		{
+			HistoryBucket* ring = g_historyRings[slot].levels[metric][level];
+			UINT32		   kb	= HistoryKb(series.value[metric]);
+			ring[open & (HISTORY_BUCKETS - 1)] = series.open[metric][level];
+			for(INT64 k = std::max(open + 1, to - HISTORY_BUCKETS + 1); k < to; ++k)
+				ring[k & (HISTORY_BUCKETS - 1)] = { kb, kb };
+			series.open[metric][level] = { kb, kb };
+		}
+	}
+	series.bucket = bucket;
+	series.end	  = (bucket + 1) * HistoryTicksPerBucket();
+}
+
+static void SetWeight(UINT32 slot)
+{
+	const HistorySeries& series = g_historySeries[slot];
+	g_historyWeights[slot]		= HistoryKb(std::max(series.value[HISTORY_USAGE], series.value[HISTORY_DEMOTED]));
+	g_historyFloor				= std::min(g_historyFloor, g_historyWeights[slot]);
+}
+
+// A new series, or the smallest one if it is smaller than 'kb'. Returns the slot + 1, 0 if the pool is full of larger
+// ones or was searched in this bucket already: with more entries than series, the ones left out retry on later updates.
+static UINT32 AllocateSeries(UINT32 index, UINT32 kb, INT64 time)
+{
+	INT64  bucket = HistoryBucketIndex(time);
+	UINT32 slot;
+	if(g_historySeries.size() < HISTORY_MAX_SERIES)
+	{
+		if(g_historyRings.empty())
+			g_historyRings.reserve(HISTORY_MAX_SERIES);
+		slot = (UINT32)g_historySeries.size();
+		g_historySeries.emplace_back();
+		g_historyRings.emplace_back();
+		g_historyWeights.push_back(0);
+	}
+	else
+	{
+		if(kb <= g_historyFloor || bucket == g_historyScanBucket)
+			return 0;
+		g_historyScanBucket = bucket;
+		slot				= 0;
+		for(UINT32 i = 1; i < HISTORY_MAX_SERIES; ++i)
+		{
+			if(g_historyWeights[i] < g_historyWeights[slot])
+				slot = i;
+		}
+		g_historyFloor = g_historyWeights[slot];
+		if(kb <= g_historyFloor)
+			return 0;
+		UINT32 owner = g_processMemory.Resolve(g_historySeries[slot].entry);
+		if(owner != INVALID_MEMORY_INDEX)
+			g_processMemory.cold[owner].historySlot = 0;
+	}
+
+	HistorySeries& series = g_historySeries[slot];
+	series.key			  = g_processMemory.keys[index];
+	series.name			  = FindProcess(series.key.pid)->imageFilename;
+	series.entry		  = g_processMemory.Handle(index);
+	series.first		  = bucket;
+	series.bucket		  = bucket;
+	series.end			  = (bucket + 1) * HistoryTicksPerBucket();
+	memset(series.value, 0, sizeof(series.value));
+	memset(series.open, 0, sizeof(series.open));
+	g_processMemory.cold[index].historySlot = slot + 1;
+	return slot + 1;
+}
+
+void HistoryOnUpdate(UINT32 index, UINT8 metric, UINT64 value, INT64 time)
+{
+	UINT32 slot = g_processMemory.cold[index].historySlot;
+	if(!slot && (!value || !(slot = AllocateSeries(index, HistoryKb(value), time))))
+		return;
+	HistorySeries& series = g_historySeries[slot - 1];
+	if(time >= series.end)
+		AdvanceSeries(slot - 1, time); // late updates go into the open buckets
+	series.value[metric] = value;
+	SetWeight(slot - 1);
+
+	UINT32		   kb	= HistoryKb(value);
+	HistoryBucket* open = series.open[metric];
+	for(int level = 0; level < HISTORY_LEVELS; ++level)
+	{
+		open[level].min = std::min(open[level].min, kb);
+		open[level].max = std::max(open[level].max, kb);
+	}
+}
+
+bool HistoryBucketAt(UINT32 slot, UINT8 metric, int level, INT64 bucket, HistoryBucket& out)
+{
+	const HistorySeries& series = g_historySeries[slot];
+	INT64				 newest = series.bucket >> level;
+	if(bucket < (series.first >> level) || bucket <= newest - HISTORY_BUCKETS)
+		return false;
+	if(bucket > newest)
+	{
+		// Nothing changed since the last update
+		UINT32 kb = HistoryKb(series.value[metric]);
+		out		  = { kb, kb };
+	}
+	else if(bucket == newest)
+		out = series.open[metric][level];
+	else
+		out = g_historyRings[slot].levels[metric][level][bucket & (HISTORY_BUCKETS - 1)];
+	return true;
+}
+
+// HistoryBucketAt over a window, with the bounds of the series worked out once instead of per bucket
+UINT32 HistoryBucketRange(UINT32 slot, UINT8 metric, int level, INT64 left, INT64 right, HistoryBucket* out)
+{
+	const HistorySeries& series = g_historySeries[slot];
+	const HistoryBucket* ring	= g_historyRings[slot].levels[metric][level];
+	INT64				 newest = series.bucket >> level;
+	INT64				 oldest = std::max(series.first >> level, newest - HISTORY_BUCKETS + 1);
+	UINT32				 kb		= HistoryKb(series.value[metric]);
+	UINT32				 peak	= 0;
+	for(INT64 k = left; k <= right; ++k)
+	{
+		HistoryBucket& bucket = out[k - left];
+		if(k < oldest)
+			bucket = {};
+		else if(k < newest)
+			bucket = ring[k & (HISTORY_BUCKETS - 1)];
+		else if(k == newest)
+			bucket = series.open[metric][level];
+		else
+			bucket = { kb, kb };
+		peak = std::max(peak, bucket.max);
+	}
+	return peak;
+}
+
+// The series keeps its history, dropping to zero at the time of the exit
+void HistoryClearProcess(UINT32 index)
+{
+	UINT32& slot = g_processMemory.cold[index].historySlot;
+	if(!slot)
+		return;
+	for(int metric = 0; metric < HISTORY_METRIC_COUNT; ++metric)
+		HistoryOnUpdate(index, metric, 0, g_eventTime);
+	g_historySeries[slot - 1].entry = MemoryHandle();
+	slot							= 0;
+}
+
+void ResetHistory()
+{
+	g_historySeries.clear();
+	g_historyRings.clear();
+	g_historyWeights.clear();
+	g_historyFloor		= 0;
+	g_historyScanBucket = -1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+// History store
+//  the local usage and demoted commitment of each entry over time, for the heatmap view. A series is a pyramid of
+//  rings of min/max buckets: level 0 buckets are HISTORY_BUCKET_MS long and each level doubles that. Every update
+//  goes into the open bucket of each level, kept together outside the rings and written to them when it closes,
+//  so a level keeps the extremes of its span and a 250 ms spike is still in the max of a 2 minute bucket. A view
+//  reads one bucket per cell from the level of its zoom, whatever the length of the history.
+//  Series outlive their entries so exited processes stay in the timeline. Past HISTORY_MAX_SERIES a new series
+//  takes the slot of the one with the smallest current value, if its own is larger; exited ones are at zero.
+#include "tracker.h"
+
+#define HISTORY_BUCKET_MS 250
+#define HISTORY_LEVELS 10	// level 9 buckets are 128 s, ~9 hours in its ring
+#define HISTORY_BUCKETS 256 // per level, a cell per bucket on the widest screens
+#define HISTORY_MAX_SERIES 256
+
+static_assert((HISTORY_BUCKETS & (HISTORY_BUCKETS - 1)) == 0, "rings are indexed with a mask");
+
+enum HistoryMetric : UINT8
+{
+	HISTORY_USAGE,	 // local
+	HISTORY_DEMOTED, // all priorities
+	HISTORY_METRIC_COUNT,
+};
+
+// KB, rounded up so a few bytes are not nothing
+struct HistoryBucket
+{
+	UINT32 min;
+	UINT32 max;
+};
+
+struct HistorySeries
+{
+	ProcessKey	  key;
+	wstring		  name;	  // of the process when last drawn
+	MemoryHandle  entry;  // invalid once the entry is gone
+	INT64		  first;  // level 0 bucket index of the first update
+	INT64		  bucket; // of the last one
+	INT64		  end;	  // event time the level 0 bucket closes
+	UINT64		  value[HISTORY_METRIC_COUNT];
+	HistoryBucket open[HISTORY_METRIC_COUNT][HISTORY_LEVELS];
+};
+
+// The closed buckets of a series, apart so the series updated together stay in a few cache lines
+struct HistoryRings
+{
+	HistoryBucket levels[HISTORY_METRIC_COUNT][HISTORY_LEVELS][HISTORY_BUCKETS];
+};
+
+extern std::vector<HistorySeries> g_historySeries;
+
+// Need g_critSec
+INT64  HistoryBucketIndex(INT64 time); // level 0
+void   HistoryOnUpdate(UINT32 index, UINT8 metric, UINT64 value, INT64 time);
+bool   HistoryBucketAt(UINT32 series, UINT8 metric, int level, INT64 bucket, HistoryBucket& out); // false without data
+UINT32 HistoryBucketRange(UINT32 series, UINT8 metric, int level, INT64 left, INT64 right, HistoryBucket* out); // zero without data, returns the largest max
+void   HistoryClearProcess(UINT32 index);
+void   ResetHistory();
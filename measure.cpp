@@ -0,0 +1,423 @@
+#include "measure.h"
+#include "alerts.h"
+#include "render.h"
+#include <math.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+Measurement g_measure;
+const char* g_measureMetricNames[MEASURE_METRIC_COUNT] = { "usage", "commit", "demoted", "demoted.min", "demoted.low", "demoted.normal", "demoted.high", "demoted.max" };
+const char* g_measureStatNames[MEASURE_STAT_COUNT]	   = { "peak", "mean", "p50", "p90", "p95", "p99" };
+
+static int MeasureBucket(UINT64 value)
+{
+	if(!value)
+		return 0;
+	int bucket = 1 + (int)(log2((double)value) * MEASURE_BUCKETS_PER_OCTAVE);
+	return bucket < MEASURE_BUCKETS ? bucket : MEASURE_BUCKETS - 1;
+}
+
+// The geometric middle of a bucket, within 4.4% of the values in it
+static double MeasureBucketValue(int bucket)
+{
+	if(bucket == 0)
+		return 0;
+	return exp2((bucket - 0.5) / MEASURE_BUCKETS_PER_OCTAVE);
+}
+
+// The value held from 'since' to 'time'
+static void CloseInterval(MeasureSeries& series, INT64 time)
+{
+	INT64 ticks = time > series.since ? time - series.since : 0;
+	series.ticks[MeasureBucket(series.value)] += ticks;
+	series.byteTicks += (double)series.value * ticks;
+	series.since = time > series.since ? time : series.since;
+}
+
+static void MoveSeries(MeasureSeries& series, INT64 delta)
+{
+	CloseInterval(series, g_eventTime);
+	series.value += delta;
+	series.peak = std::max(series.peak, series.value);
+}
+
+void MeasureChange(UINT8 metric, UINT64 previous, UINT64 value)
+{
+	if(previous == value)
+		return;
+	INT64 delta = (INT64)(value - previous);
+	MoveSeries(g_measure.series[metric], delta);
+	if(metric >= MEASURE_DEMOTED_PRIO)
+		MoveSeries(g_measure.series[MEASURE_DEMOTED], delta);
+}
+
+void MeasureOnTracked(UINT32 index, bool tracked)
+{
+	if(!g_measure.active)
+		return;
+	UINT64 zero = 0;
+	auto   Move = [&](UINT8 metric, UINT64 value) { MeasureChange(metric, tracked ? zero : value, tracked ? value : zero); };
+	Move(MEASURE_USAGE, g_processMemory.usageLocal[index]);
+	Move(MEASURE_COMMITMENT, g_processMemory.commitmentLocal[index]);
+	for(int i = 0; i < PRIO_COUNT; ++i)
+		Move((UINT8)(MEASURE_DEMOTED_PRIO + i), g_processMemory.demoted[index][i]);
+}
+
+void MeasureOnProcess(DWORD pid)
+{
+	(void)pid;
+	if(g_measure.active)
+		g_measure.processes++;
+}
+
+void StartMeasurement(INT64 time)
+{
+	for(MeasureSeries& series : g_measure.series)
+		series = {};
+	g_measure.start		= time;
+	g_measure.end		= 0;
+	g_measure.processes = (UINT32)g_trackedPids.size();
+	g_measure.active	= true;
+	INT64 eventTime		= g_eventTime;
+	g_eventTime			= time;
+	for(MeasureSeries& series : g_measure.series)
+		series.since = time;
+	for(UINT32 i = 0; i < g_processMemory.Size(); ++i)
+	{
+		if(g_processMemory.tracked[i])
+			MeasureOnTracked(i, true);
+	}
+	g_eventTime = eventTime;
+}
+
+void FinishMeasurement(INT64 time)
+{
+	if(!g_measure.active)
+		return;
+	for(MeasureSeries& series : g_measure.series)
+		CloseInterval(series, time);
+	g_measure.active = false;
+	g_measure.end	 = time;
+	for(MeasureLimit& limit : g_measure.limits)
+		limit.exceeded = MeasureValue(limit.metric, limit.stat) > limit.bytes;
+}
+
+// Percentiles come from the histogram, capped by the peak
+UINT64 MeasureValue(UINT8 metric, UINT8 stat)
+{
+	const MeasureSeries& series = g_measure.series[metric];
+	if(stat == MEASURE_PEAK)
+		return series.peak;
+	INT64 total = 0;
+	for(INT64 ticks : series.ticks)
+		total += ticks;
+	if(!total)
+		return series.value;
+	if(stat == MEASURE_MEAN)
+		return (UINT64)(series.byteTicks / total);
+
+	static const double quantiles[] = { 0, 0, 0.5, 0.9, 0.95, 0.99 };
+	INT64				rank		= (INT64)ceil(total * quantiles[stat]);
+	INT64				seen		= 0;
+	for(int bucket = 0; bucket < MEASURE_BUCKETS; ++bucket)
+	{
+		seen += series.ticks[bucket];
+		if(seen >= rank && series.ticks[bucket])
+			return std::min((UINT64)MeasureBucketValue(bucket), series.peak);
+	}
+	return series.peak;
+}
+
+static const char* SkipSpaces(const char* p)
+{
+	while(*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+bool ParseMeasureLimit(const char* text, MeasureLimit& limit)
+{
+	const char* p = SkipSpaces(text);
+	limit.text	  = p;
+	while(limit.text.size() && (limit.text.back() == ' ' || limit.text.back() == '\r' || limit.text.back() == '\n'))
+		limit.text.pop_back();
+
+	// The longest name first, "demoted.low" before "demoted"
+	int metric = -1;
+	for(int i = MEASURE_METRIC_COUNT - 1; i >= 0 && metric < 0; --i)
+	{
+		size_t len = strlen(g_measureMetricNames[i]);
+		if(_strnicmp(p, g_measureMetricNames[i], len) == 0 && (p[len] == '.' || p[len] == ' ' || p[len] == '>' || p[len] == '\t'))
+		{
+			metric = i;
+			p += len;
+		}
+	}
+	if(metric < 0)
+		return false;
+	int stat = MEASURE_PEAK;
+	if(*p == '.')
+	{
+		p++;
+		stat = -1;
+		for(int i = 0; i < MEASURE_STAT_COUNT && stat < 0; ++i)
+		{
+			size_t len = strlen(g_measureStatNames[i]);
+			if(_strnicmp(p, g_measureStatNames[i], len) == 0 && !isalnum((unsigned char)p[len]))
+			{
+				stat = i;
+				p += len;
+			}
+		}
+		if(stat < 0)
+			return false;
+	}
+
+	p = SkipSpaces(p);
+	if(*p++ != '>')
+		return false;
+	p = SkipSpaces(p);
+	double value;
+	bool   percent;
+	if(!ParseAlertAmount(p, value, percent) || percent || value < 0 || *SkipSpaces(p))
+		return false; // no adapter to take a percent of, the tracked processes can span several
+	limit.metric   = (UINT8)metric;
+	limit.stat	   = (UINT8)stat;
+	limit.bytes	   = (UINT64)value;
+	limit.exceeded = false;
+	return true;
+}
+
+bool AddMeasureLimit(const char* text)
+{
+	MeasureLimit limit;
+	if(!ParseMeasureLimit(text, limit))
+	{
+		fprintf(g_LogFile, "Invalid limit '%s'\n", text);
+		fflush(g_LogFile);
+		return false;
+	}
+	g_measure.limits.push_back(limit);
+	return true;
+}
+
+bool MeasureLimitsExceeded()
+{
+	for(const MeasureLimit& limit : g_measure.limits)
+	{
+		if(limit.exceeded)
+			return true;
+	}
+	return false;
+}
+
+static void WriteJsonString(FILE* f, const char* text)
+{
+	fputc('"', f);
+	for(const char* p = text; *p; ++p)
+	{
+		if(*p == '"' || *p == '\\')
+			fprintf(f, "\\%c", *p);
+		else if((unsigned char)*p < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*p);
+		else
+			fputc(*p, f);
+	}
+	fputc('"', f);
+}
+
+bool WriteMeasureSummary(const char* path, const MeasureReport& report)
+{
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open summary file '%s'\n", path);
+		fflush(g_LogFile);
+		return false;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	fprintf(f, "{\n\t\"command\": ");
+	WriteJsonString(f, report.command.c_str());
+	fprintf(f, ",\n\t\"exit_code\": %d,\n\t\"seconds\": %.3f,\n\t\"processes\": %u,\n", report.exitCode, report.seconds, g_measure.processes);
+	fprintf(f, "\t\"metrics\": {\n");
+	for(int metric = 0; metric < MEASURE_METRIC_COUNT; ++metric)
+	{
+		fprintf(f, "\t\t\"%s\": {", g_measureMetricNames[metric]);
+		for(int stat = 0; stat < MEASURE_STAT_COUNT; ++stat)
+			fprintf(f, "%s\"%s\": %llu", stat ? ", " : " ", g_measureStatNames[stat], MeasureValue((UINT8)metric, (UINT8)stat));
+		fprintf(f, " }%s\n", metric + 1 < MEASURE_METRIC_COUNT ? "," : "");
+	}
+	fprintf(f, "\t},\n\t\"limits\": [");
+	for(size_t i = 0; i < g_measure.limits.size(); ++i)
+	{
+		const MeasureLimit& limit = g_measure.limits[i];
+		fprintf(f, "%s\n\t\t{ \"rule\": ", i ? "," : "");
+		WriteJsonString(f, limit.text.c_str());
+		fprintf(f,
+				", \"value\": %llu, \"limit\": %llu, \"exceeded\": %s }",
+				MeasureValue(limit.metric, limit.stat),
+				limit.bytes,
+				limit.exceeded ? "true" : "false");
+	}
+	fprintf(f, "%s],\n\t\"exceeded\": %s,\n", g_measure.limits.size() ? "\n\t" : "", MeasureLimitsExceeded() ? "true" : "false");
+	fprintf(f,
+			"\t\"overhead\": { \"tracker_cpu_seconds\": %.3f, \"tracker_cpu_percent\": %.2f, \"command_cpu_seconds\": %.3f }\n}\n",
+			report.trackerCpuSeconds,
+			report.seconds > 0 ? report.trackerCpuSeconds * 100 / report.seconds : 0.0,
+			report.commandCpuSeconds);
+	LeaveCriticalSection(&g_critSec);
+	fclose(f);
+	return true;
+}
+
+void PrintMeasurement(FILE* out)
+{
+	EnterCriticalSection(&g_critSec);
+	fprintf(out, "%-16s", "");
+	for(const char* stat : g_measureStatNames)
+		fprintf(out, " %10s", stat);
+	fprintf(out, "\n");
+	for(int metric = 0; metric < MEASURE_METRIC_COUNT; ++metric)
+	{
+		fprintf(out, "%-16s", g_measureMetricNames[metric]);
+		for(int stat = 0; stat < MEASURE_STAT_COUNT; ++stat)
+		{
+			char text[MEMORY_TEXT_MAX + 1];
+			text[FormatMemoryText(MeasureValue((UINT8)metric, (UINT8)stat), text)] = '\0';
+			fprintf(out, " %10s", text);
+		}
+		fprintf(out, "\n");
+	}
+	for(const MeasureLimit& limit : g_measure.limits)
+		fprintf(out, "%s: %s\n", limit.text.c_str(), limit.exceeded ? "EXCEEDED" : "ok");
+	LeaveCriticalSection(&g_critSec);
+}
+
+#ifdef _WIN32
+static double FileTimeSeconds(const FILETIME& time)
+{
+	return (double)(((UINT64)time.dwHighDateTime << 32) | time.dwLowDateTime) / 1e7;
+}
+
+static double ProcessCpuSeconds(HANDLE process)
+{
+	FILETIME creation, exit, kernel, user;
+	if(!GetProcessTimes(process, &creation, &exit, &kernel, &user))
+		return 0;
+	return FileTimeSeconds(kernel) + FileTimeSeconds(user);
+}
+
+bool LaunchMeasured(const std::vector<std::string>& args, MeasuredProcess& process)
+{
+	std::string commandLine;
+	for(const std::string& arg : args)
+	{
+		if(commandLine.size())
+			commandLine += ' ';
+		if(args.size() > 1 && arg.find_first_of(" \t\"") != std::string::npos)
+			commandLine += '"' + arg + '"';
+		else
+			commandLine += arg;
+	}
+
+	// Suspended until it is tracked, in its own console so it does not draw over ours
+	STARTUPINFOA		startup = { sizeof(startup) };
+	PROCESS_INFORMATION info	= {};
+	if(!CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, FALSE, CREATE_SUSPENDED | CREATE_NEW_CONSOLE, nullptr, nullptr, &startup, &info))
+	{
+		fprintf(g_LogFile, "Failed to launch '%s', error %lu\n", commandLine.c_str(), GetLastError());
+		fflush(g_LogFile);
+		return false;
+	}
+	EnterCriticalSection(&g_critSec);
+	TrackProcessTree(info.dwProcessId);
+	LeaveCriticalSection(&g_critSec);
+	ResumeThread(info.hThread);
+	CloseHandle(info.hThread);
+	process		   = {};
+	process.pid	   = info.dwProcessId;
+	process.handle = (intptr_t)info.hProcess;
+	return true;
+}
+
+bool PollMeasured(MeasuredProcess& process)
+{
+	if(process.exited)
+		return true;
+	if(WaitForSingleObject((HANDLE)process.handle, 0) != WAIT_OBJECT_0)
+		return false;
+	DWORD exitCode = 0;
+	GetExitCodeProcess((HANDLE)process.handle, &exitCode);
+	process.exitCode   = (int)exitCode;
+	process.cpuSeconds = ProcessCpuSeconds((HANDLE)process.handle);
+	process.exited	   = true;
+	CloseHandle((HANDLE)process.handle);
+	process.handle = 0;
+	return true;
+}
+
+double TrackerCpuSeconds()
+{
+	return ProcessCpuSeconds(GetCurrentProcess());
+}
+#else
+static double TimevalSeconds(const timeval& time)
+{
+	return time.tv_sec + time.tv_usec / 1e6;
+}
+
+bool LaunchMeasured(const std::vector<std::string>& args, MeasuredProcess& process)
+{
+	std::vector<std::string> command = args;
+	if(command.size() == 1)
+		command = { "/bin/sh", "-c", args[0] };
+	std::vector<char*> argv;
+	for(std::string& arg : command)
+		argv.push_back(&arg[0]);
+	argv.push_back(nullptr);
+
+	pid_t pid;
+	int	  error = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+	if(error)
+	{
+		fprintf(g_LogFile, "Failed to launch '%s': %s\n", argv[0], strerror(error));
+		fflush(g_LogFile);
+		return false;
+	}
+	EnterCriticalSection(&g_critSec);
+	TrackProcessTree((DWORD)pid);
+	LeaveCriticalSection(&g_critSec);
+	process		= {};
+	process.pid = (DWORD)pid;
+	return true;
+}
+
+bool PollMeasured(MeasuredProcess& process)
+{
+	if(process.exited)
+		return true;
+	int status = 0;
+	if(waitpid((pid_t)process.pid, &status, WNOHANG) != (pid_t)process.pid)
+		return false;
+	process.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	rusage usage;
+	getrusage(RUSAGE_CHILDREN, &usage);
+	process.cpuSeconds = TimevalSeconds(usage.ru_utime) + TimevalSeconds(usage.ru_stime);
+	process.exited	   = true;
+	return true;
+}
+
+double TrackerCpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return TimevalSeconds(usage.ru_utime) + TimevalSeconds(usage.ru_stime);
+}
+#endif
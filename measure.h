@@ -0,0 +1,113 @@
+#pragma once
+// Launch and measure
+//  runs a command, tracks it and every process it starts by pid (TrackProcessTree), and keeps the sums of the
+//  tracked entries' local usage, local commitment and demoted commitment while it runs. The sums move with the
+//  memory updates of tracked entries, and the time spent at each value goes into a log histogram, so the
+//  percentiles are of time over the run (p99: what the value stayed under 99% of the time) without sampling.
+//  A JSON summary gets the statistics, the limits given and the tracker's own CPU time, for CI to fail a run.
+#include "tracker.h"
+#include <string>
+#include <vector>
+
+#define MEASURE_BUCKETS_PER_OCTAVE 8
+#define MEASURE_BUCKETS (2 + 48 * MEASURE_BUCKETS_PER_OCTAVE) // 0 bytes, then from 1 byte to 256 TB
+
+enum MeasureMetric : UINT8
+{
+	MEASURE_USAGE,
+	MEASURE_COMMITMENT,
+	MEASURE_DEMOTED,	  // all priorities
+	MEASURE_DEMOTED_PRIO, // then one per priority
+	MEASURE_METRIC_COUNT = MEASURE_DEMOTED_PRIO + PRIO_COUNT,
+};
+
+enum MeasureStat : UINT8
+{
+	MEASURE_PEAK,
+	MEASURE_MEAN,
+	MEASURE_P50,
+	MEASURE_P90,
+	MEASURE_P95,
+	MEASURE_P99,
+	MEASURE_STAT_COUNT,
+};
+
+// The sum of a metric over the tracked entries, and how long it was at each value
+struct MeasureSeries
+{
+	UINT64 value;
+	UINT64 peak;
+	INT64  since; // event time of the last change
+	double byteTicks;
+	INT64  ticks[MEASURE_BUCKETS];
+};
+
+// <metric>[.<prio>][.<stat>] > <amount>, the stat is the peak if not given
+struct MeasureLimit
+{
+	std::string text;
+	UINT8		metric;
+	UINT8		stat;
+	UINT64		bytes;
+	bool		exceeded;
+};
+
+struct Measurement
+{
+	bool					  active	= false;
+	INT64					  start		= 0; // event time
+	INT64					  end		= 0;
+	UINT32					  processes = 0; // tracked by pid during the run
+	MeasureSeries			  series[MEASURE_METRIC_COUNT];
+	std::vector<MeasureLimit> limits;
+};
+
+extern Measurement g_measure;
+extern const char* g_measureMetricNames[MEASURE_METRIC_COUNT];
+extern const char* g_measureStatNames[MEASURE_STAT_COUNT];
+
+// Need g_critSec
+void   StartMeasurement(INT64 time); // from the entries tracked at 'time'
+void   FinishMeasurement(INT64 time); // and checks the limits
+void   MeasureChange(UINT8 metric, UINT64 previous, UINT64 value);
+void   MeasureOnTracked(UINT32 index, bool tracked); // the entry joins or leaves the sums
+void   MeasureOnProcess(DWORD pid);
+UINT64 MeasureValue(UINT8 metric, UINT8 stat);
+
+inline void MeasureOnUpdate(UINT32 index, UINT8 metric, UINT64 previous, UINT64 value)
+{
+	if(g_measure.active && g_processMemory.tracked[index])
+		MeasureChange(metric, previous, value);
+}
+
+bool ParseMeasureLimit(const char* text, MeasureLimit& limit);
+bool AddMeasureLimit(const char* text);
+bool MeasureLimitsExceeded();
+
+// What the summary reports besides the statistics
+struct MeasureReport
+{
+	std::string command;
+	int			exitCode;
+	double		seconds;
+	double		trackerCpuSeconds;
+	double		commandCpuSeconds; // the root process, and on Linux the descendants it waited for
+};
+
+bool WriteMeasureSummary(const char* path, const MeasureReport& report);
+void PrintMeasurement(FILE* out); // a table of the statistics and the limits
+
+struct MeasuredProcess
+{
+	DWORD	 pid		= 0;
+	intptr_t handle		= 0; // of the process on Windows
+	bool	 exited		= false;
+	int		 exitCode	= 0;
+	double	 cpuSeconds = 0;
+};
+
+// A single argument is a command line (run by the shell on Linux), more are the program and its arguments.
+// The process is tracked before it runs on Windows, and before the next DRM scan on Linux.
+bool   LaunchMeasured(const std::vector<std::string>& args, MeasuredProcess& process);
+bool   PollMeasured(MeasuredProcess& process); // true once it exited, with exitCode and cpuSeconds
+double TrackerCpuSeconds();
@@ -0,0 +1,111 @@
+#pragma once
+// The Windows types and calls used by the portable parts of the tracker, so the core builds on other platforms too.
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <time.h>
+#include <mutex>
+
+typedef uint32_t		   DWORD;
+typedef int				   BOOL;
+typedef uint8_t			   BYTE, UCHAR, UINT8;
+typedef uint16_t		   WORD, USHORT, UINT16;
+typedef uint32_t		   UINT, UINT32;
+typedef unsigned long long UINT64, ULONGLONG; // same types as Windows so the %llu formats work everywhere
+typedef long long		   INT64, LONGLONG;
+typedef int16_t			   SHORT;
+typedef char			   CHAR;
+typedef wchar_t			   WCHAR;
+typedef size_t			   SIZE_T;
+typedef void*			   PVOID;
+typedef void*			   HANDLE;
+
+typedef union
+{
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter)
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	counter->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return 1;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+	frequency->QuadPart = 1000000000;
+	return 1;
+}
+
+struct CRITICAL_SECTION
+{
+	std::recursive_mutex mutex;
+};
+
+inline void InitializeCriticalSection(CRITICAL_SECTION*)
+{
+}
+inline void EnterCriticalSection(CRITICAL_SECTION* cs)
+{
+	cs->mutex.lock();
+}
+inline void LeaveCriticalSection(CRITICAL_SECTION* cs)
+{
+	cs->mutex.unlock();
+}
+
+struct GUID
+{
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t	 Data4[8];
+};
+
+inline bool IsEqualGUID(const GUID& a, const GUID& b)
+{
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+typedef struct
+{
+	union
+	{
+		WCHAR UnicodeChar;
+		CHAR  AsciiChar;
+	} Char;
+	WORD Attributes;
+} CHAR_INFO;
+
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#ifndef _MSC_VER
+#define __debugbreak() __builtin_trap()
+#endif
+#define sprintf_s snprintf
+#define swprintf_s swprintf
+#define _strnicmp strncasecmp
+
+inline int fopen_s(FILE** f, const char* path, const char* mode)
+{
+	*f = fopen(path, mode);
+	return *f ? 0 : 1;
+}
+
+inline int _wfopen_s(FILE** f, const wchar_t* path, const wchar_t* mode)
+{
+	char narrowPath[1024], narrowMode[16];
+	if(wcstombs(narrowPath, path, sizeof(narrowPath)) == (size_t)-1 || wcstombs(narrowMode, mode, sizeof(narrowMode)) == (size_t)-1)
+		return 1;
+	return fopen_s(f, narrowPath, narrowMode);
+}
+#endif
@@ -0,0 +1,210 @@
+#include "publish.h"
+#include "snapshot.h"
+#include <string.h>
+#include <string>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static DemoteSharedHeader*				g_sharedHeader = nullptr;
+static std::string						g_sharedName;
+#ifdef _WIN32
+static HANDLE							g_sharedMapping = nullptr;
+#endif
+static Snapshot							g_publishSnapshot;
+static std::vector<const SnapshotEntry*> g_publishOrder;
+
+bool StartSharedState(const char* name)
+{
+	StopSharedState();
+	const size_t size = sizeof(DemoteSharedHeader);
+#ifdef _WIN32
+	g_sharedName = std::string("Local\\") + name;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, g_sharedName.c_str());
+	void*  view	   = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+	if(!view)
+	{
+		if(mapping)
+			CloseHandle(mapping);
+		fprintf(g_LogFile, "Failed to create the shared state '%s': %u\n", g_sharedName.c_str(), (unsigned)GetLastError());
+		return false;
+	}
+	g_sharedMapping = mapping;
+#else
+	g_sharedName = std::string("/") + name;
+	int	  fd	 = shm_open(g_sharedName.c_str(), O_CREAT | O_RDWR, 0644);
+	void* view	 = MAP_FAILED;
+	if(fd >= 0 && ftruncate(fd, size) == 0)
+		view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(fd >= 0)
+		close(fd);
+	if(view == MAP_FAILED)
+	{
+		fprintf(g_LogFile, "Failed to create the shared state '%s'\n", g_sharedName.c_str());
+		if(fd >= 0)
+			shm_unlink(g_sharedName.c_str());
+		return false;
+	}
+#endif
+
+	// Readers check the layout fields, so they are written before anything is published
+	DemoteSharedHeader* h = new(view) DemoteSharedHeader;
+	h->published.store(0, std::memory_order_relaxed);
+	h->blocks[0].sequence.store(0, std::memory_order_relaxed);
+	h->blocks[1].sequence.store(0, std::memory_order_relaxed);
+	h->magic	   = DEMOTE_SHARED_MAGIC;
+	h->version	   = DEMOTE_SHARED_VERSION;
+	h->headerSize  = sizeof(DemoteSharedHeader);
+	h->blockSize   = sizeof(DemoteSharedBlock);
+	h->maxAdapters = DEMOTE_SHARED_MAX_ADAPTERS;
+	h->maxEntries  = DEMOTE_SHARED_MAX_ENTRIES;
+#ifdef _WIN32
+	h->writerPid = GetCurrentProcessId();
+#else
+	h->writerPid = (uint32_t)getpid();
+#endif
+	h->frequency = g_qpcFrequency;
+	std::atomic_thread_fence(std::memory_order_release);
+	g_sharedHeader = h;
+	return true;
+}
+
+void StopSharedState()
+{
+	if(!g_sharedHeader)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(g_sharedHeader);
+	CloseHandle(g_sharedMapping);
+	g_sharedMapping = nullptr;
+#else
+	munmap(g_sharedHeader, sizeof(DemoteSharedHeader));
+	shm_unlink(g_sharedName.c_str());
+#endif
+	g_sharedHeader = nullptr;
+}
+
+// UTF-8 from UTF-16 or UTF-32 wchar_t, cut at a character boundary to fit
+static void ToUtf8(const wstring& str, char* buffer, size_t bufferSize)
+{
+	size_t length = 0;
+	for(size_t i = 0; i < str.size(); ++i)
+	{
+		UINT32 c = (UINT32)str[i];
+		if(c >= 0xd800 && c < 0xdc00 && i + 1 < str.size() && (UINT32)str[i + 1] >= 0xdc00 && (UINT32)str[i + 1] < 0xe000)
+			c = 0x10000 + ((c - 0xd800) << 10) + ((UINT32)str[++i] - 0xdc00);
+		char   bytes[4];
+		size_t count;
+		if(c < 0x80)
+		{
+			bytes[0] = (char)c;
+			count	 = 1;
+		}
+		else if(c < 0x800)
+		{
+			bytes[0] = (char)(0xc0 | c >> 6);
+			bytes[1] = (char)(0x80 | (c & 0x3f));
+			count	 = 2;
+		}
+		else if(c < 0x10000)
+		{
+			bytes[0] = (char)(0xe0 | c >> 12);
+			bytes[1] = (char)(0x80 | (c >> 6 & 0x3f));
+			bytes[2] = (char)(0x80 | (c & 0x3f));
+			count	 = 3;
+		}
+		else
+		{
+			bytes[0] = (char)(0xf0 | c >> 18);
+			bytes[1] = (char)(0x80 | (c >> 12 & 0x3f));
+			bytes[2] = (char)(0x80 | (c >> 6 & 0x3f));
+			bytes[3] = (char)(0x80 | (c & 0x3f));
+			count	 = 4;
+		}
+		if(length + count >= bufferSize)
+			break;
+		memcpy(buffer + length, bytes, count);
+		length += count;
+	}
+	memset(buffer + length, 0, bufferSize - length);
+}
+
+static void WriteEntry(DemoteSharedEntry& out, const SnapshotEntry& e)
+{
+	out.pid				   = e.pid;
+	out.flags			   = e.tracked ? DEMOTE_SHARED_TRACKED : 0;
+	out.adapterId		   = (uint64_t)(uintptr_t)e.pDxgAdapter;
+	out.usageLocal		   = e.usageLocal;
+	out.commitmentLocal	   = e.commitmentLocal;
+	out.usageNonLocal	   = e.usageNonLocal;
+	out.commitmentNonLocal = e.commitmentNonLocal;
+	for(int i = 0; i < PRIO_COUNT; ++i)
+		out.demoted[i] = e.demoted[i];
+	ToUtf8(e.name, out.name, sizeof(out.name));
+}
+
+void PublishSharedState()
+{
+	DemoteSharedHeader* h = g_sharedHeader;
+	if(!h)
+		return;
+
+	// The snapshot is already sorted by (pid, adapter). When it does not fit, the tracked and then the largest
+	// entries are kept, in the same order.
+	TakeSnapshot(g_publishSnapshot);
+	const std::vector<SnapshotEntry>& entries = g_publishSnapshot.entries;
+	g_publishOrder.resize(entries.size());
+	for(size_t i = 0; i < entries.size(); ++i)
+		g_publishOrder[i] = &entries[i];
+	if(entries.size() > DEMOTE_SHARED_MAX_ENTRIES)
+	{
+		auto keep = g_publishOrder.begin() + DEMOTE_SHARED_MAX_ENTRIES;
+		std::nth_element(g_publishOrder.begin(),
+						 keep,
+						 g_publishOrder.end(),
+						 [](const SnapshotEntry* a, const SnapshotEntry* b)
+						 {
+							 if(a->tracked != b->tracked)
+								 return a->tracked > b->tracked;
+							 return a->usageLocal + a->DemotedSum() > b->usageLocal + b->DemotedSum();
+						 });
+		g_publishOrder.resize(DEMOTE_SHARED_MAX_ENTRIES);
+		// pointers into the sorted snapshot, so address order is (pid, adapter) order
+		std::sort(g_publishOrder.begin(), g_publishOrder.end());
+	}
+
+	UINT64			   published = h->published.load(std::memory_order_relaxed) + 1;
+	DemoteSharedBlock& block	 = h->blocks[published & 1];
+	block.sequence.store(published * 2 - 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	block.time		   = g_publishSnapshot.time;
+	block.entryTotal   = (uint32_t)entries.size();
+	block.entryCount   = (uint32_t)g_publishOrder.size();
+	block.adapterCount = 0;
+	for(const auto& pair : g_adapters)
+	{
+		if(block.adapterCount == DEMOTE_SHARED_MAX_ADAPTERS)
+			break;
+		const Adapter&		 adapter = pair.second;
+		DemoteSharedAdapter& out	 = block.adapters[block.adapterCount++];
+		out.id						 = (uint64_t)(uintptr_t)pair.first;
+		out.localMemory				 = adapter.LocalMemory;
+		out.nonLocalMemory			 = adapter.NonLocalMemory;
+		out.usageLocal				 = adapter.UsageLocal;
+		out.commitmentLocal			 = adapter.CommitmentLocal;
+		out.usageNonLocal			 = adapter.UsageNonLocal;
+		out.commitmentNonLocal		 = adapter.CommitmentNonLocal;
+		out.demoted					 = adapter.CommitmentDemoted;
+		ToUtf8(adapter.name, out.name, sizeof(out.name));
+	}
+	for(size_t i = 0; i < g_publishOrder.size(); ++i)
+		WriteEntry(block.entries[i], *g_publishOrder[i]);
+
+	block.sequence.store(published * 2, std::memory_order_release);
+	h->published.store(published, std::memory_order_release);
+}
@@ -0,0 +1,8 @@
+#pragma once
+// Publication of the tracker state into the shared memory segment described in shared_state.h
+#include "tracker.h"
+#include "shared_state.h"
+
+bool StartSharedState(const char* name = DEMOTE_SHARED_NAME); // creates the segment, false if it could not
+void StopSharedState();
+void PublishSharedState(); // needs g_critSec, does nothing if the segment was not created
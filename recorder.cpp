@@ -0,0 +1,367 @@
+#include "recorder.h"
+#include <string.h>
+#include <wchar.h>
+#include <new>
+#include <algorithm>
+
+// Single writer: the records of an event are filled in first and published with one store of the head
+static FlightRecord*	   g_flightRecords	   = nullptr;
+static UINT64			   g_flightCapacity	   = 0; // records, a power of two
+static INT64			   g_flightWindowTicks = 0;
+static std::atomic<UINT64> g_flightHead		   = 0; // records written so far
+
+bool StartFlightRecorder(double megabytes, double seconds)
+{
+	StopFlightRecorder();
+	UINT64 maxRecords = (UINT64)(megabytes * 1024 * 1024) / sizeof(FlightRecord);
+	UINT64 capacity	  = 1024;
+	while(capacity * 2 <= maxRecords)
+		capacity *= 2;
+
+	// Touching every page now keeps page faults off the trace thread
+	g_flightRecords = new(std::nothrow) FlightRecord[capacity];
+	if(!g_flightRecords)
+		return false;
+	memset(g_flightRecords, 0, capacity * sizeof(FlightRecord));
+	g_flightCapacity	= capacity;
+	g_flightWindowTicks = (INT64)(seconds * g_qpcFrequency);
+	g_flightHead.store(0, std::memory_order_release);
+	fprintf(g_LogFile, "Flight recorder: %llu records, last %.0f s\n", capacity, seconds);
+	fflush(g_LogFile);
+	return true;
+}
+
+void StopFlightRecorder()
+{
+	delete[] g_flightRecords;
+	g_flightRecords	 = nullptr;
+	g_flightCapacity = 0;
+}
+
+bool FlightRecorderEnabled()
+{
+	return g_flightRecords != nullptr;
+}
+
+static FlightRecord& RingRecord(UINT64 index)
+{
+	return g_flightRecords[index & (g_flightCapacity - 1)];
+}
+
+// The encoders write the records of an event through 'out', which maps an offset to a record, and return how many
+template <typename Out>
+static UINT64 EncodeProcess(Out&& out, FlightRecordType type, DWORD pid, DWORD parentPid, const wchar_t* name, INT64 time)
+{
+	size_t length = name ? wcslen(name) : 0;
+	length		  = length < FLIGHT_MAX_NAME ? length : FLIGHT_MAX_NAME;
+	UINT16 more	  = (UINT16)((length + FLIGHT_NAME_CHARS - 1) / FLIGHT_NAME_CHARS);
+	out(0)		  = { type, 0, more, (UINT32)pid, time, parentPid, length };
+	for(UINT16 m = 0; m < more; ++m)
+	{
+		UINT16 chars[FLIGHT_NAME_CHARS] = {};
+		for(size_t c = 0; c < FLIGHT_NAME_CHARS && m * FLIGHT_NAME_CHARS + c < length; ++c)
+			chars[c] = (UINT16)name[m * FLIGHT_NAME_CHARS + c];
+		FlightRecord& r = out(1 + m);
+		r				= { FLIGHT_MORE, 0, 0, 0, time, 0, 0 };
+		memcpy((BYTE*)&r + offsetof(FlightRecord, adapter), chars, sizeof(chars));
+	}
+	return 1 + more;
+}
+
+template <typename Out>
+static UINT64 EncodeSegment(Out&& out, PVOID adapter, const Segment& segment, INT64 time)
+{
+	out(0) = { FLIGHT_REPORT_SEGMENT, segment.group, 1, segment.id, time, (UINT64)adapter, segment.size };
+	out(1) = { FLIGHT_MORE, 0, 0, 0, time, segment.commitLimit, (UINT64)segment.flags << 32 | segment.numBanks };
+	return 2;
+}
+
+static void RecordProcess(FlightRecordType type, DWORD pid, DWORD parentPid, const wchar_t* name, INT64 time)
+{
+	if(!g_flightRecords)
+		return;
+	UINT64 head = g_flightHead.load(std::memory_order_relaxed);
+	auto   Ring	 = [head](UINT64 i) -> FlightRecord&
+	{
+		return RingRecord(head + i);
+	};
+	UINT64 count = EncodeProcess(Ring, type, pid, parentPid, name, time);
+	g_flightHead.store(head + count, std::memory_order_release);
+}
+
+static void RecordMemory(FlightRecordType type, UINT8 group, DWORD pid, PVOID adapter, UINT64 value, INT64 time)
+{
+	if(!g_flightRecords)
+		return;
+	UINT64 head		= g_flightHead.load(std::memory_order_relaxed);
+	RingRecord(head) = { type, group, 0, (UINT32)pid, time, (UINT64)adapter, value };
+	g_flightHead.store(head + 1, std::memory_order_release);
+}
+
+void RecordEvent(const ProcessStartEvent& e, INT64 time)
+{
+	RecordProcess(FLIGHT_PROCESS_START, e.ProcessID, e.ParentProcessID, e.ImageName, time);
+}
+
+void RecordEvent(const ProcessRundownEvent& e, INT64 time)
+{
+	RecordProcess(FLIGHT_PROCESS_RUNDOWN, e.ProcessID, e.ParentProcessID, e.ImageName, time);
+}
+
+void RecordEvent(const ProcessStopEvent& e, INT64 time)
+{
+	RecordMemory(FLIGHT_PROCESS_STOP, 0, e.ProcessID, nullptr, 0, time);
+}
+
+void RecordEvent(const ReportSegmentEvent& e, INT64 time)
+{
+	if(!g_flightRecords)
+		return;
+	Segment segment;
+	segment.id			= e.ulSegmentId;
+	segment.group		= e.MemorySegmentGroup;
+	segment.numBanks	= e.NbOfBanks;
+	segment.flags		= e.Flags;
+	segment.size		= e.Size;
+	segment.commitLimit = e.CommitLimit;
+	UINT64 head			= g_flightHead.load(std::memory_order_relaxed);
+	auto   Ring	 = [head](UINT64 i) -> FlightRecord&
+	{
+		return RingRecord(head + i);
+	};
+	UINT64 count = EncodeSegment(Ring, e.pDxgAdapter, segment, time);
+	g_flightHead.store(head + count, std::memory_order_release);
+}
+
+void RecordEvent(const VidMmProcessUsageChangeEvent& e, INT64 time)
+{
+	RecordMemory(FLIGHT_USAGE_CHANGE, e.MemorySegmentGroup, e.ProcessId, e.pDxgAdapter, e.NewUsage, time);
+}
+
+void RecordEvent(const VidMmProcessCommitmentChangeEvent& e, INT64 time)
+{
+	RecordMemory(FLIGHT_COMMITMENT_CHANGE, e.MemorySegmentGroup, e.ProcessId, e.pDxgAdapter, e.Commitment, time);
+}
+
+void RecordEvent(const VidMmProcessDemotedCommitmentChangeEvent& e, INT64 time)
+{
+	RecordMemory(FLIGHT_DEMOTED_COMMITMENT_CHANGE, e.PriorityClass, e.ProcessId, e.pDxgAdapter, e.Commitment, time);
+}
+
+bool DumpFlightRecorder(const char* path)
+{
+	if(!g_flightRecords)
+		return false;
+
+	// The writer may be filling in an event past the head, so the oldest FLIGHT_MAX_EVENT_RECORDS slots are left out
+	UINT64 end		 = g_flightHead.load(std::memory_order_acquire);
+	UINT64 available = g_flightCapacity - FLIGHT_MAX_EVENT_RECORDS;
+	UINT64 begin	 = end > available ? end - available : 0;
+	INT64  endTime	 = end > begin ? RingRecord(end - 1).time : 0;
+	INT64  startTime = endTime - g_flightWindowTicks;
+	for(UINT64 count = end - begin; count;)
+	{
+		UINT64 half = count / 2;
+		if(RingRecord(begin + half).time < startTime)
+		{
+			begin += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	INT64 firstTime = end > begin ? RingRecord(begin).time : endTime;
+
+	// What the events before the window said about the processes and segments, so the recording replays on its own
+	static std::vector<FlightRecord> prologue;
+	FlightRecord					 event[FLIGHT_MAX_EVENT_RECORDS];
+	auto							 Event = [&event](UINT64 i) -> FlightRecord&
+	{
+		return event[i];
+	};
+	prologue.clear();
+	EnterCriticalSection(&g_critSec);
+	for(const Process& process : g_processes)
+	{
+		const wstring& name = process.imagePath.size() ? process.imagePath : process.imageFilename;
+		if(process.pid == (DWORD)-1 || name.empty())
+			continue;
+		UINT64 count = EncodeProcess(Event, FLIGHT_PROCESS_RUNDOWN, process.pid, 0, name.c_str(), startTime);
+		prologue.insert(prologue.end(), event, event + count);
+	}
+	for(const auto& pair : g_adapters)
+		for(const Segment& segment : pair.second.segments)
+		{
+			UINT64 count = EncodeSegment(Event, pair.first, segment, startTime);
+			prologue.insert(prologue.end(), event, event + count);
+		}
+	LeaveCriticalSection(&g_critSec);
+
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "wb") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open flight recorder dump '%s'\n", path);
+		fflush(g_LogFile);
+		return false;
+	}
+	setvbuf(f, nullptr, _IONBF, 0); // the ring records go to the file without another copy
+
+	FlightFileHeader header = {};
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(prologue.data(), sizeof(FlightRecord), prologue.size(), f);
+	for(UINT64 index = begin; index < end;)
+	{
+		UINT64 pos	 = index & (g_flightCapacity - 1);
+		UINT64 count = std::min(end - index, g_flightCapacity - pos);
+		fwrite(&g_flightRecords[pos], sizeof(FlightRecord), count, f);
+		index += count;
+	}
+
+	// Records the writer reached while they were written out are garbage in the file
+	UINT64 after	   = g_flightHead.load(std::memory_order_acquire) + FLIGHT_MAX_EVENT_RECORDS;
+	UINT64 overwritten = after > begin + g_flightCapacity ? after - g_flightCapacity - begin : 0;
+
+	header.magic		   = FLIGHT_MAGIC;
+	header.version		   = FLIGHT_VERSION;
+	header.recordSize	   = sizeof(FlightRecord);
+	header.prologueRecords = (UINT32)prologue.size();
+	header.frequency	   = g_qpcFrequency;
+	header.startTime	   = startTime;
+	header.endTime		   = endTime;
+	header.numRecords	   = prologue.size() + end - begin;
+	header.skipRecords	   = std::min(overwritten, end - begin);
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+	bool ok = !ferror(f);
+	fclose(f);
+
+	fprintf(g_LogFile,
+			"Flight recorder: %s %llu records over %.1f s to '%s', %llu overwritten\n",
+			ok ? "wrote" : "FAILED to write",
+			header.numRecords,
+			(double)(endTime - firstTime) / g_qpcFrequency,
+			path,
+			header.skipRecords);
+	fflush(g_LogFile);
+	return ok;
+}
+
+bool LoadFlightRecording(const char* path, SynthStream& stream)
+{
+	stream.events.clear();
+	stream.imageNames.clear();
+	stream.numStorms = 0;
+
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "rb") || !f)
+		return false;
+	FlightFileHeader header;
+	std::vector<FlightRecord> records;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == FLIGHT_MAGIC && header.version == FLIGHT_VERSION &&
+			  header.recordSize == sizeof(FlightRecord) && header.frequency > 0;
+	if(ok)
+	{
+		FlightRecord buffer[4096];
+		size_t		 count;
+		while(records.size() < header.numRecords && (count = fread(buffer, sizeof(FlightRecord), _countof(buffer), f)))
+			records.insert(records.end(), buffer, buffer + count);
+	}
+	fclose(f);
+	if(!ok)
+		return false;
+
+	// Times are rebased to the start of the recording and converted to g_qpcFrequency ticks
+	double ratio = (double)g_qpcFrequency / header.frequency;
+	auto   Time	 = [&](INT64 time)
+	{
+		return 1 + (INT64)((double)(time - header.startTime) * ratio);
+	};
+
+	std::vector<std::pair<size_t, size_t>> names; // event, imageNames index
+	UINT64								   skipBegin = header.prologueRecords;
+	UINT64								   skipEnd	 = skipBegin + header.skipRecords;
+	for(UINT64 i = 0; i < records.size();)
+	{
+		if(i >= skipBegin && i < skipEnd)
+		{
+			i = skipEnd;
+			continue;
+		}
+		const FlightRecord& r = records[i];
+		UINT64				next = i + 1 + r.more;
+		bool				complete = r.type != FLIGHT_MORE && next <= records.size();
+		for(UINT64 m = i + 1; complete && m < next; ++m)
+			complete = records[m].type == FLIGHT_MORE;
+		if(!complete)
+		{
+			i++; // the rest of an event cut off at the start of the ring, or a corrupt record
+			continue;
+		}
+
+		SynthEvent e;
+		memset(&e, 0, sizeof(e));
+		e.time = Time(r.time);
+		e.type = (SynthEventType)r.type;
+		switch(r.type)
+		{
+		case FLIGHT_PROCESS_START:
+		case FLIGHT_PROCESS_RUNDOWN:
+		{
+			wstring name;
+			for(UINT64 m = i + 1; m < next; ++m)
+			{
+				UINT16 chars[FLIGHT_NAME_CHARS];
+				memcpy(chars, (const BYTE*)&records[m] + offsetof(FlightRecord, adapter), sizeof(chars));
+				for(UINT16 c : chars)
+					if(name.size() < r.value)
+						name += (wchar_t)c;
+			}
+			e.processStart.ProcessID	   = r.pid;
+			e.processStart.ParentProcessID = (DWORD)r.adapter;
+			names.push_back({ stream.events.size(), stream.imageNames.size() });
+			stream.imageNames.push_back(name);
+			break;
+		}
+		case FLIGHT_PROCESS_STOP:
+			e.processStop.ProcessID = r.pid;
+			break;
+		case FLIGHT_REPORT_SEGMENT:
+			e.reportSegment.ulSegmentId		   = r.pid;
+			e.reportSegment.pDxgAdapter		   = (PVOID)r.adapter;
+			e.reportSegment.Size			   = r.value;
+			e.reportSegment.MemorySegmentGroup = r.group;
+			e.reportSegment.CommitLimit		   = records[i + 1].adapter;
+			e.reportSegment.Flags			   = (UINT32)(records[i + 1].value >> 32);
+			e.reportSegment.NbOfBanks		   = (UINT32)records[i + 1].value;
+			break;
+		case FLIGHT_USAGE_CHANGE:
+			e.usageChange.NewUsage			 = r.value;
+			e.usageChange.pDxgAdapter		 = (PVOID)r.adapter;
+			e.usageChange.ProcessId			 = r.pid;
+			e.usageChange.MemorySegmentGroup = r.group;
+			break;
+		case FLIGHT_COMMITMENT_CHANGE:
+			e.commitmentChange.Commitment		  = r.value;
+			e.commitmentChange.pDxgAdapter		  = (PVOID)r.adapter;
+			e.commitmentChange.ProcessId		  = r.pid;
+			e.commitmentChange.MemorySegmentGroup = r.group;
+			break;
+		case FLIGHT_DEMOTED_COMMITMENT_CHANGE:
+			e.demotedCommitmentChange.Commitment	= r.value;
+			e.demotedCommitmentChange.pDxgAdapter	= (PVOID)r.adapter;
+			e.demotedCommitmentChange.ProcessId		= r.pid;
+			e.demotedCommitmentChange.PriorityClass = r.group;
+			break;
+		default:
+			i = next;
+			continue;
+		}
+		stream.events.push_back(e);
+		i = next;
+	}
+
+	// imageNames is complete, so its strings stay put now
+	for(const auto& name : names)
+		stream.events[name.first].processStart.ImageName = stream.imageNames[name.second].c_str();
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+// Flight recorder
+//  the decoded process/VidMm events are appended to a preallocated ring of fixed-size records by the trace
+//  thread, which never waits on it. A dump writes the last seconds of the ring to a .dtrec file straight from
+//  the ring memory while recording goes on; records the writer overwrote in the meantime are marked as skipped
+//  in the file header. Recordings load back into a SynthStream, so they replay through the same handlers.
+#include "tracker.h"
+#include "synth.h"
+
+#define FLIGHT_MAGIC 0x43525444 // "DTRC"
+#define FLIGHT_VERSION 1
+#define FLIGHT_NAME_CHARS 8 // per FLIGHT_MORE record
+#define FLIGHT_MAX_NAME 256 // longer image paths are cut
+#define FLIGHT_MAX_EVENT_RECORDS (1 + FLIGHT_MAX_NAME / FLIGHT_NAME_CHARS)
+
+// Same values as SynthEventType
+enum FlightRecordType : UINT8
+{
+	FLIGHT_PROCESS_START			 = SYNTH_PROCESS_START,
+	FLIGHT_PROCESS_STOP				 = SYNTH_PROCESS_STOP,
+	FLIGHT_REPORT_SEGMENT			 = SYNTH_REPORT_SEGMENT,
+	FLIGHT_USAGE_CHANGE				 = SYNTH_USAGE_CHANGE,
+	FLIGHT_COMMITMENT_CHANGE		 = SYNTH_COMMITMENT_CHANGE,
+	FLIGHT_DEMOTED_COMMITMENT_CHANGE = SYNTH_DEMOTED_COMMITMENT_CHANGE,
+	FLIGHT_PROCESS_RUNDOWN			 = SYNTH_PROCESS_RUNDOWN,
+	FLIGHT_MORE						 = 16,
+};
+
+// FLIGHT_MORE records carry the rest of the event before them in adapter and value: FLIGHT_NAME_CHARS
+// UTF-16 characters of the image path, or the CommitLimit and Flags << 32 | NbOfBanks of a segment
+struct FlightRecord
+{
+	UINT8  type;
+	UINT8  group; // MemorySegmentGroup, PriorityClass
+	UINT16 more;  // FLIGHT_MORE records following this one
+	UINT32 pid;	  // ProcessId, ulSegmentId
+	INT64  time;
+	UINT64 adapter; // pDxgAdapter, ParentProcessID
+	UINT64 value; // NewUsage, Commitment, segment Size
+};
+static_assert(sizeof(FlightRecord) == 32, "fixed record size");
+
+// A .dtrec file is this header, prologueRecords records describing the processes and segments known when
+// the dump was taken, then the ring records. The first skipRecords ring records were overwritten while
+// dumping and have to be ignored.
+struct FlightFileHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 recordSize;
+	UINT32 prologueRecords;
+	INT64  frequency;
+	INT64  startTime;
+	INT64  endTime;
+	UINT64 numRecords; // including the prologue
+	UINT64 skipRecords;
+};
+
+bool StartFlightRecorder(double megabytes, double seconds); // preallocates the ring
+void StopFlightRecorder();
+bool FlightRecorderEnabled();
+
+// Called on the trace thread for each decoded event, before its handler
+void RecordEvent(const ProcessStartEvent& e, INT64 time);
+void RecordEvent(const ProcessRundownEvent& e, INT64 time);
+void RecordEvent(const ProcessStopEvent& e, INT64 time);
+void RecordEvent(const ReportSegmentEvent& e, INT64 time);
+void RecordEvent(const VidMmProcessUsageChangeEvent& e, INT64 time);
+void RecordEvent(const VidMmProcessCommitmentChangeEvent& e, INT64 time);
+void RecordEvent(const VidMmProcessDemotedCommitmentChangeEvent& e, INT64 time);
+template <typename T>
+inline void RecordEvent(const T&, INT64)
+{
+}
+
+bool DumpFlightRecorder(const char* path); // takes g_critSec briefly for the prologue
+bool LoadFlightRecording(const char* path, SynthStream& stream);
@@ -0,0 +1,1311 @@
+#include "render.h"
+#include "alerts.h"
+#include "resolver.h"
+#include "snapshot.h"
+#include "recorder.h"
+#include "blame.h"
+#include "episode.h"
+#include "device.h"
+#include "history.h"
+#include <algorithm>
+#include <cwctype>
+#include <math.h>
+#include <string.h>
+
+int					   g_consoleWidth	   = 80;
+int					   g_consoleHeight	   = 80;
+int					   g_currentX		   = 0;
+int					   g_currentY		   = 0;
+int					   g_currentColor	   = 0;
+std::vector<CHAR_INFO> g_chars;
+bool				   g_detailedMode	   = false;
+bool				   g_showSegments	   = false;
+bool				   g_nonLocalView	   = false;
+bool				   g_showDevices	   = false;
+int					   g_heatmapView	   = HEATMAP_OFF;
+int					   g_heatmapZoom	   = 2;
+INT64				   g_heatmapOffset	   = 0;
+int					   g_sortColumn		   = SORT_USAGE;
+bool				   g_sortReverse	   = false;
+int					   g_scrollOffset	   = 0;
+int					   g_listRows		   = 1;
+wstring				   g_filterText;
+bool				   g_searchActive	   = false;
+int					   g_filterAdapter	   = -1;
+bool				   g_filterTrackedOnly = false;
+int					   g_filterMinSize	   = 0;
+FrameLatency		   g_frameLatency;
+const UINT64		   g_filterMinSizes[FILTER_MIN_SIZE_COUNT] = { 0, 1ull << 20, 16ull << 20, 64ull << 20, 256ull << 20, 1ull << 30 };
+bool				   g_detailedAvailable = false;
+int					   g_minSize		   = 0;
+
+// Colors
+int				   g_PrioTocolor[6]	  = { CYAN, YELLOW, DARK_YELLOW, RED, DARK_RED, MAGENTA };
+const char*		   g_prioNames[6]	  = { "?", "MIN", "LOW", "NORMAL", "HIGH", "MAX" };
+static int		   g_adapterToColor[] = { YELLOW, WHITE, MAGENTA, RED, CYAN, WHITE, BLUE, GREEN };
+static int		   g_numAdapterColors = sizeof(g_adapterToColor) / sizeof(g_adapterToColor[0]);
+
+void FormatBytes(int64_t bytes, wchar_t* buffer, size_t bufferSize)
+{
+	const wchar_t* units[]	 = { L"B", L"KB", L"MB", L"GB", L"TB" };
+	int			   unitIndex = 0;
+	double		   value	 = (double)(bytes < 0 ? -bytes : bytes);
+
+	while(value >= 1024.0 && unitIndex < 4)
+	{
+		value /= 1024.0;
+		unitIndex++;
+	}
+
+	if(bytes < 0)
+	{
+		swprintf_s(buffer, bufferSize, L"-%.2f%s", value, units[unitIndex]);
+	}
+	else
+	{
+		swprintf_s(buffer, bufferSize, L"%.2f%s", value, units[unitIndex]);
+	}
+}
+
+// Formats like "%6.1f %cB" with integer math only: the value is kept in tenths of the unit, starting at the
+// g_minSize unit and moving up while it is over 1024. Writes at most MEMORY_TEXT_MAX characters, no terminator.
+int FormatMemoryText(UINT64 bytes, char* out)
+{
+	const char ext[] = { ' ', 'K', 'M', 'G', 'T' };
+	int		   unit	 = g_minSize;
+	while(unit + 1 < (int)_countof(ext) && bytes > (1ull << (10 * (unit + 1))))
+		unit++;
+
+	// Rounded to nearest, ties to even like printf
+	int	   shift  = 10 * unit;
+	UINT64 tenths = bytes * 10;
+	if(shift)
+	{
+		UINT64 scaled = (bytes & ((1ull << shift) - 1)) * 10;
+		UINT64 digit  = scaled >> shift;
+		UINT64 rest	  = scaled & ((1ull << shift) - 1);
+		UINT64 half	  = 1ull << (shift - 1);
+		tenths		  = (bytes >> shift) * 10 + digit + (rest > half || (rest == half && (digit & 1)));
+	}
+
+	// Built backwards, then reversed into 'out'
+	char text[MEMORY_TEXT_MAX];
+	int	 n	 = 0;
+	text[n++] = 'B';
+	text[n++] = ext[unit];
+	text[n++] = ' ';
+	text[n++] = (char)('0' + tenths % 10);
+	text[n++] = '.';
+	tenths /= 10;
+	do
+	{
+		text[n++] = (char)('0' + tenths % 10);
+		tenths /= 10;
+	} while(tenths);
+	while(n < 9)
+		text[n++] = ' ';
+	for(int i = 0; i < n; ++i)
+		out[i] = text[n - 1 - i];
+	return n;
+}
+
+void FormatMemory(SIZE_T bytes, char* buffer, size_t bufSize)
+{
+	char   text[MEMORY_TEXT_MAX];
+	size_t length = std::min((size_t)FormatMemoryText(bytes, text), bufSize - 1);
+	memcpy(buffer, text, length);
+	buffer[length] = '\0';
+}
+
+static const char* SkipSpaces(const char* s)
+{
+	while(*s == ' ')
+		s++;
+	return s;
+}
+
+static void NextLine()
+{
+	g_currentX = 0;
+	g_currentY++;
+}
+
+static void Put(char c)
+{
+	if(g_currentX < g_consoleWidth)
+	{
+		int idx = g_currentY * g_consoleWidth + g_currentX;
+		if(idx < (int)g_chars.size())
+		{
+			g_chars.at(idx).Char.AsciiChar = c;
+			g_chars.at(idx).Attributes	   = (WORD)g_currentColor;
+		}
+		g_currentX += 1;
+	}
+}
+
+// Writes straight into the cells of the current line, clipped at the console width
+static void PutText(const char* text, int length)
+{
+	int count = std::min(length, g_consoleWidth - g_currentX);
+	if(count <= 0)
+		return;
+	if((g_currentY + 1) * g_consoleWidth <= (int)g_chars.size())
+	{
+		CHAR_INFO* cell = &g_chars[g_currentY * g_consoleWidth + g_currentX];
+		for(int i = 0; i < count; ++i)
+		{
+			cell[i].Char.AsciiChar = text[i];
+			cell[i].Attributes	   = (WORD)g_currentColor;
+		}
+	}
+	g_currentX += count;
+}
+
+static void PutRepeat(char c, int count)
+{
+	count = std::min(count, g_consoleWidth - g_currentX);
+	if(count <= 0)
+		return;
+	if((g_currentY + 1) * g_consoleWidth <= (int)g_chars.size())
+	{
+		CHAR_INFO* cell = &g_chars[g_currentY * g_consoleWidth + g_currentX];
+		for(int i = 0; i < count; ++i)
+		{
+			cell[i].Char.AsciiChar = c;
+			cell[i].Attributes	   = (WORD)g_currentColor;
+		}
+	}
+	g_currentX += count;
+}
+
+// A memory column: a separator and the value right aligned in 'width'
+static void PutMemory(UINT64 bytes, int width = MEMORY_WIDTH)
+{
+	char text[MEMORY_TEXT_MAX];
+	int	 length = FormatMemoryText(bytes, text);
+	PutRepeat(' ', 1 + width - length);
+	PutText(text, length);
+}
+
+template <typename... Args>
+static void PutFormat(const char* fmt, Args&&... args) /// wtf is going on with c++
+{
+	char buffer[512];
+	int	 r = std::snprintf(buffer, sizeof(buffer), fmt, std::forward<decltype(args)>(args)...);
+	if(r > 0)
+	{
+		int base = g_currentY * g_consoleWidth;
+		int i	 = 0;
+		while(i < r && g_currentX < g_consoleWidth)
+		{
+			int idx = base + g_currentX;
+			if(idx < (int)g_chars.size())
+			{
+				g_chars.at(idx).Char.AsciiChar = buffer[i];
+				g_chars.at(idx).Attributes	   = (WORD)g_currentColor;
+			}
+			g_currentX += 1;
+			i++;
+		}
+	}
+}
+
+void DrawMemoryBar(UINT32 index, SIZE_T usage, SIZE_T maxMemoryBytes, int barWidth)
+{
+	double barBytes	   = (double)maxMemoryBytes / (double)barWidth;
+	double rcpBarBytes = (double)barWidth / (double)maxMemoryBytes;
+
+	int filledBars = (int)(usage / barBytes);
+	if(filledBars > barWidth)
+		filledBars = barWidth;
+	if(usage > 0 && filledBars == 0)
+		filledBars = 1;
+
+	double floatBarPos = 0;
+	int	   barPut	   = 0;
+	int	   bars[PRIO_COUNT];
+	for(int i = PRIO_COUNT - 1; i >= 0; --i)
+	{
+		UINT64 dem = g_processMemory.demoted[index][i];
+		if(!dem)
+			bars[i] = 0;
+		else
+		{
+			double newFloatBarPos = floatBarPos + (dem * rcpBarBytes);
+			int	   c			  = (int)ceil(newFloatBarPos);
+			bars[i]				  = c - barPut;
+			if(bars[i])
+				barPut = c;
+			floatBarPos = newFloatBarPos;
+		}
+	}
+	int tail	   = barWidth - filledBars;
+	int baseBars   = filledBars - barPut;
+	g_currentColor = WHITE;
+	Put('[');
+	g_currentColor = (GREEN);
+	PutRepeat('#', baseBars);
+
+	for(int i = 0; i < PRIO_COUNT; ++i)
+	{
+		int count = bars[i];
+		if(count)
+		{
+			g_currentColor = (g_PrioTocolor[i + 1]);
+			PutRepeat('#', count);
+		}
+	}
+
+	g_currentColor = (DARK_GRAY);
+	PutRepeat('-', tail);
+
+	g_currentColor = (WHITE);
+	Put(']');
+}
+
+// Usage and commitment shown for an entry in the current (local or non-local) view
+static UINT64 EntryUsage(UINT32 index)
+{
+	return g_nonLocalView ? g_processMemory.cold[index].UsageNonLocal : g_processMemory.usageLocal[index];
+}
+
+static UINT64 EntryCommitment(UINT32 index)
+{
+	return g_nonLocalView ? g_processMemory.cold[index].CommitmentNonLocal : g_processMemory.commitmentLocal[index];
+}
+
+static UINT64 EntryDemoted(UINT32 index)
+{
+	UINT64 sum = 0;
+	for(UINT64 dem : g_processMemory.demoted[index])
+		sum += dem;
+	return sum;
+}
+
+// Flat trends for entries whose commitment never changed
+static const EntryTrends& EntryTrendsOf(UINT32 index)
+{
+	static const EntryTrends none = {};
+	const EntryTrends*		 trends = FindEntryTrends(index);
+	return trends ? *trends : none;
+}
+
+static wchar_t ToLowerChar(wchar_t c)
+{
+	if(c < 128)
+		return c >= L'A' && c <= L'Z' ? c + (L'a' - L'A') : c;
+	return (wchar_t)towlower(c);
+}
+
+// Case insensitive substring match, 'lowerPattern' already lower case
+static bool ContainsNoCase(const wstring& text, const wstring& lowerPattern)
+{
+	size_t n = lowerPattern.size();
+	if(n > text.size())
+		return false;
+	for(size_t i = 0; i + n <= text.size(); ++i)
+	{
+		size_t j = 0;
+		while(j < n && ToLowerChar(text[i + j]) == lowerPattern[j])
+			j++;
+		if(j == n)
+			return true;
+	}
+	return false;
+}
+
+// The adapter selected by g_filterAdapter, or nullptr for all. Wraps the selection back to all past the last adapter.
+static const Adapter* FilterAdapter()
+{
+	if(g_filterAdapter < 0)
+		return nullptr;
+	int i = 0;
+	for(const auto& pair : g_adapters)
+		if(i++ == g_filterAdapter)
+			return &pair.second;
+	g_filterAdapter = -1;
+	return nullptr;
+}
+
+// Fills 'order' with the entries that pass the list filters, tracked first then by g_sortColumn.
+// Returns the max usage of the current view.
+UINT64 SortProcessMemory(std::vector<UINT32>& order)
+{
+	static std::vector<double>		   sortKeys;
+	static std::vector<const wstring*> sortNames;
+	static std::vector<UINT8>		   nameMatch;
+	static const wstring			   noName;
+
+	INT64 now = EventClockNow();
+
+	const Adapter* adapter	  = FilterAdapter();
+	PVOID		   pAdapter	  = adapter ? adapter->pDxgAdapter : nullptr;
+	UINT64		   minSize	  = g_filterMinSizes[g_filterMinSize];
+	bool		   byName	  = g_sortColumn == SORT_NAME;
+	bool		   nameFilter = g_filterText.size() != 0;
+
+	UINT64			  maxUsage	 = 1;
+	UINT32			  numEntries = g_processMemory.Size();
+	const UINT8*	  tracked	 = g_processMemory.tracked.data();
+	const ProcessKey* keys		 = g_processMemory.keys.data();
+	order.clear();
+	sortKeys.resize(numEntries);
+
+	// Names are matched once per process and handed to its entries through the per-process entry chain
+	if(nameFilter || byName)
+	{
+		sortNames.assign(numEntries, &noName);
+		nameMatch.assign(numEntries, 0);
+		for(const Process& proc : g_processes)
+		{
+			if(proc.firstMemorySlot == INVALID_MEMORY_INDEX)
+				continue;
+			UINT8 match = !nameFilter || ContainsNoCase(proc.imageFilename, g_filterText);
+			for(UINT32 slot = proc.firstMemorySlot; slot != INVALID_MEMORY_INDEX;)
+			{
+				UINT32 index	 = g_processMemory.slotToDense[slot];
+				sortNames[index] = &proc.imageFilename;
+				nameMatch[index] = match;
+				slot			 = g_processMemory.cold[index].nextForPid;
+			}
+		}
+	}
+
+	for(UINT32 i = 0; i < numEntries; ++i)
+	{
+		UINT64 usage  = EntryUsage(i);
+		UINT64 commit = EntryCommitment(i);
+		if(usage == 0 && commit == 0)
+			continue;
+		if((g_filterTrackedOnly && !tracked[i]) || (pAdapter && keys[i].pDxgAdapter != pAdapter) ||
+		   std::max(usage, commit) < minSize)
+			continue;
+		if(nameFilter && !nameMatch[i])
+			continue;
+		order.push_back(i);
+		maxUsage = usage > maxUsage ? usage : maxUsage;
+		switch(g_sortColumn)
+		{
+		case SORT_USAGE:
+			sortKeys[i] = (double)usage;
+			break;
+		case SORT_COMMIT:
+			sortKeys[i] = (double)commit;
+			break;
+		case SORT_GROWTH:
+			sortKeys[i] = EntryTrendsOf(i).CommitmentLocalTrend.Rate(now, g_qpcFrequency);
+			break;
+		case SORT_DEMOTED:
+			sortKeys[i] = (double)EntryDemoted(i);
+			break;
+		default:
+			sortKeys[i] = 0;
+			break;
+		}
+	}
+
+	// Numeric columns sort largest first, names alphabetically; g_sortReverse flips either
+	bool reverse = g_sortReverse;
+	if(byName)
+	{
+		const wstring* const* names = sortNames.data();
+		std::sort(order.begin(),
+				  order.end(),
+				  [names, tracked, reverse](UINT32 a, UINT32 b)
+				  {
+					  if(tracked[a] != tracked[b])
+						  return tracked[a] > tracked[b];
+					  int c = names[a]->compare(*names[b]);
+					  return reverse ? c > 0 : c < 0;
+				  });
+	}
+	else
+	{
+		const double* values = sortKeys.data();
+		std::sort(order.begin(),
+				  order.end(),
+				  [values, tracked, reverse](UINT32 a, UINT32 b)
+				  {
+					  if(tracked[a] != tracked[b])
+						  return tracked[a] > tracked[b];
+					  return reverse ? values[a] < values[b] : values[a] > values[b];
+				  });
+	}
+	return maxUsage;
+}
+
+// The name column text: '*' marks tracked processes, long names are cut with "...". Returns the length.
+static int FormatName(char* buffer, int bufferSize, DWORD pid, const wstring& name, bool tracked, int nameWidth)
+{
+	int length;
+	if(name.empty())
+		length = sprintf_s(buffer, bufferSize, "<pid %u>", (unsigned)pid);
+	else
+	{
+		buffer[0] = '*';
+		int start = tracked ? 1 : 0;
+		ToNarrow(name.c_str(), buffer + start, bufferSize - 1 - start);
+		length = (int)strlen(buffer);
+	}
+	if(length > nameWidth - 1)
+	{
+		memcpy(buffer + nameWidth - 4, "...", 3);
+		length = nameWidth - 1;
+	}
+	return length;
+}
+
+// A signed memory column, gains red and losses green
+static void PutDelta(INT64 delta)
+{
+	char   text[MEMORY_TEXT_MAX + 1];
+	char*  start	 = text + 1;
+	UINT64 magnitude = delta < 0 ? 0 - (UINT64)delta : (UINT64)delta;
+	int	   length	 = FormatMemoryText(magnitude, start);
+	if(delta)
+	{
+		int first = 0;
+		while(start[first] == ' ')
+			first++;
+		if(!first)
+		{
+			start--;
+			length++;
+			first++;
+		}
+		start[first - 1] = delta > 0 ? '+' : '-';
+	}
+	g_currentColor = delta > 0 ? RED : delta < 0 ? GREEN : DARK_GRAY;
+	PutRepeat(' ', 1 + MEMORY_WIDTH - length);
+	PutText(start, length);
+}
+
+static Snapshot				  g_diffCurrent;
+static std::vector<DiffEntry> g_diff;
+
+// Diffs the tracker against g_baseline and fills 'order' with the changed entries that pass the list filters,
+// tracked first then by the size of their change in g_sortColumn
+static void SortDiff(std::vector<UINT32>& order)
+{
+	static std::vector<UINT64> sortKeys;
+
+	TakeSnapshot(g_diffCurrent);
+	DiffSnapshots(g_baseline, g_diffCurrent, g_diff);
+
+	const Adapter* adapter	= FilterAdapter();
+	PVOID		   pAdapter = adapter ? adapter->pDxgAdapter : nullptr;
+	UINT64		   minSize	= std::max(g_filterMinSizes[g_filterMinSize], 1ull);
+	order.clear();
+	sortKeys.resize(g_diff.size());
+	for(UINT32 i = 0; i < (UINT32)g_diff.size(); ++i)
+	{
+		const DiffEntry&	 d		 = g_diff[i];
+		const SnapshotEntry& e		 = d.Any();
+		UINT64				 usage	 = (UINT64)llabs(d.Delta(&SnapshotEntry::Usage, g_nonLocalView));
+		UINT64				 commit	 = (UINT64)llabs(d.Delta(&SnapshotEntry::Commitment, g_nonLocalView));
+		UINT64				 demoted = (UINT64)llabs(d.DemotedSumDelta());
+		if(std::max({ usage, commit, demoted }) < minSize)
+			continue;
+		if((g_filterTrackedOnly && !e.tracked) || (pAdapter && e.pDxgAdapter != pAdapter) ||
+		   (g_filterText.size() && !ContainsNoCase(e.name, g_filterText)))
+			continue;
+		order.push_back(i);
+		sortKeys[i] = g_sortColumn == SORT_COMMIT ? commit : g_sortColumn == SORT_DEMOTED ? demoted : usage;
+	}
+
+	bool		  reverse = g_sortReverse;
+	bool		  byName  = g_sortColumn == SORT_NAME;
+	const UINT64* values  = sortKeys.data();
+	std::sort(order.begin(),
+			  order.end(),
+			  [values, reverse, byName](UINT32 a, UINT32 b)
+			  {
+				  const SnapshotEntry& ea = g_diff[a].Any();
+				  const SnapshotEntry& eb = g_diff[b].Any();
+				  if(ea.tracked != eb.tracked)
+					  return ea.tracked > eb.tracked;
+				  if(byName)
+				  {
+					  int c = ea.name.compare(eb.name);
+					  return reverse ? c > 0 : c < 0;
+				  }
+				  return reverse ? values[a] < values[b] : values[a] > values[b];
+			  });
+}
+
+static void DrawDiffRow(const DiffEntry& d, int nameWidth, bool showDetailed, int color)
+{
+	const SnapshotEntry& e = d.Any();
+	char				 nameBuffer[64];
+	int					 nameLength = FormatName(nameBuffer, sizeof(nameBuffer), e.pid, e.name, e.tracked, nameWidth);
+	g_currentColor					= d.state == DIFF_EXITED ? DARK_GRAY : color;
+	PutText(nameBuffer, nameLength);
+	PutRepeat(' ', nameWidth - nameLength);
+
+	g_currentColor = CYAN;
+	PutMemory(d.current ? d.current->Usage(g_nonLocalView) : 0);
+	PutDelta(d.Delta(&SnapshotEntry::Usage, g_nonLocalView));
+	PutDelta(d.Delta(&SnapshotEntry::Commitment, g_nonLocalView));
+	if(showDetailed)
+	{
+		for(int i = 0; i < PRIO_COUNT; ++i)
+			PutDelta(d.DemotedDelta(i));
+	}
+	else
+		PutDelta(d.DemotedSumDelta());
+
+	Put(' ');
+	if(d.state == DIFF_NEW)
+	{
+		g_currentColor = YELLOW;
+		PutFormat(" new");
+	}
+	else if(d.state == DIFF_EXITED)
+	{
+		g_currentColor = DARK_GRAY;
+		PutFormat(" exited");
+	}
+}
+
+static int DeviceRowCount(UINT32 index)
+{
+	return (int)std::min(DeviceMemoryCount(index), (UINT32)DEVICE_MAX_ROWS);
+}
+
+// The rows under an expanded entry, largest device first: its allocated bytes in the commit column, the
+// allocation count and the non-zero bytes per allocation type. Returns the number of lines drawn.
+static int DrawDeviceRows(UINT32 index, int nameWidth, int maxRows)
+{
+	const DeviceMemory* devices[DEVICE_MAX_ROWS];
+	UINT32				count = SortDeviceMemory(index, devices, DEVICE_MAX_ROWS);
+	int					rows  = std::min(DeviceRowCount(index), maxRows);
+	for(int row = 0; row < rows; row++)
+	{
+		DeviceMemory		more   = {};
+		const DeviceMemory* device = devices[row];
+		if(row == DEVICE_MAX_ROWS - 1 && count > DEVICE_MAX_ROWS)
+		{
+			// The smallest devices past the last row are summed into it
+			for(const DeviceMemory* other = FirstDeviceMemory(index); other; other = NextDeviceMemory(other))
+			{
+				if(std::find(devices, devices + row, other) != devices + row)
+					continue;
+				more.allocations += other->allocations;
+				for(int type = 0; type < ALLOCATION_TYPE_COUNT; type++)
+					more.bytes[type] += other->bytes[type];
+			}
+			device = &more;
+		}
+
+		char nameBuffer[64];
+		int	 nameLength;
+		if(device == &more)
+			nameLength = sprintf_s(nameBuffer, sizeof(nameBuffer), "  %u more devices", count - row);
+		else if(device->hDevice)
+			nameLength = sprintf_s(nameBuffer, sizeof(nameBuffer), "  device %llx", (UINT64)device->hDevice);
+		else
+			nameLength = sprintf_s(nameBuffer, sizeof(nameBuffer), "  (no device)");
+		nameLength	   = std::min(nameLength, nameWidth - 1);
+		g_currentColor = DARK_GRAY;
+		PutText(nameBuffer, nameLength);
+		PutRepeat(' ', nameWidth - nameLength + MEMORY_COLUMN);
+
+		g_currentColor = GRAY;
+		PutMemory(device->Total());
+		g_currentColor = DARK_GRAY;
+		PutFormat(" %8u alloc", device->allocations);
+		for(int type = 0; type < ALLOCATION_TYPE_COUNT; type++)
+		{
+			if(!device->bytes[type])
+				continue;
+			char text[32];
+			FormatMemory(device->bytes[type], text, sizeof(text));
+			g_currentColor = DARK_GRAY;
+			PutFormat("  %s ", g_allocationTypeNames[type]);
+			g_currentColor = GRAY;
+			PutFormat("%s", SkipSpaces(text));
+		}
+		PutRepeat(' ', g_consoleWidth - g_currentX);
+		NextLine();
+	}
+	return rows;
+}
+
+// Heatmap cells: the character is from the max of the bucket and the color from its min, relative to the largest
+// max in the window, so a short spike is a dim '@' and a sustained peak a bright one
+static const char g_heatChars[]						= ".:-=+*#%@";
+constexpr int	  HEAT_LEVELS						= sizeof(g_heatChars) - 1;
+constexpr int	  HEATMAP_TICK						= 12; // cells between the time axis labels
+static const int  g_heatUsageColors[HEAT_LEVELS]	= { DARK_BLUE, BLUE, DARK_CYAN, CYAN, DARK_GREEN, GREEN, YELLOW, WHITE, WHITE };
+static const int  g_heatDemotedColors[HEAT_LEVELS] = { DARK_GRAY, DARK_YELLOW, DARK_YELLOW, YELLOW, DARK_RED, RED, RED, MAGENTA, MAGENTA };
+
+static int HeatmapNameWidth()
+{
+	return g_consoleWidth < 60 ? NAME_WIDTH_SMALL : NAME_WIDTH;
+}
+
+static int HeatmapCells()
+{
+	return std::max(1, std::min(g_consoleWidth - HeatmapNameWidth() - MEMORY_COLUMN - 1, HISTORY_BUCKETS));
+}
+
+void PanHeatmap(int direction)
+{
+	INT64 step		= (INT64)std::max(1, HeatmapCells() / 4) << g_heatmapZoom;
+	g_heatmapOffset = std::max<INT64>(0, std::min(g_heatmapOffset - direction * step, (INT64)HISTORY_BUCKETS << (HISTORY_LEVELS - 1)));
+}
+
+void ZoomHeatmap(int steps)
+{
+	g_heatmapZoom = std::max(0, std::min(g_heatmapZoom + steps, HISTORY_LEVELS - 1));
+}
+
+// A row per history series with data in the window, largest peak first, and a cell per bucket of the zoom level
+// with the newest on the right. Reads each series once per cell, whatever the length of the history.
+static void RenderHeatmap()
+{
+	static std::vector<UINT32>		  rows;
+	static std::vector<UINT32>		  peaks;   // KB, of each series in the window
+	static std::vector<HistoryBucket> windows; // the buckets of each series in the window, cells apart
+	static std::vector<PVOID>		  adapters;
+
+	UINT8 metric	= g_heatmapView == HEATMAP_DEMOTED ? HISTORY_DEMOTED : HISTORY_USAGE;
+	int	  nameWidth = HeatmapNameWidth();
+	int	  cells		= HeatmapCells();
+	int	  level		= g_heatmapZoom;
+	INT64 right		= (HistoryBucketIndex(EventClockNow()) - g_heatmapOffset) >> level;
+	INT64 left		= right - cells + 1;
+
+	rows.clear();
+	adapters.clear();
+	peaks.resize(g_historySeries.size());
+	windows.resize(g_historySeries.size() * cells);
+	UINT32 scale = 1;
+	for(UINT32 i = 0; i < g_historySeries.size(); ++i)
+	{
+		HistorySeries& series = g_historySeries[i];
+		peaks[i]			  = HistoryBucketRange(i, metric, level, left, right, &windows[(size_t)i * cells]);
+		if(!peaks[i])
+			continue;
+		rows.push_back(i);
+		scale = std::max(scale, peaks[i]);
+		if(g_processMemory.Resolve(series.entry) != INVALID_MEMORY_INDEX)
+		{
+			const wstring& name = FindProcess(series.key.pid)->imageFilename;
+			if(name.size())
+				series.name = name;
+		}
+	}
+	std::sort(rows.begin(), rows.end(), [](UINT32 a, UINT32 b) { return peaks[a] != peaks[b] ? peaks[a] > peaks[b] : a < b; });
+
+	int maxRows	   = std::max(1, g_consoleHeight - 4);
+	int numListed  = (int)rows.size();
+	g_listRows	   = maxRows;
+	g_scrollOffset = std::max(0, std::min(g_scrollOffset, numListed - maxRows));
+	int displayCount = std::min(maxRows, numListed - g_scrollOffset);
+
+	g_chars.resize(g_consoleWidth * g_consoleHeight);
+	for(CHAR_INFO& c : g_chars)
+	{
+		c.Char.AsciiChar = ' ';
+		c.Attributes	 = 0;
+	}
+	g_currentX = 0;
+	g_currentY = 0;
+
+	// Title, with the span of a cell and of the window, and the value of the brightest cell
+	char cellSpan[32], windowSpan[32], offset[32], scaleText[32];
+	FormatSeconds((HISTORY_BUCKET_MS << level) / 1000.0, cellSpan, sizeof(cellSpan));
+	FormatSeconds(((INT64)cells * HISTORY_BUCKET_MS << level) / 1000.0, windowSpan, sizeof(windowSpan));
+	FormatSeconds(g_heatmapOffset * HISTORY_BUCKET_MS / 1000.0, offset, sizeof(offset));
+	FormatMemory((UINT64)scale << 10, scaleText, sizeof(scaleText));
+	g_currentColor = WHITE;
+	PutFormat("%s over time", metric == HISTORY_DEMOTED ? "Demoted commitment" : "Local usage");
+	g_currentColor = DARK_GRAY;
+	PutFormat(" -- %s per cell, %s window", cellSpan, windowSpan);
+	if(g_heatmapOffset)
+	{
+		g_currentColor = YELLOW;
+		PutFormat(" ending %s ago", offset);
+		g_currentColor = DARK_GRAY;
+	}
+	PutFormat(" -- %s max", SkipSpaces(scaleText));
+	NextLine();
+
+	// Time axis, a label every HEATMAP_TICK cells back from the right edge
+	g_currentColor = CYAN;
+	PutFormat("%-*s%*s ", nameWidth, "Process Name", MEMORY_WIDTH, "Peak");
+	char axis[HISTORY_BUCKETS + 16];
+	memset(axis, ' ', sizeof(axis));
+	for(int tick = cells - 1; tick >= 0; tick -= HEATMAP_TICK)
+	{
+		char   label[32] = "|now";
+		double seconds	 = (((INT64)(cells - 1 - tick) << level) + g_heatmapOffset) * HISTORY_BUCKET_MS / 1000.0;
+		if(seconds > 0)
+		{
+			label[1] = '-';
+			FormatSeconds(seconds, label + 2, sizeof(label) - 2);
+		}
+		int length = (int)strlen(label);
+		if(tick + length <= cells)
+			memcpy(axis + tick, label, length);
+		else
+			axis[tick] = '|';
+	}
+	g_currentColor = DARK_GRAY;
+	PutText(axis, cells);
+	NextLine();
+
+	PutFormat("-- %d-%d of %d ", displayCount ? g_scrollOffset + 1 : 0, g_scrollOffset + displayCount, numListed);
+	while(g_currentX < g_consoleWidth)
+		Put('-');
+	NextLine();
+
+	const int* colors = metric == HISTORY_DEMOTED ? g_heatDemotedColors : g_heatUsageColors;
+	for(int row = 0; row < displayCount; ++row)
+	{
+		UINT32				 i		= rows[g_scrollOffset + row];
+		const HistorySeries& series = g_historySeries[i];
+		UINT32				 index	= g_processMemory.Resolve(series.entry);
+		auto				 a		= std::find(adapters.begin(), adapters.end(), series.key.pDxgAdapter);
+		if(a == adapters.end())
+			a = adapters.insert(a, series.key.pDxgAdapter);
+		char nameBuffer[64];
+		bool tracked	= index != INVALID_MEMORY_INDEX && g_processMemory.tracked[index];
+		int	 nameLength = FormatName(nameBuffer, sizeof(nameBuffer), series.key.pid, series.name, tracked, nameWidth);
+		g_currentColor	= index == INVALID_MEMORY_INDEX ? DARK_GRAY : g_adapterToColor[(a - adapters.begin()) % g_numAdapterColors];
+		PutText(nameBuffer, nameLength);
+		PutRepeat(' ', nameWidth - nameLength);
+		g_currentColor = CYAN;
+		PutMemory((UINT64)peaks[i] << 10);
+		Put(' ');
+
+		const HistoryBucket* window = &windows[(size_t)i * cells];
+		for(int k = 0; k < cells; ++k)
+		{
+			const HistoryBucket& bucket = window[k];
+			if(!bucket.max)
+			{
+				Put(' ');
+				continue;
+			}
+			g_currentColor = colors[(UINT64)bucket.min * HEAT_LEVELS / ((UINT64)scale + 1)];
+			Put(g_heatChars[(UINT64)bucket.max * HEAT_LEVELS / ((UINT64)scale + 1)]);
+		}
+		NextLine();
+	}
+
+	g_currentColor = DARK_GRAY;
+	g_currentY	   = g_consoleHeight - 1;
+	g_currentX	   = 0;
+	if(g_frameLatency.count)
+		PutFormat("Latency %.0f/%.0f ms ", g_frameLatency.Median() * 1000, g_frameLatency.Max() * 1000);
+	PutFormat("[Esc:exit h:%s left/right:pan [/]:zoom arrows/pgup/pgdn:scroll]", g_heatmapView + 1 < HEATMAP_VIEW_COUNT ? "demoted" : "list");
+	g_currentColor = WHITE;
+}
+
+// Draws the process list into g_chars, sized g_consoleWidth x g_consoleHeight. Needs g_critSec.
+void RenderFrame()
+{
+	if(g_heatmapView != HEATMAP_OFF)
+	{
+		RenderHeatmap();
+		return;
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	INT64 eventNow = EventClockNow();
+
+	static std::vector<UINT32> processes;
+	static std::vector<PVOID>  adapters;
+
+	adapters.clear();
+
+	// The diff view lists entries of g_diff instead of the process memory table
+	bool   showDiff = g_diffMode && g_baseline.time;
+	UINT64 maxUsage = 1;
+	if(showDiff)
+		SortDiff(processes);
+	else
+		maxUsage = SortProcessMemory(processes);
+
+	int segmentLines = 0;
+	if(g_showSegments)
+	{
+		for(const auto& pair : g_adapters)
+			segmentLines += 1 + (int)pair.second.segments.size();
+		segmentLines = std::min(segmentLines, g_consoleHeight / 2);
+	}
+
+	const int HEADER_LINES = 4 + segmentLines;
+	int		  maxProcesses = g_consoleHeight - HEADER_LINES;
+	if(maxProcesses < 1)
+		maxProcesses = 1;
+
+	// Only the visible window of the filtered list is formatted. Expanded entries take their device rows
+	// from the window, so only as many entries as fit are walked, from the end when clamping the scroll.
+	bool showDevices = g_showDevices && !showDiff;
+	int	 numListed	 = (int)processes.size();
+	int	 maxOffset	 = numListed - maxProcesses;
+	if(showDevices)
+	{
+		int lines = 0;
+		for(maxOffset = numListed; maxOffset > 0; maxOffset--)
+		{
+			lines += 1 + DeviceRowCount(processes[maxOffset - 1]);
+			if(lines > maxProcesses)
+				break;
+		}
+	}
+	g_listRows	   = maxProcesses;
+	g_scrollOffset = std::max(0, std::min(g_scrollOffset, maxOffset));
+	const UINT32* visible	   = processes.data() + g_scrollOffset;
+	int			  displayCount = std::min(maxProcesses, numListed - g_scrollOffset);
+	if(showDevices)
+	{
+		int lines = 0;
+		for(int i = 0; i < displayCount; i++)
+		{
+			if(lines >= maxProcesses)
+				displayCount = i;
+			else
+				lines += 1 + DeviceRowCount(visible[i]);
+		}
+	}
+
+	for(int i = 0; i < displayCount; i++)
+	{
+		PVOID adapter = showDiff ? g_diff[visible[i]].Any().pDxgAdapter : g_processMemory.keys[visible[i]].pDxgAdapter;
+		if(adapters.end() == std::find(adapters.begin(), adapters.end(), adapter))
+			adapters.push_back(adapter);
+	}
+
+	int nameWidth	= g_consoleWidth < 60 ? NAME_WIDTH_SMALL : NAME_WIDTH;
+	int memoryWidth = MEMORY_WIDTH;
+
+	bool showDetailed = false;
+
+	int fixedWidth		= ColumnsWidth(nameWidth, SUMMARY_COLUMNS) + EPISODE_COLUMN + BLAME_COLUMN;
+	int fixedWidthAll	= ColumnsWidth(nameWidth, DETAILED_COLUMNS) + EPISODE_COLUMN + BLAME_COLUMN;
+	g_detailedAvailable = fixedWidthAll + 15 < g_consoleWidth;
+	if(g_detailedAvailable && g_detailedMode)
+	{
+		showDetailed = true;
+		fixedWidth	   = fixedWidthAll;
+	}
+
+	int barWidth = g_consoleWidth - fixedWidth;
+
+	if(barWidth < 10)
+		barWidth = 10;
+
+	g_currentX	   = 0;
+	g_currentY	   = 0;
+	g_currentColor = WHITE;
+
+	auto GetAdapterColor = [&](PVOID adapter)
+	{
+		for(int i = 0; i < (int)adapters.size(); ++i)
+		{
+			if(adapters[i] == adapter)
+			{
+				return g_adapterToColor[i % g_numAdapterColors];
+			}
+		}
+		return (int)WHITE;
+	};
+
+	g_chars.resize(g_consoleWidth * g_consoleHeight);
+	for(CHAR_INFO& c : g_chars)
+	{
+		c.Char.AsciiChar = ' ';
+		c.Attributes	 = 0;
+	}
+
+	for(PVOID adapter : adapters)
+	{
+		g_currentColor = GetAdapterColor(adapter);
+		Adapter* a	   = FindAdapter(adapter);
+		char	 local[32], nonLocal[32], demoted[32];
+		FormatMemory(a->CommitmentLocal, local, sizeof(local));
+		FormatMemory(a->CommitmentNonLocal, nonLocal, sizeof(nonLocal));
+		FormatMemory(a->CommitmentDemoted, demoted, sizeof(demoted));
+		PutFormat("[%ls (%.1fGB) local %s non-local %s demoted %s] ",
+				  a->name.c_str(),
+				  a->LocalMemory / (1024.0 * 1024.0 * 1024.0),
+				  SkipSpaces(local),
+				  SkipSpaces(nonLocal),
+				  SkipSpaces(demoted));
+	}
+	NextLine();
+
+	// Segment breakdown: adapter totals and utilisation, then a line per segment
+	int segmentEnd = g_currentY + segmentLines;
+	for(const auto& pair : g_adapters)
+	{
+		const Adapter& a = pair.second;
+		if(g_currentY >= segmentEnd)
+			break;
+		auto Percent = [](UINT64 value, UINT64 total)
+		{
+			return total ? 100.0 * value / total : 0.0;
+		};
+		char local[32], usage[32], commit[32], nonLocal[32], nonLocalUsage[32];
+		FormatMemory(a.LocalMemory, local, sizeof(local));
+		FormatMemory(a.UsageLocal, usage, sizeof(usage));
+		FormatMemory(a.CommitmentLocal, commit, sizeof(commit));
+		FormatMemory(a.NonLocalMemory, nonLocal, sizeof(nonLocal));
+		FormatMemory(a.UsageNonLocal, nonLocalUsage, sizeof(nonLocalUsage));
+		g_currentColor = GetAdapterColor(a.pDxgAdapter);
+		if(a.name.size())
+			PutFormat("%ls", a.name.c_str());
+		else
+			PutFormat("%p", a.pDxgAdapter);
+		PutFormat(": local %s, usage %s %3.0f%%, commit %s %3.0f%% | non-local %s, usage %s %3.0f%%",
+				  local,
+				  usage,
+				  Percent(a.UsageLocal, a.LocalMemory),
+				  commit,
+				  Percent(a.CommitmentLocal, a.LocalMemory),
+				  nonLocal,
+				  nonLocalUsage,
+				  Percent(a.UsageNonLocal, a.NonLocalMemory));
+		NextLine();
+		for(const Segment& s : a.segments)
+		{
+			if(g_currentY >= segmentEnd)
+				break;
+			char size[32], limit[32];
+			FormatMemory(s.size, size, sizeof(size));
+			FormatMemory(s.commitLimit, limit, sizeof(limit));
+			g_currentColor = s.group == SEGMENT_GROUP_LOCAL ? CYAN : DARK_CYAN;
+			PutFormat("  segment %3u %-9s %s %3.0f%%  commit limit %s  %3u bank%s%s%s",
+					  s.id,
+					  s.group == SEGMENT_GROUP_LOCAL ? "local" : "non-local",
+					  size,
+					  Percent(s.size, s.group == SEGMENT_GROUP_LOCAL ? a.LocalMemory : a.NonLocalMemory),
+					  limit,
+					  s.numBanks,
+					  s.numBanks == 1 ? "" : "s",
+					  s.cpuVisible ? "  cpu visible" : "",
+					  (s.flags & SEGMENT_FLAG_APERTURE) ? "  aperture" : "");
+			NextLine();
+		}
+	}
+	g_currentY = segmentEnd;
+	auto WritePrios = []()
+	{
+		PutFormat("[");
+		for(int i = 0; i < 5; ++i)
+		{
+			g_currentColor = g_PrioTocolor[i + 1];
+			if(i != 4)
+				PutFormat("%s ", g_prioNames[i + 1]);
+			else
+			{
+				PutFormat("%s", g_prioNames[i + 1]);
+				g_currentColor = (CYAN);
+				Put(']');
+			}
+		}
+	};
+
+	// Column titles, the sorted one marked with its direction
+	auto Title = [](const char* name, int column)
+	{
+		static char titles[SORT_COLUMN_COUNT][32];
+		if(column != g_sortColumn)
+			return name;
+		bool ascending = (column == SORT_NAME) != g_sortReverse;
+		sprintf_s(titles[column], sizeof(titles[column]), "%c%s", ascending ? '^' : 'v', name);
+		return (const char*)titles[column];
+	};
+	g_currentColor = CYAN;
+	if(showDiff)
+	{
+		PutFormat("%-*s  %*s  %*s  %*s  ",
+				  nameWidth,
+				  Title("Process Name", SORT_NAME),
+				  memoryWidth - 1,
+				  g_nonLocalView ? "NL Usage" : "Usage",
+				  memoryWidth - 1,
+				  Title("dUsage", SORT_USAGE),
+				  memoryWidth - 1,
+				  Title("dCommit", SORT_COMMIT));
+		if(showDetailed)
+		{
+			for(int i = 0; i < PRIO_COUNT; ++i)
+			{
+				g_currentColor = g_PrioTocolor[i + 1];
+				PutFormat("%*s  ", memoryWidth - 1, g_prioNames[i + 1]);
+			}
+		}
+		else
+			PutFormat("%*s  ", memoryWidth - 1, Title("dDemoted", SORT_DEMOTED));
+	}
+	else
+	{
+		PutFormat("%-*s  %*s  %*s  ",
+				  nameWidth,
+				  Title("Process Name", SORT_NAME),
+				  memoryWidth - 1,
+				  Title(g_nonLocalView ? "NL Usage" : "Usage", SORT_USAGE),
+				  memoryWidth - 1,
+				  Title(g_nonLocalView ? "NL Commit" : "Commit", SORT_COMMIT));
+		PutFormat("%*s  ", memoryWidth - 1, Title("Growth/s", SORT_GROWTH));
+		PutFormat("%*s  ", memoryWidth - 1, Title("Demoted", SORT_DEMOTED));
+		if(showDetailed)
+			WritePrios();
+		g_currentColor = CYAN;
+		PutRepeat(' ', fixedWidth - BLAME_COLUMN - EPISODE_WIDTH + 1 - g_currentX);
+		PutFormat("%*s %-*s", EPISODE_WIDTH, "Episodes p99", BLAME_WIDTH + 1, "Caused by");
+		g_currentColor = GREEN;
+		PutFormat("Present ");
+		g_currentColor = CYAN;
+		PutFormat("Demoted");
+		WritePrios();
+	}
+	NextLine();
+
+	// Separator, with the scroll position and the active filters
+	g_currentColor = DARK_GRAY;
+	PutFormat("-- %d-%d of %d ", displayCount ? g_scrollOffset + 1 : 0, g_scrollOffset + displayCount, numListed);
+	if(showDiff)
+	{
+		g_currentColor = WHITE;
+		PutFormat("-- changes since the baseline %.0f s ago ", (double)(now.QuadPart - g_baseline.time) / g_qpcFrequency);
+	}
+	if(g_filterText.size() || g_searchActive)
+	{
+		g_currentColor = g_searchActive ? WHITE : YELLOW;
+		PutFormat("-- name '%ls'%s ", g_filterText.c_str(), g_searchActive ? "_" : "");
+	}
+	g_currentColor = YELLOW;
+	if(const Adapter* adapter = FilterAdapter())
+	{
+		if(adapter->name.size())
+			PutFormat("-- adapter %ls ", adapter->name.c_str());
+		else
+			PutFormat("-- adapter %p ", adapter->pDxgAdapter);
+	}
+	if(g_filterTrackedOnly)
+		PutFormat("-- tracked only ");
+	if(g_filterMinSize)
+	{
+		char minSize[32];
+		FormatMemory(g_filterMinSizes[g_filterMinSize], minSize, sizeof(minSize));
+		PutFormat("-- at least %s ", SkipSpaces(minSize));
+	}
+	g_currentColor = DARK_GRAY;
+	while(g_currentX < g_consoleWidth)
+		Put('-');
+	NextLine();
+	for(int i = 0, line = 0; line < maxProcesses; i++, line++)
+	{
+		if(i < displayCount && showDiff)
+		{
+			const DiffEntry& d = g_diff[visible[i]];
+			DrawDiffRow(d, nameWidth, showDetailed, GetAdapterColor(d.Any().pDxgAdapter));
+		}
+		else if(i < displayCount)
+		{
+			UINT32				 index	 = visible[i];
+			const ProcessKey&	 key	 = g_processMemory.keys[index];
+			const ProcessMemory* procMem = &g_processMemory.cold[index];
+			UINT64				 usage	 = EntryUsage(index);
+			UINT64				 commit	 = EntryCommitment(index);
+			Process*			 proc	 = FindProcess(key.pid);
+			if(proc->imageFilename.length() == 0)
+				RequestProcessName(key.pid);
+			char nameBuffer[64];
+			int	 nameLength = FormatName(nameBuffer, sizeof(nameBuffer), key.pid, proc->imageFilename, proc->isTracked, nameWidth);
+
+			g_currentColor = GetAdapterColor(key.pDxgAdapter);
+			PutText(nameBuffer, nameLength);
+			PutRepeat(' ', nameWidth - nameLength);
+
+			g_currentColor = CYAN;
+			PutMemory(usage);
+			PutMemory(commit);
+
+			const Trend& trend = EntryTrendsOf(index).CommitmentLocalTrend;
+			double		 rate  = trend.Rate(eventNow, g_qpcFrequency);
+			double		 slope = trend.Slope();
+			char   arrow = ' ';
+			g_currentColor = DARK_GRAY;
+			if(slope > TREND_LEAK_SLOPE)
+			{
+				arrow		   = '^';
+				g_currentColor = RED;
+			}
+			else if(slope < -TREND_LEAK_SLOPE)
+			{
+				arrow		   = 'v';
+				g_currentColor = GREEN;
+			}
+			// The trend arrow takes the first character of the column
+			Put(' ');
+			Put(arrow);
+			PutMemory((UINT64)fabs(rate), MEMORY_WIDTH - 2);
+
+			if(showDetailed)
+			{
+				int idx = 0;
+				for(UINT64 dem : g_processMemory.demoted[index])
+				{
+					g_currentColor = dem ? g_PrioTocolor[idx + 1] : DARK_GRAY;
+					PutMemory(dem);
+					idx++;
+				}
+			}
+			else
+			{
+				UINT64 DemotedSum	  = 0;
+				int	   prioColorIndex = 0;
+				int	   idx			  = 0;
+				for(UINT64 dem : g_processMemory.demoted[index])
+				{
+					if(dem)
+						prioColorIndex = idx + 1;
+					DemotedSum += dem;
+					idx++;
+				}
+
+				g_currentColor = (g_PrioTocolor[prioColorIndex]);
+				PutMemory(DemotedSum);
+			}
+			// Episodes in yellow while one is open, with the p99 duration of the ended ones
+			EpisodeSummary episodes;
+			Put(' ');
+			if(EpisodeSummarize(index, eventNow, episodes))
+			{
+				char duration[32] = "-";
+				if(episodes.count > episodes.open)
+					FormatSeconds(episodes.p99, duration, sizeof(duration));
+				g_currentColor = episodes.open ? YELLOW : GRAY;
+				PutFormat("%5u %6s", episodes.count, duration);
+			}
+			else
+			{
+				g_currentColor = DARK_GRAY;
+				PutFormat("%*s", EPISODE_WIDTH, "-");
+			}
+			Put(' ');
+			if(const wstring* culprit = BlameCulpritName(index))
+			{
+				char culpritBuffer[64];
+				int	 culpritLength = FormatName(culpritBuffer, sizeof(culpritBuffer), procMem->blamePid, *culprit, false, BLAME_WIDTH);
+				g_currentColor	   = RED;
+				PutText(culpritBuffer, culpritLength);
+				PutRepeat(' ', BLAME_WIDTH - culpritLength);
+			}
+			else
+			{
+				g_currentColor = DARK_GRAY;
+				Put('-');
+				PutRepeat(' ', BLAME_WIDTH - 1);
+			}
+			DrawMemoryBar(index, usage, maxUsage, barWidth - 5);
+			g_currentColor = (WHITE);
+		}
+
+		PutRepeat(' ', g_consoleWidth - g_currentX);
+		NextLine();
+		if(i < displayCount && showDevices)
+			line += DrawDeviceRows(visible[i], nameWidth, maxProcesses - line - 1);
+	}
+	g_currentColor = (DARK_GRAY);
+	g_currentY	   = g_consoleHeight - 1;
+
+	if(g_frameLatency.count)
+		PutFormat("Latency %.0f/%.0f ms ", g_frameLatency.Median() * 1000, g_frameLatency.Max() * 1000);
+	PutFormat("[Esc:exit");
+	if(g_detailedAvailable)
+		PutFormat(" Space:detailed ");
+
+	PutFormat(" bmkg:bytes a:segments v:devices h:heatmap n:%s s:sort r:reverse x:baseline d:diff e:export", g_nonLocalView ? "local" : "non-local");
+	if(FlightRecorderEnabled())
+		PutFormat(" w:dump");
+	PutFormat(" arrows/pgup/pgdn:scroll /:search t:tracked f:adapter +-:min size]");
+	if(g_alertsActive)
+	{
+		g_currentColor = RED;
+		PutFormat(" %d alert%s active", g_alertsActive, g_alertsActive == 1 ? "" : "s");
+		g_currentColor = DARK_GRAY;
+	}
+
+	for(int i = g_currentX; i < g_consoleWidth - 1; i++)
+		Put(' ');
+	g_currentColor = (WHITE);
+}
+
+// Writes every (process, adapter) entry with its trend statistics as csv
+void ExportCsv(const char* path)
+{
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open export file '%s'\n", path);
+		fflush(g_LogFile);
+		return;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	struct exitDummy
+	{
+		~exitDummy()
+		{
+			LeaveCriticalSection(&g_critSec);
+		}
+	} foo;
+
+	INT64 now = EventClockNow();
+
+	fprintf(f, "pid,process,adapter,tracked,usage_local,commitment_local,usage_nonlocal,commitment_nonlocal");
+	for(int i = 0; i < PRIO_COUNT; ++i)
+		fprintf(f, ",demoted_%s", g_prioNames[i + 1]);
+	fprintf(f, ",commitment_rate,commitment_slope,commitment_min,commitment_max");
+	fprintf(f, ",demoted_rate,demoted_slope,demoted_min,demoted_max,caused_by");
+	fprintf(f, ",episodes,episodes_open,episode_p50_s,episode_p99_s,episode_longest_s,episode_peak,demoted_byte_seconds\n");
+
+	for(UINT32 index = 0; index < g_processMemory.Size(); ++index)
+	{
+		const ProcessKey&	 key = g_processMemory.keys[index];
+		const ProcessMemory& mem = g_processMemory.cold[index];
+		fprintf(f,
+				"%u,%ls,%ls,%d,%llu,%llu,%llu,%llu",
+				(unsigned)key.pid,
+				FindProcName(key.pid).c_str(),
+				FindAdapter(key.pDxgAdapter)->name.c_str(),
+				g_processMemory.tracked[index] ? 1 : 0,
+				g_processMemory.usageLocal[index],
+				g_processMemory.commitmentLocal[index],
+				mem.UsageNonLocal,
+				mem.CommitmentNonLocal);
+		for(UINT64 dem : g_processMemory.demoted[index])
+			fprintf(f, ",%llu", dem);
+		const EntryTrends& trends = EntryTrendsOf(index);
+		for(const Trend* trend : { &trends.CommitmentLocalTrend, &trends.CommitmentDemotedTrend })
+		{
+			UINT64 minValue, maxValue;
+			trend->Window(now, g_qpcFrequency, minValue, maxValue);
+			fprintf(f, ",%.0f,%.0f,%llu,%llu", trend->Rate(now, g_qpcFrequency), trend->Slope(), minValue, maxValue);
+		}
+		const wstring* culprit = BlameCulpritName(index);
+		fprintf(f, ",%ls", culprit ? culprit->c_str() : L"");
+		EpisodeSummary episodes;
+		EpisodeSummarize(index, now, episodes);
+		fprintf(f,
+				",%u,%u,%.3f,%.3f,%.3f,%llu,%.0f\n",
+				episodes.count,
+				episodes.open,
+				episodes.p50,
+				episodes.p99,
+				episodes.longest,
+				episodes.peak,
+				episodes.byteSeconds);
+	}
+	fclose(f);
+}
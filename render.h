@@ -0,0 +1,135 @@
+#pragma once
+// Console rendering into a CHAR_INFO buffer, and the text formatting shared with the exports.
+#include "tracker.h"
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+enum ConsoleColor
+{
+	BLACK		 = 0,
+	DARK_BLUE	 = 1,
+	DARK_GREEN	 = 2,
+	DARK_CYAN	 = 3,
+	DARK_RED	 = 4,
+	DARK_MAGENTA = 5,
+	DARK_YELLOW	 = 6,
+	GRAY		 = 7,
+	DARK_GRAY	 = 8,
+	BLUE		 = 9,
+	GREEN		 = 10,
+	CYAN		 = 11,
+	RED			 = 12,
+	MAGENTA		 = 13,
+	YELLOW		 = 14,
+	WHITE		 = 15
+};
+
+// Process list columns that can be sorted on
+enum SortColumn
+{
+	SORT_USAGE,
+	SORT_COMMIT,
+	SORT_GROWTH,
+	SORT_DEMOTED,
+	SORT_NAME,
+	SORT_COLUMN_COUNT
+};
+
+const int FILTER_MIN_SIZE_COUNT = 6;
+
+// Timeline heatmap of the history store (history.h) instead of the process list
+enum HeatmapView
+{
+	HEATMAP_OFF,
+	HEATMAP_USAGE,
+	HEATMAP_DEMOTED,
+	HEATMAP_VIEW_COUNT
+};
+
+// Process list layout: the name, then memory columns of a separator and MEMORY_WIDTH characters (usage, commit,
+// growth, then the demoted sum or one column per priority), the demotion episodes and their p99 duration, the
+// largest culprit of the demotions, then the bar in what is left of the line
+constexpr int MEMORY_TEXT_MAX  = 16; // "16777216.0 TB" for the largest UINT64
+constexpr int MEMORY_WIDTH	   = 10;
+constexpr int MEMORY_COLUMN	   = 1 + MEMORY_WIDTH;
+constexpr int SUMMARY_COLUMNS  = 4;
+constexpr int DETAILED_COLUMNS = 3 + PRIO_COUNT;
+constexpr int NAME_WIDTH	   = 25;
+constexpr int NAME_WIDTH_SMALL = 15;
+constexpr int EPISODE_WIDTH	   = 12;
+constexpr int EPISODE_COLUMN   = 1 + EPISODE_WIDTH;
+constexpr int BLAME_WIDTH	   = 15;
+constexpr int BLAME_COLUMN	   = 1 + BLAME_WIDTH;
+
+constexpr int ColumnsWidth(int nameWidth, int columns)
+{
+	return nameWidth + columns * MEMORY_COLUMN - 1;
+}
+
+// Event-to-screen latency of the most recent frames, in seconds
+struct FrameLatency
+{
+	static const int WINDOW = 64;
+	double			 samples[WINDOW];
+	int				 count = 0;
+	int				 next  = 0;
+
+	void Add(double seconds)
+	{
+		samples[next] = seconds;
+		next		  = (next + 1) % WINDOW;
+		count		  = std::min(count + 1, WINDOW);
+	}
+	double Median() const
+	{
+		double sorted[WINDOW];
+		std::copy(samples, samples + count, sorted);
+		std::nth_element(sorted, sorted + count / 2, sorted + count);
+		return sorted[count / 2];
+	}
+	double Max() const
+	{
+		return *std::max_element(samples, samples + count);
+	}
+};
+
+extern int					  g_consoleWidth;
+extern int					  g_consoleHeight;
+extern int					  g_currentX;
+extern int					  g_currentY;
+extern int					  g_currentColor;
+extern std::vector<CHAR_INFO> g_chars;
+extern bool					  g_detailedMode;
+extern bool					  g_showSegments;
+extern bool					  g_nonLocalView;
+extern bool					  g_showDevices; // entries expanded into a row per device (device.h)
+extern int					  g_heatmapView;
+extern int					  g_heatmapZoom;   // history level of the cells
+extern INT64				  g_heatmapOffset; // level 0 buckets from the latest event to the right edge, 0 follows it
+extern int					  g_sortColumn;
+extern bool					  g_sortReverse;
+// Process list scroll position and filters. g_listRows is the page size of the last frame, g_filterText is lower case.
+extern int					  g_scrollOffset;
+extern int					  g_listRows;
+extern wstring				  g_filterText;
+extern bool					  g_searchActive;
+extern int					  g_filterAdapter;
+extern bool					  g_filterTrackedOnly;
+extern int					  g_filterMinSize;
+extern const UINT64			  g_filterMinSizes[FILTER_MIN_SIZE_COUNT];
+extern FrameLatency			  g_frameLatency;
+extern bool					  g_detailedAvailable;
+extern int					  g_minSize;
+extern int					  g_PrioTocolor[6];
+extern const char*			  g_prioNames[6];
+
+void   FormatBytes(int64_t bytes, wchar_t* buffer, size_t bufferSize);
+int	   FormatMemoryText(UINT64 bytes, char* out);
+void   FormatMemory(SIZE_T bytes, char* buffer, size_t bufSize);
+void   DrawMemoryBar(UINT32 index, SIZE_T usage, SIZE_T maxMemoryBytes, int barWidth);
+UINT64 SortProcessMemory(std::vector<UINT32>& order);
+void   RenderFrame();
+void   PanHeatmap(int direction); // by a quarter of the cells, towards newer if positive
+void   ZoomHeatmap(int steps);	  // out if positive
+void   ExportCsv(const char* path);
@@ -0,0 +1,120 @@
+#include "resolver.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+struct NameFailure
+{
+	INT64 retryTime;
+	int	  failures;
+};
+
+static std::mutex							  g_nameMutex;
+static std::condition_variable				  g_nameWake;
+static std::vector<DWORD>					  g_nameQueue;
+static std::unordered_set<DWORD>			  g_namePending; // queued or being resolved
+static std::unordered_map<DWORD, NameFailure> g_nameFailures;
+static std::thread							  g_nameThread;
+static bool									  g_nameRunning = false;
+
+static INT64 NameNow()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+void RequestProcessName(DWORD pid)
+{
+	std::lock_guard<std::mutex> lock(g_nameMutex);
+	if(!g_nameRunning || g_namePending.count(pid))
+		return;
+	auto failure = g_nameFailures.find(pid);
+	if(failure != g_nameFailures.end() && NameNow() < failure->second.retryTime)
+		return;
+	g_namePending.insert(pid);
+	g_nameQueue.push_back(pid);
+	g_nameWake.notify_one();
+}
+
+static void NameResolverThread()
+{
+	std::vector<DWORD>	 batch;
+	std::vector<wstring> names;
+	while(1)
+	{
+		{
+			std::unique_lock<std::mutex> lock(g_nameMutex);
+			g_nameWake.wait(lock, [] { return !g_nameRunning || !g_nameQueue.empty(); });
+			if(!g_nameRunning)
+				return;
+			size_t count = std::min(g_nameQueue.size(), (size_t)NAME_BATCH_MAX);
+			batch.assign(g_nameQueue.begin(), g_nameQueue.begin() + count);
+			g_nameQueue.erase(g_nameQueue.begin(), g_nameQueue.begin() + count);
+		}
+
+		names.resize(batch.size());
+		for(size_t i = 0; i < batch.size(); ++i)
+			names[i] = g_processNameResolver(batch[i]);
+
+		// Processes that exited meanwhile are gone from g_pidToProcess, and names the trace delivered win
+		EnterCriticalSection(&g_critSec);
+		for(size_t i = 0; i < batch.size(); ++i)
+		{
+			auto itr = g_pidToProcess.find(batch[i]);
+			if(names[i].empty() || itr == g_pidToProcess.end())
+				continue;
+			Process* process = &g_processes[itr->second];
+			if(process->imageFilename.size())
+				continue;
+			process->imagePath	   = names[i];
+			process->imageFilename = GetFileName(names[i]);
+			process->isTracked	   = ProcessCheckTracked(batch[i], names[i]);
+			UpdateProcessMemoryTracked(process);
+			MarkDirty(g_eventTime);
+		}
+		LeaveCriticalSection(&g_critSec);
+
+		INT64						now = NameNow();
+		std::lock_guard<std::mutex> lock(g_nameMutex);
+		for(size_t i = 0; i < batch.size(); ++i)
+		{
+			g_namePending.erase(batch[i]);
+			if(names[i].size())
+			{
+				g_nameFailures.erase(batch[i]);
+				continue;
+			}
+			NameFailure& failure = g_nameFailures.try_emplace(batch[i], NameFailure{ 0, 0 }).first->second;
+			double		 backoff = std::min(NAME_RETRY_MIN_SECONDS * (1 << std::min(failure.failures, 16)), NAME_RETRY_MAX_SECONDS);
+			failure.retryTime	 = now + (INT64)(backoff * g_qpcFrequency);
+			failure.failures++;
+		}
+		if(g_nameFailures.size() > NAME_FAILURES_MAX)
+			std::erase_if(g_nameFailures, [now](const auto& pair) { return pair.second.retryTime <= now; });
+	}
+}
+
+void StartNameResolver()
+{
+	if(!g_processNameResolver || g_nameRunning)
+		return;
+	g_nameRunning = true;
+	g_nameThread  = std::thread(NameResolverThread);
+}
+
+void StopNameResolver()
+{
+	{
+		std::lock_guard<std::mutex> lock(g_nameMutex);
+		if(!g_nameRunning)
+			return;
+		g_nameRunning = false;
+		g_nameWake.notify_one();
+	}
+	g_nameThread.join();
+	g_nameQueue.clear();
+	g_namePending.clear();
+	g_nameFailures.clear();
+}
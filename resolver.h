@@ -0,0 +1,15 @@
+#pragma once
+// Background process name resolution. The renderer only queues pids; a worker thread calls g_processNameResolver
+// outside g_critSec and applies each batch of results under one lock, so neither the UI nor the trace thread
+// waits on the syscalls behind it.
+#include "tracker.h"
+
+// Failed lookups are retried after an exponential backoff, capped so a reused pid is picked up eventually
+static const double NAME_RETRY_MIN_SECONDS = 1.0;
+static const double NAME_RETRY_MAX_SECONDS = 60.0;
+#define NAME_BATCH_MAX 64
+#define NAME_FAILURES_MAX 4096 // expired failures are dropped beyond this many
+
+void StartNameResolver();
+void StopNameResolver();
+void RequestProcessName(DWORD pid); // needs g_critSec
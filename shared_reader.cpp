@@ -0,0 +1,125 @@
+#include "shared_state.h"
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool OpenSharedState(DemoteSharedReader& reader, const char* name)
+{
+	CloseSharedState(reader);
+	const size_t size = sizeof(DemoteSharedHeader);
+#ifdef _WIN32
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, (std::string("Local\\") + name).c_str());
+	if(!mapping)
+		return false;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+	if(!view)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+	reader.mapping = mapping;
+#else
+	int fd = shm_open((std::string("/") + name).c_str(), O_RDONLY, 0);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	void*		view = fstat(fd, &st) == 0 && (size_t)st.st_size >= size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(view == MAP_FAILED)
+		return false;
+#endif
+	reader.header = (const DemoteSharedHeader*)view;
+
+	const DemoteSharedHeader* h = reader.header;
+	if(h->magic != DEMOTE_SHARED_MAGIC || h->version != DEMOTE_SHARED_VERSION || h->headerSize != sizeof(DemoteSharedHeader) ||
+	   h->blockSize != sizeof(DemoteSharedBlock) || h->maxAdapters != DEMOTE_SHARED_MAX_ADAPTERS || h->maxEntries != DEMOTE_SHARED_MAX_ENTRIES)
+	{
+		CloseSharedState(reader);
+		return false;
+	}
+	return true;
+}
+
+void CloseSharedState(DemoteSharedReader& reader)
+{
+	if(!reader.header)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(reader.header);
+	CloseHandle(reader.mapping);
+#else
+	munmap((void*)reader.header, sizeof(DemoteSharedHeader));
+#endif
+	reader.header  = nullptr;
+	reader.mapping = nullptr;
+}
+
+const DemoteSharedBlock* BeginSharedRead(const DemoteSharedReader& reader, uint64_t& sequence)
+{
+	// An odd sequence means the writer already moved on to this block again, so the other one is now the latest
+	for(int i = 0; i < 4; ++i)
+	{
+		uint64_t published = reader.header->published.load(std::memory_order_acquire);
+		if(!published)
+			return nullptr;
+		const DemoteSharedBlock* block = &reader.header->blocks[published & 1];
+		sequence					   = block->sequence.load(std::memory_order_acquire);
+		if(!(sequence & 1))
+			return block;
+	}
+	return nullptr;
+}
+
+bool EndSharedRead(const DemoteSharedBlock* block, uint64_t sequence)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return block->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool ReadSharedState(const DemoteSharedReader& reader, DemoteSharedCopy& copy, int attempts)
+{
+	for(int i = 0; i < attempts; ++i)
+	{
+		uint64_t				 sequence;
+		const DemoteSharedBlock* block = BeginSharedRead(reader, sequence);
+		if(!block)
+			return false;
+
+		// The counts may be torn too, so they are clamped before use and the copy is only kept if the block did not change
+		uint32_t adapterCount = std::min<uint32_t>(block->adapterCount, DEMOTE_SHARED_MAX_ADAPTERS);
+		uint32_t entryCount	  = std::min<uint32_t>(block->entryCount, DEMOTE_SHARED_MAX_ENTRIES);
+		copy.time			  = block->time;
+		copy.entryTotal		  = block->entryTotal;
+		copy.adapters.resize(adapterCount);
+		copy.entries.resize(entryCount);
+		memcpy(copy.adapters.data(), block->adapters, adapterCount * sizeof(DemoteSharedAdapter));
+		memcpy(copy.entries.data(), block->entries, entryCount * sizeof(DemoteSharedEntry));
+		if(EndSharedRead(block, sequence))
+		{
+			copy.sequence = sequence;
+			return true;
+		}
+	}
+	return false;
+}
+
+const DemoteSharedEntry* FindSharedEntry(const DemoteSharedEntry* entries, uint32_t count, uint32_t pid, uint64_t adapterId)
+{
+	auto less = [](const DemoteSharedEntry& e, const std::pair<uint32_t, uint64_t>& key)
+	{
+		return e.pid != key.first ? e.pid < key.first : e.adapterId < key.second;
+	};
+	const DemoteSharedEntry* itr = std::lower_bound(entries, entries + count, std::make_pair(pid, adapterId), less);
+	if(itr != entries + count && itr->pid == pid && itr->adapterId == adapterId)
+		return itr;
+	return nullptr;
+}
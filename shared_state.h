@@ -0,0 +1,115 @@
+#pragma once
+// Layout of the shared memory segment demote_tracker publishes its latest state into, and a small reader for it.
+// Only depends on the C++ standard library, so overlays can include it without the rest of the tracker.
+//
+// The tracker writes the two blocks in turn. Each block has a sequence number that is odd while it is written
+// and twice the publication number once complete, so readers never wait on the tracker and never see a torn
+// block. Reads are best effort though: one fails if the tracker published twice while it was running, which
+// takes two frames, and a reader that runs out of attempts keeps its previous copy and tries again later.
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#define DEMOTE_SHARED_NAME "demote_tracker_state" // Local\ prefixed on Windows, / on POSIX
+#define DEMOTE_SHARED_MAGIC 0x53544d44			  // "DMTS"
+#define DEMOTE_SHARED_VERSION 1
+#define DEMOTE_SHARED_MAX_ADAPTERS 16
+#define DEMOTE_SHARED_MAX_ENTRIES 4096
+#define DEMOTE_SHARED_NAME_LENGTH 64
+#define DEMOTE_SHARED_PRIO_COUNT 5
+
+#define DEMOTE_SHARED_TRACKED 0x1 // DemoteSharedEntry::flags
+
+// Per adapter totals over all processes
+struct DemoteSharedAdapter
+{
+	uint64_t id;							  // kernel adapter pointer, as in DemoteSharedEntry::adapterId
+	char	 name[DEMOTE_SHARED_NAME_LENGTH]; // UTF-8, null terminated
+	uint64_t localMemory;
+	uint64_t nonLocalMemory;
+	uint64_t usageLocal;
+	uint64_t commitmentLocal;
+	uint64_t usageNonLocal;
+	uint64_t commitmentNonLocal;
+	uint64_t demoted;
+};
+
+// Memory of one process on one adapter
+struct DemoteSharedEntry
+{
+	uint32_t pid;
+	uint32_t flags;
+	uint64_t adapterId;
+	char	 name[DEMOTE_SHARED_NAME_LENGTH]; // image file name, UTF-8, empty until resolved
+	uint64_t usageLocal;
+	uint64_t commitmentLocal;
+	uint64_t usageNonLocal;
+	uint64_t commitmentNonLocal;
+	uint64_t demoted[DEMOTE_SHARED_PRIO_COUNT]; // MIN to MAX
+};
+
+struct DemoteSharedBlock
+{
+	std::atomic<uint64_t> sequence;
+	int64_t				  time; // when it was published, in DemoteSharedHeader::frequency ticks
+	uint32_t			  adapterCount;
+	uint32_t			  entryCount;
+	uint32_t			  entryTotal; // entries tracked, above entryCount when the smallest did not fit
+	uint32_t			  reserved;
+	DemoteSharedAdapter	  adapters[DEMOTE_SHARED_MAX_ADAPTERS];
+	DemoteSharedEntry	  entries[DEMOTE_SHARED_MAX_ENTRIES]; // sorted by (pid, adapterId)
+};
+
+struct DemoteSharedHeader
+{
+	uint32_t			  magic;
+	uint32_t			  version;
+	uint32_t			  headerSize; // sizeof(DemoteSharedHeader) of the writer
+	uint32_t			  blockSize;
+	uint32_t			  maxAdapters;
+	uint32_t			  maxEntries;
+	uint32_t			  writerPid;
+	uint32_t			  reserved;
+	int64_t				  frequency;
+	std::atomic<uint64_t> published; // publications so far, the latest is in blocks[published & 1]
+	DemoteSharedBlock	  blocks[2];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the sequence numbers are shared between processes");
+static_assert(sizeof(DemoteSharedAdapter) == 128 && sizeof(DemoteSharedEntry) == 152, "fixed layout");
+static_assert(offsetof(DemoteSharedHeader, blocks) == 48 && offsetof(DemoteSharedBlock, adapters) == 32, "fixed layout");
+
+// Reader
+
+struct DemoteSharedReader
+{
+	const DemoteSharedHeader* header  = nullptr;
+	void*					  mapping = nullptr; // platform handle
+};
+
+// A consistent copy of the used part of a block
+struct DemoteSharedCopy
+{
+	uint64_t						 sequence = 0;
+	int64_t							 time	  = 0;
+	uint32_t						 entryTotal;
+	std::vector<DemoteSharedAdapter> adapters;
+	std::vector<DemoteSharedEntry>	 entries;
+};
+
+// Maps the segment read only. Fails if the tracker is not running or wrote another layout version.
+bool OpenSharedState(DemoteSharedReader& reader, const char* name = DEMOTE_SHARED_NAME);
+void CloseSharedState(DemoteSharedReader& reader);
+
+// Zero copy access: returns the latest complete block to read in place, null if nothing was published yet.
+// What was read is only valid if EndSharedRead returns true afterwards, otherwise start over.
+const DemoteSharedBlock* BeginSharedRead(const DemoteSharedReader& reader, uint64_t& sequence);
+bool					 EndSharedRead(const DemoteSharedBlock* block, uint64_t sequence);
+
+// Copies the latest block, false if nothing was published yet or it changed under every attempt, in which case
+// 'copy' may hold a torn block and the previous one should be kept
+bool ReadSharedState(const DemoteSharedReader& reader, DemoteSharedCopy& copy, int attempts = 4);
+
+// Binary search of a block's entries, null if not found
+const DemoteSharedEntry* FindSharedEntry(const DemoteSharedEntry* entries, uint32_t count, uint32_t pid, uint64_t adapterId);
@@ -0,0 +1,354 @@
+#include "simulate.h"
+#include "render.h"
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+bool ParseCapacities(const char* text, std::vector<UINT64>& capacities)
+{
+	capacities.clear();
+	const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+	const char* p		= text;
+	while(*p)
+	{
+		char*  end;
+		double value = strtod(p, &end);
+		if(end == p || value <= 0)
+			return false;
+		p = end;
+		for(int i = 4; i >= 0; --i)
+		{
+			size_t len = strlen(units[i]);
+			if(_strnicmp(p, units[i], len) == 0)
+			{
+				for(int j = 0; j < i; ++j)
+					value *= 1024.0;
+				p += len;
+				break;
+			}
+		}
+		capacities.push_back((UINT64)value);
+		if(*p == ',')
+			p++;
+		else if(*p)
+			return false;
+	}
+	return capacities.size() > 0;
+}
+
+struct SimAdapter
+{
+	PVOID  pDxgAdapter;
+	INT64  lastTime;
+	UINT64 commitment; // local, of all processes
+	UINT64 demoted;
+	UINT64 classCommitment[PRIO_COUNT];
+	double share[PRIO_COUNT]; // of the commitment of the class that is demoted
+	double F[PRIO_COUNT];	  // integral of share over time, seconds
+	double D[PRIO_COUNT];	  // time with a share above 0
+};
+
+struct SimState
+{
+	const SimConfig&					 config;
+	SimResult&							 result;
+	double								 budget;
+	std::vector<SimAdapter>				 adapters;
+	std::vector<UINT8>					 entryAdapter;
+	std::unordered_map<ProcessKey, UINT32> open;
+	std::unordered_map<DWORD, wstring>	 names;
+	UINT64								 demoted = 0; // over all adapters
+	INT64								 lastTime = 0;
+
+	SimState(const SimConfig& c, SimResult& r)
+		: config(c)
+		, result(r)
+	{
+		budget = c.capacity * c.budgetShare;
+	}
+
+	UINT32 FindAdapter(PVOID pDxgAdapter)
+	{
+		for(UINT32 i = 0; i < adapters.size(); ++i)
+			if(adapters[i].pDxgAdapter == pDxgAdapter)
+				return i;
+		SimAdapter a;
+		memset(&a, 0, sizeof(a));
+		a.pDxgAdapter = pDxgAdapter;
+		a.lastTime	  = lastTime;
+		adapters.push_back(a);
+		return (UINT32)adapters.size() - 1;
+	}
+
+	UINT32 FindEntry(DWORD pid, PVOID pDxgAdapter)
+	{
+		auto itr = open.find({ pid, pDxgAdapter });
+		if(itr != open.end())
+			return itr->second;
+		SimEntry e = {};
+		e.pid		  = pid;
+		e.pDxgAdapter = pDxgAdapter;
+		e.prio		  = PRIO_NORMAL;
+		e.open		  = true;
+		auto name	  = names.find(pid);
+		e.name		  = name != names.end() ? name->second : L"?";
+		UINT32 index  = (UINT32)result.entries.size();
+		result.entries.push_back(e);
+		entryAdapter.push_back((UINT8)FindAdapter(pDxgAdapter));
+		open[{ pid, pDxgAdapter }] = index;
+		return index;
+	}
+
+	void Advance(SimAdapter& a, INT64 time)
+	{
+		double dt = time > a.lastTime ? (double)(time - a.lastTime) / g_qpcFrequency : 0.0;
+		for(int p = 0; p < PRIO_COUNT; ++p)
+		{
+			a.F[p] += a.share[p] * dt;
+			if(a.share[p] > 0)
+				a.D[p] += dt;
+		}
+		a.lastTime = time;
+	}
+
+	void Settle(SimEntry& e, const SimAdapter& a)
+	{
+		if(e.commitment)
+		{
+			e.demotedByteSeconds += e.commitment * (a.F[e.prio] - e.settledF);
+			e.demotedSeconds += a.D[e.prio] - e.settledD;
+		}
+		e.settledF = a.F[e.prio];
+		e.settledD = a.D[e.prio];
+	}
+
+	// The overflow is taken from the lowest classes first
+	void Rebalance(SimAdapter& a)
+	{
+		UINT64 overflow = a.commitment > budget ? (UINT64)(a.commitment - budget) : 0;
+		demoted -= a.demoted;
+		a.demoted = overflow;
+		demoted += a.demoted;
+		for(int p = 0; p < PRIO_COUNT; ++p)
+		{
+			UINT64 take = std::min(overflow, a.classCommitment[p]);
+			a.share[p]	= a.classCommitment[p] ? (double)take / a.classCommitment[p] : 0.0;
+			overflow -= take;
+		}
+		result.peakDemoted = std::max(result.peakDemoted, demoted);
+	}
+
+	void Set(UINT32 index, UINT64 commitment, UINT8 prio, INT64 time)
+	{
+		SimEntry&	e = result.entries[index];
+		SimAdapter& a = adapters[entryAdapter[index]];
+		if(e.commitment == commitment && e.prio == prio)
+			return;
+		Advance(a, time);
+		Settle(e, a);
+		a.classCommitment[e.prio] -= e.commitment;
+		a.commitment -= e.commitment;
+		e.commitment = commitment;
+		e.prio		 = prio;
+		a.classCommitment[e.prio] += e.commitment;
+		a.commitment += e.commitment;
+		e.settledF = a.F[e.prio];
+		e.settledD = a.D[e.prio];
+		Rebalance(a);
+		e.peakCommitment = std::max(e.peakCommitment, e.commitment);
+		e.peakDemoted	 = std::max(e.peakDemoted, (UINT64)(e.commitment * a.share[e.prio]));
+	}
+
+	void Sample(INT64 time, INT64 start)
+	{
+		for(UINT32 i = 0; i < result.entries.size(); ++i)
+		{
+			SimEntry&		  e = result.entries[i];
+			const SimAdapter& a = adapters[entryAdapter[i]];
+			UINT64			  d = (UINT64)(e.commitment * a.share[e.prio]);
+			if(!e.open || !d)
+				continue;
+			e.peakDemoted = std::max(e.peakDemoted, d);
+			result.samples.push_back({ (float)((double)(time - start) / g_qpcFrequency), i, d, e.prio });
+		}
+	}
+};
+
+void SimulateBudget(const SynthStream& stream, const SimConfig& config, SimResult& result)
+{
+	result		  = SimResult();
+	result.config = config;
+	if(stream.events.empty())
+		return;
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	SimState sim(config, result);
+	INT64	 first		= stream.events.front().time;
+	INT64	 last		= stream.events.back().time;
+	INT64	 step		= std::max((last - first) / SIM_SAMPLES, (INT64)1);
+	INT64	 nextSample = first + step;
+	sim.lastTime		= first;
+	for(const SynthEvent& e : stream.events)
+	{
+		while(e.time > nextSample && nextSample <= last)
+		{
+			sim.Sample(nextSample, first);
+			nextSample += step;
+		}
+		if(sim.demoted)
+			result.demotedSeconds += (double)(e.time - sim.lastTime) / g_qpcFrequency;
+		sim.lastTime = std::max(sim.lastTime, e.time);
+		result.events++;
+
+		switch(e.type)
+		{
+		case SYNTH_PROCESS_START:
+		case SYNTH_PROCESS_RUNDOWN:
+			sim.names[e.processStart.ProcessID] = GetFileName(e.processStart.ImageName);
+			break;
+		case SYNTH_PROCESS_STOP:
+			for(auto itr = sim.open.begin(); itr != sim.open.end();)
+			{
+				if(itr->first.pid != e.processStop.ProcessID)
+				{
+					++itr;
+					continue;
+				}
+				sim.Set(itr->second, 0, result.entries[itr->second].prio, e.time);
+				result.entries[itr->second].open = false;
+				itr								 = sim.open.erase(itr);
+			}
+			sim.names.erase(e.processStop.ProcessID);
+			break;
+		case SYNTH_COMMITMENT_CHANGE:
+			if(e.commitmentChange.MemorySegmentGroup == SEGMENT_GROUP_LOCAL)
+			{
+				UINT32 index = sim.FindEntry(e.commitmentChange.ProcessId, e.commitmentChange.pDxgAdapter);
+				sim.Set(index, e.commitmentChange.Commitment, result.entries[index].prio, e.time);
+			}
+			break;
+		case SYNTH_DEMOTED_COMMITMENT_CHANGE:
+		{
+			UINT32 index = sim.FindEntry(e.demotedCommitmentChange.ProcessId, e.demotedCommitmentChange.pDxgAdapter);
+			UINT8  prio	 = (UINT8)std::min((int)e.demotedCommitmentChange.PriorityClass, (int)PRIO_MAX);
+			sim.Set(index, result.entries[index].commitment, prio, e.time);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	for(UINT32 i = 0; i < result.entries.size(); ++i)
+	{
+		SimAdapter& a = sim.adapters[sim.entryAdapter[i]];
+		sim.Advance(a, last);
+		sim.Settle(result.entries[i], a);
+	}
+	result.streamSeconds = (double)(last - first) / g_qpcFrequency;
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	result.seconds = (double)(end.QuadPart - start.QuadPart) / g_qpcFrequency;
+}
+
+void SweepBudgets(const SynthStream& stream, const std::vector<UINT64>& capacities, double budgetShare, std::vector<SimResult>& results)
+{
+	results.clear();
+	results.resize(capacities.size());
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < capacities.size(); ++i)
+	{
+		threads.emplace_back(
+			[&, i]()
+			{
+				SimConfig config;
+				config.capacity	   = capacities[i];
+				config.budgetShare = budgetShare;
+				SimulateBudget(stream, config, results[i]);
+			});
+	}
+	for(std::thread& thread : threads)
+		thread.join();
+}
+
+void PrintSimulation(FILE* out, const std::vector<SimResult>& results, int topProcesses)
+{
+	for(const SimResult& r : results)
+	{
+		double byteSeconds = 0;
+		int	   demoted	   = 0;
+		for(const SimEntry& e : r.entries)
+		{
+			byteSeconds += e.demotedByteSeconds;
+			demoted += e.demotedByteSeconds > 0;
+		}
+		fprintf(out,
+				"%.1f GB (budget %.1f GB): %d processes demoted, %.1f of %.1f s with demotions, peak %.1f MB, %.1f GB*s, simulated in %.1f ms (%.0fx real time)\n",
+				r.config.capacity / (1024.0 * 1024.0 * 1024.0),
+				r.config.capacity * r.config.budgetShare / (1024.0 * 1024.0 * 1024.0),
+				demoted,
+				r.demotedSeconds,
+				r.streamSeconds,
+				r.peakDemoted / (1024.0 * 1024.0),
+				byteSeconds / (1024.0 * 1024.0 * 1024.0),
+				r.seconds * 1e3,
+				r.streamSeconds / std::max(r.seconds, 1e-9));
+
+		std::vector<const SimEntry*> top;
+		for(const SimEntry& e : r.entries)
+			if(e.demotedByteSeconds > 0)
+				top.push_back(&e);
+		int count = std::min((int)top.size(), topProcesses);
+		std::partial_sort(top.begin(),
+						  top.begin() + count,
+						  top.end(),
+						  [](const SimEntry* a, const SimEntry* b) { return a->demotedByteSeconds > b->demotedByteSeconds; });
+		for(int i = 0; i < count; ++i)
+		{
+			const SimEntry* e = top[i];
+			fprintf(out,
+					"  %-24ls %6u %-6s peak commit %8.1f MB  peak demoted %8.1f MB  %8.1f MB*s over %.1f s\n",
+					e->name.c_str(),
+					(unsigned)e->pid,
+					g_prioNames[e->prio + 1],
+					e->peakCommitment / (1024.0 * 1024.0),
+					e->peakDemoted / (1024.0 * 1024.0),
+					e->demotedByteSeconds / (1024.0 * 1024.0),
+					e->demotedSeconds);
+		}
+	}
+}
+
+// The timeline of each capacity, one row per sampled entry with demoted bytes
+bool ExportSimulationCsv(const char* path, const std::vector<SimResult>& results)
+{
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open export file '%s'\n", path);
+		fflush(g_LogFile);
+		return false;
+	}
+	fprintf(f, "capacity,time,pid,process,adapter,priority,commitment_peak,demoted\n");
+	for(const SimResult& r : results)
+	{
+		for(const SimSample& s : r.samples)
+		{
+			const SimEntry& e = r.entries[s.entry];
+			fprintf(f,
+					"%llu,%.3f,%u,%ls,%p,%s,%llu,%llu\n",
+					r.config.capacity,
+					s.time,
+					(unsigned)e.pid,
+					e.name.c_str(),
+					e.pDxgAdapter,
+					g_prioNames[s.prio + 1],
+					e.peakCommitment,
+					s.demoted);
+		}
+	}
+	fclose(f);
+	return true;
+}
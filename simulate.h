@@ -0,0 +1,61 @@
+#pragma once
+// VRAM budget what-if simulator
+//  replays the per-process local commitment and priority timelines of a recorded stream against a card of
+//  another size. When the local commitment on an adapter is over its budget, VidMm demotes the overflow from
+//  the lowest priority class up; within a class every process loses the same share of its commitment. The
+//  demoted share of each class only changes with the events of its adapter, so byte-seconds are integrated
+//  per class and settled into a process when its own commitment or priority changes, which keeps each event
+//  O(PRIO_COUNT) whatever the number of processes. Capacities of a sweep run in parallel, one thread each.
+#include "tracker.h"
+#include "synth.h"
+
+#define SIM_SAMPLES 200 // timeline samples over the length of the stream
+
+struct SimConfig
+{
+	UINT64 capacity;		   // local memory of every adapter of the stream, bytes
+	double budgetShare = 0.9; // of the capacity processes get to commit before demotion
+};
+
+// One (process, adapter) of the stream. Peaks are taken at the process's events and at the timeline samples.
+struct SimEntry
+{
+	DWORD	pid;
+	PVOID	pDxgAdapter;
+	wstring name;
+	UINT8	prio;				// last priority class seen, PRIO_NORMAL until the stream has one
+	UINT64	commitment;			// local, in the simulation
+	UINT64	peakCommitment;
+	UINT64	peakDemoted;
+	double	demotedByteSeconds; // predicted
+	double	demotedSeconds;		// time with demoted bytes
+	double	settledF;			// of its class, at its last settle
+	double	settledD;
+	bool	open;				// the process has not exited
+};
+
+struct SimSample
+{
+	float  time; // seconds from the start of the stream
+	UINT32 entry;
+	UINT64 demoted;
+	UINT8  prio;
+};
+
+struct SimResult
+{
+	SimConfig				config;
+	double					seconds		   = 0; // to simulate
+	double					streamSeconds  = 0;
+	UINT64					events		   = 0;
+	UINT64					peakDemoted	   = 0; // over all adapters at once
+	double					demotedSeconds = 0; // time with anything demoted
+	std::vector<SimEntry>	entries;
+	std::vector<SimSample>	samples; // of the entries with demoted bytes, in time order
+};
+
+bool ParseCapacities(const char* text, std::vector<UINT64>& capacities); // "8GB,12GB,16384MB"
+void SimulateBudget(const SynthStream& stream, const SimConfig& config, SimResult& result);
+void SweepBudgets(const SynthStream& stream, const std::vector<UINT64>& capacities, double budgetShare, std::vector<SimResult>& results);
+void PrintSimulation(FILE* out, const std::vector<SimResult>& results, int topProcesses);
+bool ExportSimulationCsv(const char* path, const std::vector<SimResult>& results);
@@ -0,0 +1,135 @@
+#include "snapshot.h"
+#include "render.h"
+#include <algorithm>
+
+Snapshot g_baseline;
+bool	 g_diffMode = false;
+
+static bool SnapshotLess(const SnapshotEntry& a, const SnapshotEntry& b)
+{
+	return a.pid != b.pid ? a.pid < b.pid : a.pDxgAdapter < b.pDxgAdapter;
+}
+
+void TakeSnapshot(Snapshot& snapshot)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	snapshot.time = now.QuadPart;
+
+	// Sorting the keys and filling the entries in that order avoids moving the names around. Assigning into the
+	// previous entries keeps their name buffers when a snapshot is retaken every frame.
+	static std::vector<UINT32> order;
+	UINT32					   numEntries = g_processMemory.Size();
+	const ProcessKey*		   keys		  = g_processMemory.keys.data();
+	order.resize(numEntries);
+	for(UINT32 i = 0; i < numEntries; ++i)
+		order[i] = i;
+	std::sort(order.begin(),
+			  order.end(),
+			  [keys](UINT32 a, UINT32 b)
+			  {
+				  return keys[a].pid != keys[b].pid ? keys[a].pid < keys[b].pid : keys[a].pDxgAdapter < keys[b].pDxgAdapter;
+			  });
+
+	snapshot.entries.resize(numEntries);
+	for(UINT32 j = 0; j < numEntries; ++j)
+	{
+		UINT32				 i	 = order[j];
+		const ProcessKey&	 key = keys[i];
+		const ProcessMemory& mem = g_processMemory.cold[i];
+		SnapshotEntry&		 e	 = snapshot.entries[j];
+		auto				 itr = g_pidToProcess.find(key.pid);
+		e.pid					 = key.pid;
+		e.pDxgAdapter			 = key.pDxgAdapter;
+		e.tracked				 = g_processMemory.tracked[i];
+		if(itr != g_pidToProcess.end())
+			e.name = g_processes[itr->second].imageFilename;
+		else
+			e.name.clear();
+		e.usageLocal		 = g_processMemory.usageLocal[i];
+		e.commitmentLocal	 = g_processMemory.commitmentLocal[i];
+		e.usageNonLocal		 = mem.UsageNonLocal;
+		e.commitmentNonLocal = mem.CommitmentNonLocal;
+		e.demoted			 = g_processMemory.demoted[i];
+	}
+}
+
+// A pid that now has another image was reused, so it diffs as an exited and a new process
+void DiffSnapshots(const Snapshot& base, const Snapshot& current, std::vector<DiffEntry>& diff)
+{
+	diff.clear();
+	const SnapshotEntry* a	  = base.entries.data();
+	const SnapshotEntry* aEnd = a + base.entries.size();
+	const SnapshotEntry* b	  = current.entries.data();
+	const SnapshotEntry* bEnd = b + current.entries.size();
+	while(a != aEnd || b != bEnd)
+	{
+		if(b == bEnd || (a != aEnd && SnapshotLess(*a, *b)))
+			diff.push_back({ a++, nullptr, DIFF_EXITED });
+		else if(a == aEnd || SnapshotLess(*b, *a))
+			diff.push_back({ nullptr, b++, DIFF_NEW });
+		else if(a->name.size() && b->name.size() && a->name != b->name)
+		{
+			diff.push_back({ a++, nullptr, DIFF_EXITED });
+			diff.push_back({ nullptr, b++, DIFF_NEW });
+		}
+		else
+			diff.push_back({ a++, b++, DIFF_CHANGED });
+	}
+}
+
+// Writes the diff between the baseline and now, one line per (process, adapter) entry of either
+void ExportDiffCsv(const char* path)
+{
+	static const char* states[] = { "changed", "new", "exited" };
+
+	FILE* f = nullptr;
+	if(fopen_s(&f, path, "w") || !f)
+	{
+		fprintf(g_LogFile, "Failed to open export file '%s'\n", path);
+		fflush(g_LogFile);
+		return;
+	}
+
+	EnterCriticalSection(&g_critSec);
+	struct exitDummy
+	{
+		~exitDummy()
+		{
+			LeaveCriticalSection(&g_critSec);
+		}
+	} foo;
+
+	Snapshot			   current;
+	std::vector<DiffEntry> diff;
+	TakeSnapshot(current);
+	DiffSnapshots(g_baseline, current, diff);
+	double seconds = (double)(current.time - g_baseline.time) / g_qpcFrequency;
+
+	fprintf(f, "pid,process,adapter,state,seconds");
+	for(const char* field : { "usage_local", "commitment_local", "usage_nonlocal", "commitment_nonlocal" })
+		fprintf(f, ",%s_base,%s_now,%s_delta", field, field, field);
+	for(int i = 0; i < PRIO_COUNT; ++i)
+		fprintf(f, ",demoted_%s_base,demoted_%s_now,demoted_%s_delta", g_prioNames[i + 1], g_prioNames[i + 1], g_prioNames[i + 1]);
+	fprintf(f, "\n");
+
+	for(const DiffEntry& d : diff)
+	{
+		const SnapshotEntry& e = d.Any();
+		fprintf(f, "%u,%ls,%ls,%s,%.1f", (unsigned)e.pid, e.name.c_str(), FindAdapter(e.pDxgAdapter)->name.c_str(), states[d.state], seconds);
+		auto Write = [f](UINT64 base, UINT64 now)
+		{
+			fprintf(f, ",%llu,%llu,%lld", base, now, (long long)(now - base));
+		};
+		const SnapshotEntry* base = d.base;
+		const SnapshotEntry* now  = d.current;
+		Write(base ? base->usageLocal : 0, now ? now->usageLocal : 0);
+		Write(base ? base->commitmentLocal : 0, now ? now->commitmentLocal : 0);
+		Write(base ? base->usageNonLocal : 0, now ? now->usageNonLocal : 0);
+		Write(base ? base->commitmentNonLocal : 0, now ? now->commitmentNonLocal : 0);
+		for(int i = 0; i < PRIO_COUNT; ++i)
+			Write(base ? base->demoted[i] : 0, now ? now->demoted[i] : 0);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
@@ -0,0 +1,78 @@
+#pragma once
+// Point in time copies of the process memory table, and the diff between two of them.
+#include "tracker.h"
+
+struct SnapshotEntry
+{
+	DWORD			  pid;
+	PVOID			  pDxgAdapter;
+	bool			  tracked;
+	wstring			  name;
+	UINT64			  usageLocal;
+	UINT64			  commitmentLocal;
+	UINT64			  usageNonLocal;
+	UINT64			  commitmentNonLocal;
+	DemotedCommitment demoted;
+
+	UINT64 Usage(bool nonLocal) const
+	{
+		return nonLocal ? usageNonLocal : usageLocal;
+	}
+	UINT64 Commitment(bool nonLocal) const
+	{
+		return nonLocal ? commitmentNonLocal : commitmentLocal;
+	}
+	UINT64 DemotedSum() const
+	{
+		UINT64 sum = 0;
+		for(UINT64 dem : demoted)
+			sum += dem;
+		return sum;
+	}
+};
+
+// Entries are sorted by (pid, adapter), so two snapshots diff in one merge pass
+struct Snapshot
+{
+	INT64					   time = 0; // QPC ticks, 0 if never taken
+	std::vector<SnapshotEntry> entries;
+};
+
+enum DiffState : UINT8
+{
+	DIFF_CHANGED,
+	DIFF_NEW,
+	DIFF_EXITED,
+};
+
+// An entry of either snapshot; base is null for new processes and current for exited ones
+struct DiffEntry
+{
+	const SnapshotEntry* base;
+	const SnapshotEntry* current;
+	DiffState			 state;
+
+	INT64 Delta(UINT64 (SnapshotEntry::*value)(bool) const, bool nonLocal) const
+	{
+		return (INT64)((current ? (current->*value)(nonLocal) : 0) - (base ? (base->*value)(nonLocal) : 0));
+	}
+	INT64 DemotedDelta(int prio) const
+	{
+		return (INT64)((current ? current->demoted[prio] : 0) - (base ? base->demoted[prio] : 0));
+	}
+	INT64 DemotedSumDelta() const
+	{
+		return (INT64)((current ? current->DemotedSum() : 0) - (base ? base->DemotedSum() : 0));
+	}
+	const SnapshotEntry& Any() const
+	{
+		return current ? *current : *base;
+	}
+};
+
+extern Snapshot g_baseline;
+extern bool		g_diffMode;
+
+void TakeSnapshot(Snapshot& snapshot); // needs g_critSec
+void DiffSnapshots(const Snapshot& base, const Snapshot& current, std::vector<DiffEntry>& diff);
+void ExportDiffCsv(const char* path);
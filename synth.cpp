@@ -0,0 +1,205 @@
+#include "synth.h"
+#include "recorder.h"
+#include "device.h"
+#include <algorithm>
+#include <string.h>
+
+static UINT32 SynthRandom(UINT32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+static bool SynthChance(UINT32& state, double chance)
+{
+	return SynthRandom(state) < chance * (1 << 24);
+}
+
+// The first hotProcesses processes are long lived and own most of the memory; the rest trickle
+// updates and are replaced according to churn. During a storm the hot processes get demoted,
+// which shows up as bursts of demoted commitment changes on the first adapter.
+void GenerateSynthEvents(const SynthConfig& config, int numEvents, SynthStream& stream)
+{
+	const int NUM_IMAGES   = 64;
+	int		  hotProcesses = std::clamp(config.hotProcesses, 1, std::min(config.numProcesses, NUM_IMAGES - 1));
+	UINT32	  rnd		   = config.seed;
+	INT64	  time		   = 1;
+	INT64	  step		   = (INT64)(g_qpcFrequency / config.eventsPerSecond);
+	DWORD	  nextPid	   = 1000;
+	int		  storm		   = 0;
+	if(step < 1)
+		step = 1;
+
+	stream.events.clear();
+	stream.events.reserve(numEvents);
+	stream.imageNames.clear();
+	stream.numStorms = 0;
+	for(int i = 0; i < NUM_IMAGES; ++i)
+	{
+		wchar_t name[64];
+		swprintf_s(name, _countof(name), i < hotProcesses ? L"C:\\Games\\game%d.exe" : L"C:\\Program Files\\App\\app%d.exe", i);
+		stream.imageNames.push_back(name);
+	}
+
+	auto Add = [&](SynthEventType type) -> SynthEvent&
+	{
+		SynthEvent e;
+		memset(&e, 0, sizeof(e));
+		e.time = time;
+		e.type = type;
+		stream.events.push_back(e);
+		return stream.events.back();
+	};
+	auto AdapterOf = [](int adapter)
+	{
+		return (PVOID)(UINT64)(0x10000 * (adapter + 1));
+	};
+
+	for(int a = 0; a < config.numAdapters; ++a)
+	{
+		for(UINT32 segment = 0; segment < 3; ++segment)
+		{
+			SynthEvent& e					   = Add(SYNTH_REPORT_SEGMENT);
+			e.reportSegment.ulSegmentId		   = segment;
+			e.reportSegment.pDxgAdapter		   = AdapterOf(a);
+			e.reportSegment.Size			   = (UINT64)(segment == 2 ? 16 : 4) << 30;
+			e.reportSegment.CommitLimit		   = e.reportSegment.Size;
+			e.reportSegment.NbOfBanks		   = segment == 2 ? 0 : 4;
+			e.reportSegment.Flags			   = segment == 2 ? SEGMENT_FLAG_APERTURE | SEGMENT_FLAG_CPU_VISIBLE : segment == 1 ? SEGMENT_FLAG_CPU_VISIBLE : 0;
+			e.reportSegment.MemorySegmentGroup = segment == 2 ? SEGMENT_GROUP_NON_LOCAL : SEGMENT_GROUP_LOCAL;
+		}
+	}
+
+	std::vector<DWORD> alive;
+	auto			   Start = [&](int slot)
+	{
+		int			image			 = slot < hotProcesses ? slot : hotProcesses + SynthRandom(rnd) % (NUM_IMAGES - hotProcesses);
+		SynthEvent& e				 = Add(SYNTH_PROCESS_START);
+		e.processStart.ProcessID	 = nextPid;
+		e.processStart.ImageName	 = stream.imageNames[image].c_str();
+		nextPid += 4;
+		return e.processStart.ProcessID;
+	};
+	for(int i = 0; i < config.numProcesses; ++i)
+		alive.push_back(Start(i));
+
+	while((int)stream.events.size() < numEvents)
+	{
+		time += step;
+		if(config.numProcesses > hotProcesses && SynthChance(rnd, config.churn))
+		{
+			int slot									  = hotProcesses + SynthRandom(rnd) % (config.numProcesses - hotProcesses);
+			Add(SYNTH_PROCESS_STOP).processStop.ProcessID = alive[slot];
+			alive[slot]									  = Start(slot);
+		}
+		if(!storm && SynthChance(rnd, config.stormChance))
+		{
+			storm = config.stormLength;
+			stream.numStorms++;
+		}
+
+		bool  hot	  = storm || SynthChance(rnd, config.hotShare);
+		int	  slot	  = SynthRandom(rnd) % (hot ? hotProcesses : config.numProcesses);
+		PVOID adapter = AdapterOf(hot ? 0 : SynthRandom(rnd) % config.numAdapters);
+		int	  burst	  = 1 + SynthRandom(rnd) % 16;
+		for(int j = 0; j < burst && (int)stream.events.size() < numEvents; ++j)
+		{
+			UINT64 value = (UINT64)(SynthRandom(rnd) % (hot ? 2048 : 64)) << 20;
+			UINT32 kind	 = SynthRandom(rnd) % 8;
+			if(storm)
+			{
+				storm--;
+				kind = kind < 5 ? 7 : kind;
+			}
+			if(kind < 3)
+			{
+				SynthEvent& e					 = Add(SYNTH_USAGE_CHANGE);
+				e.usageChange.NewUsage			 = value;
+				e.usageChange.pDxgAdapter		 = adapter;
+				e.usageChange.ProcessId			 = alive[slot];
+				e.usageChange.MemorySegmentGroup = kind == 2;
+			}
+			else if(kind < 6)
+			{
+				SynthEvent& e						  = Add(SYNTH_COMMITMENT_CHANGE);
+				e.commitmentChange.Commitment		  = value;
+				e.commitmentChange.pDxgAdapter		  = adapter;
+				e.commitmentChange.ProcessId		  = alive[slot];
+				e.commitmentChange.MemorySegmentGroup = kind == 5;
+			}
+			else
+			{
+				SynthEvent& e							= Add(SYNTH_DEMOTED_COMMITMENT_CHANGE);
+				e.demotedCommitmentChange.Commitment	= storm ? value : 0;
+				e.demotedCommitmentChange.pDxgAdapter	= adapter;
+				e.demotedCommitmentChange.ProcessId		= alive[slot];
+				e.demotedCommitmentChange.PriorityClass = (UINT8)(SynthRandom(rnd) % PRIO_COUNT);
+			}
+			time += step;
+		}
+	}
+}
+
+// Same path as the trace callback: memory updates are queued, anything else flushes them and takes the lock
+void DispatchSynthEvent(const SynthEvent& e)
+{
+	t_eventTime = e.time;
+	switch(e.type)
+	{
+	case SYNTH_PROCESS_START:
+		RecordEvent(e.processStart, e.time);
+		RunLockedHandler<ProcessStartEvent, HandleProcessStart>(e.processStart, e.time);
+		break;
+	case SYNTH_PROCESS_RUNDOWN:
+		RecordEvent(e.processRundown, e.time);
+		RunLockedHandler<ProcessRundownEvent, HandleProcessRundown>(e.processRundown, e.time);
+		break;
+	case SYNTH_DEVICE_ALLOCATION_START:
+		RecordEvent(e.deviceAllocationStart, e.time);
+		RunLockedHandler<DeviceAllocationStartEvent, HandleDeviceAllocationStart>(e.deviceAllocationStart, e.time);
+		break;
+	case SYNTH_DEVICE_ALLOCATION_STOP:
+		RecordEvent(e.deviceAllocationStop, e.time);
+		RunLockedHandler<DeviceAllocationStopEvent, HandleDeviceAllocationStop>(e.deviceAllocationStop, e.time);
+		break;
+	case SYNTH_DEVICE_ALLOCATION_RUNDOWN:
+		RecordEvent(e.deviceAllocationRundown, e.time);
+		RunLockedHandler<DeviceAllocationDCStartEvent, HandleDeviceAllocationRundown>(e.deviceAllocationRundown, e.time);
+		break;
+	case SYNTH_ALLOCATION_DETAILS_START:
+		RecordEvent(e.allocationDetailsStart, e.time);
+		RunLockedHandler<ProcessAllocationDetailsStartEvent, HandleProcessAllocationDetailsStart>(e.allocationDetailsStart, e.time);
+		break;
+	case SYNTH_ALLOCATION_DETAILS_STOP:
+		RecordEvent(e.allocationDetailsStop, e.time);
+		RunLockedHandler<ProcessAllocationDetailsStopEvent, HandleProcessAllocationDetailsStop>(e.allocationDetailsStop, e.time);
+		break;
+	case SYNTH_PROCESS_STOP:
+		RecordEvent(e.processStop, e.time);
+		RunLockedHandler<ProcessStopEvent, HandleProcessStop>(e.processStop, e.time);
+		break;
+	case SYNTH_REPORT_SEGMENT:
+		RecordEvent(e.reportSegment, e.time);
+		RunLockedHandler<ReportSegmentEvent, HandleReportSegment>(e.reportSegment, e.time);
+		break;
+	case SYNTH_USAGE_CHANGE:
+		RecordEvent(e.usageChange, e.time);
+		HandleVidMmProcessUsageChange(e.usageChange);
+		break;
+	case SYNTH_COMMITMENT_CHANGE:
+		RecordEvent(e.commitmentChange, e.time);
+		HandleVidMmProcessCommitmentChange(e.commitmentChange);
+		break;
+	case SYNTH_DEMOTED_COMMITMENT_CHANGE:
+		RecordEvent(e.demotedCommitmentChange, e.time);
+		HandleVidMmProcessDemotedCommitmentChange(e.demotedCommitmentChange);
+		break;
+	}
+}
+
+void ReplaySynthEvents(const SynthStream& stream)
+{
+	for(const SynthEvent& e : stream.events)
+		DispatchSynthEvent(e);
+	FlushMemoryUpdates(t_batch);
+}
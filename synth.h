@@ -0,0 +1,65 @@
+#pragma once
+// Synthetic process and VidMm event streams, to drive the tracker without a trace session
+#include "tracker.h"
+#include <vector>
+
+struct SynthConfig
+{
+	int	   numProcesses	   = 256; // alive at any time
+	int	   numAdapters	   = 2;
+	int	   hotProcesses	   = 4;		 // processes getting most of the memory traffic
+	double hotShare		   = 0.875;	 // share of the updates outside storms that go to the hot processes
+	double churn		   = 0.0005; // chance per event that a process exits and another one starts
+	double stormChance	   = 0.0002; // chance per event that a demotion storm starts
+	int	   stormLength	   = 8192;	 // events in a storm
+	double eventsPerSecond = 100000.0;
+	UINT32 seed			   = 1;
+};
+
+enum SynthEventType : UINT8
+{
+	SYNTH_PROCESS_START,
+	SYNTH_PROCESS_STOP,
+	SYNTH_REPORT_SEGMENT,
+	SYNTH_USAGE_CHANGE,
+	SYNTH_COMMITMENT_CHANGE,
+	SYNTH_DEMOTED_COMMITMENT_CHANGE,
+	SYNTH_PROCESS_RUNDOWN,
+	SYNTH_DEVICE_ALLOCATION_START,
+	SYNTH_DEVICE_ALLOCATION_STOP,
+	SYNTH_DEVICE_ALLOCATION_RUNDOWN,
+	SYNTH_ALLOCATION_DETAILS_START,
+	SYNTH_ALLOCATION_DETAILS_STOP,
+};
+
+struct SynthEvent
+{
+	INT64		   time;
+	SynthEventType type;
+	union
+	{
+		ProcessStartEvent						 processStart;
+		ProcessRundownEvent						 processRundown;
+		ProcessStopEvent						 processStop;
+		ReportSegmentEvent						 reportSegment;
+		VidMmProcessUsageChangeEvent			 usageChange;
+		VidMmProcessCommitmentChangeEvent		 commitmentChange;
+		VidMmProcessDemotedCommitmentChangeEvent demotedCommitmentChange;
+		DeviceAllocationStartEvent				 deviceAllocationStart;
+		DeviceAllocationStopEvent				 deviceAllocationStop;
+		DeviceAllocationDCStartEvent			 deviceAllocationRundown;
+		ProcessAllocationDetailsStartEvent		 allocationDetailsStart;
+		ProcessAllocationDetailsStopEvent		 allocationDetailsStop;
+	};
+};
+
+struct SynthStream
+{
+	std::vector<SynthEvent> events;
+	std::vector<wstring>	imageNames; // ImageName of the process start/rundown events points in here
+	int						numStorms = 0;
+};
+
+void GenerateSynthEvents(const SynthConfig& config, int numEvents, SynthStream& stream);
+void DispatchSynthEvent(const SynthEvent& e);
+void ReplaySynthEvents(const SynthStream& stream);
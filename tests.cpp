@@ -0,0 +1,1229 @@
+#include "bench.h"
+#include "render.h"
+#include "publish.h"
+#include "recorder.h"
+#include "etl.h"
+#include "drm.h"
+#include "simulate.h"
+#include "blame.h"
+#include "episode.h"
+#include "fleet.h"
+#include "measure.h"
+#include "device.h"
+#include "history.h"
+#include "snapshot.h"
+#include "synth.h"
+#include "alerts.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+static UINT32 TestRandom(UINT32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+static double TestSeconds(const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	return (double)(end.QuadPart - start.QuadPart) / g_qpcFrequency;
+}
+
+// Prints the line and text of a check that failed
+#define CHECK(condition) ((condition) || TestFailed(__LINE__, #condition))
+static bool TestFailed(int line, const char* condition)
+{
+	printf("  line %d: %s\n", line, condition);
+	return false;
+}
+
+// The event time 'seconds' after the start of the clock
+static INT64 TestTime(double seconds)
+{
+	return 1 + (INT64)(seconds * g_qpcFrequency);
+}
+
+// One update at 'seconds', applied at once
+static void TestUpdate(double seconds, DWORD pid, PVOID adapter, MemoryField field, UINT8 prio, UINT64 value)
+{
+	t_eventTime = TestTime(seconds);
+	QueueMemoryUpdate(pid, adapter, field, prio, value);
+	FlushMemoryUpdates(t_batch);
+}
+
+// A trend sampled from the first tick of the event clock: the sample at time 0 counts, and the window read in the
+// first minute, before the ring has wrapped once, only sees buckets that were written.
+static bool TestTrend()
+{
+	const UINT64 MB = 1ull << 20;
+	auto		 At = [](double seconds) { return (INT64)(seconds * g_qpcFrequency); };
+	Trend		 trend;
+	trend.Update(0, 100 * MB, g_qpcFrequency);
+	trend.Update(At(1), 300 * MB, g_qpcFrequency);
+	UINT64 minValue, maxValue;
+	trend.Window(At(2), g_qpcFrequency, minValue, maxValue);
+	bool ok = CHECK(minValue == 100 * MB && maxValue == 300 * MB && trend.Rate(At(1), g_qpcFrequency) > 0);
+	trend.Update(At(7), 200 * MB, g_qpcFrequency);
+	trend.Update(At(12), 50 * MB, g_qpcFrequency);
+	for(double seconds : { 12.0, 30.0, 59.0 })
+	{
+		trend.Window(At(seconds), g_qpcFrequency, minValue, maxValue);
+		ok = ok && CHECK(minValue == 50 * MB && maxValue == 300 * MB);
+	}
+
+	// Once the first buckets have left the window, it holds the values since
+	trend.Window(At(66), g_qpcFrequency, minValue, maxValue);
+	ok = ok && CHECK(minValue == 50 * MB && maxValue == 200 * MB);
+	trend.Window(At(80), g_qpcFrequency, minValue, maxValue);
+	ok = ok && CHECK(minValue == 50 * MB && maxValue == 50 * MB);
+
+	// A trend that has not been sampled reports nothing
+	Trend empty;
+	empty.Window(At(30), g_qpcFrequency, minValue, maxValue);
+	return ok && CHECK(minValue == 0 && maxValue == 0 && empty.Rate(At(30), g_qpcFrequency) == 0 && empty.Slope() == 0);
+}
+
+// Rules as written in an alert file, then one rule with a clear level, one with a hold time and one on a percent of
+// the adapter's memory. An alert is only raised once its hold time has passed, by an event or by the tick, and only
+// cleared below the clear level. The alerts of an exiting process are cleared with it.
+static bool TestAlerts()
+{
+	const UINT64 MB		 = 1ull << 20;
+	const UINT64 GB		 = 1ull << 30;
+	PVOID		 adapter = (PVOID)0x10000;
+	AlertRule	 rule;
+	bool		 ok = CHECK(ParseAlertRule("tracked.demoted.low > 512MB for 2s clear 256MB\n", rule) && rule.text == "tracked.demoted.low > 512MB for 2s clear 256MB");
+	ok			 = ok && CHECK(rule.scope == ALERT_SCOPE_TRACKED && rule.field == ALERT_FIELD_DEMOTED && rule.prio == PRIO_LOW && !rule.percent);
+	ok			 = ok && CHECK(rule.threshold == 512 * MB && rule.clear == 256 * MB && rule.holdTicks == 2 * g_qpcFrequency);
+	ok			 = ok && CHECK(ParseAlertRule("adapter.commit > 90% for 500ms", rule) && rule.percent && rule.threshold == 90 && rule.clear == 81);
+	ok			 = ok && CHECK(rule.holdTicks == g_qpcFrequency / 2 && ParseAlertRule("any.nonlocal_usage > 1.5GB for 1m", rule));
+	ok			 = ok && CHECK(rule.field == ALERT_FIELD_USAGE_NONLOCAL && rule.threshold == 1.5 * GB && rule.holdTicks == 60 * g_qpcFrequency);
+	for(const char* text : { "adapter.demoted.low > 1GB", "any.usage.low > 1GB", "any.usage > 1GB clear 2GB", "any.usage > 90% clear 1GB", "all.usage > 1GB",
+							 "any.usage 1GB", "any.usage > 1GB forever", "any.usage > GB" })
+		ok = ok && CHECK(!ParseAlertRule(text, rule));
+
+	ResetTrackerState();
+	FindAdapter(adapter)->LocalMemory = 8 * GB;
+	for(const char* text : { "any.usage > 2GB clear 1GB", "any.demoted > 1GB for 2s", "adapter.usage > 50%" })
+		ok = CHECK(AddAlertRule(text)) && ok;
+	auto Last = [](int rule, DWORD pid, bool raised, double seconds)
+	{
+		const AlertEvent& e = g_alertEvents.back();
+		return e.rule == rule && e.pid == pid && e.raised == raised && e.time == TestTime(seconds);
+	};
+
+	// Raised over 2 GB, kept down to 1 GB, cleared below it, and the adapter over half its memory
+	TestUpdate(0, 10, adapter, MEMORY_USAGE_LOCAL, 0, 3 * GB);
+	ok = ok && CHECK(g_alertEvents.size() == 1 && Last(0, 10, true, 0) && g_alertsActive == 1);
+	TestUpdate(1, 10, adapter, MEMORY_USAGE_LOCAL, 0, 3 * GB / 2);
+	ok = ok && CHECK(g_alertEvents.size() == 1 && g_alertsActive == 1);
+	TestUpdate(2, 10, adapter, MEMORY_USAGE_LOCAL, 0, GB / 2);
+	ok = ok && CHECK(g_alertEvents.size() == 2 && Last(0, 10, false, 2) && g_alertsActive == 0 && g_alertStates.empty());
+	TestUpdate(3, 20, adapter, MEMORY_USAGE_LOCAL, 0, 5 * GB);
+	ok = ok && CHECK(g_alertEvents.size() == 4 && g_alertEvents[2].rule == 0 && Last(2, (DWORD)-1, true, 3) && g_alertsActive == 2);
+
+	// Pending over 1 GB, dropped when it falls back before 2 s, raised by the event that comes 2 s after it rose again
+	TestUpdate(10, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, 2 * GB);
+	TestUpdate(11, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, 3 * GB / 2);
+	ok = ok && CHECK(g_alertEvents.size() == 4 && g_alertStates.size() == 3);
+	TestUpdate(11.5, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, GB / 2);
+	ok = ok && CHECK(g_alertStates.size() == 2);
+	TestUpdate(12, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, 2 * GB);
+	TestUpdate(13, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, 5 * GB / 2);
+	ok = ok && CHECK(g_alertEvents.size() == 4);
+	TestUpdate(14.5, 30, adapter, MEMORY_DEMOTED, PRIO_LOW, 9 * GB / 4);
+	ok = ok && CHECK(g_alertEvents.size() == 5 && Last(1, 30, true, 14.5) && g_alertsActive == 3);
+
+	// Without another event the tick raises it, and the exit clears it
+	TestUpdate(20, 40, adapter, MEMORY_DEMOTED, PRIO_LOW, 2 * GB);
+	EnterCriticalSection(&g_critSec);
+	g_eventTime = TestTime(21);
+	AlertTick();
+	ok			= ok && CHECK(g_alertEvents.size() == 5);
+	g_eventTime = TestTime(22);
+	AlertTick();
+	ok = ok && CHECK(g_alertEvents.size() == 6 && Last(1, 40, true, 22) && g_alertsActive == 4);
+	OnProcessStop(40);
+	ok = ok && CHECK(g_alertEvents.size() == 7 && Last(1, 40, false, 22) && g_alertsActive == 3);
+	LeaveCriticalSection(&g_critSec);
+
+	g_alertRules.clear();
+	for(std::vector<int>& rules : g_alertRulesByField)
+		rules.clear();
+	ResetTrackerState();
+	return ok;
+}
+
+// 100000 adds and removes of 1200 keys against a std::map, so that removals shift back long runs of the index, and
+// a clear half way. Every key is found where the map has it, every handle of a removed entry stops resolving even
+// once its slot is reused, and the handles of the others keep following their entry as it moves.
+static bool TestMemoryTable()
+{
+	struct Model
+	{
+		UINT64		 value;
+		MemoryHandle handle;
+	};
+	typedef std::pair<DWORD, PVOID> Key;
+
+	ProcessMemoryTable		  table;
+	std::map<Key, Model>	  model;
+	std::vector<MemoryHandle> stale;
+	UINT32					  random = 30;
+	auto					  Check	 = [&]()
+	{
+		bool ok = CHECK(table.Size() == model.size());
+		for(auto itr = model.begin(); ok && itr != model.end(); ++itr)
+		{
+			UINT32 dense = table.Find(itr->first.first, itr->first.second);
+			ok			 = CHECK(dense != INVALID_MEMORY_INDEX && table.usageLocal[dense] == itr->second.value && table.Resolve(itr->second.handle) == dense);
+		}
+		for(const MemoryHandle& handle : stale)
+			ok = ok && CHECK(table.Resolve(handle) == INVALID_MEMORY_INDEX);
+		return ok;
+	};
+
+	bool ok = true;
+	for(int i = 0; i < 100000 && ok; ++i)
+	{
+		Key	   key	 = { 1 + TestRandom(random) % 300, (PVOID)(UINT64)(0x10000 * (1 + TestRandom(random) % 4)) };
+		auto   itr	 = model.find(key);
+		UINT32 dense = table.Find(key.first, key.second);
+		if(itr == model.end())
+		{
+			ok = CHECK(dense == INVALID_MEMORY_INDEX);
+			if(TestRandom(random) % 4)
+			{
+				dense					= table.Add(key.first, key.second, false);
+				table.usageLocal[dense] = TestRandom(random);
+				model[key]				= { table.usageLocal[dense], table.Handle(dense) };
+			}
+		}
+		else
+		{
+			ok = CHECK(dense != INVALID_MEMORY_INDEX && table.keys[dense].pid == key.first && table.keys[dense].pDxgAdapter == key.second);
+			stale.push_back(itr->second.handle);
+			table.Remove(dense);
+			model.erase(itr);
+		}
+		if(i % 1000 == 999)
+			ok = ok && Check();
+		if(i == 50000)
+		{
+			for(auto& pair : model)
+				stale.push_back(pair.second.handle);
+			table.Clear();
+			model.clear();
+		}
+	}
+	return ok && CHECK(stale.size() > 10000) && Check();
+}
+
+// Every value up to 1 MB and around each unit, then random values up to 2^53 where doubles are still exact, at each
+// minimum unit. FormatMemoryText has to write what the sprintf it replaced did, rounding ties to even included.
+static bool TestFormat()
+{
+	const int minSize = g_minSize;
+	UINT32	  random  = 38;
+	UINT64	  bytes	  = 0;
+	int		  length  = 0;
+	char	  expected[64];
+	char	  text[MEMORY_TEXT_MAX];
+	auto	  Matches = [&]()
+	{
+		FormatMemoryPrintf(bytes, expected, sizeof(expected));
+		length = FormatMemoryText(bytes, text);
+		return (size_t)length == strlen(expected) && memcmp(text, expected, length) == 0;
+	};
+
+	bool ok = true;
+	for(int unit = 0; unit < 4 && ok; ++unit)
+	{
+		g_minSize = unit;
+		for(bytes = 0; bytes < (1 << 20) && ok; ++bytes)
+			ok = CHECK(Matches());
+		for(int shift = 20; shift <= 40 && ok; shift += 10)
+			for(bytes = (1ull << shift) - 4096; bytes < (1ull << shift) + 4096 && ok; ++bytes)
+				ok = CHECK(Matches());
+		for(int i = 0; i < (1 << 18) && ok; ++i)
+		{
+			bytes = (((UINT64)TestRandom(random) << 24 | TestRandom(random)) << 5) >> (TestRandom(random) % 53);
+			ok	  = CHECK(Matches());
+		}
+	}
+	if(!ok)
+		printf("  %llu bytes at minimum unit %d: '%.*s', not '%s'\n", (unsigned long long)bytes, g_minSize, length, text, expected);
+	g_minSize = minSize;
+	return ok;
+}
+
+// 4200 entries, more than the segment holds, with the smallest process tracked. The copy has to be the latest
+// publication, tracked and larger entries first, and while the tracker republishes with every entry's usage set
+// to the publication number, every read that succeeds has to be one whole publication.
+static bool TestSharedState()
+{
+	const int	 NUM_PROCESSES = 2100;
+	const int	 NUM_PUBLISHES = 2000;
+	const UINT64 MB			   = 1ull << 20;
+	const PVOID	 adapters[2]   = { (PVOID)0x10000, (PVOID)0x20000 };
+	char		 name[64];
+	LARGE_INTEGER nameTime;
+	QueryPerformanceCounter(&nameTime);
+	sprintf_s(name, sizeof(name), "%s_test_%llx", DEMOTE_SHARED_NAME, (UINT64)nameTime.QuadPart);
+
+	ResetTrackerState();
+	EnterCriticalSection(&g_critSec);
+	TrackProcessTree(1000);
+	for(int p = 0; p < NUM_PROCESSES; ++p)
+		OnProcessCreate(L"\\Device\\HarddiskVolume1\\game.exe", 1000 + p, 4, false);
+	LeaveCriticalSection(&g_critSec);
+	for(int p = 0; p < NUM_PROCESSES; ++p)
+	{
+		for(int a = 0; a < 2; ++a)
+			QueueMemoryUpdate(1000 + p, adapters[a], MEMORY_USAGE_LOCAL, 0, (p + 1) * (a + 1) * MB);
+	}
+	FlushMemoryUpdates(t_batch);
+
+	bool ok = CHECK(StartSharedState(name));
+	EnterCriticalSection(&g_critSec);
+	PublishSharedState();
+	LeaveCriticalSection(&g_critSec);
+	DemoteSharedReader reader;
+	DemoteSharedCopy   copy;
+	ok = ok && CHECK(OpenSharedState(reader, name) && ReadSharedState(reader, copy));
+	ok = ok && CHECK(copy.sequence == 2 && copy.entries.size() == DEMOTE_SHARED_MAX_ENTRIES && copy.entryTotal == 2 * NUM_PROCESSES);
+	ok = ok && CHECK(copy.adapters.size() == 2);
+	UINT64 usageSum = 0;
+	for(int p = 0; p < NUM_PROCESSES; ++p)
+		usageSum += (p + 1) * 3 * MB;
+	for(const DemoteSharedAdapter& a : copy.adapters)
+		usageSum -= a.usageLocal;
+	ok = ok && CHECK(usageSum == 0);
+
+	// The 104 smallest untracked entries did not fit, the ones under 72 MB: processes 1001 to 1070 on the first
+	// adapter and 1001 to 1034 on the second
+	auto Find = [&](DWORD pid, int a) { return FindSharedEntry(copy.entries.data(), (uint32_t)copy.entries.size(), pid, (uint64_t)adapters[a]); };
+	for(int a = 0; ok && a < 2; ++a)
+	{
+		const DemoteSharedEntry* tracked = Find(1000, a);
+		ok = ok && CHECK(tracked && tracked->flags == DEMOTE_SHARED_TRACKED && tracked->usageLocal == (a + 1) * MB);
+		ok = ok && CHECK(tracked && strcmp(tracked->name, "game.exe") == 0);
+		for(int p = 1; ok && p < NUM_PROCESSES; ++p)
+		{
+			const DemoteSharedEntry* e = Find(1000 + p, a);
+			if((p + 1) * (a + 1) < 72)
+				ok = CHECK(!e);
+			else
+				ok = CHECK(e && e->flags == 0 && e->usageLocal == (p + 1) * (a + 1) * MB);
+		}
+	}
+
+	std::atomic<bool> done	 = false;
+	int				  reads	 = 0;
+	int				  missed = 0;
+	int				  wrong	 = 0;
+	std::thread		  readerThread(
+		  [&]()
+		  {
+			  DemoteSharedCopy readerCopy;
+			  while(!done)
+			  {
+				  if(!ReadSharedState(reader, readerCopy, 1))
+				  {
+					  missed++;
+					  continue;
+				  }
+				  reads++;
+				  if(readerCopy.sequence == 2) // the first publication, with the sizes
+					  continue;
+				  for(const DemoteSharedEntry& e : readerCopy.entries)
+				  {
+					  if(e.usageLocal != readerCopy.sequence / 2)
+					  {
+						  wrong++;
+						  break;
+					  }
+				  }
+			  }
+		  });
+	for(UINT64 published = 2; published <= NUM_PUBLISHES && ok; ++published)
+	{
+		EnterCriticalSection(&g_critSec);
+		for(UINT64& usage : g_processMemory.usageLocal)
+			usage = published;
+		PublishSharedState();
+		LeaveCriticalSection(&g_critSec);
+		if(published % 64 == 0)
+			std::this_thread::yield();
+	}
+	done = true;
+	readerThread.join();
+	ok = ok && CHECK(reads > 0 && wrong == 0 && ReadSharedState(reader, copy) && copy.sequence == 2 * NUM_PUBLISHES);
+	if(!ok)
+		printf("  %d reads, %d retried out, %d torn\n", reads, missed, wrong);
+
+	CloseSharedState(reader);
+	StopSharedState();
+	ok = ok && CHECK(!OpenSharedState(reader, name));
+	ResetTrackerState();
+	return ok;
+}
+
+// Entries that are not in both snapshots with the same values
+static int CountDifferences(const Snapshot& a, const Snapshot& b)
+{
+	std::vector<DiffEntry> diff;
+	DiffSnapshots(a, b, diff);
+	int different = 0;
+	for(const DiffEntry& d : diff)
+	{
+		if(d.state != DIFF_CHANGED || d.Delta(&SnapshotEntry::Usage, false) || d.Delta(&SnapshotEntry::Commitment, false) ||
+		   d.Delta(&SnapshotEntry::Usage, true) || d.Delta(&SnapshotEntry::Commitment, true))
+			different++;
+		else
+			for(int i = 0; i < PRIO_COUNT; ++i)
+				different += d.DemotedDelta(i) != 0;
+	}
+	return different;
+}
+
+// 20000 updates of 40 processes on 2 adapters, a few microseconds apart so that most batches overwrite some of their
+// updates, queued as the event handlers do and then applied one by one. Both end with the same table, adapter totals
+// and demotion episodes.
+static bool TestBatching()
+{
+	const int				  NUM_UPDATES = 20000;
+	const UINT64			  MB		  = 1ull << 20;
+	PVOID					  adapters[]  = { (PVOID)0x10000, (PVOID)0x20000 };
+	UINT32					  random	  = 29;
+	std::vector<MemoryUpdate> updates;
+	INT64					  time		  = 1;
+	for(int i = 0; i < NUM_UPDATES; ++i)
+	{
+		MemoryUpdate u;
+		time += TestRandom(random) % (g_qpcFrequency / 5000 + 1);
+		u.time		  = time;
+		u.pid		  = 1 + TestRandom(random) % 40;
+		u.pDxgAdapter = adapters[TestRandom(random) % 2];
+		u.field		  = (UINT8)(TestRandom(random) % (MEMORY_DEMOTED + 1));
+		u.prio		  = u.field == MEMORY_DEMOTED ? (UINT8)(TestRandom(random) % PRIO_COUNT) : 0;
+		u.value		  = (TestRandom(random) % 8) * 64 * MB;
+		updates.push_back(u);
+	}
+
+	// The table, then the adapter totals and the episodes of each entry
+	struct State
+	{
+		Snapshot			snapshot;
+		std::vector<UINT64> totals;
+	};
+	auto Capture = [&](State& state)
+	{
+		EnterCriticalSection(&g_critSec);
+		TakeSnapshot(state.snapshot);
+		for(PVOID adapter : adapters)
+		{
+			const Adapter* a = FindAdapter(adapter);
+			state.totals.insert(state.totals.end(), { a->UsageLocal, a->CommitmentLocal, a->UsageNonLocal, a->CommitmentNonLocal, a->CommitmentDemoted });
+		}
+		for(const SnapshotEntry& e : state.snapshot.entries)
+		{
+			EpisodeSummary summary = {};
+			EpisodeSummarize(g_processMemory.Find(e.pid, e.pDxgAdapter), time, summary);
+			state.totals.insert(state.totals.end(), { summary.count, summary.open, summary.peak, (UINT64)(summary.byteSeconds / MB) });
+		}
+		LeaveCriticalSection(&g_critSec);
+		ResetTrackerState();
+	};
+
+	ResetTrackerState();
+	for(const MemoryUpdate& u : updates)
+	{
+		t_eventTime = u.time;
+		QueueMemoryUpdate(u.pid, u.pDxgAdapter, (MemoryField)u.field, u.prio, u.value);
+	}
+	FlushMemoryUpdates(t_batch);
+	State batched;
+	Capture(batched);
+
+	EnterCriticalSection(&g_critSec);
+	for(const MemoryUpdate& u : updates)
+		ApplyMemoryUpdate(u, FindProcessMemory(u.pid, u.pDxgAdapter));
+	LeaveCriticalSection(&g_critSec);
+	State applied;
+	Capture(applied);
+
+	bool ok = CHECK(batched.snapshot.entries.size() == 80 && CountDifferences(batched.snapshot, applied.snapshot) == 0);
+	return ok && CHECK(batched.totals.size() == 10 + 4 * 80 && batched.totals == applied.totals);
+}
+
+// Records a synthetic stream, dumps the ring and replays the dump into a fresh tracker, which has to end up in the
+// same state
+static bool TestFlightRecorder()
+{
+	const int	NUM_EVENTS = 1 << 18;
+	const char* PATH	   = "demote_tests.dtrec";
+	SynthConfig config;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+	ResetTrackerState();
+	bool ok = CHECK(StartFlightRecorder(16, 3600));
+	ReplaySynthEvents(stream);
+	Snapshot recorded;
+	EnterCriticalSection(&g_critSec);
+	TakeSnapshot(recorded);
+	LeaveCriticalSection(&g_critSec);
+	ok = ok && CHECK(DumpFlightRecorder(PATH));
+	StopFlightRecorder();
+
+	SynthStream loaded;
+	ok = ok && CHECK(LoadFlightRecording(PATH, loaded));
+	remove(PATH);
+	ResetTrackerState();
+	ReplaySynthEvents(loaded);
+	Snapshot replayed;
+	EnterCriticalSection(&g_critSec);
+	TakeSnapshot(replayed);
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok && CHECK(recorded.entries.size() && CountDifferences(recorded, replayed) == 0);
+}
+
+// Devices of the processes, with their allocation counts and bytes, and the allocations known. Needs g_critSec.
+static std::vector<UINT64> DeviceState(const std::vector<DWORD>& pids, PVOID adapter)
+{
+	std::vector<UINT64> state = { DeviceAllocationCount() };
+	for(DWORD pid : pids)
+	{
+		UINT32 index = g_processMemory.Find(pid, adapter);
+		if(index == INVALID_MEMORY_INDEX)
+		{
+			state.push_back(0);
+			continue;
+		}
+		for(const DeviceMemory* d = FirstDeviceMemory(index); d; d = NextDeviceMemory(d))
+		{
+			state.push_back((UINT64)d->hDevice);
+			state.push_back(d->allocations);
+			state.insert(state.end(), d->bytes, d->bytes + ALLOCATION_TYPE_COUNT);
+		}
+	}
+	return state;
+}
+
+// Writes a synthetic stream as an .etl file with its events spread over the buffers of 8 processors and reads it
+// back, which has to dispatch every event and give the same state as replaying the stream. A tail of allocation
+// events, which the generator does not make, covers their encoding.
+static bool TestEtlReader()
+{
+	const int	NUM_EVENTS = 1 << 18;
+	const char* PATH	   = "demote_tests.etl";
+	SynthConfig config;
+	SynthStream stream;
+	GenerateSynthEvents(config, NUM_EVENTS, stream);
+	PVOID			   adapter = (PVOID)0x10000;
+	std::vector<DWORD> pids	   = { 900001, 900002, 900003, 900004 };
+	for(const SynthEvent& e : stream.events)
+	{
+		if(e.type == SYNTH_USAGE_CHANGE)
+		{
+			adapter = e.usageChange.pDxgAdapter;
+			break;
+		}
+	}
+	auto Add = [&](SynthEventType type)
+	{
+		SynthEvent e = {};
+		e.type		 = type;
+		e.time		 = stream.events.back().time + 1;
+		stream.events.push_back(e);
+		return &stream.events.back();
+	};
+	size_t numGenerated = stream.events.size();
+	for(UINT64 a = 0; a < 64; ++a)
+	{
+		PVOID allocation = (PVOID)(0x100000 + a * 0x40);
+		PVOID device	 = (PVOID)(0xd0 + a % 5);
+		if(a % 2)
+		{
+			DeviceAllocationDCStartEvent& rundown = Add(SYNTH_DEVICE_ALLOCATION_RUNDOWN)->deviceAllocationRundown;
+			rundown.hDevice						  = device;
+			rundown.pDxgAllocation				  = allocation;
+		}
+		ProcessAllocationDetailsStartEvent& details = Add(SYNTH_ALLOCATION_DETAILS_START)->allocationDetailsStart;
+		details.ProcessId							= pids[a % pids.size()];
+		details.pDxgAdapter							= adapter;
+		details.pDxgAllocation						= allocation;
+		details.Size								= (a + 1) << 20;
+		details.Flags								= a % 3 ? 0 : ALLOCATION_FLAG_CPU_VISIBLE;
+		if(a % 2 == 0)
+		{
+			DeviceAllocationStartEvent& start = Add(SYNTH_DEVICE_ALLOCATION_START)->deviceAllocationStart;
+			start.hDevice					  = device;
+			start.pDxgAllocation			  = allocation;
+		}
+		if(a % 8 == 0)
+			Add(SYNTH_DEVICE_ALLOCATION_STOP)->deviceAllocationStop.pDxgAllocation = allocation;
+		if(a % 8 == 4)
+			Add(SYNTH_ALLOCATION_DETAILS_STOP)->allocationDetailsStop.pDxgAllocation = allocation;
+	}
+	ResetTrackerState();
+	ReplaySynthEvents(stream);
+	Snapshot expected;
+	EnterCriticalSection(&g_critSec);
+	TakeSnapshot(expected);
+	std::vector<UINT64> expectedDevices = DeviceState(pids, adapter);
+	LeaveCriticalSection(&g_critSec);
+
+	// The allocation events are only read with --devices
+	bool ok = CHECK(WriteSynthEtl(PATH, stream, 8, 64 * 1024));
+	ResetTrackerState();
+	EtlStats stats;
+	ok = ok && CHECK(ReadEtlFile(PATH, stats) && stats.dispatched == numGenerated && !stats.undecoded);
+	EnterCriticalSection(&g_critSec);
+	ok = ok && CHECK(DeviceAllocationCount() == 0);
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	g_deviceEvents = true;
+	ok			   = ok && CHECK(ReadEtlFile(PATH, stats));
+	g_deviceEvents = false;
+	remove(PATH);
+	Snapshot parsed;
+	EnterCriticalSection(&g_critSec);
+	TakeSnapshot(parsed);
+	ok = ok && CHECK(DeviceState(pids, adapter) == expectedDevices && expectedDevices.size() > 1 + 4 * pids.size());
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	ok = ok && CHECK(stats.dispatched == stream.events.size() && !stats.undecoded && !stats.lateEvents && stats.processors == 8);
+	return ok && CHECK(expected.entries.size() && CountDifferences(expected, parsed) == 0);
+}
+
+#ifndef _WIN32
+// Scans of a fixture with DRM clients in old and new style fdinfo files, some on a second gpu and some shared with a
+// child, have to give the tracker what the processes report: after the first scan, after processes changed, exited
+// and started, and after scans of the unchanged tree
+static bool TestDrmSource()
+{
+	DrmFixture fixture;
+	CreateDrmFixture(fixture, "demote_tests_drm", 1000);
+	ResetTrackerState();
+	SetDrmRoots((fixture.root + "/proc").c_str(), (fixture.root + "/sys").c_str());
+	DrmScanStats stats;
+	bool		 ok = CHECK(ScanDrmClients(stats) && DrmFixtureMatches(fixture));
+	ok				= ok && CHECK(stats.processes == 1000 && stats.gpuProcesses == 124); // not the child sharing its parent's client
+	ChangeDrmFixture(fixture);
+	ok = ok && CHECK(ScanDrmClients(stats) && DrmFixtureMatches(fixture));
+	for(int i = 0; i < 20; ++i)
+		ok = CHECK(ScanDrmClients(stats)) && ok;
+	ok = ok && CHECK(DrmFixtureMatches(fixture));
+	SetDrmRoots("/proc", "/sys");
+	ResetTrackerState();
+	RemoveDrmFixture(fixture);
+	return ok;
+}
+#endif
+
+// A low and a high priority process overflowing a 10 GB budget by 2 GB for 2 seconds, which has to demote the low one
+// only, then sweeps of a synthetic stream, where more memory can never mean more demotion
+static bool TestSimulator()
+{
+	const UINT64 GB = 1ull << 30;
+	SynthStream	 small;
+	auto		 Add = [&](double seconds, SynthEventType type, DWORD pid, UINT64 value, UINT8 prio) -> SynthEvent&
+	{
+		SynthEvent e;
+		memset(&e, 0, sizeof(e));
+		e.time = TestTime(seconds);
+		e.type = type;
+		if(type == SYNTH_COMMITMENT_CHANGE)
+		{
+			e.commitmentChange.ProcessId   = pid;
+			e.commitmentChange.pDxgAdapter = (PVOID)0x10000;
+			e.commitmentChange.Commitment  = value;
+		}
+		else
+		{
+			e.demotedCommitmentChange.ProcessId		= pid;
+			e.demotedCommitmentChange.pDxgAdapter	= (PVOID)0x10000;
+			e.demotedCommitmentChange.PriorityClass = prio;
+		}
+		small.events.push_back(e);
+		return small.events.back();
+	};
+	Add(0, SYNTH_DEMOTED_COMMITMENT_CHANGE, 1, 0, PRIO_LOW);
+	Add(0, SYNTH_DEMOTED_COMMITMENT_CHANGE, 2, 0, PRIO_HIGH);
+	Add(0, SYNTH_COMMITMENT_CHANGE, 1, 6 * GB, 0);
+	Add(1, SYNTH_COMMITMENT_CHANGE, 2, 6 * GB, 0);
+	Add(3, SYNTH_COMMITMENT_CHANGE, 2, 2 * GB, 0);
+	Add(5, SYNTH_COMMITMENT_CHANGE, 1, 6 * GB, 0);
+	SimConfig config;
+	config.capacity	   = 10 * GB;
+	config.budgetShare = 1.0;
+	SimResult result;
+	SimulateBudget(small, config, result);
+	bool ok = CHECK(result.entries.size() == 2 && fabs(result.entries[0].demotedByteSeconds - 4.0 * GB) < 0.01 * GB);
+	ok		= ok && CHECK(fabs(result.entries[0].demotedSeconds - 2.0) < 0.01 && result.entries[0].peakDemoted == 2 * GB);
+	ok		= ok && CHECK(result.entries[1].demotedByteSeconds == 0 && result.peakDemoted == 2 * GB);
+
+
+	SynthConfig synth;
+	SynthStream stream;
+	GenerateSynthEvents(synth, 1 << 18, stream);
+	std::vector<SimResult> results;
+	SweepBudgets(stream, { 1 * GB, 2 * GB, 4 * GB, 8 * GB, 16 * GB }, 0.9, results);
+	double previous = -1;
+	for(const SimResult& r : results)
+	{
+		double byteSeconds = 0;
+		for(const SimEntry& e : r.entries)
+			byteSeconds += e.demotedByteSeconds;
+		ok		 = ok && CHECK((previous < 0 ? byteSeconds > 0 : byteSeconds <= previous * (1 + 1e-9)));
+		previous = byteSeconds;
+	}
+	return ok && CHECK(results.size() == 5);
+}
+
+// A victim demoted by 2 GB half a second after two processes grew by 1 and 3 GB on its adapter, then demoted again
+// once their growth has left the window. The report ages the blame by event time, 3 s at the last event.
+static bool TestBlame()
+{
+	const UINT64 GB		 = 1ull << 30;
+	PVOID		 adapter = (PVOID)0x10000;
+	ResetTrackerState();
+	TestUpdate(0.0, 10, adapter, MEMORY_COMMITMENT_LOCAL, 0, 4 * GB);
+	TestUpdate(1.0, 20, adapter, MEMORY_COMMITMENT_LOCAL, 0, 1 * GB);
+	TestUpdate(1.5, 30, adapter, MEMORY_COMMITMENT_LOCAL, 0, 3 * GB);
+	TestUpdate(2.0, 10, adapter, MEMORY_DEMOTED, PRIO_LOW, 2 * GB);
+	TestUpdate(5.0, 10, adapter, MEMORY_DEMOTED, PRIO_LOW, 3 * GB);
+
+	// The culprit and last_seconds_ago of each row of the report
+	const char*								 PATH = "demote_tests_blame.csv";
+	std::vector<std::pair<unsigned, double>> rows;
+	FILE*									 f = nullptr;
+	if(ExportBlameReport(PATH) && fopen_s(&f, PATH, "r") == 0 && f)
+	{
+		char line[512];
+		while(fgets(line, sizeof(line), f))
+		{
+			std::vector<const char*> fields = { line };
+			for(char* c = strchr(line, ','); c; c = strchr(c + 1, ','))
+				fields.push_back(c + 1);
+			if(fields.size() == 8 && isdigit(*fields[3]))
+				rows.push_back({ (unsigned)atoi(fields[3]), atof(fields[7]) });
+		}
+		fclose(f);
+	}
+	remove(PATH);
+	bool ok = CHECK(rows.size() == 2 && rows[0] == std::make_pair(30u, 3.0) && rows[1] == std::make_pair(20u, 3.0));
+
+	EnterCriticalSection(&g_critSec);
+	UINT32				 victim = g_processMemory.Find(10, adapter);
+	const ProcessMemory& memory = g_processMemory.cold[victim];
+	auto				 Blamed = [&](DWORD culprit)
+	{
+		auto itr = g_blameScores.find({ 10, culprit, adapter });
+		return itr != g_blameScores.end() ? itr->second.bytes : 0.0;
+	};
+	ok		= ok && CHECK(memory.blamePid == 30 && fabs(Blamed(20) - 0.5 * GB) < 1 && fabs(Blamed(30) - 1.5 * GB) < 1);
+	ok		= ok && CHECK(g_blameUnattributed == GB && g_blameScores.size() == 2);
+	OnProcessStop(10);
+	ok = ok && CHECK(g_blameScores.empty());
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok;
+}
+
+// 100 low priority episodes of 10 ms to 1 s at 1 GB, then one high priority episode left open. The statistics go
+// with the process and its pool slot is reused, and an episode inside a single batch is still seen.
+static bool TestEpisodes()
+{
+	const UINT64 GB		 = 1ull << 30;
+	PVOID		 adapter = (PVOID)0x10000;
+	ResetTrackerState();
+	double seconds = 0;
+	auto   Demote  = [&](DWORD pid, UINT8 prio, UINT64 value) { TestUpdate(seconds, pid, adapter, MEMORY_DEMOTED, prio, value); };
+	for(int i = 1; i <= 100; ++i)
+	{
+		Demote(10, PRIO_LOW, GB / 2);
+		seconds += i * 0.005;
+		Demote(10, PRIO_LOW, GB);
+		seconds += i * 0.005;
+		Demote(10, PRIO_LOW, 0);
+		seconds += 1;
+	}
+	Demote(10, PRIO_HIGH, GB);
+	seconds += 2;
+
+	EnterCriticalSection(&g_critSec);
+	EpisodeSummary summary;
+	bool		   ok	= CHECK(EpisodeSummarize(g_processMemory.Find(10, adapter), TestTime(seconds), summary));
+	double		   gbs	= summary.byteSeconds / GB;
+	ok					= ok && CHECK(summary.count == 101 && summary.open == 1 && summary.peak == GB && fabs(summary.longest - 2) < 1e-6);
+	ok					= ok && CHECK(fabs(summary.p50 - 0.5) < 0.5 * 0.2 && fabs(summary.p99 - 0.99) < 0.99 * 0.2 && fabs(gbs - (37.875 + 2)) < 1e-3);
+	OnProcessStop(10);
+	LeaveCriticalSection(&g_critSec);
+	Demote(20, PRIO_LOW, GB);
+	EnterCriticalSection(&g_critSec);
+	ok = ok && CHECK(EpisodeSummarize(g_processMemory.Find(20, adapter), g_eventTime, summary) && summary.count == 1 && summary.open == 1);
+	LeaveCriticalSection(&g_critSec);
+
+	// An episode that starts and ends within one batch
+	t_eventTime = TestTime(seconds);
+	QueueMemoryUpdate(30, adapter, MEMORY_DEMOTED, PRIO_LOW, GB);
+	t_eventTime += g_qpcFrequency / 1000;
+	QueueMemoryUpdate(30, adapter, MEMORY_DEMOTED, PRIO_LOW, 0);
+	FlushMemoryUpdates(t_batch);
+	EnterCriticalSection(&g_critSec);
+	ok = ok && CHECK(EpisodeSummarize(g_processMemory.Find(30, adapter), g_eventTime, summary) && summary.count == 1 && summary.open == 0);
+	ok = ok && CHECK(summary.peak == GB);
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok;
+}
+
+// Sums of a snapshot as the collector keeps them for a host
+static bool FleetHostMatches(const FleetHost& host, const Snapshot& snapshot)
+{
+	UINT64 totals[FLEET_FIELD_COUNT] = {};
+	for(const SnapshotEntry& e : snapshot.entries)
+	{
+		totals[0] += e.usageLocal;
+		totals[1] += e.commitmentLocal;
+		totals[2] += e.usageNonLocal;
+		totals[3] += e.commitmentNonLocal;
+		for(int i = 0; i < PRIO_COUNT; ++i)
+			totals[4 + i] += e.demoted[i];
+	}
+	return host.entries.size() == snapshot.entries.size() && memcmp(totals, host.totals, sizeof(totals)) == 0;
+}
+
+#ifndef _WIN32
+// Localhost agents with 64 entries each send their full state, then rounds where a few entries change, one exits
+// and one starts. The collector model has to match the agents, a bad frame drops its connection, and a query is
+// answered while the loop runs on another thread.
+static bool TestFleet()
+{
+	const int	   NUM_AGENTS = 16;
+	const int	   NUM_ENTRIES = 64;
+	const int	   NUM_ROUNDS = 10;
+	FleetCollector collector;
+	if(!StartFleetCollector(collector, 0))
+		return false;
+	char address[64];
+	sprintf_s(address, sizeof(address), "127.0.0.1:%d", collector.port);
+
+	std::vector<FleetAgent> agents(NUM_AGENTS);
+	std::vector<Snapshot>	states(NUM_AGENTS);
+	UINT32					rnd	 = 7;
+	bool					ok	 =CHECK( true);
+	auto					Make = [&](DWORD pid)
+	{
+		SnapshotEntry e = {};
+		e.pid			= pid;
+		e.pDxgAdapter	= (PVOID)(UINT64)(0x10000 * (1 + pid % 2));
+		e.name			= L"app" + std::to_wstring(pid % 97) + L".exe";
+		e.tracked		= pid % 13 == 0;
+		e.usageLocal	= (UINT64)(TestRandom(rnd) % 4096) << 20;
+		e.commitmentLocal = e.usageLocal + ((UINT64)(TestRandom(rnd) % 256) << 20);
+		e.demoted[TestRandom(rnd) % PRIO_COUNT] = (UINT64)(TestRandom(rnd) % 64) << 20;
+		return e;
+	};
+	for(int a = 0; a < NUM_AGENTS; ++a)
+	{
+		for(int i = 0; i < NUM_ENTRIES; ++i)
+			states[a].entries.push_back(Make(1000 + i * 4));
+		char host[32];
+		sprintf_s(host, sizeof(host), "node%03d", a);
+		ok = CHECK(FleetAgentConnect(agents[a], address, host)) && ok;
+	}
+
+	// Every agent sends, then the collector runs until it has all the records
+	UINT64 expected = 0;
+	auto   Round	= [&]()
+	{
+		for(int a = 0; a < NUM_AGENTS; ++a)
+			ok = CHECK(FleetAgentSend(agents[a], states[a])) && ok;
+		expected = 0;
+		for(const FleetAgent& agent : agents)
+			expected += agent.recordsSent;
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		while(collector.stats.records < expected && TestSeconds(start) < 10)
+			PollFleetCollector(collector, 10);
+	};
+	Round();
+	for(int round = 0; round < NUM_ROUNDS; ++round)
+	{
+		for(Snapshot& state : states)
+		{
+			for(int i = 0; i < 4; ++i)
+			{
+				SnapshotEntry& e = state.entries[TestRandom(rnd) % state.entries.size()];
+				e.usageLocal	 = (UINT64)(TestRandom(rnd) % 4096) << 20;
+				e.demoted[PRIO_LOW] += 1 << 20;
+			}
+			state.entries.erase(state.entries.begin() + TestRandom(rnd) % state.entries.size());
+			state.entries.push_back(Make(state.entries.back().pid + 4)); // pids stay sorted
+		}
+		Round();
+	}
+
+	// Names past 127 characters, and one past the 255 a record carries
+	states[0].entries[0].name = std::wstring(126, L'n') + L".exe";
+	states[1].entries[0].name = std::wstring(300, L'n') + L".exe";
+	Round();
+	auto NameLength = [&](int a)
+	{
+		const SnapshotEntry& e	 = states[a].entries[0];
+		auto				 itr = collector.hosts[a].entries.find({ e.pid, (UINT64)e.pDxgAdapter });
+		return itr != collector.hosts[a].entries.end() ? itr->second.name.size() : 0;
+	};
+	ok = ok && CHECK(collector.hosts.size() == NUM_AGENTS && NameLength(0) == 130 && NameLength(1) == 255);
+
+	ok = ok && CHECK(collector.stats.records == expected && collector.hosts.size() == NUM_AGENTS && collector.stats.connections == NUM_AGENTS);
+	for(int a = 0; a < NUM_AGENTS && ok; ++a)
+		ok = CHECK(FleetHostMatches(collector.hosts[a], states[a])); // hosts are added in the order of the hellos
+
+	// A frame over the buffer size drops the connection that sent it
+	FleetAgent bad;
+	ok = ok && CHECK(FleetAgentConnect(bad, address, "bad"));
+	FleetFrameHeader header = { FLEET_MAGIC, FLEET_DELTA, 0, FLEET_BUFFER_BYTES };
+	ok = ok && CHECK(send((int)bad.socket, (const char*)&header, sizeof(header), 0) == sizeof(header));
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	while(collector.stats.dropped == 0 && TestSeconds(start) < 5)
+		PollFleetCollector(collector, 10);
+	ok = ok && CHECK(collector.stats.dropped == 1);
+	FleetAgentClose(bad);
+
+	std::atomic<bool> stop = false;
+	std::thread		  loop([&]()
+					   {
+						   while(!stop)
+							   PollFleetCollector(collector, 10);
+					   });
+	std::string		  view;
+	bool			  queried = QueryFleet(address, FLEET_DEMOTED, 10, view);
+	for(FleetAgent& agent : agents)
+		FleetAgentClose(agent);
+	QueryPerformanceCounter(&start);
+	while(collector.stats.connections && TestSeconds(start) < 5)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	stop = true;
+	loop.join();
+	ok = ok && CHECK(queried && view.find("17 hosts (16 connected)") != std::string::npos);
+	ok = ok && CHECK(collector.stats.connections == 0 && !collector.hosts[0].connected);
+	StopFleetCollector(collector);
+	return ok;
+}
+#endif
+
+// A launched process (100) starts a child (101) that starts a grandchild (102), beside an unrelated process (200).
+// Only the tree is measured: 1 GB for 5 s and 4 GB for 1 s while the grandchild lives, 512 MB demoted for 1 s.
+static bool TestMeasure()
+{
+	const UINT64 GB		 = 1ull << 30;
+	PVOID		 adapter = (PVOID)0x10000;
+	ResetTrackerState();
+	auto At   = [](double seconds) { g_eventTime = t_eventTime = TestTime(seconds); };
+	auto Near = [](UINT64 value, UINT64 expected) { return fabs((double)value - (double)expected) <= expected * 0.05; };
+
+	EnterCriticalSection(&g_critSec);
+	At(0);
+	StartMeasurement(g_eventTime);
+	TrackProcessTree(100);
+	OnProcessCreate(L"launcher.exe", 100, 1, false);
+	OnProcessCreate(L"child.exe", 101, 100, false);
+	OnProcessCreate(L"grandchild.exe", 102, 101, false);
+	OnProcessCreate(L"other.exe", 200, 1, false);
+	LeaveCriticalSection(&g_critSec);
+	TestUpdate(0, 101, adapter, MEMORY_USAGE_LOCAL, 0, GB);
+	TestUpdate(0, 200, adapter, MEMORY_USAGE_LOCAL, 0, 8 * GB);
+	TestUpdate(1, 101, adapter, MEMORY_DEMOTED, PRIO_LOW, GB / 2);
+	TestUpdate(2, 101, adapter, MEMORY_DEMOTED, PRIO_LOW, 0);
+	TestUpdate(3, 102, adapter, MEMORY_USAGE_LOCAL, 0, 3 * GB);
+	EnterCriticalSection(&g_critSec);
+	At(4);
+	OnProcessStop(102);
+	bool ok = CHECK(g_trackedPids.size() == 2 && g_processMemory.tracked[g_processMemory.Find(101, adapter)] && !g_processMemory.tracked[g_processMemory.Find(200, adapter)]);
+	for(const char* text : { "usage.p90 > 3GB", "usage.p50 > 1.5GB", "demoted.low > 0", "commit.p99 > 1GB" })
+		ok = CHECK(AddMeasureLimit(text)) && ok;
+	MeasureLimit limit;
+	ok = ok && CHECK(!ParseMeasureLimit("usage > 50%", limit) && !ParseMeasureLimit("demoted.low.p42 > 1GB", limit));
+	At(6);
+	FinishMeasurement(g_eventTime);
+	ok = ok && CHECK(g_measure.processes == 3 && MeasureValue(MEASURE_USAGE, MEASURE_PEAK) == 4 * GB && Near(MeasureValue(MEASURE_USAGE, MEASURE_P50), GB));
+	ok = ok && CHECK(Near(MeasureValue(MEASURE_USAGE, MEASURE_P90), 4 * GB) && Near(MeasureValue(MEASURE_USAGE, MEASURE_MEAN), GB * 3 / 2));
+	ok = ok && CHECK(MeasureValue(MEASURE_DEMOTED, MEASURE_PEAK) == GB / 2 && MeasureValue(MEASURE_DEMOTED_PRIO + (UINT8)PRIO_LOW, MEASURE_PEAK) == GB / 2);
+	ok = ok && CHECK(MeasureValue(MEASURE_DEMOTED_PRIO + (UINT8)PRIO_HIGH, MEASURE_PEAK) == 0 && MeasureValue(MEASURE_DEMOTED, MEASURE_P50) == 0);
+	ok = ok && CHECK(g_measure.limits.size() == 4 && g_measure.limits[0].exceeded && !g_measure.limits[1].exceeded && g_measure.limits[2].exceeded);
+	ok = ok && CHECK(!g_measure.limits[3].exceeded && MeasureLimitsExceeded());
+	g_measure = Measurement();
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+
+	// A peak that comes and goes within one batch
+	EnterCriticalSection(&g_critSec);
+	At(10);
+	StartMeasurement(g_eventTime);
+	TrackProcessTree(300);
+	OnProcessCreate(L"spike.exe", 300, 1, false);
+	LeaveCriticalSection(&g_critSec);
+	QueueMemoryUpdate(300, adapter, MEMORY_COMMITMENT_LOCAL, 0, 2 * GB);
+	QueueMemoryUpdate(300, adapter, MEMORY_USAGE_LOCAL, 0, 2 * GB);
+	QueueMemoryUpdate(300, adapter, MEMORY_USAGE_LOCAL, 0, GB);
+	QueueMemoryUpdate(300, adapter, MEMORY_COMMITMENT_LOCAL, 0, GB);
+	FlushMemoryUpdates(t_batch);
+	EnterCriticalSection(&g_critSec);
+	At(11);
+	FinishMeasurement(g_eventTime);
+	ok = ok && CHECK(MeasureValue(MEASURE_USAGE, MEASURE_PEAK) == 2 * GB && MeasureValue(MEASURE_COMMITMENT, MEASURE_PEAK) == 2 * GB);
+	g_measure = Measurement();
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok;
+}
+
+// Allocations detailed before and after their device is known, one without a device, a device that loses its last
+// allocation, and a process with more devices than rows. The records go with the process and the pool is reused.
+static bool TestDevices()
+{
+	const UINT64 MB		 = 1ull << 20;
+	PVOID		 adapter = (PVOID)0x10000;
+	ResetTrackerState();
+	SynthEvent e;
+	auto	   Send = [&](SynthEventType type)
+	{
+		e.type = type;
+		e.time = ++g_eventTime;
+		DispatchSynthEvent(e);
+		memset(&e, 0, sizeof(e));
+	};
+	auto Details = [&](DWORD pid, UINT64 allocation, UINT64 size, UINT32 flags)
+	{
+		e.allocationDetailsStart.ProcessId		= pid;
+		e.allocationDetailsStart.pDxgAdapter	= adapter;
+		e.allocationDetailsStart.pDxgAllocation = (PVOID)allocation;
+		e.allocationDetailsStart.Size			= size;
+		e.allocationDetailsStart.Flags			= flags;
+		Send(SYNTH_ALLOCATION_DETAILS_START);
+	};
+	auto Device = [&](UINT64 device, UINT64 allocation)
+	{
+		e.deviceAllocationStart.hDevice		   = (PVOID)device;
+		e.deviceAllocationStart.pDxgAllocation = (PVOID)allocation;
+		Send(SYNTH_DEVICE_ALLOCATION_START);
+	};
+	auto Bytes = [](UINT32 index, UINT64 device, int type)
+	{
+		for(const DeviceMemory* d = FirstDeviceMemory(index); d; d = NextDeviceMemory(d))
+		{
+			if(d->hDevice == (PVOID)device)
+				return d->bytes[type];
+		}
+		return ~0ull;
+	};
+	memset(&e, 0, sizeof(e));
+	Details(10, 0xa1, 1024 * MB, 0);
+	Device(0xd1, 0xa1);
+	Device(0xd2, 0xa2);
+	Details(10, 0xa2, 256 * MB, ALLOCATION_FLAG_CPU_VISIBLE);
+	Details(10, 0xa3, 64 * MB, ALLOCATION_FLAG_PERMANENT_SYSMEM);
+	Details(10, 0xa4, 32 * MB, ALLOCATION_FLAG_CPU_VISIBLE);
+	Device(0xd2, 0xa4);
+	for(UINT64 i = 0; i < 8; ++i)
+	{
+		Details(20, 0xb0 + i, (i + 1) * MB, 0);
+		Device(0xe0 + i, 0xb0 + i);
+	}
+
+	EnterCriticalSection(&g_critSec);
+	UINT32 index = g_processMemory.Find(10, adapter);
+	bool   ok	 = CHECK(DeviceMemoryCount(index) == 3 && Bytes(index, 0xd1, ALLOCATION_GPU) == 1024 * MB);
+	ok			 = ok && CHECK(Bytes(index, 0xd2, ALLOCATION_CPU_VISIBLE) == 288 * MB && Bytes(index, 0, ALLOCATION_SYSTEM) == 64 * MB);
+	LeaveCriticalSection(&g_critSec);
+	e.deviceAllocationStop.pDxgAllocation = (PVOID)0xa1;
+	Send(SYNTH_DEVICE_ALLOCATION_STOP);
+	e.allocationDetailsStop.pDxgAllocation = (PVOID)0xa1;
+	Send(SYNTH_ALLOCATION_DETAILS_STOP);
+
+	// Expanded, the 8 devices of the second process take 6 rows, the last for the 3 smallest
+	for(DWORD pid : { 10, 20 })
+		QueueMemoryUpdate(pid, adapter, MEMORY_COMMITMENT_LOCAL, 0, 512 * MB);
+	FlushMemoryUpdates(t_batch);
+	EnterCriticalSection(&g_critSec);
+	g_consoleWidth	= 120;
+	g_consoleHeight = 40;
+	g_showDevices	= true;
+	RenderFrame();
+	g_showDevices = false;
+	std::string screen;
+	for(const CHAR_INFO& c : g_chars)
+		screen += c.Char.AsciiChar;
+	index = g_processMemory.Find(10, adapter);
+	ok	  = ok && CHECK(DeviceMemoryCount(index) == 2 && Bytes(index, 0xd1, ALLOCATION_GPU) == ~0ull && DeviceAllocationCount() == 11);
+	ok	  = ok && CHECK(screen.find("device d2") != std::string::npos && screen.find("3 more devices") != std::string::npos);
+	ok	  = ok && CHECK(screen.find("device e7") != std::string::npos && screen.find("device e2") == std::string::npos);
+	OnProcessStop(10);
+	LeaveCriticalSection(&g_critSec);
+	Details(30, 0xa2, 16 * MB, 0);
+	EnterCriticalSection(&g_critSec);
+	index = g_processMemory.Find(30, adapter);
+	ok	  = ok && CHECK(DeviceMemoryCount(index) == 1 && Bytes(index, 0xd2, ALLOCATION_GPU) == 16 * MB);
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok;
+}
+
+// Ten minutes of a process at 1 GB with a 100 ms spike to 3 GB at 30 s and 512 MB demoted for 1 s every 10 s, then
+// 300 processes of 1 to 300 MB. The spike has to survive in the coarse levels (their first bucket also has the 0 from
+// before the process), the smallest processes lose their series to the larger ones, and the exited process keeps
+// its history. Then the heatmap over all of it.
+static bool TestHistory()
+{
+	const UINT64 MB		 = 1ull << 20;
+	const UINT64 GB		 = 1ull << 30;
+	PVOID		 adapter = (PVOID)0x10000;
+	ResetTrackerState();
+	TestUpdate(0, 10, adapter, MEMORY_USAGE_LOCAL, 0, GB);
+	TestUpdate(30, 10, adapter, MEMORY_USAGE_LOCAL, 0, 3 * GB);
+	TestUpdate(30.1, 10, adapter, MEMORY_USAGE_LOCAL, 0, GB);
+	for(int i = 1; i <= 60; ++i)
+	{
+		TestUpdate(i * 10.0, 10, adapter, MEMORY_DEMOTED, PRIO_LOW, GB / 2);
+		TestUpdate(i * 10.0 + 1, 10, adapter, MEMORY_DEMOTED, PRIO_LOW, 0);
+	}
+	for(int i = 0; i < 300; ++i)
+		TestUpdate(602 + i * 0.25, 1000 + i, adapter, MEMORY_USAGE_LOCAL, 0, (i + 1) * MB);
+
+	EnterCriticalSection(&g_critSec);
+	auto Bucket = [](DWORD pid, UINT8 metric, int level, double seconds)
+	{
+		for(UINT32 i = 0; i < g_historySeries.size(); ++i)
+		{
+			HistoryBucket bucket;
+			if(g_historySeries[i].key.pid == pid && HistoryBucketAt(i, metric, level, HistoryBucketIndex(TestTime(seconds)) >> level, bucket))
+				return std::make_pair((UINT64)bucket.min << 10, (UINT64)bucket.max << 10);
+		}
+		return std::make_pair(~0ull, ~0ull);
+	};
+	bool ok = CHECK(Bucket(10, HISTORY_USAGE, 0, 30) == std::make_pair(~0ull, ~0ull) && Bucket(10, HISTORY_USAGE, 0, 600) == std::make_pair(GB, GB));
+	ok		= ok && CHECK(Bucket(10, HISTORY_USAGE, 5, 30) == std::make_pair(GB, 3 * GB) && Bucket(10, HISTORY_USAGE, 9, 30) == std::make_pair(0ull, 3 * GB));
+	ok		= ok && CHECK(Bucket(10, HISTORY_DEMOTED, 9, 300) == std::make_pair(0ull, GB / 2) && Bucket(10, HISTORY_DEMOTED, 0, 595) == std::make_pair(0ull, 0ull));
+	ok		= ok && CHECK(g_historySeries.size() == HISTORY_MAX_SERIES && Bucket(1000, HISTORY_USAGE, 0, 700).first == ~0ull);
+	ok		= ok && CHECK(Bucket(1299, HISTORY_USAGE, 0, 700) == std::make_pair(300 * MB, 300 * MB));
+	OnProcessStop(10);
+	ok = ok && CHECK(Bucket(10, HISTORY_USAGE, 9, 30) == std::make_pair(0ull, 3 * GB) && Bucket(10, HISTORY_USAGE, 0, 700) == std::make_pair(0ull, 0ull));
+
+	// A window read at once is the buckets read one by one, past both ends of the data too
+	HistoryBucket window[HISTORY_BUCKETS * 2];
+	for(UINT32 i = 0; i < g_historySeries.size(); i += 37)
+	{
+		for(int level = 0; level < HISTORY_LEVELS; ++level)
+		{
+			INT64  right = (HistoryBucketIndex(g_eventTime) >> level) + 8;
+			INT64  left	 = right - HISTORY_BUCKETS * 2 + 1;
+			UINT32 peak	 = HistoryBucketRange(i, HISTORY_USAGE, level, left, right, window);
+			UINT32 max	 = 0;
+			for(INT64 k = left; k <= right; ++k)
+			{
+				HistoryBucket bucket = {};
+				HistoryBucketAt(i, HISTORY_USAGE, level, k, bucket);
+				ok	= ok && CHECK(bucket.min == window[k - left].min && bucket.max == window[k - left].max);
+				max = std::max(max, bucket.max);
+			}
+			ok = ok && CHECK(peak == max);
+		}
+	}
+
+	// 8 s per cell, the spike is the brightest cell whatever the zoom it was recorded at
+	g_consoleWidth	= 120;
+	g_consoleHeight = 40;
+	g_heatmapView	= HEATMAP_USAGE;
+	g_heatmapZoom	= 5;
+	RenderFrame();
+	g_heatmapView = HEATMAP_OFF;
+	g_heatmapZoom = 2;
+	ok			  = ok && CHECK(std::any_of(g_chars.begin(), g_chars.end(), [](const CHAR_INFO& c) { return c.Char.AsciiChar == '@'; }));
+	LeaveCriticalSection(&g_critSec);
+	ResetTrackerState();
+	return ok;
+}
+
+struct Test
+{
+	const char* name;
+	bool (*run)();
+};
+
+static const Test g_tests[] = {
+	{ "trend", TestTrend },
+	{ "alerts", TestAlerts },
+	{ "batching", TestBatching },
+	{ "memory_table", TestMemoryTable },
+	{ "format", TestFormat },
+	{ "shared_state", TestSharedState },
+	{ "flight_recorder", TestFlightRecorder },
+	{ "etl_reader", TestEtlReader },
+#ifndef _WIN32
+	{ "drm_source", TestDrmSource },
+#endif
+	{ "simulator", TestSimulator },
+	{ "blame", TestBlame },
+	{ "episodes", TestEpisodes },
+#ifndef _WIN32
+	{ "fleet", TestFleet },
+#endif
+	{ "measure", TestMeasure },
+	{ "devices", TestDevices },
+	{ "history", TestHistory },
+};
+
+// demote_tests [<test>...]
+//  runs the named tests, or all of them, and exits with 1 when one fails
+int main(int argc, char** argv)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	g_qpcFrequency = frequency.QuadPart;
+	fopen_s(&g_LogFile, NULL_DEVICE, "w");
+	InitializeCriticalSection(&g_critSec);
+
+	int failed = 0;
+	int run	   = 0;
+	for(const Test& test : g_tests)
+	{
+		bool selected = argc == 1;
+		for(int i = 1; i < argc; ++i)
+			selected = selected || strcmp(argv[i], test.name) == 0;
+		if(!selected)
+			continue;
+		bool ok = test.run();
+		printf("%s: %s\n", test.name, ok ? "ok" : "FAILED");
+		failed += !ok;
+		run++;
+	}
+	fclose(g_LogFile);
+	if(run < argc - 1)
+	{
+		fprintf(stderr, "usage: demote_tests [<test>...], an unknown test was named\n");
+		return 2;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,659 @@
+#include "tracker.h"
+#include "alerts.h"
+#include "blame.h"
+#include "device.h"
+#include "episode.h"
+#include "history.h"
+#include "measure.h"
+#include <algorithm>
+#include <cwchar>
+#include <cwctype>
+
+CRITICAL_SECTION				   g_critSec;
+std::vector<Process>			   g_processes;
+int								   g_processFirstFree	 = -1;
+std::unordered_map<DWORD, int>	   g_pidToProcess;
+ProcessMemoryTable				   g_processMemory;
+std::unordered_map<PVOID, Adapter> g_adapters;
+std::vector<EntryTrends>		   g_entryTrends;
+static std::vector<UINT32>		   g_entryTrendsFree; // slots of g_entryTrends
+std::vector<wstring>			   g_trackedProcesses;
+std::unordered_set<DWORD>		   g_trackedPids;
+bool							   g_verbose			 = false;
+INT64							   g_eventTime;
+INT64							   g_qpcFrequency		 = 1;
+FILE*							   g_LogFile			 = nullptr;
+ProcessNameResolver				   g_processNameResolver = nullptr;
+RedrawSignal					   g_redrawSignal		 = nullptr;
+EventClock						   g_eventClock			 = nullptr;
+std::atomic<INT64>				   g_dirtyTime			 = 0;
+
+void ProcessMemoryTable::Insert(UINT32 slot)
+{
+	const ProcessKey& key = keys[slotToDense[slot]];
+	size_t			  pos = Hash(key.pid, key.pDxgAdapter) & indexMask;
+	while(index[pos])
+		pos = (pos + 1) & indexMask;
+	index[pos] = slot + 1;
+}
+
+UINT32 ProcessMemoryTable::Add(DWORD pid, PVOID pDxgAdapter, bool isTracked)
+{
+	if((keys.size() + 1) * 2 > index.size())
+	{
+		index.assign(index.size() ? index.size() * 2 : 64, 0);
+		indexMask = index.size() - 1;
+		for(UINT32 slot : denseToSlot)
+			Insert(slot);
+	}
+
+	UINT32 slot;
+	if(freeSlots.size())
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		slot = (UINT32)slotToDense.size();
+		slotToDense.push_back(INVALID_MEMORY_INDEX);
+		slotGeneration.push_back(0);
+	}
+	UINT32 dense	  = Size();
+	slotToDense[slot] = dense;
+	keys.push_back({ pid, pDxgAdapter });
+	tracked.push_back(isTracked);
+	usageLocal.push_back(0);
+	commitmentLocal.push_back(0);
+	demoted.push_back({});
+	cold.push_back({});
+	cold.back().nextForPid = INVALID_MEMORY_INDEX;
+	denseToSlot.push_back(slot);
+	Insert(slot);
+	return dense;
+}
+
+void ProcessMemoryTable::Remove(UINT32 dense)
+{
+	UINT32			  slot = denseToSlot[dense];
+	const ProcessKey& key  = keys[dense];
+	size_t			  pos  = Hash(key.pid, key.pDxgAdapter) & indexMask;
+	while(index[pos] != slot + 1)
+		pos = (pos + 1) & indexMask;
+
+	// shift back following entries that would no longer be reachable from their home position
+	size_t hole = pos;
+	for(size_t next = (pos + 1) & indexMask; index[next]; next = (next + 1) & indexMask)
+	{
+		const ProcessKey& nextKey = keys[slotToDense[index[next] - 1]];
+		size_t			  home	  = Hash(nextKey.pid, nextKey.pDxgAdapter) & indexMask;
+		if(((next - home) & indexMask) >= ((next - hole) & indexMask))
+		{
+			index[hole] = index[next];
+			hole		= next;
+		}
+	}
+	index[hole] = 0;
+
+	UINT32 last = Size() - 1;
+	if(dense != last)
+	{
+		keys[dense]						= keys[last];
+		tracked[dense]					= tracked[last];
+		usageLocal[dense]				= usageLocal[last];
+		commitmentLocal[dense]			= commitmentLocal[last];
+		demoted[dense]					= demoted[last];
+		cold[dense]						= cold[last];
+		denseToSlot[dense]				= denseToSlot[last];
+		slotToDense[denseToSlot[dense]] = dense;
+	}
+	keys.pop_back();
+	tracked.pop_back();
+	usageLocal.pop_back();
+	commitmentLocal.pop_back();
+	demoted.pop_back();
+	cold.pop_back();
+	denseToSlot.pop_back();
+
+	slotToDense[slot] = INVALID_MEMORY_INDEX;
+	slotGeneration[slot]++;
+	freeSlots.push_back(slot);
+}
+
+void ProcessMemoryTable::Clear()
+{
+	for(UINT32 slot : denseToSlot)
+	{
+		slotToDense[slot] = INVALID_MEMORY_INDEX;
+		slotGeneration[slot]++;
+		freeSlots.push_back(slot);
+	}
+	keys.clear();
+	tracked.clear();
+	usageLocal.clear();
+	commitmentLocal.clear();
+	demoted.clear();
+	cold.clear();
+	denseToSlot.clear();
+	std::fill(index.begin(), index.end(), 0);
+}
+
+wstring FindProcName(DWORD pid)
+{
+	auto itr = g_pidToProcess.find(pid);
+	if(itr != g_pidToProcess.end())
+	{
+		int index = (*itr).second;
+		return g_processes[index].imageFilename;
+	}
+	return L"?";
+}
+const EntryTrends* FindEntryTrends(UINT32 index)
+{
+	UINT32 slot = g_processMemory.cold[index].trendSlot;
+	return slot ? &g_entryTrends[slot - 1] : nullptr;
+}
+
+static EntryTrends& AllocateEntryTrends(ProcessMemory& memory)
+{
+	if(!memory.trendSlot)
+	{
+		if(g_entryTrendsFree.size())
+		{
+			memory.trendSlot = g_entryTrendsFree.back() + 1;
+			g_entryTrendsFree.pop_back();
+			g_entryTrends[memory.trendSlot - 1] = {};
+		}
+		else
+		{
+			g_entryTrends.emplace_back();
+			memory.trendSlot = (UINT32)g_entryTrends.size();
+		}
+	}
+	return g_entryTrends[memory.trendSlot - 1];
+}
+
+UINT32 FindProcessMemory(DWORD processId, PVOID pDxgAdapter)
+{
+	UINT32 index = g_processMemory.Find(processId, pDxgAdapter);
+	if(index != INVALID_MEMORY_INDEX)
+		return index;
+
+	Process* process						= FindProcess(processId);
+	index									= g_processMemory.Add(processId, pDxgAdapter, process->isTracked);
+	g_processMemory.cold[index].nextForPid	= process->firstMemorySlot;
+	process->firstMemorySlot				= g_processMemory.denseToSlot[index];
+	return index;
+}
+
+void FreeProcessMemory(Process* process)
+{
+	UINT32 slot = process->firstMemorySlot;
+	while(slot != INVALID_MEMORY_INDEX)
+	{
+		UINT32	 index	 = g_processMemory.slotToDense[slot];
+		Adapter* adapter = FindAdapter(g_processMemory.keys[index].pDxgAdapter);
+		adapter->CommitmentLocal -= g_processMemory.commitmentLocal[index];
+		adapter->UsageLocal -= g_processMemory.usageLocal[index];
+		adapter->CommitmentNonLocal -= g_processMemory.cold[index].CommitmentNonLocal;
+		adapter->UsageNonLocal -= g_processMemory.cold[index].UsageNonLocal;
+		for(UINT64 dem : g_processMemory.demoted[index])
+			adapter->CommitmentDemoted -= dem;
+		AlertClearProcess(index);
+		BlameClearProcess(index);
+		EpisodeClearProcess(index);
+		DeviceClearProcess(index);
+		HistoryClearProcess(index);
+		if(g_processMemory.cold[index].trendSlot)
+			g_entryTrendsFree.push_back(g_processMemory.cold[index].trendSlot - 1);
+		if(g_processMemory.tracked[index])
+			MeasureOnTracked(index, false);
+		AlertOnAdapterChange(adapter, ALERT_FIELD_USAGE_LOCAL);
+		AlertOnAdapterChange(adapter, ALERT_FIELD_COMMITMENT_LOCAL);
+		AlertOnAdapterChange(adapter, ALERT_FIELD_DEMOTED);
+		slot = g_processMemory.cold[index].nextForPid;
+		g_processMemory.Remove(index);
+	}
+	process->firstMemorySlot = INVALID_MEMORY_INDEX;
+}
+
+// Propagates a change of the tracked flag to the process's entries
+void UpdateProcessMemoryTracked(Process* process)
+{
+	for(UINT32 slot = process->firstMemorySlot; slot != INVALID_MEMORY_INDEX;)
+	{
+		UINT32 index = g_processMemory.slotToDense[slot];
+		if(g_processMemory.tracked[index] != process->isTracked)
+			MeasureOnTracked(index, process->isTracked);
+		g_processMemory.tracked[index] = process->isTracked;
+		slot						   = g_processMemory.cold[index].nextForPid;
+	}
+}
+
+Adapter* FindAdapter(PVOID pDxgAdapter)
+{
+	Adapter& a	  = g_adapters[pDxgAdapter];
+	a.pDxgAdapter = pDxgAdapter;
+	return &a;
+}
+
+Process* FindProcess(DWORD pid)
+{
+	auto	 itr = g_pidToProcess.find(pid);
+	Process* res = nullptr;
+	if(itr != g_pidToProcess.end())
+	{
+		int index = (*itr).second;
+		res		  = &g_processes[index];
+	}
+	else
+	{
+		if(g_processFirstFree >= 0)
+		{
+			res				   = &g_processes[g_processFirstFree];
+			g_processFirstFree = res->nextFree;
+			res->nextFree	   = -1;
+		}
+		else
+		{
+			size_t s = g_processes.size();
+			g_processes.push_back({});
+			res = &g_processes[s];
+		}
+		res->Reset();
+		res->pid			= pid;
+		int index			= (int)(res - &g_processes[0]);
+		g_pidToProcess[pid] = index;
+	}
+	if(res->nextFree >= 0)
+		__debugbreak();
+	if(res->pid != pid)
+		__debugbreak();
+	return res;
+}
+void FreeProcess(Process* process)
+{
+	int	 index = (int)(process - &g_processes[0]);
+	auto itr   = g_pidToProcess.find(process->pid);
+	if(itr != g_pidToProcess.end())
+	{
+		g_pidToProcess.erase(itr);
+		process->pid = (DWORD)-1;
+	}
+
+	if(process->nextFree >= 0)
+		__debugbreak();
+	if(process->pid != (DWORD)-1)
+		__debugbreak();
+	process->nextFree  = g_processFirstFree;
+	g_processFirstFree = index;
+}
+
+// Needs g_critSec. Only the first change after a frame signals, so a storm costs one wakeup per frame.
+void MarkDirty(INT64 time)
+{
+	if(g_dirtyTime.load(std::memory_order_relaxed))
+		return;
+	g_dirtyTime.store(time > 0 ? time : 1, std::memory_order_relaxed);
+	if(g_redrawSignal)
+		g_redrawSignal();
+}
+
+INT64 EventClockNow()
+{
+	return g_eventClock ? std::max(g_eventClock(), g_eventTime) : g_eventTime;
+}
+
+void ResetTrackerState()
+{
+	g_processMemory.Clear();
+	g_entryTrends.clear();
+	g_entryTrendsFree.clear();
+	g_adapters.clear();
+	g_processes.clear();
+	g_pidToProcess.clear();
+	g_processFirstFree = -1;
+	g_dirtyTime		   = 0;
+	g_trackedPids.clear();
+	ResetAlerts();
+	ResetBlame();
+	ResetEpisodes();
+	ResetDevices();
+	ResetHistory();
+}
+
+std::wstring ToLower(const std::wstring& str)
+{
+	std::wstring result = str;
+	std::transform(result.begin(), result.end(), result.begin(), ::towlower);
+	return result;
+}
+
+std::wstring GetFileName(const std::wstring& path)
+{
+	size_t pos = path.find_last_of(L"\\/");
+	if(pos != std::wstring::npos)
+	{
+		return path.substr(pos + 1);
+	}
+	return path;
+}
+
+// The console and the logs are written with narrow chars
+void ToNarrow(const wchar_t* str, char* buffer, int bufferSize)
+{
+#ifdef _WIN32
+	WideCharToMultiByte(CP_ACP, 0, str, -1, buffer, bufferSize, NULL, NULL);
+#else
+	int i = 0;
+	for(; str[i] && i < bufferSize - 1; ++i)
+		buffer[i] = (unsigned)str[i] < 0x80 ? (char)str[i] : '?';
+	buffer[i] = '\0';
+#endif
+}
+
+bool ProcessCheckTracked(DWORD pid, const wstring& path)
+{
+	if(g_trackedPids.count(pid))
+		return true;
+	for(const wstring& tracked : g_trackedProcesses)
+	{
+		if(std::wcsstr(path.c_str(), tracked.c_str()))
+			return true;
+	}
+	return false;
+}
+
+void TrackProcessTree(DWORD pid)
+{
+	if(g_trackedPids.insert(pid).second)
+		MeasureOnProcess(pid);
+	auto itr = g_pidToProcess.find(pid);
+	if(itr == g_pidToProcess.end())
+		return;
+	Process* process   = &g_processes[itr->second];
+	process->isTracked = true;
+	UpdateProcessMemoryTracked(process);
+	MarkDirty(g_eventTime);
+}
+
+// A process started by one of g_trackedPids joins them
+void OnProcessCreate(wstring imageName, DWORD processId, DWORD parentId, bool isRundown)
+{
+	(void)isRundown;
+	if(g_trackedPids.size() && parentId && g_trackedPids.count(parentId) && g_trackedPids.insert(processId).second)
+		MeasureOnProcess(processId);
+	std::wstring fileName  = GetFileName(imageName);
+	Process*	 process   = FindProcess(processId);
+	process->imageFilename = fileName;
+	process->imagePath	   = imageName;
+	process->isTracked	   = ProcessCheckTracked(processId, imageName);
+	if(process->firstMemorySlot != INVALID_MEMORY_INDEX)
+		MarkDirty(g_eventTime);
+	UpdateProcessMemoryTracked(process);
+}
+void OnProcessStop(DWORD pid)
+{
+	Process* process = FindProcess(pid);
+	if(process->firstMemorySlot != INVALID_MEMORY_INDEX)
+		MarkDirty(g_eventTime);
+	FreeProcessMemory(process);
+	FreeProcess(process);
+	g_trackedPids.erase(pid);
+}
+
+void HandleProcessStart(const ProcessStartEvent& e)
+{
+	OnProcessCreate(e.ImageName, e.ProcessID, e.ParentProcessID, false);
+}
+void HandleProcessRundown(const ProcessRundownEvent& e)
+{
+	OnProcessCreate(e.ImageName, e.ProcessID, e.ParentProcessID, true);
+}
+void HandleProcessStop(const ProcessStopEvent& e)
+{
+	OnProcessStop(e.ProcessID);
+}
+
+void HandleVidMmProcessBudgetChange(const VidMmProcessBudgetChangeEvent&)
+{
+}
+
+thread_local std::vector<MemoryUpdate> t_batch;
+thread_local INT64					   t_eventTime;
+static thread_local INT64			   t_batchEnd; // event time past which the batch is flushed
+
+// The value an update replaces in the table
+static UINT64 StoredMemoryValue(const MemoryUpdate& u, UINT32 index)
+{
+	switch(u.field)
+	{
+	case MEMORY_USAGE_LOCAL:
+		return g_processMemory.usageLocal[index];
+	case MEMORY_COMMITMENT_LOCAL:
+		return g_processMemory.commitmentLocal[index];
+	case MEMORY_DEMOTED:
+		return g_processMemory.demoted[index][u.prio];
+	default:
+		return 0;
+	}
+}
+
+// What has to see every value of an entry, including the ones a batch overwrites before they reach the table.
+// Needs g_critSec.
+static void OnMemoryEvent(const MemoryUpdate& u, UINT32 index, UINT64 previous)
+{
+	g_eventTime = u.time;
+	switch(u.field)
+	{
+	case MEMORY_USAGE_LOCAL:
+		MeasureOnUpdate(index, MEASURE_USAGE, previous, u.value);
+		break;
+	case MEMORY_COMMITMENT_LOCAL:
+		MeasureOnUpdate(index, MEASURE_COMMITMENT, previous, u.value);
+		break;
+	case MEMORY_DEMOTED:
+		EpisodeOnDemoted(index, u.prio, previous, u.value, u.time);
+		MeasureOnUpdate(index, MEASURE_DEMOTED_PRIO + u.prio, previous, u.value);
+		break;
+	default:
+		break;
+	}
+}
+
+// Moves the table, the adapter totals and the per entry state that only needs the latest value. Needs g_critSec.
+static void StoreMemoryUpdate(const MemoryUpdate& u, UINT32 index)
+{
+	g_eventTime			  = u.time;
+	ProcessMemory& memory = g_processMemory.cold[index];
+	switch(u.field)
+	{
+	case MEMORY_USAGE_LOCAL:
+	{
+		Adapter* adapter = FindAdapter(u.pDxgAdapter);
+		adapter->UsageLocal += u.value - g_processMemory.usageLocal[index];
+		g_processMemory.usageLocal[index] = u.value;
+		HistoryOnUpdate(index, HISTORY_USAGE, u.value, u.time);
+		AlertOnProcessChange(index, ALERT_FIELD_USAGE_LOCAL);
+		break;
+	}
+	case MEMORY_USAGE_NONLOCAL:
+		FindAdapter(u.pDxgAdapter)->UsageNonLocal += u.value - memory.UsageNonLocal;
+		memory.UsageNonLocal = u.value;
+		AlertOnProcessChange(index, ALERT_FIELD_USAGE_NONLOCAL);
+		break;
+	case MEMORY_COMMITMENT_LOCAL:
+	{
+		Adapter* adapter = FindAdapter(u.pDxgAdapter);
+		if(u.value > g_processMemory.commitmentLocal[index])
+			BlameOnCommitmentGrowth(u.pDxgAdapter, u.pid, u.value - g_processMemory.commitmentLocal[index], u.time);
+		adapter->CommitmentLocal += u.value - g_processMemory.commitmentLocal[index];
+		g_processMemory.commitmentLocal[index] = u.value;
+		AllocateEntryTrends(memory).CommitmentLocalTrend.Update(u.time, u.value, g_qpcFrequency);
+		AlertOnProcessChange(index, ALERT_FIELD_COMMITMENT_LOCAL);
+		break;
+	}
+	case MEMORY_COMMITMENT_NONLOCAL:
+		FindAdapter(u.pDxgAdapter)->CommitmentNonLocal += u.value - memory.CommitmentNonLocal;
+		memory.CommitmentNonLocal = u.value;
+		AlertOnProcessChange(index, ALERT_FIELD_COMMITMENT_NONLOCAL);
+		break;
+	case MEMORY_DEMOTED:
+	{
+		DemotedCommitment& demoted = g_processMemory.demoted[index];
+		Adapter*		   adapter = FindAdapter(u.pDxgAdapter);
+		if(u.value > demoted[u.prio])
+			BlameOnDemotion(index, u.value - demoted[u.prio], u.time);
+		adapter->CommitmentDemoted += u.value - demoted[u.prio];
+		demoted[u.prio] = u.value;
+		AlertOnProcessChange(index, ALERT_FIELD_DEMOTED);
+
+		UINT64 DemotedSum = 0;
+		for(UINT64 dem : demoted)
+			DemotedSum += dem;
+		AllocateEntryTrends(memory).CommitmentDemotedTrend.Update(u.time, DemotedSum, g_qpcFrequency);
+		HistoryOnUpdate(index, HISTORY_DEMOTED, DemotedSum, u.time);
+		break;
+	}
+	}
+}
+
+// Needs g_critSec
+void ApplyMemoryUpdate(const MemoryUpdate& u, UINT32 index)
+{
+	OnMemoryEvent(u, index, StoredMemoryValue(u, index));
+	StoreMemoryUpdate(u, index);
+}
+
+static size_t HashMemoryUpdate(const MemoryUpdate& u)
+{
+	size_t h = (size_t)u.pDxgAdapter ^ ((size_t)u.pid << 16) ^ ((size_t)u.field << 8) ^ u.prio;
+	return h * 0x9e3779b97f4a7c15ULL;
+}
+
+static bool SameMemoryKey(const MemoryUpdate& a, const MemoryUpdate& b)
+{
+	return a.pid == b.pid && a.pDxgAdapter == b.pDxgAdapter && a.field == b.field && a.prio == b.prio;
+}
+
+// Applies the batch under a single lock, skipping updates that are overwritten later in the batch. The skipped
+// updates still go through OnMemoryEvent in order, each with the value before it, when something needs them.
+void FlushMemoryUpdates(std::vector<MemoryUpdate>& batch)
+{
+	if(batch.empty())
+		return;
+
+	const size_t				TABLE_SIZE = BATCH_MAX_EVENTS * 2;
+	static thread_local USHORT	table[TABLE_SIZE]; // index + 1 of the earliest update seen for a key, 0 if empty
+	static thread_local USHORT	used[BATCH_MAX_EVENTS];
+	static thread_local bool	skip[BATCH_MAX_EVENTS];
+	static thread_local USHORT	previous[BATCH_MAX_EVENTS]; // index + 1 of the update before with the same key, 0 if none
+	int							numUsed = 0;
+
+	int count = (int)batch.size();
+	for(int i = count - 1; i >= 0; --i)
+	{
+		size_t slot = HashMemoryUpdate(batch[i]) & (TABLE_SIZE - 1);
+		skip[i]		= false;
+		previous[i] = 0;
+		while(table[slot])
+		{
+			if(SameMemoryKey(batch[table[slot] - 1], batch[i]))
+			{
+				skip[i]					  = true;
+				previous[table[slot] - 1] = (USHORT)(i + 1);
+				table[slot]				  = (USHORT)(i + 1);
+				break;
+			}
+			slot = (slot + 1) & (TABLE_SIZE - 1);
+		}
+		if(!skip[i])
+		{
+			table[slot]		= (USHORT)(i + 1);
+			used[numUsed++] = (USHORT)slot;
+		}
+	}
+	for(int i = 0; i < numUsed; ++i)
+		table[used[i]] = 0;
+
+	EnterCriticalSection(&g_critSec);
+	UINT32 index = INVALID_MEMORY_INDEX;
+	for(int i = 0; i < count; ++i)
+	{
+		const MemoryUpdate& u		 = batch[i];
+		bool				perEvent = u.field == MEMORY_DEMOTED || (g_measure.active && (u.field == MEMORY_USAGE_LOCAL || u.field == MEMORY_COMMITMENT_LOCAL));
+		if(skip[i] && !perEvent)
+			continue;
+		if(index == INVALID_MEMORY_INDEX || g_processMemory.keys[index].pid != u.pid || g_processMemory.keys[index].pDxgAdapter != u.pDxgAdapter)
+			index = FindProcessMemory(u.pid, u.pDxgAdapter);
+		if(perEvent)
+			OnMemoryEvent(u, index, previous[i] ? batch[previous[i] - 1].value : StoredMemoryValue(u, index));
+		if(!skip[i])
+			StoreMemoryUpdate(u, index);
+	}
+	MarkDirty(batch[0].time);
+	LeaveCriticalSection(&g_critSec);
+	batch.clear();
+}
+
+void QueueMemoryUpdate(DWORD pid, PVOID pDxgAdapter, MemoryField field, UINT8 prio, UINT64 value)
+{
+	std::vector<MemoryUpdate>& batch = t_batch;
+	batch.push_back({ t_eventTime, value, pDxgAdapter, pid, field, prio });
+	if(batch.size() == 1)
+		t_batchEnd = t_eventTime + (INT64)(BATCH_MAX_SECONDS * g_qpcFrequency);
+	else if(batch.size() >= BATCH_MAX_EVENTS || t_eventTime > t_batchEnd)
+		FlushMemoryUpdates(batch);
+}
+
+void HandleVidMmProcessUsageChange(const VidMmProcessUsageChangeEvent& e)
+{
+	QueueMemoryUpdate(e.ProcessId, e.pDxgAdapter, e.MemorySegmentGroup ? MEMORY_USAGE_NONLOCAL : MEMORY_USAGE_LOCAL, 0, e.NewUsage);
+}
+
+void HandleVidMmProcessDemotedCommitmentChange(const VidMmProcessDemotedCommitmentChangeEvent& e)
+{
+	int prio = PRIO_MAX < e.PriorityClass ? (int)PRIO_MAX : e.PriorityClass;
+	QueueMemoryUpdate(e.ProcessId, e.pDxgAdapter, MEMORY_DEMOTED, (UINT8)prio, e.Commitment);
+
+	if(g_verbose)
+	{
+		fprintf(g_LogFile, "DEM %lld <- %lld %p, %d. %d %d\n", e.Commitment, e.OldCommitment, e.pDxgAdapter, e.ProcessId, e.PhysicalAdapterIndex, e.PriorityClass);
+		fflush(g_LogFile);
+	}
+}
+
+void HandleVidMmProcessCommitmentChange(const VidMmProcessCommitmentChangeEvent& e)
+{
+	QueueMemoryUpdate(e.ProcessId, e.pDxgAdapter, e.MemorySegmentGroup ? MEMORY_COMMITMENT_NONLOCAL : MEMORY_COMMITMENT_LOCAL, 0, e.Commitment);
+}
+
+void HandleReportSegment(const ReportSegmentEvent& e)
+{
+	Segment segment;
+	segment.id			= e.ulSegmentId;
+	segment.group		= e.MemorySegmentGroup == SEGMENT_GROUP_LOCAL ? SEGMENT_GROUP_LOCAL : SEGMENT_GROUP_NON_LOCAL;
+	segment.cpuVisible	= (e.Flags & SEGMENT_FLAG_CPU_VISIBLE) != 0;
+	segment.numBanks	= e.NbOfBanks;
+	segment.flags		= e.Flags;
+	segment.size		= e.Size;
+	segment.commitLimit = e.CommitLimit;
+
+	Adapter* adapter = FindAdapter(e.pDxgAdapter);
+	adapter->SetSegment(segment);
+	MarkDirty(g_eventTime);
+	AlertOnAdapterChange(adapter, ALERT_FIELD_USAGE_LOCAL);
+	AlertOnAdapterChange(adapter, ALERT_FIELD_COMMITMENT_LOCAL);
+	AlertOnAdapterChange(adapter, ALERT_FIELD_DEMOTED);
+
+	fprintf(g_LogFile,
+			"Adapter Segment %ls/%d: %6.fMB / %s, commit limit %.fMB, %d banks, flags 0x%x\n",
+			adapter->name.c_str(),
+			e.ulSegmentId,
+			e.Size / (1024.f * 1024.f),
+			segment.group == SEGMENT_GROUP_LOCAL ? "Local" : "NonLocal",
+			e.CommitLimit / (1024.f * 1024.f),
+			e.NbOfBanks,
+			e.Flags);
+	fflush(g_LogFile);
+}
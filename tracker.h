@@ -0,0 +1,470 @@
+#pragma once
+// Platform independent tracker state: processes, adapters and their video memory, updated from decoded events.
+#include "platform.h"
+#include "events.h"
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+using std::wstring;
+
+enum Prio
+{
+	PRIO_MIN,
+	PRIO_LOW,
+	PRIO_NORMAL,
+	PRIO_HIGH,
+	PRIO_MAX,
+	PRIO_COUNT,
+};
+
+struct Process
+{
+	DWORD	pid;
+	bool	isTracked = false;
+	wstring imageFilename;
+	wstring imagePath;
+	int		nextFree		= -1;
+	UINT32	firstMemorySlot = 0xffffffff; // ProcessMemoryTable entries of this process, linked by nextForPid
+	void	Reset()
+	{
+		pid				= (DWORD)-1;
+		isTracked		= false;
+		imageFilename	= L"";
+		imagePath		= L"";
+		firstMemorySlot = 0xffffffff;
+	}
+};
+
+struct ProcessKey
+{
+	DWORD pid;
+	PVOID pDxgAdapter;
+	bool  operator==(const ProcessKey& other) const
+	{
+		return pid == other.pid && pDxgAdapter == other.pDxgAdapter;
+	};
+};
+
+namespace std
+{
+template <>
+struct hash<ProcessKey>
+{
+	std::size_t operator()(const ProcessKey& f) const noexcept
+	{
+		std::size_t h1 = std::hash<DWORD>{}(f.pid);
+		std::size_t h2 = std::hash<PVOID>{}(f.pDxgAdapter);
+		return h1 ^ (h2 + 0x9e3779b97f4a7c15ULL + (h1 << 6) + (h1 >> 2));
+	}
+};
+} // namespace std
+
+// Trend tracking for a single value, updated in O(1) per sample using the event timestamps:
+//  - rate:  EWMA of the rate of change in bytes/sec
+//  - slope: exponentially weighted least squares slope over a longer horizon, used to spot leaks
+//  - min/max over a sliding window, made of TREND_BUCKETS fixed-size buckets
+#define TREND_BUCKETS 12
+static const double TREND_BUCKET_SECONDS = 5.0;
+static const double TREND_RATE_TAU		 = 5.0;
+static const double TREND_SLOPE_TAU		 = 60.0;
+static const double TREND_LEAK_SLOPE	 = 64.0 * 1024.0; // bytes/sec considered growing/shrinking
+
+// Slot of a bucket number in the ring, also for the negative numbers of times before the clock's origin
+inline int TrendBucketSlot(INT64 b)
+{
+	INT64 slot = b % TREND_BUCKETS;
+	return (int)(slot < 0 ? slot + TREND_BUCKETS : slot);
+}
+
+struct Trend
+{
+	bool   valid = false; // set by the first sample
+	INT64  lastTime;
+	UINT64 lastValue = 0;
+	double rate;
+	double sw, st, sv, stt, stv; // regression sums, t relative to lastTime in seconds, v in MB
+	INT64  bucket;
+	UINT64 bucketMin[TREND_BUCKETS];
+	UINT64 bucketMax[TREND_BUCKETS];
+
+	void Update(INT64 time, UINT64 value, INT64 frequency)
+	{
+		INT64 bucketTicks = (INT64)(TREND_BUCKET_SECONDS * frequency);
+		INT64 b			  = time / bucketTicks;
+		double v		  = value / (1024.0 * 1024.0);
+		if(!valid)
+		{
+			valid	  = true;
+			lastTime  = time;
+			lastValue = value;
+			rate	  = 0;
+			sw		  = 1;
+			st = stt = stv = 0;
+			sv			   = v;
+			bucket		   = b;
+			for(int i = 0; i < TREND_BUCKETS; ++i)
+				bucketMin[i] = bucketMax[i] = value;
+			return;
+		}
+		double dt = time > lastTime ? (double)(time - lastTime) / frequency : 0.0;
+
+		// rate = decay * rate + (1 - decay) * dv / dt, which tends to rate + dv / tau for events in the same tick
+		double alpha  = 1.0 - exp(-dt / TREND_RATE_TAU);
+		double weight = dt > 0 ? alpha / dt : 1.0 / TREND_RATE_TAU;
+		rate		  = rate * (1.0 - alpha) + ((double)value - (double)lastValue) * weight;
+
+		// decay the sums and move the time origin to the new sample
+		double decay = exp(-dt / TREND_SLOPE_TAU);
+		sw *= decay;
+		st *= decay;
+		sv *= decay;
+		stt *= decay;
+		stv *= decay;
+		stt = stt - 2 * dt * st + dt * dt * sw;
+		stv = stv - dt * sv;
+		st	= st - dt * sw;
+		sw += 1;
+		sv += v;
+
+		if(b != bucket)
+		{
+			// buckets skipped over held the last value
+			INT64 steps = b - bucket < TREND_BUCKETS ? b - bucket : TREND_BUCKETS;
+			for(INT64 i = 1; i <= steps; ++i)
+			{
+				int idx		   = TrendBucketSlot(bucket + i);
+				bucketMin[idx] = lastValue;
+				bucketMax[idx] = lastValue;
+			}
+			int idx = TrendBucketSlot(b);
+			if(value < bucketMin[idx])
+				bucketMin[idx] = value;
+			if(value > bucketMax[idx])
+				bucketMax[idx] = value;
+			bucket = b;
+		}
+		else
+		{
+			int idx = TrendBucketSlot(b);
+			if(value < bucketMin[idx])
+				bucketMin[idx] = value;
+			if(value > bucketMax[idx])
+				bucketMax[idx] = value;
+		}
+		lastTime  = time;
+		lastValue = value;
+	}
+
+	// EWMA rate decayed to 'now' (EventClockNow), the value has been constant since the last sample
+	double Rate(INT64 now, INT64 frequency) const
+	{
+		if(!valid)
+			return 0;
+		double dt = now > lastTime ? (double)(now - lastTime) / frequency : 0.0;
+		return rate * exp(-dt / TREND_RATE_TAU);
+	}
+
+	// Leak slope in bytes/sec
+	double Slope() const
+	{
+		if(!valid)
+			return 0;
+		double d = sw * stt - st * st;
+		if(d < 1e-9)
+			return 0;
+		return (sw * stv - st * sv) / d * (1024.0 * 1024.0);
+	}
+
+	void Window(INT64 now, INT64 frequency, UINT64& minValue, UINT64& maxValue) const
+	{
+		minValue = maxValue = lastValue;
+		if(!valid)
+			return;
+		INT64 bucketTicks = (INT64)(TREND_BUCKET_SECONDS * frequency);
+		INT64 nowBucket	  = now / bucketTicks;
+		for(INT64 i = 0; i < TREND_BUCKETS; ++i)
+		{
+			INT64 b = nowBucket - i;
+			if(b > bucket || b <= bucket - TREND_BUCKETS)
+				continue;
+			int idx	 = TrendBucketSlot(b);
+			minValue = bucketMin[idx] < minValue ? bucketMin[idx] : minValue;
+			maxValue = bucketMax[idx] > maxValue ? bucketMax[idx] : maxValue;
+		}
+	}
+};
+
+// Trends of an entry, apart from ProcessMemory so entries that never commit memory don't carry them
+struct EntryTrends
+{
+	Trend CommitmentLocalTrend;
+	Trend CommitmentDemotedTrend;
+};
+
+// Cold per entry state, the values read for every entry every frame live in ProcessMemoryTable
+struct ProcessMemory
+{
+	UINT64 CommitmentNonLocal;
+	UINT64 UsageNonLocal;
+	UINT64 alertMask;  // rules with pending/active state for this entry
+	UINT32 nextForPid; // slot of the next entry of the same process
+	DWORD  blamePid;   // largest culprit of this entry's demotions (blame.h), if blameBytes
+	double blameBytes;
+	UINT32 episodeSlot; // demotion episode statistics (episode.h), + 1, 0 until the entry is demoted
+	UINT32 firstDevice; // device breakdown (device.h), + 1, 0 until an allocation is detailed
+	UINT32 historySlot; // usage and demoted over time (history.h), + 1, 0 until either is non-zero
+	UINT32 trendSlot;	// g_entryTrends, + 1, 0 until the local or demoted commitment changes
+};
+
+typedef std::array<UINT64, PRIO_COUNT> DemotedCommitment;
+
+#define INVALID_MEMORY_INDEX 0xffffffff
+
+struct MemoryHandle
+{
+	UINT32 slot		  = INVALID_MEMORY_INDEX;
+	UINT32 generation = 0;
+};
+
+// ProcessMemory storage
+//  entries are packed densely so walking all of them every frame is a linear scan, with the
+//  fields used for sorting and drawing in their own arrays. Removing an entry moves the last
+//  one into its place, so dense indices are only stable while holding g_critSec. Handles
+//  (slot + generation) stay valid until the entry is removed, and resolve to INVALID_MEMORY_INDEX
+//  after. Lookup by (pid, adapter) goes through an open addressing index of slots, using
+//  backward shift deletion so process churn doesn't leave tombstones behind.
+struct ProcessMemoryTable
+{
+	std::vector<ProcessKey>		   keys;
+	std::vector<UINT8>			   tracked;
+	std::vector<UINT64>			   usageLocal;
+	std::vector<UINT64>			   commitmentLocal;
+	std::vector<DemotedCommitment> demoted;
+	std::vector<ProcessMemory>	   cold;
+	std::vector<UINT32>			   denseToSlot;
+
+	std::vector<UINT32> slotToDense;
+	std::vector<UINT32> slotGeneration;
+	std::vector<UINT32> freeSlots;
+	std::vector<UINT32> index; // slot + 1, 0 is empty
+	size_t				indexMask = 0;
+
+	UINT32 Size() const
+	{
+		return (UINT32)keys.size();
+	}
+
+	static size_t Hash(DWORD pid, PVOID pDxgAdapter)
+	{
+		UINT64 h = ((UINT64)pid << 32) ^ (UINT64)pDxgAdapter;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return (size_t)h;
+	}
+
+	UINT32 Find(DWORD pid, PVOID pDxgAdapter) const
+	{
+		if(!indexMask)
+			return INVALID_MEMORY_INDEX;
+		for(size_t pos = Hash(pid, pDxgAdapter) & indexMask; index[pos]; pos = (pos + 1) & indexMask)
+		{
+			UINT32			  dense = slotToDense[index[pos] - 1];
+			const ProcessKey& key	= keys[dense];
+			if(key.pid == pid && key.pDxgAdapter == pDxgAdapter)
+				return dense;
+		}
+		return INVALID_MEMORY_INDEX;
+	}
+
+	MemoryHandle Handle(UINT32 dense) const
+	{
+		UINT32 slot = denseToSlot[dense];
+		return { slot, slotGeneration[slot] };
+	}
+
+	UINT32 Resolve(MemoryHandle handle) const
+	{
+		if(handle.slot >= slotToDense.size() || slotGeneration[handle.slot] != handle.generation)
+			return INVALID_MEMORY_INDEX;
+		return slotToDense[handle.slot];
+	}
+
+	UINT32 Add(DWORD pid, PVOID pDxgAdapter, bool isTracked);
+	void   Remove(UINT32 dense);
+	void   Clear();
+
+private:
+	void Insert(UINT32 slot);
+};
+
+// D3DKMT_MEMORY_SEGMENT_GROUP
+enum SegmentGroup : UINT8
+{
+	SEGMENT_GROUP_LOCAL,
+	SEGMENT_GROUP_NON_LOCAL,
+	SEGMENT_GROUP_COUNT,
+};
+
+// DXGK_SEGMENTFLAGS bits of ReportSegment Flags
+#define SEGMENT_FLAG_APERTURE 0x1
+#define SEGMENT_FLAG_CPU_VISIBLE 0x4
+
+struct Segment
+{
+	UINT32 id;
+	UINT8  group;
+	bool   cpuVisible;
+	UINT32 numBanks;
+	UINT32 flags;
+	UINT64 size;
+	UINT64 commitLimit;
+};
+
+struct Adapter
+{
+	std::wstring		 name;
+	UINT64				 LocalMemory		= 0; // sum of the segment sizes of each group
+	UINT64				 NonLocalMemory		= 0;
+	PVOID				 pDxgAdapter		= 0;
+	std::vector<Segment> segments;				 // sorted by id
+	UINT64				 CommitmentLocal	= 0; // sum over all processes on this adapter
+	UINT64				 UsageLocal			= 0;
+	UINT64				 CommitmentNonLocal = 0;
+	UINT64				 UsageNonLocal		= 0;
+	UINT64				 CommitmentDemoted	= 0;
+	UINT64				 alertMask			= 0;
+
+	UINT64& GroupMemory(UINT8 group)
+	{
+		return group == SEGMENT_GROUP_LOCAL ? LocalMemory : NonLocalMemory;
+	}
+
+	// Adds or replaces a segment, keeping the group totals up to date
+	void SetSegment(const Segment& segment)
+	{
+		auto itr = std::lower_bound(segments.begin(), segments.end(), segment.id, [](const Segment& s, UINT32 id) { return s.id < id; });
+		if(itr != segments.end() && itr->id == segment.id)
+		{
+			GroupMemory(itr->group) -= itr->size;
+			*itr = segment;
+		}
+		else
+		{
+			segments.insert(itr, segment);
+		}
+		GroupMemory(segment.group) += segment.size;
+	}
+};
+
+// Memory updates
+//  VidMm usage/commitment events are the bulk of the traffic. They are queued in a batch on the
+//  trace thread and applied under g_critSec in groups, at the end of each ETW buffer or when the
+//  batch is full or old. Updates to the same (pid, adapter, field) in a batch are coalesced so
+//  only the last value is applied. Any other event flushes the batch first to keep ordering.
+#define BATCH_MAX_EVENTS 1024
+static const double BATCH_MAX_SECONDS = 0.002; // of event time from the first update
+
+enum MemoryField : UINT8
+{
+	MEMORY_USAGE_LOCAL,
+	MEMORY_USAGE_NONLOCAL,
+	MEMORY_COMMITMENT_LOCAL,
+	MEMORY_COMMITMENT_NONLOCAL,
+	MEMORY_DEMOTED,
+};
+
+struct MemoryUpdate
+{
+	INT64  time;
+	UINT64 value;
+	PVOID  pDxgAdapter;
+	DWORD  pid;
+	UINT8  field;
+	UINT8  prio;
+};
+
+// Looks up the image path of a running process that started before tracing, empty if unknown. Called on the
+// name resolver thread (resolver.h). Set by the platform layer, may be null.
+typedef wstring (*ProcessNameResolver)(DWORD pid);
+
+// Wakes the UI after the first change since its last frame. Set by the platform layer, may be null.
+typedef void (*RedrawSignal)();
+
+// Current time on the clock of the live event source, QueryPerformanceCounter for ETW and DRM. Set by the platform
+// layer, null when replaying events, where the time of the last event is now.
+typedef INT64 (*EventClock)();
+
+extern CRITICAL_SECTION						  g_critSec;
+extern std::vector<Process>					  g_processes;
+extern int									  g_processFirstFree;
+extern std::unordered_map<DWORD, int>		  g_pidToProcess;
+extern ProcessMemoryTable					  g_processMemory;
+extern std::unordered_map<PVOID, Adapter>	  g_adapters;
+extern std::vector<EntryTrends>				  g_entryTrends;
+extern std::vector<wstring>					  g_trackedProcesses;
+extern std::unordered_set<DWORD>			  g_trackedPids; // launched processes and their descendants, tracked by pid
+extern bool									  g_verbose;
+extern INT64								  g_eventTime; // timestamp of the event being handled, in g_qpcFrequency ticks, written under g_critSec
+extern INT64								  g_qpcFrequency; // of QueryPerformanceCounter, which live events are stamped with
+extern FILE*								  g_LogFile;
+extern ProcessNameResolver					  g_processNameResolver;
+extern RedrawSignal							  g_redrawSignal;
+extern EventClock							  g_eventClock;
+extern std::atomic<INT64>					  g_dirtyTime; // event time of the oldest change not drawn yet, 0 if none
+extern thread_local std::vector<MemoryUpdate> t_batch;
+extern thread_local INT64					  t_eventTime; // timestamp of the event being decoded on this thread, for its queued updates
+
+wstring	 FindProcName(DWORD pid);
+Process* FindProcess(DWORD pid);
+void	 FreeProcess(Process* process);
+Adapter* FindAdapter(PVOID pDxgAdapter);
+UINT32	 FindProcessMemory(DWORD processId, PVOID pDxgAdapter);
+void	 FreeProcessMemory(Process* process);
+void	 UpdateProcessMemoryTracked(Process* process);
+void	 ResetTrackerState();
+void	 MarkDirty(INT64 time);
+INT64	 EventClockNow(); // needs g_critSec, compared with event times
+
+const EntryTrends* FindEntryTrends(UINT32 index); // null until the entry's commitment changed
+
+std::wstring ToLower(const std::wstring& str);
+std::wstring GetFileName(const std::wstring& path);
+void		 ToNarrow(const wchar_t* str, char* buffer, int bufferSize);
+
+bool ProcessCheckTracked(DWORD pid, const wstring& path);
+void TrackProcessTree(DWORD pid); // the process and the ones it starts from now on, needs g_critSec
+void OnProcessCreate(wstring imageName, DWORD processId, DWORD parentId, bool isRundown);
+void OnProcessStop(DWORD pid);
+
+void ApplyMemoryUpdate(const MemoryUpdate& u, UINT32 index);
+void FlushMemoryUpdates(std::vector<MemoryUpdate>& batch);
+void QueueMemoryUpdate(DWORD pid, PVOID pDxgAdapter, MemoryField field, UINT8 prio, UINT64 value);
+
+// Event handlers. The VidMm usage/commitment ones only queue their update and run without g_critSec,
+// everything else runs through RunLockedHandler.
+void HandleProcessStart(const ProcessStartEvent& e);
+void HandleProcessRundown(const ProcessRundownEvent& e);
+void HandleProcessStop(const ProcessStopEvent& e);
+void HandleVidMmProcessBudgetChange(const VidMmProcessBudgetChangeEvent& e);
+void HandleVidMmProcessUsageChange(const VidMmProcessUsageChangeEvent& e);
+void HandleVidMmProcessDemotedCommitmentChange(const VidMmProcessDemotedCommitmentChangeEvent& e);
+void HandleVidMmProcessCommitmentChange(const VidMmProcessCommitmentChangeEvent& e);
+void HandleReportSegment(const ReportSegmentEvent& e);
+
+// Flushes the queued memory updates to keep ordering, then runs the handler under g_critSec
+template <typename T, void (*Handler)(const T&)>
+void RunLockedHandler(const T& e, INT64 time)
+{
+	FlushMemoryUpdates(t_batch);
+	EnterCriticalSection(&g_critSec);
+	g_eventTime = time;
+	Handler(e);
+	LeaveCriticalSection(&g_critSec);
+}